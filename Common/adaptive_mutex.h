@@ -0,0 +1,368 @@
+//
+// adaptive_mutex.h
+//
+// An sqlite3_mutex_methods implementation for SQLITE_CONFIG_MUTEX. Every
+// mutex is one 32-bit word: an uncontended enter/leave is a single atomic
+// exchange each, a contended enter spins for an adaptively sized budget and
+// only then sleeps in the kernel (futex on Linux, WaitOnAddress on Windows).
+// Leave makes a system call only when someone is actually asleep.
+//
+// Contention counters can be switched on at install time; they cost a few
+// relaxed increments on the contended path and one on every enter.
+//
+
+#pragma once
+
+#include "sqlite3.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#elif defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#pragma comment(lib, "Synchronization.lib")
+#endif
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace sqlite3tests {
+
+    struct MutexContentionStats {
+        int type = 0;
+        /// <summary>
+        /// False for the folded-in totals of mutexes SQLite already freed.
+        /// </summary>
+        bool live = true;
+        long long acquisitions = 0;
+        long long contended = 0;
+        long long sleeps = 0;
+        long long spins = 0;
+    };
+
+    namespace detail {
+
+        inline void CpuRelax() {
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+            _mm_pause();
+#else
+            std::this_thread::yield();
+#endif
+        }
+
+        inline void WaitWhileEquals(std::atomic<int>* word, int value) {
+#if defined(__linux__)
+            syscall(SYS_futex, reinterpret_cast<int*>(word), FUTEX_WAIT_PRIVATE, value, nullptr, nullptr, 0);
+#elif defined(_WIN32)
+            WaitOnAddress(word, &value, sizeof(value), INFINITE);
+#else
+            if (word->load(std::memory_order_relaxed) == value) {
+                std::this_thread::yield();
+            }
+#endif
+        }
+
+        inline void WakeOne(std::atomic<int>* word) {
+#if defined(__linux__)
+            syscall(SYS_futex, reinterpret_cast<int*>(word), FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+#elif defined(_WIN32)
+            WakeByAddressSingle(word);
+#endif
+        }
+
+        /// <summary>
+        /// Identifies the calling thread by the address of a thread_local, which
+        /// is cheaper to obtain than std::this_thread::get_id.
+        /// </summary>
+        inline std::uintptr_t CurrentThreadTag() {
+            static thread_local char tag;
+            return reinterpret_cast<std::uintptr_t>(&tag);
+        }
+
+        struct AdaptiveMutex {
+            static const int kMaxSpins = 1000;
+
+            // 0 unlocked, 1 locked, 2 locked with possible sleepers.
+            std::atomic<int> state{ 0 };
+            std::atomic<std::uintptr_t> owner{ 0 };
+            int depth = 0;
+            int type = SQLITE_MUTEX_FAST;
+            // Running average of spins that led to the lock; only read as a hint.
+            std::atomic<int> spinBudget{ 100 };
+
+            std::atomic<long long> acquisitions{ 0 };
+            std::atomic<long long> contended{ 0 };
+            std::atomic<long long> sleeps{ 0 };
+            std::atomic<long long> spins{ 0 };
+
+            bool TryLock() {
+                int expected = 0;
+                return state.compare_exchange_strong(expected, 1, std::memory_order_acquire,
+                    std::memory_order_relaxed);
+            }
+
+            void Lock(bool count) {
+                if (TryLock()) {
+                    return;
+                }
+                int budget = spinBudget.load(std::memory_order_relaxed);
+                int maxSpins = std::min(kMaxSpins, budget * 2 + 10);
+                for (int i = 0; i < maxSpins; ++i) {
+                    CpuRelax();
+                    if (state.load(std::memory_order_relaxed) == 0 && TryLock()) {
+                        spinBudget.store(budget + (i - budget) / 8, std::memory_order_relaxed);
+                        if (count) {
+                            contended.fetch_add(1, std::memory_order_relaxed);
+                            spins.fetch_add(i + 1, std::memory_order_relaxed);
+                        }
+                        return;
+                    }
+                }
+                spinBudget.store(budget + (maxSpins - budget) / 8, std::memory_order_relaxed);
+                long long slept = 0;
+                while (state.exchange(2, std::memory_order_acquire) != 0) {
+                    WaitWhileEquals(&state, 2);
+                    ++slept;
+                }
+                if (count) {
+                    contended.fetch_add(1, std::memory_order_relaxed);
+                    spins.fetch_add(maxSpins, std::memory_order_relaxed);
+                    sleeps.fetch_add(slept, std::memory_order_relaxed);
+                }
+            }
+
+            void Unlock() {
+                if (state.exchange(0, std::memory_order_release) == 2) {
+                    WakeOne(&state);
+                }
+            }
+        };
+
+        struct AdaptiveMutexGlobals {
+            bool countContention = false;
+            AdaptiveMutex statics[SQLITE_MUTEX_STATIC_VFS3 + 1];
+            std::mutex registryLock;
+            std::unordered_set<AdaptiveMutex*> live;
+            MutexContentionStats retired[2];
+
+            AdaptiveMutexGlobals() {
+                for (int i = 0; i <= SQLITE_MUTEX_STATIC_VFS3; ++i) {
+                    statics[i].type = i;
+                }
+            }
+        };
+
+        inline AdaptiveMutexGlobals& MutexGlobals() {
+            static AdaptiveMutexGlobals globals;
+            return globals;
+        }
+
+        inline AdaptiveMutex* AsAdaptive(sqlite3_mutex* mutex) {
+            return reinterpret_cast<AdaptiveMutex*>(mutex);
+        }
+
+        inline MutexContentionStats Snapshot(const AdaptiveMutex& mutex) {
+            MutexContentionStats stats;
+            stats.type = mutex.type;
+            stats.acquisitions = mutex.acquisitions.load(std::memory_order_relaxed);
+            stats.contended = mutex.contended.load(std::memory_order_relaxed);
+            stats.sleeps = mutex.sleeps.load(std::memory_order_relaxed);
+            stats.spins = mutex.spins.load(std::memory_order_relaxed);
+            return stats;
+        }
+
+        inline int AdaptiveMutexInit() { return SQLITE_OK; }
+
+        inline int AdaptiveMutexEnd() { return SQLITE_OK; }
+
+        inline sqlite3_mutex* AdaptiveMutexAlloc(int type) {
+            AdaptiveMutexGlobals& globals = MutexGlobals();
+            if (type > SQLITE_MUTEX_RECURSIVE) {
+                if (type > SQLITE_MUTEX_STATIC_VFS3) {
+                    return 0;
+                }
+                return reinterpret_cast<sqlite3_mutex*>(&globals.statics[type]);
+            }
+            AdaptiveMutex* mutex = new (std::nothrow) AdaptiveMutex();
+            if (mutex == nullptr) {
+                return 0;
+            }
+            mutex->type = type;
+            if (globals.countContention) {
+                std::lock_guard<std::mutex> lock(globals.registryLock);
+                globals.live.insert(mutex);
+            }
+            return reinterpret_cast<sqlite3_mutex*>(mutex);
+        }
+
+        inline void AdaptiveMutexFree(sqlite3_mutex* handle) {
+            AdaptiveMutex* mutex = AsAdaptive(handle);
+            AdaptiveMutexGlobals& globals = MutexGlobals();
+            if (globals.countContention) {
+                std::lock_guard<std::mutex> lock(globals.registryLock);
+                if (globals.live.erase(mutex)) {
+                    MutexContentionStats stats = Snapshot(*mutex);
+                    MutexContentionStats& retired = globals.retired[mutex->type];
+                    retired.acquisitions += stats.acquisitions;
+                    retired.contended += stats.contended;
+                    retired.sleeps += stats.sleeps;
+                    retired.spins += stats.spins;
+                }
+            }
+            delete mutex;
+        }
+
+        inline void AdaptiveMutexEnter(sqlite3_mutex* handle) {
+            AdaptiveMutex* mutex = AsAdaptive(handle);
+            std::uintptr_t self = CurrentThreadTag();
+            if (mutex->type == SQLITE_MUTEX_RECURSIVE &&
+                mutex->owner.load(std::memory_order_relaxed) == self) {
+                ++mutex->depth;
+                return;
+            }
+            bool count = MutexGlobals().countContention;
+            mutex->Lock(count);
+            if (count) {
+                mutex->acquisitions.fetch_add(1, std::memory_order_relaxed);
+            }
+            mutex->owner.store(self, std::memory_order_relaxed);
+            mutex->depth = 1;
+        }
+
+        inline int AdaptiveMutexTry(sqlite3_mutex* handle) {
+            AdaptiveMutex* mutex = AsAdaptive(handle);
+            std::uintptr_t self = CurrentThreadTag();
+            if (mutex->type == SQLITE_MUTEX_RECURSIVE &&
+                mutex->owner.load(std::memory_order_relaxed) == self) {
+                ++mutex->depth;
+                return SQLITE_OK;
+            }
+            if (!mutex->TryLock()) {
+                return SQLITE_BUSY;
+            }
+            if (MutexGlobals().countContention) {
+                mutex->acquisitions.fetch_add(1, std::memory_order_relaxed);
+            }
+            mutex->owner.store(self, std::memory_order_relaxed);
+            mutex->depth = 1;
+            return SQLITE_OK;
+        }
+
+        inline void AdaptiveMutexLeave(sqlite3_mutex* handle) {
+            AdaptiveMutex* mutex = AsAdaptive(handle);
+            if (--mutex->depth > 0) {
+                return;
+            }
+            mutex->owner.store(0, std::memory_order_relaxed);
+            mutex->Unlock();
+        }
+
+        inline int AdaptiveMutexHeld(sqlite3_mutex* handle) {
+            return handle == 0 ||
+                AsAdaptive(handle)->owner.load(std::memory_order_relaxed) == CurrentThreadTag();
+        }
+
+        inline int AdaptiveMutexNotheld(sqlite3_mutex* handle) {
+            return handle == 0 ||
+                AsAdaptive(handle)->owner.load(std::memory_order_relaxed) != CurrentThreadTag();
+        }
+    }
+
+    inline const sqlite3_mutex_methods* AdaptiveMutexMethods() {
+        static const sqlite3_mutex_methods methods = {
+            detail::AdaptiveMutexInit,
+            detail::AdaptiveMutexEnd,
+            detail::AdaptiveMutexAlloc,
+            detail::AdaptiveMutexFree,
+            detail::AdaptiveMutexEnter,
+            detail::AdaptiveMutexTry,
+            detail::AdaptiveMutexLeave,
+            detail::AdaptiveMutexHeld,
+            detail::AdaptiveMutexNotheld,
+        };
+        return &methods;
+    }
+
+    /// <summary>
+    /// Shuts SQLite down, installs the adaptive mutexes and initializes it
+    /// again. Every connection must be closed first.
+    /// </summary>
+    inline int InstallAdaptiveMutex(bool countContention) {
+        int retcode = sqlite3_shutdown();
+        if (retcode != SQLITE_OK) {
+            return retcode;
+        }
+        detail::MutexGlobals().countContention = countContention;
+        retcode = sqlite3_config(SQLITE_CONFIG_MUTEX, AdaptiveMutexMethods());
+        if (retcode != SQLITE_OK) {
+            return retcode;
+        }
+        return sqlite3_initialize();
+    }
+
+    /// <summary>
+    /// Puts SQLite's built-in mutexes back; a zeroed method table makes
+    /// sqlite3_initialize pick the default implementation again.
+    /// </summary>
+    inline int RestoreDefaultMutex() {
+        int retcode = sqlite3_shutdown();
+        if (retcode != SQLITE_OK) {
+            return retcode;
+        }
+        sqlite3_mutex_methods defaults = {};
+        retcode = sqlite3_config(SQLITE_CONFIG_MUTEX, &defaults);
+        if (retcode != SQLITE_OK) {
+            return retcode;
+        }
+        detail::MutexGlobals().countContention = false;
+        return sqlite3_initialize();
+    }
+
+    /// <summary>
+    /// Counters of every mutex that was entered at least once while counting
+    /// was on: the static mutexes, each live dynamic mutex, and one folded
+    /// entry per type for dynamic mutexes that have been freed.
+    /// </summary>
+    inline std::vector<MutexContentionStats> AdaptiveMutexContention() {
+        detail::AdaptiveMutexGlobals& globals = detail::MutexGlobals();
+        std::vector<MutexContentionStats> result;
+        for (const auto& mutex : globals.statics) {
+            MutexContentionStats stats = detail::Snapshot(mutex);
+            if (stats.acquisitions > 0) {
+                result.push_back(stats);
+            }
+        }
+        std::lock_guard<std::mutex> lock(globals.registryLock);
+        for (detail::AdaptiveMutex* mutex : globals.live) {
+            MutexContentionStats stats = detail::Snapshot(*mutex);
+            if (stats.acquisitions > 0) {
+                result.push_back(stats);
+            }
+        }
+        for (int type = SQLITE_MUTEX_FAST; type <= SQLITE_MUTEX_RECURSIVE; ++type) {
+            MutexContentionStats stats = globals.retired[type];
+            if (stats.acquisitions > 0) {
+                stats.type = type;
+                stats.live = false;
+                result.push_back(stats);
+            }
+        }
+        return result;
+    }
+}
@@ -0,0 +1,379 @@
+//
+// arena_allocator.h
+//
+// An sqlite3_mem_methods implementation for SQLITE_CONFIG_MALLOC. Each thread
+// allocates from its own arena of size-classed free lists, so the common
+// malloc/free pair touches no shared state. A block freed by another thread
+// is pushed onto its owning arena's lock-free remote list and reclaimed by the
+// owner the next time that size class runs dry.
+//
+// Arenas keep their chunks for the life of the process; when a thread exits
+// its arena is parked and adopted by the next new thread. Requests above the
+// largest size class go straight to the system allocator.
+//
+
+#pragma once
+
+#include "sqlite3.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+namespace sqlite3tests {
+
+    struct ArenaAllocatorStats {
+        /// <summary>
+        /// Bytes currently handed out to SQLite, by size class.
+        /// </summary>
+        long long liveBytes = 0;
+        /// <summary>
+        /// High-water mark of liveBytes. Threads publish their usage in
+        /// steps of kArenaPublishBytes, so this can trail by that much per thread.
+        /// </summary>
+        long long peakBytes = 0;
+        /// <summary>
+        /// Memory obtained from the system for arena chunks.
+        /// </summary>
+        long long chunkBytes = 0;
+        int arenas = 0;
+    };
+
+    namespace detail {
+
+        const int kArenaHeaderBytes = 16;
+        const int kArenaChunkBytes = 256 * 1024;
+        const long long kArenaPublishBytes = 64 * 1024;
+
+        struct Arena;
+
+        struct ArenaBlock {
+            Arena* owner;          // nullptr for system allocations
+            std::uint32_t sizeClass;
+            std::uint32_t bytes;   // usable bytes
+        };
+
+        struct FreeNode {
+            FreeNode* next;
+        };
+
+        /// <summary>
+        /// 16..128 in steps of 16, then four classes per power of two up to 64 KB.
+        /// </summary>
+        struct SizeClasses {
+            std::vector<int> sizes;
+
+            SizeClasses() {
+                for (int size = 16; size <= 128; size += 16) {
+                    sizes.push_back(size);
+                }
+                for (int base = 128; base < 64 * 1024; base *= 2) {
+                    for (int step = 1; step <= 4; ++step) {
+                        sizes.push_back(base + base / 4 * step);
+                    }
+                }
+            }
+
+            int IndexOf(int bytes) const {
+                return static_cast<int>(std::lower_bound(sizes.begin(), sizes.end(), bytes) - sizes.begin());
+            }
+
+            int Count() const { return static_cast<int>(sizes.size()); }
+
+            int Largest() const { return sizes.back(); }
+        };
+
+        inline const SizeClasses& Classes() {
+            static const SizeClasses classes;
+            return classes;
+        }
+
+        struct Arena {
+            std::vector<FreeNode*> freeLists;
+            std::atomic<FreeNode*> remoteFrees{ nullptr };
+            char* bump = nullptr;
+            char* bumpEnd = nullptr;
+            std::vector<void*> chunks;
+            // Written only by the thread currently using the arena.
+            std::atomic<long long> liveBytes{ 0 };
+            long long unpublished = 0;
+
+            Arena() : freeLists(Classes().Count(), nullptr) {}
+        };
+
+        struct ArenaGlobals {
+            std::mutex lock;
+            std::vector<Arena*> all;
+            std::vector<Arena*> parked;
+            std::atomic<long long> publishedBytes{ 0 };
+            std::atomic<long long> peakBytes{ 0 };
+            std::atomic<long long> chunkBytes{ 0 };
+            std::atomic<long long> systemBytes{ 0 };
+        };
+
+        inline ArenaGlobals& Arenas() {
+            static ArenaGlobals globals;
+            return globals;
+        }
+
+        struct ArenaHolder {
+            Arena* arena = nullptr;
+            bool destroyed = false;
+
+            ~ArenaHolder() {
+                destroyed = true;
+                if (arena != nullptr) {
+                    ArenaGlobals& globals = Arenas();
+                    std::lock_guard<std::mutex> lock(globals.lock);
+                    globals.parked.push_back(arena);
+                }
+            }
+        };
+
+        /// <summary>
+        /// The calling thread's arena, adopting a parked one or creating a new
+        /// one on first use. Null while the thread is being torn down.
+        /// </summary>
+        inline Arena* CurrentArena() {
+            static thread_local ArenaHolder holder;
+            if (holder.arena != nullptr || holder.destroyed) {
+                return holder.arena;
+            }
+            ArenaGlobals& globals = Arenas();
+            std::lock_guard<std::mutex> lock(globals.lock);
+            if (!globals.parked.empty()) {
+                holder.arena = globals.parked.back();
+                globals.parked.pop_back();
+            }
+            else {
+                holder.arena = new Arena();
+                globals.all.push_back(holder.arena);
+            }
+            return holder.arena;
+        }
+
+        inline ArenaBlock* HeaderOf(void* p) {
+            return reinterpret_cast<ArenaBlock*>(static_cast<char*>(p) - kArenaHeaderBytes);
+        }
+
+        inline void Publish(long long delta) {
+            ArenaGlobals& globals = Arenas();
+            long long total = globals.publishedBytes.fetch_add(delta, std::memory_order_relaxed) + delta;
+            long long peak = globals.peakBytes.load(std::memory_order_relaxed);
+            while (total > peak && !globals.peakBytes.compare_exchange_weak(peak, total,
+                std::memory_order_relaxed)) {
+            }
+        }
+
+        /// <summary>
+        /// Charges delta to the calling thread's arena, whoever owns the block,
+        /// so each counter has a single writer. Null arena means a system
+        /// allocation or a thread in teardown; those are published at once.
+        /// </summary>
+        inline void Account(Arena* arena, long long delta) {
+            if (arena == nullptr) {
+                Arenas().systemBytes.fetch_add(delta, std::memory_order_relaxed);
+                Publish(delta);
+                return;
+            }
+            arena->liveBytes.store(arena->liveBytes.load(std::memory_order_relaxed) + delta,
+                std::memory_order_relaxed);
+            arena->unpublished += delta;
+            if (arena->unpublished >= kArenaPublishBytes || arena->unpublished <= -kArenaPublishBytes) {
+                Publish(arena->unpublished);
+                arena->unpublished = 0;
+            }
+        }
+
+        inline void DrainRemoteFrees(Arena* arena) {
+            FreeNode* node = arena->remoteFrees.exchange(nullptr, std::memory_order_acquire);
+            while (node != nullptr) {
+                FreeNode* next = node->next;
+                ArenaBlock* block = HeaderOf(node);
+                node->next = arena->freeLists[block->sizeClass];
+                arena->freeLists[block->sizeClass] = node;
+                node = next;
+            }
+        }
+
+        inline void* SystemMalloc(int bytes) {
+            ArenaBlock* block = static_cast<ArenaBlock*>(std::malloc(kArenaHeaderBytes + bytes));
+            if (block == nullptr) {
+                return nullptr;
+            }
+            block->owner = nullptr;
+            block->sizeClass = 0;
+            block->bytes = static_cast<std::uint32_t>(bytes);
+            Account(nullptr, bytes);
+            return reinterpret_cast<char*>(block) + kArenaHeaderBytes;
+        }
+
+        inline void* ArenaMalloc(int bytes) {
+            if (bytes <= 0) {
+                bytes = 1;
+            }
+            const SizeClasses& classes = Classes();
+            Arena* arena = CurrentArena();
+            if (bytes > classes.Largest() || arena == nullptr) {
+                return SystemMalloc(bytes);
+            }
+            int sizeClass = classes.IndexOf(bytes);
+            int usable = classes.sizes[sizeClass];
+
+            FreeNode* node = arena->freeLists[sizeClass];
+            if (node == nullptr && arena->remoteFrees.load(std::memory_order_relaxed) != nullptr) {
+                DrainRemoteFrees(arena);
+                node = arena->freeLists[sizeClass];
+            }
+            if (node != nullptr) {
+                arena->freeLists[sizeClass] = node->next;
+                Account(arena, usable);
+                return node;
+            }
+
+            int blockBytes = kArenaHeaderBytes + usable;
+            if (arena->bumpEnd - arena->bump < blockBytes) {
+                int chunkBytes = std::max(kArenaChunkBytes, blockBytes);
+                char* chunk = static_cast<char*>(std::malloc(chunkBytes));
+                if (chunk == nullptr) {
+                    return nullptr;
+                }
+                arena->chunks.push_back(chunk);
+                arena->bump = chunk;
+                arena->bumpEnd = chunk + chunkBytes;
+                Arenas().chunkBytes.fetch_add(chunkBytes, std::memory_order_relaxed);
+            }
+            ArenaBlock* block = reinterpret_cast<ArenaBlock*>(arena->bump);
+            arena->bump += blockBytes;
+            block->owner = arena;
+            block->sizeClass = static_cast<std::uint32_t>(sizeClass);
+            block->bytes = static_cast<std::uint32_t>(usable);
+            Account(arena, usable);
+            return reinterpret_cast<char*>(block) + kArenaHeaderBytes;
+        }
+
+        inline void ArenaFree(void* p) {
+            if (p == nullptr) {
+                return;
+            }
+            ArenaBlock* block = HeaderOf(p);
+            Arena* self = CurrentArena();
+            if (block->owner == nullptr) {
+                Account(nullptr, -static_cast<long long>(block->bytes));
+                std::free(block);
+                return;
+            }
+            Account(self, -static_cast<long long>(block->bytes));
+            FreeNode* node = static_cast<FreeNode*>(p);
+            if (block->owner == self) {
+                node->next = self->freeLists[block->sizeClass];
+                self->freeLists[block->sizeClass] = node;
+                return;
+            }
+            std::atomic<FreeNode*>& remote = block->owner->remoteFrees;
+            FreeNode* head = remote.load(std::memory_order_relaxed);
+            do {
+                node->next = head;
+            } while (!remote.compare_exchange_weak(head, node, std::memory_order_release,
+                std::memory_order_relaxed));
+        }
+
+        inline int ArenaSize(void* p) {
+            return p == nullptr ? 0 : static_cast<int>(HeaderOf(p)->bytes);
+        }
+
+        inline void* ArenaRealloc(void* p, int bytes) {
+            if (p == nullptr) {
+                return ArenaMalloc(bytes);
+            }
+            int current = ArenaSize(p);
+            ArenaBlock* block = HeaderOf(p);
+            if (block->owner != nullptr && Classes().IndexOf(std::max(bytes, 1)) == static_cast<int>(block->sizeClass)) {
+                return p;
+            }
+            void* fresh = ArenaMalloc(bytes);
+            if (fresh != nullptr) {
+                std::memcpy(fresh, p, std::min(current, bytes));
+                ArenaFree(p);
+            }
+            return fresh;
+        }
+
+        inline int ArenaRoundup(int bytes) {
+            const SizeClasses& classes = Classes();
+            if (bytes > classes.Largest()) {
+                return (bytes + 7) & ~7;
+            }
+            return classes.sizes[classes.IndexOf(std::max(bytes, 1))];
+        }
+
+        inline int ArenaInit(void*) { return SQLITE_OK; }
+
+        inline void ArenaShutdown(void*) {}
+    }
+
+    inline const sqlite3_mem_methods* ArenaAllocatorMethods() {
+        static const sqlite3_mem_methods methods = {
+            detail::ArenaMalloc,
+            detail::ArenaFree,
+            detail::ArenaRealloc,
+            detail::ArenaSize,
+            detail::ArenaRoundup,
+            detail::ArenaInit,
+            detail::ArenaShutdown,
+            0,
+        };
+        return &methods;
+    }
+
+    /// <summary>
+    /// Shuts SQLite down and re-initializes it on the arena allocator. SQLite's
+    /// own memory statistics are switched off: they serialize every allocation
+    /// on a global mutex, and ArenaAllocatorCounters covers the same ground.
+    /// Every connection must be closed first.
+    /// </summary>
+    inline int InstallArenaAllocator() {
+        int retcode = sqlite3_shutdown();
+        if (retcode == SQLITE_OK) {
+            retcode = sqlite3_config(SQLITE_CONFIG_MALLOC, ArenaAllocatorMethods());
+        }
+        if (retcode == SQLITE_OK) {
+            retcode = sqlite3_config(SQLITE_CONFIG_MEMSTATUS, 0);
+        }
+        return retcode == SQLITE_OK ? sqlite3_initialize() : retcode;
+    }
+
+    /// <summary>
+    /// Puts the system allocator back; a zeroed method table makes
+    /// sqlite3_initialize pick the built-in one again.
+    /// </summary>
+    inline int RestoreDefaultAllocator(bool memStatus = true) {
+        int retcode = sqlite3_shutdown();
+        sqlite3_mem_methods defaults = {};
+        if (retcode == SQLITE_OK) {
+            retcode = sqlite3_config(SQLITE_CONFIG_MALLOC, &defaults);
+        }
+        if (retcode == SQLITE_OK) {
+            retcode = sqlite3_config(SQLITE_CONFIG_MEMSTATUS, memStatus ? 1 : 0);
+        }
+        return retcode == SQLITE_OK ? sqlite3_initialize() : retcode;
+    }
+
+    inline ArenaAllocatorStats ArenaAllocatorCounters() {
+        detail::ArenaGlobals& globals = detail::Arenas();
+        ArenaAllocatorStats stats;
+        stats.liveBytes = globals.systemBytes.load(std::memory_order_relaxed);
+        std::lock_guard<std::mutex> lock(globals.lock);
+        for (detail::Arena* arena : globals.all) {
+            stats.liveBytes += arena->liveBytes.load(std::memory_order_relaxed);
+        }
+        stats.peakBytes = std::max(stats.liveBytes, globals.peakBytes.load(std::memory_order_relaxed));
+        stats.chunkBytes = globals.chunkBytes.load(std::memory_order_relaxed);
+        stats.arenas = static_cast<int>(globals.all.size());
+        return stats;
+    }
+}
@@ -0,0 +1,556 @@
+//
+// async_db.h
+//
+// A C++20 coroutine interface over SQLite. Every AsyncConnection owns one
+// connection and one executor thread that runs all of its work in order.
+// "co_await conn.Exec(sql)" queues the statement on that executor and
+// suspends the caller instead of blocking a thread. The coroutine then
+// resumes on the executor once the statement is done. Thousands of logical
+// clients can thus share a handful of connections and threads; an
+// AsyncConnectionPool spreads them round-robin.
+//
+// Each connection is only ever touched by its executor, which is what
+// multi-thread mode (SQLITE_THREADSAFE=2) requires. Code that runs between
+// two co_awaits runs on an executor thread and holds up that connection's
+// queue, so it should stay short.
+//
+// Requires C++20 for coroutines.
+//
+
+#pragma once
+
+#include "sqlite3.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <coroutine>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+
+namespace sqlite3tests {
+
+    template <class T = void>
+    class Task;
+
+    namespace detail {
+
+        struct TaskPromiseBase {
+            struct FinalAwaiter {
+                bool await_ready() noexcept { return false; }
+
+                // Symmetric transfer back to whoever awaited the task.
+                template <class Promise>
+                std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept {
+                    std::coroutine_handle<> continuation = handle.promise().continuation;
+                    return continuation ? continuation : std::noop_coroutine();
+                }
+
+                void await_resume() noexcept {}
+            };
+
+            std::suspend_always initial_suspend() noexcept { return {}; }
+
+            FinalAwaiter final_suspend() noexcept { return {}; }
+
+            void unhandled_exception() { error = std::current_exception(); }
+
+            void Rethrow() {
+                if (error) {
+                    std::rethrow_exception(error);
+                }
+            }
+
+            std::coroutine_handle<> continuation;
+            std::exception_ptr error;
+        };
+
+        template <class T>
+        struct TaskPromise : TaskPromiseBase {
+            Task<T> get_return_object();
+
+            void return_value(T result) { value.emplace(std::move(result)); }
+
+            T Result() {
+                Rethrow();
+                return std::move(*value);
+            }
+
+            std::optional<T> value;
+        };
+
+        template <>
+        struct TaskPromise<void> : TaskPromiseBase {
+            Task<void> get_return_object();
+
+            void return_void() {}
+
+            void Result() { Rethrow(); }
+        };
+    }
+
+    /// <summary>
+    /// A lazily started coroutine returning T; runs when first awaited.
+    /// </summary>
+    template <class T>
+    class Task {
+    public:
+        using promise_type = detail::TaskPromise<T>;
+
+        explicit Task(std::coroutine_handle<promise_type> handle) : handle_(handle) {}
+
+        Task(Task&& other) noexcept : handle_(std::exchange(other.handle_, {})) {}
+
+        Task(const Task&) = delete;
+        Task& operator=(const Task&) = delete;
+
+        ~Task() {
+            if (handle_) {
+                handle_.destroy();
+            }
+        }
+
+        bool await_ready() const noexcept { return !handle_ || handle_.done(); }
+
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+            handle_.promise().continuation = awaiting;
+            return handle_;
+        }
+
+        T await_resume() { return handle_.promise().Result(); }
+
+    private:
+        std::coroutine_handle<promise_type> handle_;
+    };
+
+    namespace detail {
+
+        template <class T>
+        Task<T> TaskPromise<T>::get_return_object() {
+            return Task<T>(std::coroutine_handle<TaskPromise<T>>::from_promise(*this));
+        }
+
+        inline Task<void> TaskPromise<void>::get_return_object() {
+            return Task<void>(std::coroutine_handle<TaskPromise<void>>::from_promise(*this));
+        }
+
+        // A fire-and-forget coroutine that cleans up after itself.
+        struct Detached {
+            struct promise_type {
+                Detached get_return_object() noexcept { return {}; }
+                std::suspend_never initial_suspend() noexcept { return {}; }
+                std::suspend_never final_suspend() noexcept { return {}; }
+                void return_void() noexcept {}
+                void unhandled_exception() noexcept { std::terminate(); }
+            };
+        };
+
+        template <class T>
+        struct SyncWaitState {
+            std::mutex lock;
+            std::condition_variable cv;
+            bool done = false;
+            std::optional<std::conditional_t<std::is_void_v<T>, bool, T>> value;
+            std::exception_ptr error;
+        };
+
+        template <class T>
+        Detached SyncWaitDriver(Task<T>& task, SyncWaitState<T>& state) {
+            try {
+                if constexpr (std::is_void_v<T>) {
+                    co_await task;
+                }
+                else {
+                    state.value.emplace(co_await task);
+                }
+            }
+            catch (...) {
+                state.error = std::current_exception();
+            }
+            // Notify under the lock: state lives on the waiter's stack.
+            std::lock_guard<std::mutex> lock(state.lock);
+            state.done = true;
+            state.cv.notify_one();
+        }
+
+        inline Detached SpawnDriver(Task<void> task, std::function<void()> done) {
+            co_await task;
+            if (done) {
+                done();
+            }
+        }
+    }
+
+    /// <summary>
+    /// Runs task and blocks the calling thread until it finishes; rethrows
+    /// its exception.
+    /// </summary>
+    template <class T>
+    T SyncWait(Task<T> task) {
+        detail::SyncWaitState<T> state;
+        detail::SyncWaitDriver(task, state);
+        std::unique_lock<std::mutex> lock(state.lock);
+        state.cv.wait(lock, [&state] { return state.done; });
+        if (state.error) {
+            std::rethrow_exception(state.error);
+        }
+        if constexpr (!std::is_void_v<T>) {
+            return std::move(*state.value);
+        }
+    }
+
+    /// <summary>
+    /// Starts task without waiting for it; done, if given, runs when it
+    /// finishes. An exception escaping task terminates the program.
+    /// </summary>
+    inline void Spawn(Task<void> task, std::function<void()> done = {}) {
+        detail::SpawnDriver(std::move(task), std::move(done));
+    }
+
+    using SqlValue = std::variant<std::nullptr_t, int64_t, double, std::string>;
+    using AsyncRow = std::vector<SqlValue>;
+
+    class AsyncConnection;
+
+    /// <summary>
+    /// Awaitable running work(sqlite3*) on a connection's executor.
+    /// </summary>
+    template <class Work>
+    class RunAwaiter {
+    public:
+        using Result = std::invoke_result_t<Work&, sqlite3*>;
+        static_assert(!std::is_void_v<Result>, "work must return a value, typically a retcode");
+
+        RunAwaiter(AsyncConnection* connection, Work work) : connection_(connection), work_(std::move(work)) {}
+
+        bool await_ready() const noexcept { return false; }
+
+        void await_suspend(std::coroutine_handle<> handle);
+
+        Result await_resume() { return std::move(*result_); }
+
+    private:
+        AsyncConnection* connection_;
+        Work work_;
+        std::optional<Result> result_;
+    };
+
+    /// <summary>
+    /// The rows of a query, fetched from the executor in batches:
+    /// while (co_await rows.Next()) { ... rows.Current() ... }
+    /// </summary>
+    class AsyncRowStream {
+    public:
+        class NextAwaiter {
+        public:
+            explicit NextAwaiter(AsyncRowStream* stream) : stream_(stream) {}
+
+            bool await_ready() const noexcept {
+                return stream_->position_ < stream_->buffer_.size() || stream_->done_;
+            }
+
+            void await_suspend(std::coroutine_handle<> handle);
+
+            bool await_resume() { return stream_->Advance(); }
+
+        private:
+            AsyncRowStream* stream_;
+        };
+
+        AsyncRowStream(AsyncConnection* connection, std::string sql, int batch)
+            : connection_(connection), sql_(std::move(sql)), batch_(batch > 0 ? batch : 1) {}
+
+        AsyncRowStream(const AsyncRowStream&) = delete;
+        AsyncRowStream& operator=(const AsyncRowStream&) = delete;
+
+        ~AsyncRowStream();
+
+        NextAwaiter Next() { return NextAwaiter(this); }
+
+        const AsyncRow& Current() const { return current_; }
+
+        /// <summary>
+        /// SQLITE_OK, or the error that ended the stream.
+        /// </summary>
+        int Status() const { return status_; }
+
+    private:
+        // Runs on the executor.
+        void Fill() {
+            buffer_.clear();
+            position_ = 0;
+            if (stmt_ == 0) {
+                status_ = sqlite3_prepare_v2(Db(), sql_.c_str(), static_cast<int>(sql_.size()), &stmt_, 0);
+                if (status_ != SQLITE_OK) {
+                    done_ = true;
+                    return;
+                }
+            }
+            int retcode = SQLITE_ROW;
+            while (static_cast<int>(buffer_.size()) < batch_ && (retcode = sqlite3_step(stmt_)) == SQLITE_ROW) {
+                int columns = sqlite3_column_count(stmt_);
+                AsyncRow& row = buffer_.emplace_back();
+                row.reserve(columns);
+                for (int c = 0; c < columns; ++c) {
+                    switch (sqlite3_column_type(stmt_, c)) {
+                    case SQLITE_INTEGER:
+                        row.emplace_back(static_cast<int64_t>(sqlite3_column_int64(stmt_, c)));
+                        break;
+                    case SQLITE_FLOAT:
+                        row.emplace_back(sqlite3_column_double(stmt_, c));
+                        break;
+                    case SQLITE_NULL:
+                        row.emplace_back(nullptr);
+                        break;
+                    default: {
+                        const char* text = static_cast<const char*>(sqlite3_column_blob(stmt_, c));
+                        row.emplace_back(std::string(text != nullptr ? text : "", sqlite3_column_bytes(stmt_, c)));
+                        break;
+                    }
+                    }
+                }
+            }
+            if (retcode != SQLITE_ROW) {
+                status_ = retcode == SQLITE_DONE ? SQLITE_OK : retcode;
+                sqlite3_finalize(stmt_);
+                stmt_ = 0;
+                done_ = true;
+            }
+        }
+
+        bool Advance() {
+            if (position_ < buffer_.size()) {
+                current_ = std::move(buffer_[position_++]);
+                return true;
+            }
+            return false;
+        }
+
+        sqlite3* Db() const;
+
+        AsyncConnection* connection_;
+        std::string sql_;
+        int batch_;
+        sqlite3_stmt* stmt_ = 0;
+        std::vector<AsyncRow> buffer_;
+        size_t position_ = 0;
+        AsyncRow current_;
+        bool done_ = false;
+        int status_ = SQLITE_OK;
+    };
+
+    /// <summary>
+    /// One connection and the executor thread that serializes its work.
+    /// </summary>
+    class AsyncConnection {
+    public:
+        AsyncConnection() = default;
+        AsyncConnection(const AsyncConnection&) = delete;
+        AsyncConnection& operator=(const AsyncConnection&) = delete;
+
+        ~AsyncConnection() { Close(); }
+
+        /// <summary>
+        /// Opens the connection and starts its executor. SQLITE_MISUSE if it
+        /// is already open; Close it first.
+        /// </summary>
+        int Open(const std::string& path, int flags = SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, int busyTimeoutMs = 5000) {
+            if (executor_.joinable()) {
+                return SQLITE_MISUSE;
+            }
+            int retcode = sqlite3_open_v2(path.c_str(), &db_, flags, 0);
+            if (retcode != SQLITE_OK) {
+                sqlite3_close(db_);
+                db_ = 0;
+                return retcode;
+            }
+            sqlite3_busy_timeout(db_, busyTimeoutMs);
+            stopping_ = false;
+            executor_ = std::thread([this] { Loop(); });
+            return SQLITE_OK;
+        }
+
+        /// <summary>
+        /// Finishes the queued work, stops the executor and closes the
+        /// connection.
+        /// </summary>
+        void Close() {
+            if (!executor_.joinable()) {
+                return;
+            }
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                stopping_ = true;
+            }
+            wake_.notify_one();
+            executor_.join();
+            sqlite3_close(db_);
+            db_ = 0;
+        }
+
+        sqlite3* Db() const { return db_; }
+
+        std::thread::id ExecutorId() const { return executor_.get_id(); }
+
+        /// <summary>
+        /// Jobs run by the executor so far.
+        /// </summary>
+        long long Executed() const { return executed_.load(std::memory_order_relaxed); }
+
+        /// <summary>
+        /// Queues job on the executor.
+        /// </summary>
+        void Post(std::function<void()> job) {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                jobs_.push_back(std::move(job));
+            }
+            wake_.notify_one();
+        }
+
+        /// <summary>
+        /// co_await Run([](sqlite3* db) { ... return retcode; }) runs the
+        /// lambda on the executor and yields what it returns.
+        /// </summary>
+        template <class Work>
+        RunAwaiter<Work> Run(Work work) {
+            return RunAwaiter<Work>(this, std::move(work));
+        }
+
+        /// <summary>
+        /// co_await Exec(sql) yields the retcode of sqlite3_exec.
+        /// </summary>
+        auto Exec(std::string sql) {
+            return Run([sql = std::move(sql)](sqlite3* db) { return sqlite3_exec(db, sql.c_str(), 0, 0, 0); });
+        }
+
+        /// <summary>
+        /// The connection must outlive the stream.
+        /// </summary>
+        std::unique_ptr<AsyncRowStream> Rows(std::string sql, int batch = 64) {
+            return std::make_unique<AsyncRowStream>(this, std::move(sql), batch);
+        }
+
+    private:
+        void Loop() {
+            std::deque<std::function<void()>> ready;
+            std::unique_lock<std::mutex> lock(mutex_);
+            while (true) {
+                wake_.wait(lock, [this] { return stopping_ || !jobs_.empty(); });
+                if (jobs_.empty()) {
+                    break;
+                }
+                ready.swap(jobs_);
+                lock.unlock();
+                for (std::function<void()>& job : ready) {
+                    job();
+                }
+                executed_.fetch_add(static_cast<long long>(ready.size()), std::memory_order_relaxed);
+                ready.clear();
+                lock.lock();
+            }
+        }
+
+        sqlite3* db_ = 0;
+        std::thread executor_;
+        std::mutex mutex_;
+        std::condition_variable wake_;
+        std::deque<std::function<void()>> jobs_;
+        bool stopping_ = false;
+        std::atomic<long long> executed_{ 0 };
+    };
+
+    template <class Work>
+    void RunAwaiter<Work>::await_suspend(std::coroutine_handle<> handle) {
+        connection_->Post([this, handle] {
+            result_.emplace(work_(connection_->Db()));
+            handle.resume();
+        });
+    }
+
+    inline void AsyncRowStream::NextAwaiter::await_suspend(std::coroutine_handle<> handle) {
+        AsyncRowStream* stream = stream_;
+        stream->connection_->Post([stream, handle] {
+            stream->Fill();
+            handle.resume();
+        });
+    }
+
+    inline AsyncRowStream::~AsyncRowStream() {
+        if (stmt_ != 0) {
+            sqlite3_stmt* stmt = stmt_;
+            connection_->Post([stmt] { sqlite3_finalize(stmt); });
+        }
+    }
+
+    inline sqlite3* AsyncRowStream::Db() const { return connection_->Db(); }
+
+    struct AsyncPoolOptions {
+        std::string path;
+        int connections = 4;
+        int openFlags = SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE;
+        int busyTimeoutMs = 5000;
+        /// <summary>
+        /// Executed once on every connection when the pool is opened.
+        /// </summary>
+        std::vector<std::string> warmupSql;
+    };
+
+    /// <summary>
+    /// A fixed set of AsyncConnections handed out round-robin.
+    /// </summary>
+    class AsyncConnectionPool {
+    public:
+        AsyncConnectionPool() = default;
+        AsyncConnectionPool(const AsyncConnectionPool&) = delete;
+        AsyncConnectionPool& operator=(const AsyncConnectionPool&) = delete;
+
+        ~AsyncConnectionPool() { Close(); }
+
+        int Open(const AsyncPoolOptions& options) {
+            for (int i = 0; i < options.connections; ++i) {
+                std::unique_ptr<AsyncConnection> connection = std::make_unique<AsyncConnection>();
+                int retcode = connection->Open(options.path, options.openFlags, options.busyTimeoutMs);
+                for (size_t s = 0; retcode == SQLITE_OK && s < options.warmupSql.size(); ++s) {
+                    // The executor has not been handed any work yet.
+                    retcode = sqlite3_exec(connection->Db(), options.warmupSql[s].c_str(), 0, 0, 0);
+                }
+                if (retcode != SQLITE_OK) {
+                    Close();
+                    return retcode;
+                }
+                connections_.push_back(std::move(connection));
+            }
+            return SQLITE_OK;
+        }
+
+        void Close() { connections_.clear(); }
+
+        int Size() const { return static_cast<int>(connections_.size()); }
+
+        AsyncConnection& operator[](int i) { return *connections_[i]; }
+
+        /// <summary>
+        /// The next connection in round-robin order; a logical client that
+        /// needs a transaction keeps using the one it got.
+        /// </summary>
+        AsyncConnection& Next() {
+            unsigned i = next_.fetch_add(1, std::memory_order_relaxed);
+            return *connections_[i % connections_.size()];
+        }
+
+    private:
+        std::vector<std::unique_ptr<AsyncConnection>> connections_;
+        std::atomic<unsigned> next_{ 0 };
+    };
+}
@@ -0,0 +1,215 @@
+//
+// bulk_insert.h
+//
+// Inserts whole column arrays in one transaction. Every row of
+// "insert into Students values (...)" in its own autocommit statement costs a
+// compile and a journal sync. BulkInsert compiles at most two statements
+// instead: a multi-row "insert ... values (?,?),(?,?),..." and one sized for
+// the rest, and rebinds them for each batch inside a single savepoint.
+// Batches stay within SQLITE_LIMIT_VARIABLE_NUMBER, but default to a few
+// hundred rows: compiling a statement of tens of thousands of rows costs
+// more than the executions it saves.
+//
+// Requires C++20 for std::span.
+//
+
+#pragma once
+
+#include "sqlite3.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <variant>
+
+namespace sqlite3tests {
+
+    /// <summary>
+    /// One column of a bulk insert: its name and a view of its values, which
+    /// must stay alive until BulkInsert returns.
+    /// </summary>
+    struct BulkColumn {
+        using Values = std::variant<std::span<const int64_t>, std::span<const double>,
+            std::span<const std::string_view>, std::span<const std::string>>;
+
+        BulkColumn(std::string name, std::span<const int64_t> values) : name(std::move(name)), values(values) {}
+        BulkColumn(std::string name, std::span<const double> values) : name(std::move(name)), values(values) {}
+        BulkColumn(std::string name, std::span<const std::string_view> values) : name(std::move(name)), values(values) {}
+        BulkColumn(std::string name, std::span<const std::string> values) : name(std::move(name)), values(values) {}
+
+        size_t Size() const {
+            return std::visit([](auto span) { return span.size(); }, values);
+        }
+
+        std::string name;
+        Values values;
+    };
+
+    struct BulkInsertOptions {
+        /// <summary>
+        /// false binds one row per execution of a single-row statement.
+        /// </summary>
+        bool multiRow = true;
+        /// <summary>
+        /// Rows per multi-row statement, capped by the variable limit; 0
+        /// means as many as it allows.
+        /// </summary>
+        int rowsPerStatement = 256;
+    };
+
+    struct BulkInsertStats {
+        long long rows = 0;
+        long long executions = 0;
+        int rowsPerStatement = 0;
+    };
+
+    namespace detail {
+
+        inline std::string QuoteIdentifier(const std::string& name) {
+            std::string quoted = "\"";
+            for (char c : name) {
+                quoted += c;
+                if (c == '"') {
+                    quoted += '"';
+                }
+            }
+            return quoted + '"';
+        }
+
+        inline int PrepareBulkInsert(sqlite3* db, const std::string& table, std::span<const BulkColumn> columns,
+                                     int rows, sqlite3_stmt** stmt) {
+            std::string sql = "insert into " + QuoteIdentifier(table) + " (";
+            std::string row = "(";
+            for (size_t c = 0; c < columns.size(); ++c) {
+                sql += (c > 0 ? ", " : "") + QuoteIdentifier(columns[c].name);
+                row += c > 0 ? ",?" : "?";
+            }
+            row += ')';
+            sql += ") values ";
+            sql.reserve(sql.size() + rows * (row.size() + 1));
+            for (int r = 0; r < rows; ++r) {
+                if (r > 0) {
+                    sql += ',';
+                }
+                sql += row;
+            }
+            return sqlite3_prepare_v3(db, sql.c_str(), static_cast<int>(sql.size()), SQLITE_PREPARE_PERSISTENT, stmt, 0);
+        }
+
+        // Binds rows [first, first + count) to the parameters of stmt, row by
+        // row, and runs it once.
+        inline int ExecuteBatch(sqlite3_stmt* stmt, std::span<const BulkColumn> columns, size_t first, int count) {
+            const int width = static_cast<int>(columns.size());
+            int retcode = SQLITE_OK;
+            for (int c = 0; c < width && retcode == SQLITE_OK; ++c) {
+                std::visit([&](auto span) {
+                    using Value = typename decltype(span)::value_type;
+                    for (int r = 0; r < count && retcode == SQLITE_OK; ++r) {
+                        const Value& value = span[first + r];
+                        int index = r * width + c + 1;
+                        if constexpr (std::is_same_v<Value, int64_t>) {
+                            retcode = sqlite3_bind_int64(stmt, index, value);
+                        }
+                        else if constexpr (std::is_same_v<Value, double>) {
+                            retcode = sqlite3_bind_double(stmt, index, value);
+                        }
+                        else {
+                            // An empty string_view may have a null data(),
+                            // which SQLite would store as NULL, not ''.
+                            retcode = sqlite3_bind_text(stmt, index, value.data() ? value.data() : "",
+                                static_cast<int>(value.size()), SQLITE_STATIC);
+                        }
+                    }
+                }, columns[c].values);
+            }
+            if (retcode == SQLITE_OK) {
+                retcode = sqlite3_step(stmt);
+                retcode = retcode == SQLITE_DONE ? SQLITE_OK : retcode;
+            }
+            sqlite3_reset(stmt);
+            return retcode;
+        }
+    }
+
+    /// <summary>
+    /// Inserts the rows formed by columns into table, all or nothing. Works
+    /// inside an open transaction too, as a nested savepoint. All columns
+    /// must have the same length.
+    /// </summary>
+    inline int BulkInsert(sqlite3* db, const std::string& table, std::span<const BulkColumn> columns,
+                          const BulkInsertOptions& options = BulkInsertOptions(), BulkInsertStats* stats = nullptr) {
+        if (columns.empty()) {
+            return SQLITE_MISUSE;
+        }
+        const size_t rows = columns[0].Size();
+        for (const BulkColumn& column : columns) {
+            if (column.Size() != rows) {
+                return SQLITE_MISUSE;
+            }
+        }
+        const int width = static_cast<int>(columns.size());
+        const int variables = sqlite3_limit(db, SQLITE_LIMIT_VARIABLE_NUMBER, -1);
+        if (width > variables) {
+            return SQLITE_RANGE;
+        }
+        int perStatement = 1;
+        if (options.multiRow) {
+            perStatement = variables / width;
+            if (options.rowsPerStatement > 0) {
+                perStatement = std::min(perStatement, options.rowsPerStatement);
+            }
+            perStatement = static_cast<int>(std::min<size_t>(perStatement, std::max<size_t>(rows, 1)));
+        }
+
+        int retcode = sqlite3_exec(db, "savepoint bulk_insert", 0, 0, 0);
+        if (retcode != SQLITE_OK) {
+            return retcode;
+        }
+        sqlite3_stmt* batch = 0;
+        sqlite3_stmt* tail = 0;
+        long long executions = 0;
+        retcode = detail::PrepareBulkInsert(db, table, columns, perStatement, &batch);
+        size_t row = 0;
+        for (; retcode == SQLITE_OK && rows - row >= static_cast<size_t>(perStatement); row += perStatement) {
+            retcode = detail::ExecuteBatch(batch, columns, row, perStatement);
+            ++executions;
+        }
+        if (retcode == SQLITE_OK && row < rows) {
+            int rest = static_cast<int>(rows - row);
+            retcode = detail::PrepareBulkInsert(db, table, columns, rest, &tail);
+            if (retcode == SQLITE_OK) {
+                retcode = detail::ExecuteBatch(tail, columns, row, rest);
+                ++executions;
+            }
+        }
+        sqlite3_finalize(batch);
+        sqlite3_finalize(tail);
+
+        if (retcode == SQLITE_OK) {
+            retcode = sqlite3_exec(db, "release bulk_insert", 0, 0, 0);
+        }
+        if (retcode != SQLITE_OK) {
+            sqlite3_exec(db, "rollback to bulk_insert; release bulk_insert", 0, 0, 0);
+            return retcode;
+        }
+        if (stats != nullptr) {
+            stats->rows = static_cast<long long>(rows);
+            stats->executions = executions;
+            stats->rowsPerStatement = perStatement;
+        }
+        return SQLITE_OK;
+    }
+
+    /// <summary>
+    /// BulkInsert of a single integer column, e.g. Students.SID.
+    /// </summary>
+    inline int BulkInsert(sqlite3* db, const std::string& table, const std::string& column, std::span<const int64_t> values,
+                          const BulkInsertOptions& options = BulkInsertOptions(), BulkInsertStats* stats = nullptr) {
+        const BulkColumn columns[] = { BulkColumn(column, values) };
+        return BulkInsert(db, table, columns, options, stats);
+    }
+}
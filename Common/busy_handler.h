@@ -0,0 +1,203 @@
+//
+// busy_handler.h
+//
+// A sqlite3_busy_handler that retries with jittered exponential backoff
+// until a deadline, and keeps telemetry. sqlite3_busy_timeout sleeps on a
+// fixed schedule, so every waiter wakes up in lockstep and they collide
+// again. The jitter spreads them out, and the deadline bounds how long one
+// statement may wait in total.
+//
+// Counters are kept per handler and aggregated per database file, so a run
+// with many connections can say which database was contended.
+//
+
+#pragma once
+
+#include "sqlite3.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace sqlite3tests {
+
+    struct BusyPolicy {
+        std::chrono::microseconds initialDelay{ 100 };
+        std::chrono::microseconds maxDelay{ 20000 };
+        double multiplier = 2.0;
+        /// <summary>
+        /// Total time one busy episode may wait before SQLITE_BUSY is
+        /// returned to the caller.
+        /// </summary>
+        std::chrono::milliseconds deadline{ 5000 };
+    };
+
+    struct BusyStats {
+        /// <summary>
+        /// Statements that found the database locked at least once.
+        /// </summary>
+        long long busyEvents = 0;
+        long long retries = 0;
+        long long giveUps = 0;
+        double waitMs = 0;
+    };
+
+    namespace detail {
+
+        struct BusyCounters {
+            std::atomic<long long> busyEvents{ 0 };
+            std::atomic<long long> retries{ 0 };
+            std::atomic<long long> giveUps{ 0 };
+            std::atomic<long long> waitMicros{ 0 };
+
+            BusyStats Snapshot() const {
+                BusyStats stats;
+                stats.busyEvents = busyEvents.load(std::memory_order_relaxed);
+                stats.retries = retries.load(std::memory_order_relaxed);
+                stats.giveUps = giveUps.load(std::memory_order_relaxed);
+                stats.waitMs = waitMicros.load(std::memory_order_relaxed) / 1000.0;
+                return stats;
+            }
+        };
+
+        struct BusyRegistry {
+            std::mutex lock;
+            std::map<std::string, std::shared_ptr<BusyCounters>> databases;
+        };
+
+        inline BusyRegistry& Busy() {
+            static BusyRegistry registry;
+            return registry;
+        }
+
+        inline std::shared_ptr<BusyCounters> DatabaseCounters(const std::string& path) {
+            BusyRegistry& registry = Busy();
+            std::lock_guard<std::mutex> lock(registry.lock);
+            std::shared_ptr<BusyCounters>& counters = registry.databases[path];
+            if (!counters) {
+                counters = std::make_shared<BusyCounters>();
+            }
+            return counters;
+        }
+
+        /// <summary>
+        /// Uniform in [0, 1); xorshift64 per thread.
+        /// </summary>
+        inline double Jitter() {
+            static thread_local unsigned long long state =
+                0x9e3779b97f4a7c15ULL ^ std::hash<std::thread::id>()(std::this_thread::get_id());
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            return static_cast<double>(state >> 11) / 9007199254740992.0;
+        }
+    }
+
+    /// <summary>
+    /// Owns the busy handler of one connection; must outlive it, or be
+    /// uninstalled first.
+    /// </summary>
+    class AdaptiveBusyHandler {
+    public:
+        AdaptiveBusyHandler() = default;
+        AdaptiveBusyHandler(const AdaptiveBusyHandler&) = delete;
+        AdaptiveBusyHandler& operator=(const AdaptiveBusyHandler&) = delete;
+
+        /// <summary>
+        /// Replaces any busy handler or busy timeout on db.
+        /// </summary>
+        int Install(sqlite3* db, const BusyPolicy& policy = BusyPolicy()) {
+            const char* path = sqlite3_db_filename(db, "main");
+            database_ = detail::DatabaseCounters(path != nullptr ? path : "");
+            policy_ = policy;
+            db_ = db;
+            return sqlite3_busy_handler(db, &AdaptiveBusyHandler::Callback, this);
+        }
+
+        int Uninstall() {
+            int retcode = db_ != 0 ? sqlite3_busy_handler(db_, 0, 0) : SQLITE_OK;
+            db_ = 0;
+            return retcode;
+        }
+
+        BusyStats Stats() const { return counters_.Snapshot(); }
+
+    private:
+        // Called by SQLite with count = number of earlier calls in this
+        // episode; returning 0 gives up with SQLITE_BUSY.
+        static int Callback(void* arg, int count) {
+            AdaptiveBusyHandler* self = static_cast<AdaptiveBusyHandler*>(arg);
+            auto now = std::chrono::steady_clock::now();
+            if (count == 0) {
+                self->episodeStart_ = now;
+                self->Add(&detail::BusyCounters::busyEvents, 1);
+            }
+            auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(now - self->episodeStart_);
+            auto remaining = self->policy_.deadline - elapsed;
+            if (remaining.count() <= 0) {
+                self->Add(&detail::BusyCounters::giveUps, 1);
+                return 0;
+            }
+
+            double ceiling = static_cast<double>(self->policy_.initialDelay.count()) *
+                std::pow(self->policy_.multiplier, std::min(count, 30));
+            ceiling = std::min(ceiling, static_cast<double>(self->policy_.maxDelay.count()));
+            // Half fixed, half random, so that backoff still grows.
+            long long delay = static_cast<long long>(ceiling * (0.5 + 0.5 * detail::Jitter()));
+            delay = std::max(1LL, std::min(delay, static_cast<long long>(remaining.count())));
+
+            std::this_thread::sleep_for(std::chrono::microseconds(delay));
+            long long slept = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - now).count();
+            self->Add(&detail::BusyCounters::retries, 1);
+            self->Add(&detail::BusyCounters::waitMicros, slept);
+            return 1;
+        }
+
+        void Add(std::atomic<long long> detail::BusyCounters::* counter, long long n) {
+            (counters_.*counter).fetch_add(n, std::memory_order_relaxed);
+            ((*database_).*counter).fetch_add(n, std::memory_order_relaxed);
+        }
+
+        sqlite3* db_ = 0;
+        BusyPolicy policy_;
+        std::chrono::steady_clock::time_point episodeStart_;
+        detail::BusyCounters counters_;
+        std::shared_ptr<detail::BusyCounters> database_;
+    };
+
+    /// <summary>
+    /// Totals over every handler installed on connections to path, as
+    /// reported by sqlite3_db_filename.
+    /// </summary>
+    inline BusyStats BusyTelemetry(const std::string& path) {
+        detail::BusyRegistry& registry = detail::Busy();
+        std::lock_guard<std::mutex> lock(registry.lock);
+        auto found = registry.databases.find(path);
+        return found != registry.databases.end() ? found->second->Snapshot() : BusyStats();
+    }
+
+    /// <summary>
+    /// Zeroes the per-database totals. The records stay in place, because
+    /// handlers already installed keep counting into them.
+    /// </summary>
+    inline void ResetBusyTelemetry() {
+        detail::BusyRegistry& registry = detail::Busy();
+        std::lock_guard<std::mutex> lock(registry.lock);
+        for (auto& database : registry.databases) {
+            detail::BusyCounters& counters = *database.second;
+            counters.busyEvents.store(0, std::memory_order_relaxed);
+            counters.retries.store(0, std::memory_order_relaxed);
+            counters.giveUps.store(0, std::memory_order_relaxed);
+            counters.waitMicros.store(0, std::memory_order_relaxed);
+        }
+    }
+}
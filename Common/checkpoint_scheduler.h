@@ -0,0 +1,302 @@
+//
+// checkpoint_scheduler.h
+//
+// Moves WAL checkpoints off the committing thread. SQLite's auto-checkpoint
+// runs inside the COMMIT that pushes the WAL past wal_autocheckpoint pages,
+// so whichever writer happens to commit then pays for copying the whole WAL
+// back into the database. The scheduler turns auto-checkpoint off. Its
+// sqlite3_wal_hook only records the WAL size and wakes a background thread,
+// which checkpoints through a connection of its own.
+//
+// The mode is chosen from the WAL size and from whether readers are pinning
+// the log. PASSIVE never blocks anyone and is used by default. Once the WAL
+// is past restartFrames and the last pass could backfill everything, so no
+// reader holds an old snapshot, RESTART (or TRUNCATE, past truncateFrames)
+// rewinds the log so that it stops growing. These wait only briefly for
+// readers and the writer, and otherwise fall back to a passive pass. A pass
+// that backfills nothing is not retried until the log has grown by another
+// passiveFrames or idleInterval has passed, so a reader holding the log does
+// not keep the thread spinning.
+//
+
+#pragma once
+
+#include "sqlite3.h"
+
+#include "test_support.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace sqlite3tests {
+
+    struct CheckpointPolicy {
+        /// <summary>
+        /// WAL size, in frames, that wakes the background thread.
+        /// </summary>
+        int passiveFrames = 1000;
+        int restartFrames = 4000;
+        int truncateFrames = 16000;
+        /// <summary>
+        /// A WAL left unchanged this long is checkpointed even when small.
+        /// </summary>
+        std::chrono::milliseconds idleInterval{ 200 };
+        /// <summary>
+        /// How long RESTART/TRUNCATE may wait for readers to move off the
+        /// log. The writer is blocked meanwhile, so this stays short.
+        /// </summary>
+        int restartBusyMs = 10;
+    };
+
+    struct CheckpointStats {
+        long long passive = 0;
+        long long restart = 0;
+        long long truncate = 0;
+        /// <summary>
+        /// RESTART/TRUNCATE attempts that found readers or the writer in the
+        /// way and fell back to a passive pass.
+        /// </summary>
+        long long busy = 0;
+        long long walFrames = 0;
+        long long maxWalFrames = 0;
+        long long walBytes = 0;
+        double lastMs = 0;
+        double maxMs = 0;
+        double totalMs = 0;
+    };
+
+    /// <summary>
+    /// The checkpoint mode for a WAL of walFrames frames. readersPinning is
+    /// true when the previous pass left frames behind for an open reader.
+    /// </summary>
+    inline int ChooseCheckpointMode(long long walFrames, bool readersPinning, const CheckpointPolicy& policy) {
+        if (readersPinning || walFrames < policy.restartFrames) {
+            return SQLITE_CHECKPOINT_PASSIVE;
+        }
+        return walFrames >= policy.truncateFrames ? SQLITE_CHECKPOINT_TRUNCATE : SQLITE_CHECKPOINT_RESTART;
+    }
+
+    class CheckpointScheduler {
+    public:
+        CheckpointScheduler() = default;
+        CheckpointScheduler(const CheckpointScheduler&) = delete;
+        CheckpointScheduler& operator=(const CheckpointScheduler&) = delete;
+
+        ~CheckpointScheduler() { Detach(); }
+
+        /// <summary>
+        /// Takes over checkpointing for the main database of writer, which
+        /// must be in WAL mode. Any wal_hook on writer is replaced.
+        /// </summary>
+        int Attach(sqlite3* writer, const CheckpointPolicy& policy = CheckpointPolicy()) {
+            if (running_ || writer == 0) {
+                return SQLITE_MISUSE;
+            }
+            const char* path = sqlite3_db_filename(writer, "main");
+            if (path == nullptr || *path == 0) {
+                return SQLITE_MISUSE;
+            }
+            int retcode = sqlite3_open_v2(path, &db_, SQLITE_OPEN_READWRITE, 0);
+            if (retcode != SQLITE_OK) {
+                sqlite3_close(db_);
+                db_ = 0;
+                return retcode;
+            }
+            sqlite3_busy_timeout(db_, policy.restartBusyMs);
+            // A connection only sees the WAL once it has read the database;
+            // before that sqlite3_wal_checkpoint_v2 is a no-op.
+            sqlite3_exec(db_, "select count(*) from sqlite_master", 0, 0, 0);
+            sqlite3_stmt* stmt = 0;
+            pageSize_ = 4096;
+            if (sqlite3_prepare_v2(db_, "pragma page_size", -1, &stmt, 0) == SQLITE_OK &&
+                sqlite3_step(stmt) == SQLITE_ROW) {
+                pageSize_ = sqlite3_column_int(stmt, 0);
+            }
+            sqlite3_finalize(stmt);
+
+            writer_ = writer;
+            policy_ = policy;
+            stats_ = CheckpointStats();
+            durations_.clear();
+            oldestDuration_ = 0;
+            frames_ = 0;
+            stalledFrames_ = -1;
+            backfilled_ = 0;
+            pinning_ = false;
+            running_ = true;
+            sqlite3_wal_autocheckpoint(writer, 0);
+            sqlite3_wal_hook(writer, &CheckpointScheduler::WalHook, this);
+            thread_ = std::thread([this] { Loop(); });
+            return SQLITE_OK;
+        }
+
+        /// <summary>
+        /// Stops the background thread after a final TRUNCATE attempt, gives
+        /// the writer back its default auto-checkpoint and closes the
+        /// checkpoint connection.
+        /// </summary>
+        void Detach() {
+            if (!running_) {
+                return;
+            }
+            sqlite3_wal_hook(writer_, 0, 0);
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                running_ = false;
+            }
+            wake_.notify_one();
+            thread_.join();
+            Checkpoint(SQLITE_CHECKPOINT_TRUNCATE);
+            // SQLite's default auto-checkpoint threshold.
+            sqlite3_wal_autocheckpoint(writer_, 1000);
+            sqlite3_close(db_);
+            db_ = 0;
+            writer_ = 0;
+        }
+
+        CheckpointStats Stats() {
+            std::lock_guard<std::mutex> lock(mutex_);
+            CheckpointStats stats = stats_;
+            stats.walFrames = frames_;
+            stats.walBytes = frames_ > 0 ? 32 + frames_ * (24LL + pageSize_) : 0;
+            return stats;
+        }
+
+        /// <summary>
+        /// The durations of the last kDurationSamples checkpoints in
+        /// milliseconds, oldest first.
+        /// </summary>
+        std::vector<double> Durations() {
+            std::lock_guard<std::mutex> lock(mutex_);
+            std::vector<double> durations(durations_.begin() + oldestDuration_, durations_.end());
+            durations.insert(durations.end(), durations_.begin(), durations_.begin() + oldestDuration_);
+            return durations;
+        }
+
+        static constexpr size_t kDurationSamples = 4096;
+
+    private:
+        // Runs on the committing thread: record and wake, nothing more.
+        static int WalHook(void* arg, sqlite3*, const char* schema, int frames) {
+            CheckpointScheduler* self = static_cast<CheckpointScheduler*>(arg);
+            if (std::string(schema) != "main") {
+                return SQLITE_OK;
+            }
+            bool wake = false;
+            {
+                std::lock_guard<std::mutex> lock(self->mutex_);
+                if (frames < self->frames_) {
+                    // The writer rewound a fully backfilled log by itself.
+                    self->backfilled_ = 0;
+                    self->stalledFrames_ = -1;
+                }
+                self->frames_ = frames;
+                self->stats_.maxWalFrames = std::max(self->stats_.maxWalFrames, static_cast<long long>(frames));
+                self->lastCommit_ = std::chrono::steady_clock::now();
+                wake = self->Due(false);
+            }
+            if (wake) {
+                self->wake_.notify_one();
+            }
+            return SQLITE_OK;
+        }
+
+        bool Due(bool timedOut) const {
+            long long unbackfilled = frames_ - backfilled_;
+            // After a pass that got nothing done, only new frames count.
+            long long fresh = stalledFrames_ >= 0 ? frames_ - stalledFrames_ : unbackfilled;
+            if (fresh >= policy_.passiveFrames) {
+                return true;
+            }
+            return timedOut && unbackfilled > 0 &&
+                   std::chrono::steady_clock::now() - lastCommit_ >= policy_.idleInterval;
+        }
+
+        void Loop() {
+            std::unique_lock<std::mutex> lock(mutex_);
+            while (running_) {
+                bool woken = wake_.wait_for(lock, policy_.idleInterval, [this] {
+                    return !running_ || Due(false);
+                });
+                if (!running_) {
+                    break;
+                }
+                if (!woken && !Due(true)) {
+                    continue;
+                }
+                int mode = ChooseCheckpointMode(frames_, pinning_, policy_);
+                lock.unlock();
+                Checkpoint(mode);
+                lock.lock();
+            }
+        }
+
+        void Checkpoint(int mode) {
+            int logFrames = 0;
+            int backfilled = 0;
+            Stopwatch watch;
+            int retcode = sqlite3_wal_checkpoint_v2(db_, "main", mode, &logFrames, &backfilled);
+            double ms = watch.Seconds() * 1000;
+
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (mode == SQLITE_CHECKPOINT_PASSIVE) {
+                ++stats_.passive;
+            }
+            else if (retcode == SQLITE_BUSY) {
+                // SQLite still ran the passive part before giving up.
+                ++stats_.busy;
+            }
+            else {
+                ++(mode == SQLITE_CHECKPOINT_RESTART ? stats_.restart : stats_.truncate);
+            }
+            stats_.lastMs = ms;
+            stats_.maxMs = std::max(stats_.maxMs, ms);
+            stats_.totalMs += ms;
+            if (durations_.size() < kDurationSamples) {
+                durations_.push_back(ms);
+            }
+            else {
+                durations_[oldestDuration_] = ms;
+                oldestDuration_ = (oldestDuration_ + 1) % kDurationSamples;
+            }
+            if (retcode == SQLITE_OK && mode != SQLITE_CHECKPOINT_PASSIVE) {
+                frames_ = 0;
+                backfilled_ = 0;
+                stalledFrames_ = -1;
+                pinning_ = false;
+            }
+            else if (logFrames >= 0) {
+                // Frames left behind belong to snapshots readers still hold.
+                pinning_ = backfilled < logFrames;
+                stalledFrames_ = pinning_ && backfilled <= backfilled_ ? logFrames : -1;
+                frames_ = logFrames;
+                backfilled_ = backfilled;
+            }
+        }
+
+        sqlite3* writer_ = 0;
+        sqlite3* db_ = 0;
+        int pageSize_ = 4096;
+        CheckpointPolicy policy_;
+        std::thread thread_;
+        std::mutex mutex_;
+        std::condition_variable wake_;
+        bool running_ = false;
+        bool pinning_ = false;
+        long long frames_ = 0;
+        long long backfilled_ = 0;
+        /// <summary>
+        /// WAL size when a pass last backfilled nothing, or -1.
+        /// </summary>
+        long long stalledFrames_ = -1;
+        std::chrono::steady_clock::time_point lastCommit_;
+        CheckpointStats stats_;
+        std::vector<double> durations_;
+        size_t oldestDuration_ = 0;
+    };
+}
@@ -0,0 +1,306 @@
+//
+// connection_pool.h
+//
+// SQLite has no connection pool of its own: every sqlite3_open re-reads the
+// header and the schema before the first statement can run. This pool keeps
+// a bounded set of warm connections and lends them out one thread at a time,
+// which is what multi-thread mode (SQLITE_THREADSAFE=2) requires.
+//
+
+#pragma once
+
+#include "sqlite3.h"
+
+#include "mmap_tuning.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace sqlite3tests {
+
+    struct ConnectionPoolOptions {
+        std::string path;
+        int capacity = 8;
+        int openFlags = SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE;
+        /// <summary>
+        /// Passed to sqlite3_busy_timeout; pooled writers on one file still
+        /// contend for the database lock.
+        /// </summary>
+        int busyTimeoutMs = 5000;
+        /// <summary>
+        /// Executed once on every connection when the pool is opened.
+        /// </summary>
+        std::vector<std::string> warmupSql;
+        /// <summary>
+        /// Reads through a memory mapping sized by an MmapTuner, re-tuned on
+        /// checkout when the file has grown.
+        /// </summary>
+        bool mmap = false;
+        MmapTuning mmapTuning;
+    };
+
+    struct ConnectionPoolStats {
+        long long checkouts = 0;
+        long long waits = 0;
+        long long timeouts = 0;
+        long long statementHits = 0;
+        long long statementMisses = 0;
+    };
+
+    class ConnectionPool;
+
+    namespace detail {
+        struct PoolSlot {
+            sqlite3* db = 0;
+            std::unordered_map<std::string, sqlite3_stmt*> statements;
+            std::unique_ptr<MmapTuner> mmap;
+        };
+    }
+
+    /// <summary>
+    /// A connection checked out of a ConnectionPool. Move-only; the connection
+    /// goes back to the pool when the lease is destroyed or released.
+    /// </summary>
+    class PooledConnection {
+    public:
+        PooledConnection() = default;
+        PooledConnection(const PooledConnection&) = delete;
+        PooledConnection& operator=(const PooledConnection&) = delete;
+
+        PooledConnection(PooledConnection&& other) noexcept
+            : pool_(other.pool_), slot_(other.slot_) {
+            other.pool_ = nullptr;
+            other.slot_ = nullptr;
+        }
+
+        PooledConnection& operator=(PooledConnection&& other) noexcept {
+            if (this != &other) {
+                Release();
+                pool_ = other.pool_;
+                slot_ = other.slot_;
+                other.pool_ = nullptr;
+                other.slot_ = nullptr;
+            }
+            return *this;
+        }
+
+        ~PooledConnection() { Release(); }
+
+        explicit operator bool() const { return slot_ != nullptr; }
+
+        sqlite3* Handle() const { return slot_ ? slot_->db : 0; }
+
+        /// <summary>
+        /// Returns a statement for sql that stays compiled on this connection
+        /// across checkouts. The statement is reset with its bindings cleared
+        /// and must not be finalized by the caller.
+        /// </summary>
+        int Prepare(const char* sql, sqlite3_stmt** stmt);
+
+        void Release();
+
+    private:
+        friend class ConnectionPool;
+
+        PooledConnection(ConnectionPool* pool, detail::PoolSlot* slot)
+            : pool_(pool), slot_(slot) {}
+
+        ConnectionPool* pool_ = nullptr;
+        detail::PoolSlot* slot_ = nullptr;
+    };
+
+    class ConnectionPool {
+    public:
+        ConnectionPool() = default;
+        ConnectionPool(const ConnectionPool&) = delete;
+        ConnectionPool& operator=(const ConnectionPool&) = delete;
+
+        ~ConnectionPool() { Close(); }
+
+        /// <summary>
+        /// Opens options.capacity connections up front and warms each one by
+        /// loading the schema and running options.warmupSql. Nothing is left
+        /// open if any connection fails.
+        /// </summary>
+        int Open(const ConnectionPoolOptions& options) {
+            if (options.capacity <= 0 || !slots_.empty()) {
+                return SQLITE_MISUSE;
+            }
+            for (int i = 0; i < options.capacity; ++i) {
+                std::unique_ptr<detail::PoolSlot> slot(new detail::PoolSlot());
+                int retcode = sqlite3_open_v2(options.path.c_str(), &slot->db, options.openFlags, 0);
+                if (retcode == SQLITE_OK) {
+                    sqlite3_busy_timeout(slot->db, options.busyTimeoutMs);
+                    // Forces the schema to be parsed now rather than on first use.
+                    retcode = sqlite3_exec(slot->db, "select count(*) from sqlite_master", 0, 0, 0);
+                }
+                for (size_t j = 0; retcode == SQLITE_OK && j < options.warmupSql.size(); ++j) {
+                    retcode = sqlite3_exec(slot->db, options.warmupSql[j].c_str(), 0, 0, 0);
+                }
+                if (retcode == SQLITE_OK && options.mmap) {
+                    slot->mmap.reset(new MmapTuner());
+                    retcode = slot->mmap->Attach(slot->db, options.mmapTuning);
+                }
+                if (retcode != SQLITE_OK) {
+                    slot->mmap.reset();
+                    sqlite3_close(slot->db);
+                    CloseSlots();
+                    return retcode;
+                }
+                slots_.push_back(std::move(slot));
+            }
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (auto& slot : slots_) {
+                idle_.push_back(slot.get());
+            }
+            open_ = true;
+            return SQLITE_OK;
+        }
+
+        /// <summary>
+        /// Waits up to timeout for an idle connection. Returns SQLITE_BUSY on
+        /// timeout and SQLITE_MISUSE when the pool is not open.
+        /// </summary>
+        int Checkout(PooledConnection* out,
+                     std::chrono::milliseconds timeout = std::chrono::milliseconds::max()) {
+            std::unique_lock<std::mutex> lock(mutex_);
+            if (!open_) {
+                return SQLITE_MISUSE;
+            }
+            if (idle_.empty()) {
+                ++stats_.waits;
+                auto ready = [this] { return !idle_.empty() || !open_; };
+                if (timeout == std::chrono::milliseconds::max()) {
+                    available_.wait(lock, ready);
+                }
+                else if (!available_.wait_for(lock, timeout, ready)) {
+                    ++stats_.timeouts;
+                    return SQLITE_BUSY;
+                }
+                if (!open_) {
+                    return SQLITE_MISUSE;
+                }
+            }
+            // LIFO so the most recently used connection, with the warmest
+            // page cache, is handed out first.
+            detail::PoolSlot* slot = idle_.back();
+            idle_.pop_back();
+            ++stats_.checkouts;
+            lock.unlock();
+            if (slot->mmap) {
+                int retcode = slot->mmap->Refresh();
+                if (retcode != SQLITE_OK) {
+                    Checkin(slot);
+                    return retcode;
+                }
+            }
+            *out = PooledConnection(this, slot);
+            return SQLITE_OK;
+        }
+
+        /// <summary>
+        /// Waits for every outstanding connection to be returned, then
+        /// finalizes the retained statements and closes all connections.
+        /// </summary>
+        void Close() {
+            std::unique_lock<std::mutex> lock(mutex_);
+            if (!open_) {
+                return;
+            }
+            returned_.wait(lock, [this] { return idle_.size() == slots_.size(); });
+            open_ = false;
+            idle_.clear();
+            available_.notify_all();
+            lock.unlock();
+            CloseSlots();
+        }
+
+        int Capacity() const { return static_cast<int>(slots_.size()); }
+
+        int Idle() {
+            std::lock_guard<std::mutex> lock(mutex_);
+            return static_cast<int>(idle_.size());
+        }
+
+        ConnectionPoolStats Stats() {
+            std::lock_guard<std::mutex> lock(mutex_);
+            return stats_;
+        }
+
+    private:
+        friend class PooledConnection;
+
+        void Checkin(detail::PoolSlot* slot) {
+            for (auto& entry : slot->statements) {
+                sqlite3_reset(entry.second);
+            }
+            // A lease must not hand its open transaction to the next borrower.
+            if (!sqlite3_get_autocommit(slot->db)) {
+                sqlite3_exec(slot->db, "rollback", 0, 0, 0);
+            }
+            std::lock_guard<std::mutex> lock(mutex_);
+            idle_.push_back(slot);
+            available_.notify_one();
+            returned_.notify_all();
+        }
+
+        void CountStatement(bool hit) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            ++(hit ? stats_.statementHits : stats_.statementMisses);
+        }
+
+        void CloseSlots() {
+            for (auto& slot : slots_) {
+                for (auto& entry : slot->statements) {
+                    sqlite3_finalize(entry.second);
+                }
+                slot->mmap.reset();
+                sqlite3_close(slot->db);
+            }
+            slots_.clear();
+        }
+
+        std::mutex mutex_;
+        std::condition_variable available_;
+        std::condition_variable returned_;
+        std::vector<std::unique_ptr<detail::PoolSlot>> slots_;
+        std::vector<detail::PoolSlot*> idle_;
+        ConnectionPoolStats stats_;
+        bool open_ = false;
+    };
+
+    inline int PooledConnection::Prepare(const char* sql, sqlite3_stmt** stmt) {
+        *stmt = 0;
+        if (slot_ == nullptr) {
+            return SQLITE_MISUSE;
+        }
+        auto found = slot_->statements.find(sql);
+        if (found != slot_->statements.end()) {
+            sqlite3_reset(found->second);
+            sqlite3_clear_bindings(found->second);
+            *stmt = found->second;
+            pool_->CountStatement(true);
+            return SQLITE_OK;
+        }
+        int retcode = sqlite3_prepare_v2(slot_->db, sql, -1, stmt, 0);
+        if (retcode != SQLITE_OK) {
+            return retcode;
+        }
+        slot_->statements.emplace(sql, *stmt);
+        pool_->CountStatement(false);
+        return SQLITE_OK;
+    }
+
+    inline void PooledConnection::Release() {
+        if (slot_ != nullptr) {
+            pool_->Checkin(slot_);
+            pool_ = nullptr;
+            slot_ = nullptr;
+        }
+    }
+}
@@ -0,0 +1,359 @@
+//
+// hash_join.h
+//
+// "select * from Students S, Courses C where S.sid = C.sid" with Courses in
+// an attached file can only use the indexes that either file already has.
+// Without one on the join key, the planner falls back to a nested loop, or
+// to an automatic index that it rebuilds for every statement.
+//
+// The hash_index virtual table module copies one side of the join into
+// memory once and hashes it on the join key. A join against the virtual
+// table then costs one hash probe per row of the other side. It is a
+// snapshot: later changes to the source are not seen, so build it for a
+// batch of joins and drop it afterwards. HashJoinIndex does both, and can
+// pick the smaller side of the join.
+//
+// Keys match by value: integers equal integral reals, and text and blobs
+// compare bytewise. No affinity conversions are applied, and NULL keys
+// never match.
+//
+
+#pragma once
+
+#include "sqlite3.h"
+
+#include "scan_value.h"
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace sqlite3tests {
+
+    namespace detail {
+        // Encodes a join key so equal values give equal strings; false for NULL.
+        inline bool HashKey(int type, int64_t integer, double real, const void* bytes, int size, std::string* key) {
+            switch (type) {
+            case SQLITE_FLOAT:
+                if (!(real >= -9223372036854775808.0 && real < 9223372036854775808.0 &&
+                      static_cast<double>(static_cast<int64_t>(real)) == real)) {
+                    key->assign(1, 'r');
+                    key->append(reinterpret_cast<const char*>(&real), sizeof(real));
+                    return true;
+                }
+                // Integral reals share the integer encoding.
+                integer = static_cast<int64_t>(real);
+                [[fallthrough]];
+            case SQLITE_INTEGER:
+                key->assign(1, 'i');
+                key->append(reinterpret_cast<const char*>(&integer), sizeof(integer));
+                return true;
+            case SQLITE_TEXT:
+            case SQLITE_BLOB:
+                key->assign(1, type == SQLITE_TEXT ? 't' : 'b');
+                key->append(static_cast<const char*>(bytes), size);
+                return true;
+            default:
+                return false;
+            }
+        }
+
+        struct HashIndexTable : sqlite3_vtab {
+            std::vector<ScanRow> rows;
+            std::unordered_multimap<std::string, size_t> index;
+            int keyColumn = 0;
+            size_t distinctKeys = 0;
+        };
+
+        struct HashIndexCursor : sqlite3_vtab_cursor {
+            using Match = std::unordered_multimap<std::string, size_t>::const_iterator;
+
+            bool lookup = false;
+            Match match;
+            Match end;
+            size_t position = 0;
+
+            const HashIndexTable* Table() const { return static_cast<const HashIndexTable*>(pVtab); }
+
+            size_t Row() const { return lookup ? match->second : position; }
+
+            bool Eof() const { return lookup ? match == end : position >= Table()->rows.size(); }
+        };
+
+        // Arguments: the source table, possibly schema-qualified, and the
+        // key column: "using hash_index(DB1.Courses, SID)".
+        inline int HashIndexConnect(sqlite3* db, void*, int argc, const char* const* argv, sqlite3_vtab** vtab,
+                                    char** error) {
+            if (argc != 5) {
+                *error = sqlite3_mprintf("hash_index: expected (source table, key column)");
+                return SQLITE_ERROR;
+            }
+            std::string sql = std::string("select * from ") + argv[3];
+            sqlite3_stmt* stmt = 0;
+            int retcode = sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, 0);
+            if (retcode != SQLITE_OK) {
+                *error = sqlite3_mprintf("hash_index: %s", sqlite3_errmsg(db));
+                return retcode;
+            }
+            int columns = sqlite3_column_count(stmt);
+            int keyColumn = -1;
+            std::string schema = "create table x(";
+            for (int c = 0; c < columns; ++c) {
+                if (sqlite3_stricmp(sqlite3_column_name(stmt, c), argv[4]) == 0) {
+                    keyColumn = c;
+                }
+                const char* type = sqlite3_column_decltype(stmt, c);
+                char* column = sqlite3_mprintf("%s\"%w\" %s", c == 0 ? "" : ", ", sqlite3_column_name(stmt, c),
+                    type != nullptr ? type : "");
+                schema += column;
+                sqlite3_free(column);
+            }
+            schema += ")";
+            if (keyColumn < 0) {
+                sqlite3_finalize(stmt);
+                *error = sqlite3_mprintf("hash_index: no column %s in %s", argv[4], argv[3]);
+                return SQLITE_ERROR;
+            }
+            retcode = sqlite3_declare_vtab(db, schema.c_str());
+            if (retcode != SQLITE_OK) {
+                sqlite3_finalize(stmt);
+                return retcode;
+            }
+
+            HashIndexTable* table = new HashIndexTable();
+            table->keyColumn = keyColumn;
+            std::string key;
+            while ((retcode = sqlite3_step(stmt)) == SQLITE_ROW) {
+                ScanRow& row = table->rows.emplace_back();
+                row.reserve(columns);
+                for (int c = 0; c < columns; ++c) {
+                    row.push_back(ReadScanValue(stmt, c));
+                }
+                const ScanValue& value = row[keyColumn];
+                if (HashKey(value.type, value.integer, value.real, value.bytes.data(),
+                        static_cast<int>(value.bytes.size()), &key)) {
+                    table->distinctKeys += table->index.count(key) == 0;
+                    table->index.emplace(key, table->rows.size() - 1);
+                }
+            }
+            sqlite3_finalize(stmt);
+            if (retcode != SQLITE_DONE) {
+                delete table;
+                *error = sqlite3_mprintf("hash_index: %s", sqlite3_errmsg(db));
+                return retcode;
+            }
+            *vtab = table;
+            return SQLITE_OK;
+        }
+
+        inline int HashIndexDisconnect(sqlite3_vtab* vtab) {
+            delete static_cast<HashIndexTable*>(vtab);
+            return SQLITE_OK;
+        }
+
+        inline int HashIndexBestIndex(sqlite3_vtab* vtab, sqlite3_index_info* info) {
+            const HashIndexTable* table = static_cast<const HashIndexTable*>(vtab);
+            double rows = static_cast<double>(table->rows.size());
+            for (int i = 0; i < info->nConstraint; ++i) {
+                const auto& constraint = info->aConstraint[i];
+                if (constraint.usable && constraint.iColumn == table->keyColumn &&
+                    constraint.op == SQLITE_INDEX_CONSTRAINT_EQ) {
+                    info->aConstraintUsage[i].argvIndex = 1;
+                    info->aConstraintUsage[i].omit = 1;
+                    info->idxNum = 1;
+                    double perKey = table->distinctKeys > 0 ? rows / table->distinctKeys : 1;
+                    info->estimatedCost = 1 + perKey;
+                    info->estimatedRows = static_cast<sqlite3_int64>(perKey) + 1;
+                    return SQLITE_OK;
+                }
+            }
+            info->idxNum = 0;
+            info->estimatedCost = rows + 1;
+            info->estimatedRows = static_cast<sqlite3_int64>(rows);
+            return SQLITE_OK;
+        }
+
+        inline int HashIndexOpen(sqlite3_vtab*, sqlite3_vtab_cursor** cursor) {
+            *cursor = new HashIndexCursor();
+            return SQLITE_OK;
+        }
+
+        inline int HashIndexClose(sqlite3_vtab_cursor* cursor) {
+            delete static_cast<HashIndexCursor*>(cursor);
+            return SQLITE_OK;
+        }
+
+        inline int HashIndexFilter(sqlite3_vtab_cursor* base, int idxNum, const char*, int, sqlite3_value** argv) {
+            HashIndexCursor* cursor = static_cast<HashIndexCursor*>(base);
+            const HashIndexTable* table = cursor->Table();
+            cursor->lookup = idxNum == 1;
+            cursor->position = 0;
+            if (cursor->lookup) {
+                sqlite3_value* value = argv[0];
+                int type = sqlite3_value_type(value);
+                std::string key;
+                bool found = HashKey(type, sqlite3_value_int64(value), sqlite3_value_double(value),
+                    type == SQLITE_TEXT || type == SQLITE_BLOB ? sqlite3_value_blob(value) : nullptr,
+                    sqlite3_value_bytes(value), &key);
+                auto range = found ? table->index.equal_range(key) : std::make_pair(table->index.end(), table->index.end());
+                cursor->match = range.first;
+                cursor->end = range.second;
+            }
+            return SQLITE_OK;
+        }
+
+        inline int HashIndexNext(sqlite3_vtab_cursor* base) {
+            HashIndexCursor* cursor = static_cast<HashIndexCursor*>(base);
+            if (cursor->lookup) {
+                ++cursor->match;
+            }
+            else {
+                ++cursor->position;
+            }
+            return SQLITE_OK;
+        }
+
+        inline int HashIndexEof(sqlite3_vtab_cursor* base) {
+            return static_cast<HashIndexCursor*>(base)->Eof();
+        }
+
+        inline int HashIndexColumn(sqlite3_vtab_cursor* base, sqlite3_context* context, int column) {
+            const HashIndexCursor* cursor = static_cast<HashIndexCursor*>(base);
+            const ScanValue& value = cursor->Table()->rows[cursor->Row()][column];
+            switch (value.type) {
+            case SQLITE_INTEGER:
+                sqlite3_result_int64(context, value.integer);
+                break;
+            case SQLITE_FLOAT:
+                sqlite3_result_double(context, value.real);
+                break;
+            case SQLITE_TEXT:
+                // The rows live as long as the table, which outlives any statement reading it.
+                sqlite3_result_text(context, value.bytes.data(), static_cast<int>(value.bytes.size()), SQLITE_STATIC);
+                break;
+            case SQLITE_BLOB:
+                sqlite3_result_blob(context, value.bytes.data(), static_cast<int>(value.bytes.size()), SQLITE_STATIC);
+                break;
+            default:
+                sqlite3_result_null(context);
+                break;
+            }
+            return SQLITE_OK;
+        }
+
+        inline int HashIndexRowid(sqlite3_vtab_cursor* base, sqlite3_int64* rowid) {
+            *rowid = static_cast<sqlite3_int64>(static_cast<HashIndexCursor*>(base)->Row()) + 1;
+            return SQLITE_OK;
+        }
+
+        inline sqlite3_module MakeHashIndexModule() {
+            sqlite3_module module = {};
+            module.xCreate = HashIndexConnect;
+            module.xConnect = HashIndexConnect;
+            module.xBestIndex = HashIndexBestIndex;
+            module.xDisconnect = HashIndexDisconnect;
+            module.xDestroy = HashIndexDisconnect;
+            module.xOpen = HashIndexOpen;
+            module.xClose = HashIndexClose;
+            module.xFilter = HashIndexFilter;
+            module.xNext = HashIndexNext;
+            module.xEof = HashIndexEof;
+            module.xColumn = HashIndexColumn;
+            module.xRowid = HashIndexRowid;
+            return module;
+        }
+
+        inline const sqlite3_module& HashIndexModule() {
+            static const sqlite3_module module = MakeHashIndexModule();
+            return module;
+        }
+    }
+
+    /// <summary>
+    /// Makes the hash_index module available on db. Call once per connection.
+    /// </summary>
+    inline int RegisterHashIndexModule(sqlite3* db) {
+        return sqlite3_create_module(db, "hash_index", &detail::HashIndexModule(), 0);
+    }
+
+    /// <summary>
+    /// One side of an equi-join: a table, possibly schema-qualified, and
+    /// its join key column.
+    /// </summary>
+    struct JoinSide {
+        std::string table;
+        std::string key;
+    };
+
+    /// <summary>
+    /// A temp hash_index table that lives as long as this object, or until
+    /// Drop. The connection must have the module registered.
+    /// </summary>
+    class HashJoinIndex {
+    public:
+        HashJoinIndex() = default;
+        HashJoinIndex(const HashJoinIndex&) = delete;
+        HashJoinIndex& operator=(const HashJoinIndex&) = delete;
+
+        ~HashJoinIndex() { Drop(); }
+
+        /// <summary>
+        /// Copies side.table into memory as temp.name, hashed on side.key.
+        /// </summary>
+        int Create(sqlite3* db, const std::string& name, const JoinSide& side) {
+            Drop();
+            char* sql = sqlite3_mprintf("create virtual table temp.\"%w\" using hash_index(%s, %s)", name.c_str(),
+                side.table.c_str(), side.key.c_str());
+            int retcode = sqlite3_exec(db, sql, 0, 0, 0);
+            sqlite3_free(sql);
+            if (retcode == SQLITE_OK) {
+                db_ = db;
+                name_ = name;
+            }
+            return retcode;
+        }
+
+        /// <summary>
+        /// Indexes whichever side has fewer rows and sets *indexed to 0 for
+        /// left or 1 for right. The join then reads name in place of that side.
+        /// </summary>
+        int CreateOverSmaller(sqlite3* db, const std::string& name, const JoinSide& left, const JoinSide& right,
+                              int* indexed) {
+            long long rows[2] = { -1, -1 };
+            const JoinSide* sides[2] = { &left, &right };
+            for (int i = 0; i < 2; ++i) {
+                std::string sql = "select count(*) from " + sides[i]->table;
+                sqlite3_stmt* stmt = 0;
+                int retcode = sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, 0);
+                if (retcode == SQLITE_OK && sqlite3_step(stmt) == SQLITE_ROW) {
+                    rows[i] = sqlite3_column_int64(stmt, 0);
+                }
+                sqlite3_finalize(stmt);
+                if (rows[i] < 0) {
+                    return retcode != SQLITE_OK ? retcode : sqlite3_errcode(db);
+                }
+            }
+            *indexed = rows[1] < rows[0] ? 1 : 0;
+            return Create(db, name, *sides[*indexed]);
+        }
+
+        void Drop() {
+            if (db_ != 0) {
+                char* sql = sqlite3_mprintf("drop table temp.\"%w\"", name_.c_str());
+                sqlite3_exec(db_, sql, 0, 0, 0);
+                sqlite3_free(sql);
+                db_ = 0;
+                name_.clear();
+            }
+        }
+
+        const std::string& Name() const { return name_; }
+
+    private:
+        sqlite3* db_ = 0;
+        std::string name_;
+    };
+}
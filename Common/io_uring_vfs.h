@@ -0,0 +1,933 @@
+//
+// io_uring_vfs.h
+//
+// A shim sqlite3_vfs, registered as "io_uring", that sends the page I/O of
+// database, rollback journal and WAL files through io_uring. Writes are not
+// issued one syscall each: a file queues them until the next sync, and then
+// the writes and the fsync go to the kernel in one submission. The fsync is
+// IOSQE_IO_DRAIN, so it runs only after every write ahead of it. A commit
+// therefore costs one io_uring_enter per xSync rather than a pwrite per page.
+// io_uring does not order the writes of one submission among themselves, so
+// queued writes never overlap: rewriting a queued range replaces it, and a
+// write that partly overlaps one flushes the queue first.
+//
+// Opening, locking, shared memory and file deletion stay with the default
+// VFS, which the shim wraps. Queued writes are flushed before anything can
+// observe the file from outside: on xUnlock, on shared-memory locks and
+// barriers, and on reads of a queued range. A WAL's queued frames are
+// therefore on disk before the wal-index publishes them. The write of a
+// commit frame flushes at once, so that a failed write fails the commit;
+// xShmBarrier cannot return an error, and a flush failing there is returned
+// by the next call on the file that can.
+//
+// The shim needs the descriptor the unix VFS opened. It reads it from the
+// head of unixFile and checks it with fstat. It falls back to passing every
+// call straight through in several cases: on other platforms, when
+// io_uring_setup fails (old kernel, seccomp, io_uring_disabled), or when the
+// descriptor check fails. Memory-mapped reads are turned off on shimmed files
+// because the mapping would not see queued writes.
+//
+
+#pragma once
+
+#include "sqlite3.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+namespace sqlite3tests {
+
+    const char* const kIoUringVfsName = "io_uring";
+
+    struct IoUringVfsOptions {
+        bool makeDefault = false;
+        /// <summary>
+        /// Submission queue depth of each thread's ring; also the most writes
+        /// that go to the kernel in one io_uring_enter.
+        /// </summary>
+        unsigned ringEntries = 64;
+        /// <summary>
+        /// Registers the shim with io_uring switched off, as on a kernel
+        /// without it.
+        /// </summary>
+        bool disableRing = false;
+    };
+
+    struct IoUringVfsStats {
+        long long submissions = 0;
+        long long reads = 0;
+        long long writes = 0;
+        long long syncs = 0;
+        long long passthroughFiles = 0;
+    };
+
+    namespace detail {
+
+        struct UringCounters {
+            std::atomic<long long> submissions{ 0 };
+            std::atomic<long long> reads{ 0 };
+            std::atomic<long long> writes{ 0 };
+            std::atomic<long long> syncs{ 0 };
+            std::atomic<long long> passthroughFiles{ 0 };
+        };
+
+        struct UringGlobals {
+            sqlite3_vfs vfs = {};
+            sqlite3_vfs* base = nullptr;
+            IoUringVfsOptions options;
+            std::atomic<bool> available{ false };
+            UringCounters counters;
+        };
+
+        inline UringGlobals& Uring() {
+            static UringGlobals globals;
+            return globals;
+        }
+
+#ifdef __linux__
+        /// <summary>
+        /// A minimal io_uring over the raw syscalls: fill up to Capacity()
+        /// entries, then submit them and wait for all of their completions.
+        /// Used by one thread only.
+        /// </summary>
+        class Ring {
+        public:
+            Ring() = default;
+            Ring(const Ring&) = delete;
+            Ring& operator=(const Ring&) = delete;
+
+            ~Ring() {
+                if (sqes_ != nullptr) {
+                    munmap(sqes_, sqesBytes_);
+                }
+                if (cq_ != nullptr && cq_ != sq_) {
+                    munmap(cq_, cqBytes_);
+                }
+                if (sq_ != nullptr) {
+                    munmap(sq_, sqBytes_);
+                }
+                if (fd_ >= 0) {
+                    close(fd_);
+                }
+            }
+
+            bool Init(unsigned entries) {
+                io_uring_params params;
+                std::memset(&params, 0, sizeof(params));
+                fd_ = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+                if (fd_ < 0) {
+                    return false;
+                }
+                sqBytes_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+                cqBytes_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+                bool single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+                if (single) {
+                    sqBytes_ = cqBytes_ = std::max(sqBytes_, cqBytes_);
+                }
+                sq_ = Map(sqBytes_, IORING_OFF_SQ_RING);
+                cq_ = single ? sq_ : Map(cqBytes_, IORING_OFF_CQ_RING);
+                sqesBytes_ = params.sq_entries * sizeof(io_uring_sqe);
+                sqes_ = static_cast<io_uring_sqe*>(Map(sqesBytes_, IORING_OFF_SQES));
+                if (sq_ == nullptr || cq_ == nullptr || sqes_ == nullptr) {
+                    return false;
+                }
+                char* sq = static_cast<char*>(sq_);
+                char* cq = static_cast<char*>(cq_);
+                sqTail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+                sqMask_ = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+                sqArray_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+                cqHead_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+                cqTail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+                cqMask_ = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+                cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+                capacity_ = params.sq_entries;
+                return true;
+            }
+
+            unsigned Capacity() const { return capacity_; }
+
+            /// <summary>
+            /// A zeroed entry whose user_data is its index in this batch, or
+            /// nullptr once Capacity() entries are queued.
+            /// </summary>
+            io_uring_sqe* Next() {
+                if (queued_ == capacity_) {
+                    return nullptr;
+                }
+                unsigned index = (*sqTail_ + queued_) & sqMask_;
+                io_uring_sqe* sqe = &sqes_[index];
+                std::memset(sqe, 0, sizeof(*sqe));
+                sqe->user_data = queued_;
+                sqArray_[index] = index;
+                ++queued_;
+                return sqe;
+            }
+
+            /// <summary>
+            /// Submits the queued entries and waits for all of them. results
+            /// receives each entry's res, in queue order. Returns -errno if the
+            /// ring itself fails; it is then Failed() and must not be used
+            /// again, but every entry the kernel took has completed, unless
+            /// the ring is also Abandoned().
+            /// </summary>
+            int SubmitAndWait(std::vector<int>* results) {
+                unsigned count = queued_;
+                queued_ = 0;
+                results->assign(count, 0);
+                if (failed_) {
+                    return -EBADF;
+                }
+                if (count == 0) {
+                    return 0;
+                }
+                __atomic_store_n(sqTail_, *sqTail_ + count, __ATOMIC_RELEASE);
+                Uring().counters.submissions.fetch_add(1, std::memory_order_relaxed);
+
+                unsigned toSubmit = count;
+                unsigned reaped = 0;
+                int error = 0;
+                // Once the ring fails, entries not yet submitted stay in the
+                // submission queue, which is never entered again, and only
+                // those the kernel took are waited for.
+                while (reaped < count - (failed_ ? toSubmit : 0)) {
+                    unsigned inFlight = count - toSubmit - reaped;
+                    int entered = static_cast<int>(syscall(__NR_io_uring_enter, fd_, failed_ ? 0 : toSubmit,
+                        failed_ ? inFlight : count - reaped, IORING_ENTER_GETEVENTS, nullptr, 0));
+                    if (entered < 0) {
+                        int err = errno;
+                        bool retry = err == EINTR || ((err == EAGAIN || err == EBUSY) && inFlight > 0);
+                        if (!retry) {
+                            if (failed_) {
+                                // Cannot even wait: the kernel may still use
+                                // the ring, so it is never unmapped.
+                                abandoned_ = true;
+                                return error;
+                            }
+                            failed_ = true;
+                            error = -err;
+                        }
+                    }
+                    else if (!failed_) {
+                        toSubmit -= std::min(toSubmit, static_cast<unsigned>(entered));
+                    }
+                    unsigned head = *cqHead_;
+                    unsigned tail = __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE);
+                    for (; head != tail; ++head, ++reaped) {
+                        io_uring_cqe* cqe = &cqes_[head & cqMask_];
+                        if (cqe->user_data < count) {
+                            (*results)[static_cast<size_t>(cqe->user_data)] = cqe->res;
+                        }
+                    }
+                    __atomic_store_n(cqHead_, head, __ATOMIC_RELEASE);
+                }
+                return error;
+            }
+
+            bool Failed() const { return failed_; }
+
+            bool Abandoned() const { return abandoned_; }
+
+        private:
+            void* Map(size_t bytes, long long offset) {
+                void* mapped = mmap(0, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, offset);
+                return mapped == MAP_FAILED ? nullptr : mapped;
+            }
+
+            int fd_ = -1;
+            void* sq_ = nullptr;
+            void* cq_ = nullptr;
+            io_uring_sqe* sqes_ = nullptr;
+            size_t sqBytes_ = 0;
+            size_t cqBytes_ = 0;
+            size_t sqesBytes_ = 0;
+            unsigned* sqTail_ = nullptr;
+            unsigned sqMask_ = 0;
+            unsigned* sqArray_ = nullptr;
+            unsigned* cqHead_ = nullptr;
+            unsigned* cqTail_ = nullptr;
+            unsigned cqMask_ = 0;
+            io_uring_cqe* cqes_ = nullptr;
+            unsigned capacity_ = 0;
+            unsigned queued_ = 0;
+            bool failed_ = false;
+            bool abandoned_ = false;
+        };
+
+        /// <summary>
+        /// This thread's ring, or nullptr if it could not be set up or has
+        /// failed since; callers then fall back to pread and pwrite. A
+        /// connection is used by one thread at a time and every submission
+        /// completes before the VFS call returns, so rings are never shared.
+        /// </summary>
+        inline Ring* ThreadRing() {
+            static thread_local std::unique_ptr<Ring> ring;
+            static thread_local bool failed = false;
+            if (ring && ring->Failed()) {
+                if (ring->Abandoned()) {
+                    ring.release();
+                }
+                ring.reset();
+                failed = true;
+            }
+            if (!ring && !failed) {
+                ring.reset(new Ring());
+                if (!ring->Init(Uring().options.ringEntries)) {
+                    ring.reset();
+                    failed = true;
+                }
+            }
+            return ring.get();
+        }
+
+        /// <summary>
+        /// The leading members of the unix VFS's unixFile, which have kept
+        /// this layout since 3.7.
+        /// </summary>
+        struct UnixFileHead {
+            const sqlite3_io_methods* pMethod;
+            sqlite3_vfs* pVfs;
+            void* pInode;
+            int h;
+        };
+
+        inline int UnixDescriptor(sqlite3_file* real, const char* path) {
+            if (path == nullptr || std::strncmp(Uring().base->zName, "unix", 4) != 0) {
+                return -1;
+            }
+            int fd = reinterpret_cast<UnixFileHead*>(real)->h;
+            struct stat opened;
+            struct stat named;
+            if (fd < 0 || fstat(fd, &opened) != 0 || stat(path, &named) != 0 ||
+                opened.st_dev != named.st_dev || opened.st_ino != named.st_ino) {
+                return -1;
+            }
+            return fd;
+        }
+#endif
+
+        struct QueuedWrite {
+            sqlite3_int64 offset;
+            std::vector<char> data;
+        };
+
+        struct UringFile {
+            sqlite3_file base;
+            sqlite3_file* real;
+            int fd;
+            bool dirSync;
+            std::string path;
+            std::vector<QueuedWrite> queued;
+            // A WAL and its database are linked so that the database's
+            // shared-memory calls can flush the WAL's queued frames.
+            UringFile* wal;
+            UringFile* database;
+            bool walFile;
+            // Set once a commit frame's header is queued: the write of its
+            // page flushes.
+            bool commitFrame;
+            // A flush error xShmBarrier could not report.
+            int deferred;
+        };
+
+        inline UringFile* AsUring(sqlite3_file* file) {
+            return reinterpret_cast<UringFile*>(file);
+        }
+
+        inline int TakeDeferred(UringFile* file) {
+            int retcode = file->deferred;
+            file->deferred = SQLITE_OK;
+            return retcode;
+        }
+
+        // A WAL frame header: page number, then the database size in pages
+        // after commit, which is zero unless the frame commits.
+        const int kWalFrameHeaderBytes = 24;
+        const int kWalHeaderBytes = 32;
+
+        inline bool IsCommitFrameHeader(const unsigned char* header) {
+            return (header[4] | header[5] | header[6] | header[7]) != 0;
+        }
+
+        inline int SyncFallback(UringFile* file, int flags) {
+            return file->real->pMethods->xSync(file->real, flags);
+        }
+
+#ifdef __linux__
+        // Writes queued[first..] in order with pwrite, then syncs if asked,
+        // and empties the queue.
+        inline int PwriteQueued(UringFile* file, size_t first, bool sync, int syncFlags) {
+            int retcode = SQLITE_OK;
+            for (size_t i = first; i < file->queued.size() && retcode == SQLITE_OK; ++i) {
+                QueuedWrite& write = file->queued[i];
+                size_t done = 0;
+                while (done < write.data.size()) {
+                    ssize_t n = pwrite(file->fd, write.data.data() + done, write.data.size() - done,
+                        static_cast<off_t>(write.offset + done));
+                    if (n <= 0) {
+                        retcode = SQLITE_IOERR_WRITE;
+                        break;
+                    }
+                    done += static_cast<size_t>(n);
+                }
+            }
+            file->queued.clear();
+            return retcode == SQLITE_OK && sync ? SyncFallback(file, syncFlags) : retcode;
+        }
+#endif
+
+        /// <summary>
+        /// Writes out every queued write, then, if sync is set, makes the file
+        /// durable. All of it goes to the kernel in as few submissions as the
+        /// ring depth allows.
+        /// </summary>
+        inline int Flush(UringFile* file, bool sync, int syncFlags) {
+            if (file->fd < 0) {
+                return sync ? SyncFallback(file, syncFlags) : SQLITE_OK;
+            }
+#ifdef __linux__
+            Ring* ring = ThreadRing();
+            if (ring == nullptr) {
+                return PwriteQueued(file, 0, sync, syncFlags);
+            }
+
+            int dirFd = -1;
+            if (sync && file->dirSync) {
+                std::string dir = file->path.substr(0, file->path.find_last_of('/') + 1);
+                dirFd = open(dir.empty() ? "." : dir.c_str(), O_RDONLY);
+                file->dirSync = false;
+            }
+            UringCounters& counters = Uring().counters;
+            std::vector<int> results;
+            int retcode = SQLITE_OK;
+            size_t next = 0;
+            bool synced = !sync;
+            while (retcode == SQLITE_OK && (next < file->queued.size() || !synced)) {
+                size_t first = next;
+                // Leave room for the file and directory fsyncs in the last batch.
+                unsigned room = ring->Capacity() - 2;
+                for (unsigned n = 0; n < room && next < file->queued.size(); ++n, ++next) {
+                    QueuedWrite& write = file->queued[next];
+                    io_uring_sqe* sqe = ring->Next();
+                    sqe->opcode = IORING_OP_WRITE;
+                    sqe->fd = file->fd;
+                    sqe->off = static_cast<__u64>(write.offset);
+                    sqe->addr = reinterpret_cast<__u64>(write.data.data());
+                    sqe->len = static_cast<__u32>(write.data.size());
+                }
+                unsigned fsyncs = 0;
+                if (next == file->queued.size() && !synced) {
+                    io_uring_sqe* sqe = ring->Next();
+                    sqe->opcode = IORING_OP_FSYNC;
+                    sqe->fd = file->fd;
+                    sqe->flags = IOSQE_IO_DRAIN;
+                    // fdatasync, as the unix VFS uses for every sync on Linux.
+                    sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+                    ++fsyncs;
+                    if (dirFd >= 0) {
+                        sqe = ring->Next();
+                        sqe->opcode = IORING_OP_FSYNC;
+                        sqe->fd = dirFd;
+                        ++fsyncs;
+                    }
+                    synced = true;
+                }
+                if (ring->SubmitAndWait(&results) < 0) {
+                    // The ring is retired. Whatever of this batch reached the
+                    // file is rewritten, in order, with the rest.
+                    if (dirFd >= 0) {
+                        close(dirFd);
+                    }
+                    return PwriteQueued(file, first, sync, syncFlags);
+                }
+                size_t writes = next - first;
+                counters.writes.fetch_add(static_cast<long long>(writes), std::memory_order_relaxed);
+                counters.syncs.fetch_add(fsyncs, std::memory_order_relaxed);
+                for (size_t i = 0; i < writes && retcode == SQLITE_OK; ++i) {
+                    QueuedWrite& write = file->queued[first + i];
+                    size_t done = results[i] > 0 ? static_cast<size_t>(results[i]) : 0;
+                    if (results[i] < 0) {
+                        retcode = SQLITE_IOERR_WRITE;
+                    }
+                    // Short writes are rare enough to finish synchronously.
+                    while (retcode == SQLITE_OK && done < write.data.size()) {
+                        ssize_t n = pwrite(file->fd, write.data.data() + done, write.data.size() - done,
+                            static_cast<off_t>(write.offset + done));
+                        if (n <= 0) {
+                            retcode = SQLITE_IOERR_WRITE;
+                        }
+                        done += n > 0 ? static_cast<size_t>(n) : 0;
+                    }
+                }
+                // The directory fsync is advisory, as it is in the unix VFS.
+                if (retcode == SQLITE_OK && fsyncs > 0 && results[writes] < 0) {
+                    retcode = SQLITE_IOERR_FSYNC;
+                }
+            }
+            if (dirFd >= 0) {
+                close(dirFd);
+            }
+            file->queued.clear();
+            return retcode;
+#else
+            return SQLITE_IOERR_WRITE;
+#endif
+        }
+
+        /// <summary>
+        /// Flushes file and, for a database, the frames queued on its WAL.
+        /// </summary>
+        inline int FlushBeforeVisible(UringFile* file) {
+            int retcode = Flush(file, false, 0);
+            if (retcode == SQLITE_OK && file->wal != nullptr) {
+                retcode = Flush(file->wal, false, 0);
+            }
+            return retcode;
+        }
+
+        inline int UringClose(sqlite3_file* handle) {
+            UringFile* file = AsUring(handle);
+            int retcode = Flush(file, false, 0);
+            if (file->database != nullptr && file->database->wal == file) {
+                file->database->wal = nullptr;
+            }
+            if (file->wal != nullptr) {
+                file->wal->database = nullptr;
+            }
+            int closed = file->real->pMethods->xClose(file->real);
+            file->~UringFile();
+            return retcode == SQLITE_OK ? closed : retcode;
+        }
+
+        inline int UringRead(sqlite3_file* handle, void* buffer, int amount, sqlite3_int64 offset) {
+            UringFile* file = AsUring(handle);
+            if (file->deferred != SQLITE_OK) {
+                return TakeDeferred(file);
+            }
+            if (file->fd < 0) {
+                return file->real->pMethods->xRead(file->real, buffer, amount, offset);
+            }
+            for (QueuedWrite& write : file->queued) {
+                if (write.offset < offset + amount &&
+                    offset < write.offset + static_cast<sqlite3_int64>(write.data.size())) {
+                    int retcode = Flush(file, false, 0);
+                    if (retcode != SQLITE_OK) {
+                        return retcode;
+                    }
+                    break;
+                }
+            }
+            long long got = -1;
+#ifdef __linux__
+            Ring* ring = ThreadRing();
+            if (ring != nullptr) {
+                io_uring_sqe* sqe = ring->Next();
+                sqe->opcode = IORING_OP_READ;
+                sqe->fd = file->fd;
+                sqe->off = static_cast<__u64>(offset);
+                sqe->addr = reinterpret_cast<__u64>(buffer);
+                sqe->len = static_cast<__u32>(amount);
+                std::vector<int> results;
+                if (ring->SubmitAndWait(&results) == 0) {
+                    got = results[0];
+                }
+                else {
+                    got = pread(file->fd, buffer, static_cast<size_t>(amount), static_cast<off_t>(offset));
+                }
+                Uring().counters.reads.fetch_add(1, std::memory_order_relaxed);
+            }
+            else {
+                got = pread(file->fd, buffer, static_cast<size_t>(amount), static_cast<off_t>(offset));
+            }
+#endif
+            if (got < 0) {
+                return SQLITE_IOERR_READ;
+            }
+            if (got < amount) {
+                // SQLite requires the unread tail to be zeroed.
+                std::memset(static_cast<char*>(buffer) + got, 0, static_cast<size_t>(amount - got));
+                return SQLITE_IOERR_SHORT_READ;
+            }
+            return SQLITE_OK;
+        }
+
+        inline int UringWrite(sqlite3_file* handle, const void* buffer, int amount, sqlite3_int64 offset) {
+            UringFile* file = AsUring(handle);
+            if (file->fd < 0) {
+                return file->real->pMethods->xWrite(file->real, buffer, amount, offset);
+            }
+            if (file->deferred != SQLITE_OK) {
+                return TakeDeferred(file);
+            }
+            const char* bytes = static_cast<const char*>(buffer);
+            bool commitPage = file->commitFrame;
+            file->commitFrame = file->walFile && amount == kWalFrameHeaderBytes && offset >= kWalHeaderBytes &&
+                IsCommitFrameHeader(static_cast<const unsigned char*>(buffer));
+            QueuedWrite* same = nullptr;
+            for (QueuedWrite& write : file->queued) {
+                sqlite3_int64 end = write.offset + static_cast<sqlite3_int64>(write.data.size());
+                if (write.offset == offset && end == offset + amount) {
+                    same = &write;
+                    break;
+                }
+                if (write.offset < offset + amount && offset < end) {
+                    int retcode = Flush(file, false, 0);
+                    if (retcode != SQLITE_OK) {
+                        return retcode;
+                    }
+                    break;
+                }
+            }
+            if (same != nullptr) {
+                same->data.assign(bytes, bytes + amount);
+            }
+            else {
+                file->queued.push_back(QueuedWrite{ offset, std::vector<char>(bytes, bytes + amount) });
+            }
+            // Bound the memory held by a transaction that never syncs.
+            if (commitPage || file->queued.size() >= 4 * Uring().options.ringEntries) {
+                return Flush(file, false, 0);
+            }
+            return SQLITE_OK;
+        }
+
+        inline int UringTruncate(sqlite3_file* handle, sqlite3_int64 size) {
+            UringFile* file = AsUring(handle);
+            int retcode = Flush(file, false, 0);
+            return retcode == SQLITE_OK ? file->real->pMethods->xTruncate(file->real, size) : retcode;
+        }
+
+        inline int UringSync(sqlite3_file* handle, int flags) {
+            UringFile* file = AsUring(handle);
+            int retcode = Flush(file, true, flags);
+            int deferred = TakeDeferred(file);
+            return retcode == SQLITE_OK ? deferred : retcode;
+        }
+
+        inline int UringFileSize(sqlite3_file* handle, sqlite3_int64* size) {
+            UringFile* file = AsUring(handle);
+            int retcode = file->real->pMethods->xFileSize(file->real, size);
+            for (QueuedWrite& write : file->queued) {
+                *size = std::max(*size, write.offset + static_cast<sqlite3_int64>(write.data.size()));
+            }
+            return retcode;
+        }
+
+        inline int UringLock(sqlite3_file* handle, int level) {
+            UringFile* file = AsUring(handle);
+            return file->real->pMethods->xLock(file->real, level);
+        }
+
+        inline int UringUnlock(sqlite3_file* handle, int level) {
+            UringFile* file = AsUring(handle);
+            int retcode = FlushBeforeVisible(file);
+            int unlocked = file->real->pMethods->xUnlock(file->real, level);
+            return retcode == SQLITE_OK ? unlocked : retcode;
+        }
+
+        inline int UringCheckReservedLock(sqlite3_file* handle, int* out) {
+            UringFile* file = AsUring(handle);
+            return file->real->pMethods->xCheckReservedLock(file->real, out);
+        }
+
+        inline int UringFileControl(sqlite3_file* handle, int op, void* arg) {
+            UringFile* file = AsUring(handle);
+            if (op == SQLITE_FCNTL_MMAP_SIZE && file->fd >= 0) {
+                sqlite3_int64 none = 0;
+                file->real->pMethods->xFileControl(file->real, op, &none);
+                *static_cast<sqlite3_int64*>(arg) = 0;
+                return SQLITE_OK;
+            }
+            int retcode = file->real->pMethods->xFileControl(file->real, op, arg);
+            if (op == SQLITE_FCNTL_VFSNAME && retcode == SQLITE_OK) {
+                char** name = static_cast<char**>(arg);
+                *name = *name != nullptr ? sqlite3_mprintf("%s/%s", kIoUringVfsName, *name)
+                                         : sqlite3_mprintf("%s", kIoUringVfsName);
+            }
+            return retcode;
+        }
+
+        inline int UringSectorSize(sqlite3_file* handle) {
+            UringFile* file = AsUring(handle);
+            return file->real->pMethods->xSectorSize(file->real);
+        }
+
+        inline int UringDeviceCharacteristics(sqlite3_file* handle) {
+            UringFile* file = AsUring(handle);
+            return file->real->pMethods->xDeviceCharacteristics(file->real);
+        }
+
+        inline int UringShmMap(sqlite3_file* handle, int region, int size, int extend, void volatile** out) {
+            UringFile* file = AsUring(handle);
+            return file->real->pMethods->xShmMap(file->real, region, size, extend, out);
+        }
+
+        inline int UringShmLock(sqlite3_file* handle, int offset, int n, int flags) {
+            UringFile* file = AsUring(handle);
+            int retcode = FlushBeforeVisible(file);
+            if ((flags & SQLITE_SHM_UNLOCK) != 0) {
+                // SQLite ignores what an unlock returns, so the deferred
+                // error waits for the next lock.
+                int unlocked = file->real->pMethods->xShmLock(file->real, offset, n, flags);
+                return retcode == SQLITE_OK ? unlocked : retcode;
+            }
+            if (retcode == SQLITE_OK) {
+                retcode = TakeDeferred(file);
+            }
+            return retcode == SQLITE_OK ? file->real->pMethods->xShmLock(file->real, offset, n, flags) : retcode;
+        }
+
+        inline void UringShmBarrier(sqlite3_file* handle) {
+            UringFile* file = AsUring(handle);
+            // The wal-index header is published right after this barrier.
+            // Commit frames are already out; anything else that fails here
+            // is kept for the next call that can return it.
+            int retcode = FlushBeforeVisible(file);
+            if (retcode != SQLITE_OK && file->deferred == SQLITE_OK) {
+                file->deferred = retcode;
+            }
+            file->real->pMethods->xShmBarrier(file->real);
+        }
+
+        inline int UringShmUnmap(sqlite3_file* handle, int deleteFlag) {
+            UringFile* file = AsUring(handle);
+            return file->real->pMethods->xShmUnmap(file->real, deleteFlag);
+        }
+
+        inline int UringFetch(sqlite3_file* handle, sqlite3_int64 offset, int amount, void** out) {
+            UringFile* file = AsUring(handle);
+            if (file->fd < 0 && file->real->pMethods->iVersion >= 3) {
+                return file->real->pMethods->xFetch(file->real, offset, amount, out);
+            }
+            *out = nullptr;
+            return SQLITE_OK;
+        }
+
+        inline int UringUnfetch(sqlite3_file* handle, sqlite3_int64 offset, void* page) {
+            UringFile* file = AsUring(handle);
+            if (file->fd < 0 && file->real->pMethods->iVersion >= 3) {
+                return file->real->pMethods->xUnfetch(file->real, offset, page);
+            }
+            return SQLITE_OK;
+        }
+
+        inline const sqlite3_io_methods* UringIoMethods() {
+            static const sqlite3_io_methods methods = {
+                3,
+                UringClose,
+                UringRead,
+                UringWrite,
+                UringTruncate,
+                UringSync,
+                UringFileSize,
+                UringLock,
+                UringUnlock,
+                UringCheckReservedLock,
+                UringFileControl,
+                UringSectorSize,
+                UringDeviceCharacteristics,
+                UringShmMap,
+                UringShmLock,
+                UringShmBarrier,
+                UringShmUnmap,
+                UringFetch,
+                UringUnfetch,
+            };
+            return &methods;
+        }
+
+        inline sqlite3_vfs* UringBase(sqlite3_vfs*) {
+            return Uring().base;
+        }
+
+        inline int UringOpen(sqlite3_vfs* vfs, const char* name, sqlite3_file* handle, int flags, int* outFlags) {
+            sqlite3_vfs* base = UringBase(vfs);
+            UringFile* file = new (handle) UringFile();
+            file->base.pMethods = nullptr;
+            file->real = reinterpret_cast<sqlite3_file*>(file + 1);
+            file->fd = -1;
+            file->dirSync = false;
+            file->wal = nullptr;
+            file->database = nullptr;
+            file->walFile = false;
+            file->commitFrame = false;
+            file->deferred = SQLITE_OK;
+
+            const int shimmed = SQLITE_OPEN_MAIN_DB | SQLITE_OPEN_MAIN_JOURNAL | SQLITE_OPEN_WAL;
+            const int journals = SQLITE_OPEN_MAIN_JOURNAL | SQLITE_OPEN_WAL;
+            int exists = 1;
+            if (name != nullptr && (flags & journals) != 0) {
+                base->xAccess(base, name, SQLITE_ACCESS_EXISTS, &exists);
+            }
+            int retcode = base->xOpen(base, name, file->real, flags, outFlags);
+            if (retcode != SQLITE_OK) {
+                if (file->real->pMethods != nullptr) {
+                    file->real->pMethods->xClose(file->real);
+                }
+                file->~UringFile();
+                handle->pMethods = nullptr;
+                return retcode;
+            }
+#ifdef __linux__
+            if ((flags & shimmed) != 0 && Uring().available.load()) {
+                file->fd = UnixDescriptor(file->real, name);
+            }
+#endif
+            if (file->fd < 0) {
+                Uring().counters.passthroughFiles.fetch_add(1, std::memory_order_relaxed);
+            }
+            else {
+                file->path = name;
+                // A new journal's directory entry must be durable too.
+                file->dirSync = (flags & journals) != 0 && !exists;
+                if ((flags & SQLITE_OPEN_WAL) != 0) {
+                    file->walFile = true;
+                    sqlite3_file* database = sqlite3_database_file_object(name);
+                    if (database != nullptr && database->pMethods == UringIoMethods()) {
+                        file->database = AsUring(database);
+                        file->database->wal = file;
+                    }
+                }
+            }
+            file->base.pMethods = UringIoMethods();
+            return SQLITE_OK;
+        }
+
+        inline int UringDelete(sqlite3_vfs* vfs, const char* name, int syncDir) {
+            return UringBase(vfs)->xDelete(UringBase(vfs), name, syncDir);
+        }
+
+        inline int UringAccess(sqlite3_vfs* vfs, const char* name, int flags, int* out) {
+            return UringBase(vfs)->xAccess(UringBase(vfs), name, flags, out);
+        }
+
+        inline int UringFullPathname(sqlite3_vfs* vfs, const char* name, int n, char* out) {
+            return UringBase(vfs)->xFullPathname(UringBase(vfs), name, n, out);
+        }
+
+        inline void* UringDlOpen(sqlite3_vfs* vfs, const char* name) {
+            return UringBase(vfs)->xDlOpen(UringBase(vfs), name);
+        }
+
+        inline void UringDlError(sqlite3_vfs* vfs, int n, char* out) {
+            UringBase(vfs)->xDlError(UringBase(vfs), n, out);
+        }
+
+        inline void (*UringDlSym(sqlite3_vfs* vfs, void* library, const char* symbol))(void) {
+            return UringBase(vfs)->xDlSym(UringBase(vfs), library, symbol);
+        }
+
+        inline void UringDlClose(sqlite3_vfs* vfs, void* library) {
+            UringBase(vfs)->xDlClose(UringBase(vfs), library);
+        }
+
+        inline int UringRandomness(sqlite3_vfs* vfs, int n, char* out) {
+            return UringBase(vfs)->xRandomness(UringBase(vfs), n, out);
+        }
+
+        inline int UringSleep(sqlite3_vfs* vfs, int micros) {
+            return UringBase(vfs)->xSleep(UringBase(vfs), micros);
+        }
+
+        inline int UringCurrentTime(sqlite3_vfs* vfs, double* out) {
+            return UringBase(vfs)->xCurrentTime(UringBase(vfs), out);
+        }
+
+        inline int UringGetLastError(sqlite3_vfs* vfs, int n, char* out) {
+            return UringBase(vfs)->xGetLastError(UringBase(vfs), n, out);
+        }
+
+        inline int UringCurrentTimeInt64(sqlite3_vfs* vfs, sqlite3_int64* out) {
+            return UringBase(vfs)->xCurrentTimeInt64(UringBase(vfs), out);
+        }
+
+        inline bool ProbeRing(unsigned entries) {
+#ifdef __linux__
+            Ring ring;
+            return ring.Init(entries);
+#else
+            (void)entries;
+            return false;
+#endif
+        }
+    }
+
+    /// <summary>
+    /// Registers the "io_uring" VFS over the current default VFS. The shim is
+    /// registered even when io_uring is unavailable; IoUringAvailable() then
+    /// reports false and every file is passed straight through.
+    /// </summary>
+    inline int RegisterIoUringVfs(const IoUringVfsOptions& options = IoUringVfsOptions()) {
+        int retcode = sqlite3_initialize();
+        if (retcode != SQLITE_OK) {
+            return retcode;
+        }
+        detail::UringGlobals& globals = detail::Uring();
+        if (globals.base == nullptr) {
+            sqlite3_vfs* base = sqlite3_vfs_find(0);
+            if (base == nullptr || base->iVersion < 2) {
+                return SQLITE_ERROR;
+            }
+            globals.base = base;
+            sqlite3_vfs& vfs = globals.vfs;
+            vfs.iVersion = 2;
+            vfs.szOsFile = static_cast<int>(sizeof(detail::UringFile)) + base->szOsFile;
+            vfs.mxPathname = base->mxPathname;
+            vfs.zName = kIoUringVfsName;
+            vfs.xOpen = detail::UringOpen;
+            vfs.xDelete = detail::UringDelete;
+            vfs.xAccess = detail::UringAccess;
+            vfs.xFullPathname = detail::UringFullPathname;
+            vfs.xDlOpen = detail::UringDlOpen;
+            vfs.xDlError = detail::UringDlError;
+            vfs.xDlSym = detail::UringDlSym;
+            vfs.xDlClose = detail::UringDlClose;
+            vfs.xRandomness = detail::UringRandomness;
+            vfs.xSleep = detail::UringSleep;
+            vfs.xCurrentTime = detail::UringCurrentTime;
+            vfs.xGetLastError = detail::UringGetLastError;
+            vfs.xCurrentTimeInt64 = detail::UringCurrentTimeInt64;
+        }
+        globals.options = options;
+        globals.options.ringEntries = std::max(options.ringEntries, 4u);
+        globals.available = !options.disableRing && detail::ProbeRing(globals.options.ringEntries);
+        return sqlite3_vfs_register(&globals.vfs, options.makeDefault ? 1 : 0);
+    }
+
+    /// <summary>
+    /// Unregisters the shim; connections opened on it must be closed first.
+    /// </summary>
+    inline int UnregisterIoUringVfs() {
+        detail::UringGlobals& globals = detail::Uring();
+        return globals.base == nullptr ? SQLITE_OK : sqlite3_vfs_unregister(&globals.vfs);
+    }
+
+    inline bool IoUringAvailable() {
+        return detail::Uring().available.load();
+    }
+
+    inline IoUringVfsStats IoUringVfsCounters() {
+        detail::UringCounters& counters = detail::Uring().counters;
+        IoUringVfsStats stats;
+        stats.submissions = counters.submissions.load(std::memory_order_relaxed);
+        stats.reads = counters.reads.load(std::memory_order_relaxed);
+        stats.writes = counters.writes.load(std::memory_order_relaxed);
+        stats.syncs = counters.syncs.load(std::memory_order_relaxed);
+        stats.passthroughFiles = counters.passthroughFiles.load(std::memory_order_relaxed);
+        return stats;
+    }
+}
@@ -0,0 +1,171 @@
+//
+// memdb_fixture.h
+//
+// In-memory copies of the checked-in fixture databases (MyDB, MyDBExtn,
+// Tables, MyDB.db). Each fixture file is read once per process. Every test
+// then opens or attaches its own private copy with sqlite3_deserialize, so
+// tests never write to the checked-in files, never contend for their locks,
+// and can run in parallel.
+//
+
+#pragma once
+
+#include "sqlite3.h"
+
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace sqlite3tests {
+
+    typedef std::vector<unsigned char> DbImage;
+
+    namespace detail {
+
+        struct FixtureCache {
+            std::mutex lock;
+            std::map<std::string, std::shared_ptr<const DbImage>> images;
+        };
+
+        inline FixtureCache& Fixtures() {
+            static FixtureCache cache;
+            return cache;
+        }
+
+        /// <summary>
+        /// Copies image into memory owned by SQLite and hands it to the schema
+        /// as a writable, growable memdb database.
+        /// </summary>
+        inline int DeserializeCopy(sqlite3* db, const char* schema, const DbImage& image) {
+            sqlite3_int64 size = static_cast<sqlite3_int64>(image.size());
+            unsigned char* copy = static_cast<unsigned char*>(sqlite3_malloc64(image.size()));
+            if (copy == nullptr && size > 0) {
+                return SQLITE_NOMEM;
+            }
+            if (size > 0) {
+                std::memcpy(copy, image.data(), image.size());
+            }
+            return sqlite3_deserialize(db, schema, copy, size, size,
+                SQLITE_DESERIALIZE_FREEONCLOSE | SQLITE_DESERIALIZE_RESIZEABLE);
+        }
+    }
+
+    /// <summary>
+    /// Returns the database image of schema, as it would be written to disk.
+    /// </summary>
+    inline int SerializeDb(sqlite3* db, const char* schema, DbImage* image) {
+        sqlite3_int64 size = 0;
+        unsigned char* bytes = sqlite3_serialize(db, schema, &size, 0);
+        if (bytes == nullptr) {
+            image->clear();
+            // A database with no pages serializes to nothing.
+            return size == 0 ? SQLITE_OK : SQLITE_NOMEM;
+        }
+        image->assign(bytes, bytes + size);
+        sqlite3_free(bytes);
+        return SQLITE_OK;
+    }
+
+    /// <summary>
+    /// Reads a fixture file once per process and returns its image. The file
+    /// is opened immutable and read-only, so it is never locked, and any
+    /// journal left next to it is neither replayed nor deleted.
+    /// </summary>
+    inline int LoadFixture(const std::string& path, std::shared_ptr<const DbImage>* image) {
+        detail::FixtureCache& cache = detail::Fixtures();
+        std::lock_guard<std::mutex> lock(cache.lock);
+        auto found = cache.images.find(path);
+        if (found != cache.images.end()) {
+            *image = found->second;
+            return SQLITE_OK;
+        }
+        std::FILE* exists = std::fopen(path.c_str(), "rb");
+        if (exists == nullptr) {
+            return SQLITE_CANTOPEN;
+        }
+        std::fclose(exists);
+
+        sqlite3* db = 0;
+        std::string uri = "file:" + path + "?immutable=1";
+        int retcode = sqlite3_open_v2(uri.c_str(), &db, SQLITE_OPEN_READONLY | SQLITE_OPEN_URI, 0);
+        std::shared_ptr<DbImage> loaded(new DbImage());
+        if (retcode == SQLITE_OK) {
+            retcode = SerializeDb(db, "main", loaded.get());
+        }
+        sqlite3_close(db);
+        if (retcode != SQLITE_OK) {
+            return retcode;
+        }
+        cache.images[path] = loaded;
+        *image = loaded;
+        return SQLITE_OK;
+    }
+
+    /// <summary>
+    /// Opens a private, writable in-memory copy of a fixture.
+    /// </summary>
+    inline int OpenFixture(const std::string& path, sqlite3** db) {
+        *db = 0;
+        std::shared_ptr<const DbImage> image;
+        int retcode = LoadFixture(path, &image);
+        if (retcode == SQLITE_OK) {
+            retcode = sqlite3_open(":memory:", db);
+        }
+        if (retcode == SQLITE_OK) {
+            retcode = detail::DeserializeCopy(*db, "main", *image);
+        }
+        if (retcode != SQLITE_OK) {
+            sqlite3_close(*db);
+            *db = 0;
+        }
+        return retcode;
+    }
+
+    /// <summary>
+    /// The in-memory counterpart of "attach database path as schema".
+    /// </summary>
+    inline int AttachFixture(sqlite3* db, const std::string& path, const char* schema) {
+        std::shared_ptr<const DbImage> image;
+        int retcode = LoadFixture(path, &image);
+        if (retcode != SQLITE_OK) {
+            return retcode;
+        }
+        char* sql = sqlite3_mprintf("attach database ':memory:' as \"%w\"", schema);
+        retcode = sqlite3_exec(db, sql, 0, 0, 0);
+        sqlite3_free(sql);
+        return retcode == SQLITE_OK ? detail::DeserializeCopy(db, schema, *image) : retcode;
+    }
+
+    /// <summary>
+    /// True if schema still holds exactly the bytes of the fixture at path.
+    /// </summary>
+    inline bool MatchesFixture(sqlite3* db, const char* schema, const std::string& path) {
+        std::shared_ptr<const DbImage> image;
+        DbImage current;
+        return LoadFixture(path, &image) == SQLITE_OK &&
+               SerializeDb(db, schema, &current) == SQLITE_OK && current == *image;
+    }
+
+    /// <summary>
+    /// Writes schema's image to a file, e.g. to inspect a test's end state
+    /// with the sqlite3 shell. An existing file is replaced.
+    /// </summary>
+    inline int ExportDb(sqlite3* db, const char* schema, const std::string& path) {
+        DbImage image;
+        int retcode = SerializeDb(db, schema, &image);
+        if (retcode != SQLITE_OK) {
+            return retcode;
+        }
+        std::FILE* file = std::fopen(path.c_str(), "wb");
+        if (file == nullptr) {
+            return SQLITE_CANTOPEN;
+        }
+        size_t written = image.empty() ? 0 : std::fwrite(image.data(), 1, image.size(), file);
+        bool closed = std::fclose(file) == 0;
+        return written == image.size() && closed ? SQLITE_OK : SQLITE_IOERR_WRITE;
+    }
+}
@@ -0,0 +1,196 @@
+//
+// mmap_tuning.h
+//
+// Memory-mapped reads for a connection, sized from the database file. SQLite
+// maps at most PRAGMA mmap_size bytes and remaps by itself as the file grows
+// up to that limit; the tuner raises the limit, with headroom, once the file
+// outgrows it. Growth is noticed cheaply: PRAGMA data_version moves when other
+// connections commit, sqlite3_total_changes64 when this one writes.
+//
+// The limit can never exceed SQLITE_MAX_MMAP_SIZE, fixed when sqlite3.c is
+// compiled (the x64 builds of NormalSqlite3 raise it to 64 GB), nor the
+// process-wide maximum set with SQLITE_CONFIG_MMAP_SIZE.
+//
+
+#pragma once
+
+#include "sqlite3.h"
+
+#include <algorithm>
+#include <cstdio>
+
+namespace sqlite3tests {
+
+    struct MmapTuning {
+        /// <summary>
+        /// The mapping is sized to the file times this, rounded up to a power
+        /// of two, so that a growing file is not re-tuned on every commit.
+        /// </summary>
+        double headroom = 1.5;
+        long long minBytes = 1LL << 20;
+        long long maxBytes = 1LL << 40;
+    };
+
+    class MmapTuner {
+    public:
+        MmapTuner() = default;
+        MmapTuner(const MmapTuner&) = delete;
+        MmapTuner& operator=(const MmapTuner&) = delete;
+
+        ~MmapTuner() { Detach(); }
+
+        /// <summary>
+        /// Sizes the mapping of db's main database from its current file size.
+        /// </summary>
+        int Attach(sqlite3* db, const MmapTuning& tuning = MmapTuning()) {
+            Detach();
+            db_ = db;
+            tuning_ = tuning;
+            int retcode = sqlite3_prepare_v2(db, "pragma data_version", -1, &dataVersionStmt_, 0);
+            if (retcode == SQLITE_OK) {
+                retcode = sqlite3_prepare_v2(db, "pragma page_count", -1, &pageCountStmt_, 0);
+            }
+            if (retcode == SQLITE_OK) {
+                retcode = QueryInt64("pragma page_size", &pageSize_);
+            }
+            if (retcode != SQLITE_OK) {
+                Detach();
+                return retcode;
+            }
+            limit_ = 0;
+            return Retune(true);
+        }
+
+        void Detach() {
+            sqlite3_finalize(dataVersionStmt_);
+            sqlite3_finalize(pageCountStmt_);
+            dataVersionStmt_ = 0;
+            pageCountStmt_ = 0;
+            db_ = 0;
+        }
+
+        /// <summary>
+        /// Re-checks the file size if anything was committed since the last
+        /// call and raises the mapping when the file has outgrown it. Costs
+        /// one PRAGMA step when nothing changed.
+        /// </summary>
+        int Refresh(bool* retuned = nullptr) {
+            if (retuned != nullptr) {
+                *retuned = false;
+            }
+            if (db_ == 0) {
+                return SQLITE_MISUSE;
+            }
+            long long version = 0;
+            int retcode = Step(dataVersionStmt_, &version);
+            if (retcode != SQLITE_OK) {
+                return retcode;
+            }
+            sqlite3_int64 changes = sqlite3_total_changes64(db_);
+            if (version == dataVersion_ && changes == totalChanges_) {
+                return SQLITE_OK;
+            }
+            long long before = limit_;
+            retcode = Retune(false);
+            if (retuned != nullptr) {
+                *retuned = limit_ != before;
+            }
+            return retcode;
+        }
+
+        /// <summary>
+        /// The mapping limit SQLite actually applied, after its own caps.
+        /// </summary>
+        long long MappedLimit() const { return limit_; }
+
+        long long FileBytes() const { return fileBytes_; }
+
+    private:
+        int Step(sqlite3_stmt* stmt, long long* value) {
+            int retcode = sqlite3_step(stmt);
+            if (retcode == SQLITE_ROW) {
+                *value = sqlite3_column_int64(stmt, 0);
+                retcode = SQLITE_OK;
+            }
+            sqlite3_reset(stmt);
+            return retcode == SQLITE_DONE ? SQLITE_OK : retcode;
+        }
+
+        int QueryInt64(const char* sql, long long* value) {
+            sqlite3_stmt* stmt = 0;
+            int retcode = sqlite3_prepare_v2(db_, sql, -1, &stmt, 0);
+            if (retcode == SQLITE_OK) {
+                retcode = Step(stmt, value);
+            }
+            sqlite3_finalize(stmt);
+            return retcode;
+        }
+
+        int Retune(bool force) {
+            long long pages = 0;
+            int retcode = Step(pageCountStmt_, &pages);
+            if (retcode == SQLITE_OK) {
+                retcode = Step(dataVersionStmt_, &dataVersion_);
+            }
+            if (retcode != SQLITE_OK) {
+                return retcode;
+            }
+            totalChanges_ = sqlite3_total_changes64(db_);
+            fileBytes_ = pages * pageSize_;
+
+            long long wanted = static_cast<long long>(fileBytes_ * tuning_.headroom);
+            long long target = tuning_.minBytes;
+            while (target < wanted && target < tuning_.maxBytes) {
+                target *= 2;
+            }
+            target = std::min(target, tuning_.maxBytes);
+            if (!force && target <= limit_) {
+                return SQLITE_OK;
+            }
+            char sql[64];
+            snprintf(sql, sizeof(sql), "pragma mmap_size = %lld", target);
+            // Returns the limit in effect, which SQLite may have capped.
+            return QueryInt64(sql, &limit_);
+        }
+
+        sqlite3* db_ = 0;
+        MmapTuning tuning_;
+        sqlite3_stmt* dataVersionStmt_ = 0;
+        sqlite3_stmt* pageCountStmt_ = 0;
+        long long pageSize_ = 0;
+        long long dataVersion_ = -1;
+        sqlite3_int64 totalChanges_ = -1;
+        long long fileBytes_ = 0;
+        long long limit_ = 0;
+    };
+
+    /// <summary>
+    /// sqlite3_open_v2 followed by tuner->Attach. The tuner must outlive the
+    /// connection's use of it and be detached before sqlite3_close.
+    /// </summary>
+    inline int OpenMmapped(const char* path, sqlite3** db, int flags, MmapTuner* tuner,
+                           const MmapTuning& tuning = MmapTuning()) {
+        int retcode = sqlite3_open_v2(path, db, flags, 0);
+        if (retcode == SQLITE_OK) {
+            retcode = tuner->Attach(*db, tuning);
+        }
+        if (retcode != SQLITE_OK) {
+            sqlite3_close(*db);
+            *db = 0;
+        }
+        return retcode;
+    }
+
+    /// <summary>
+    /// Raises the process-wide default and maximum mapping sizes
+    /// (SQLITE_CONFIG_MMAP_SIZE). Every connection must be closed first.
+    /// </summary>
+    inline int ConfigureMmapLimits(long long defaultBytes, long long maxBytes) {
+        int retcode = sqlite3_shutdown();
+        if (retcode == SQLITE_OK) {
+            retcode = sqlite3_config(SQLITE_CONFIG_MMAP_SIZE,
+                static_cast<sqlite3_int64>(defaultBytes), static_cast<sqlite3_int64>(maxBytes));
+        }
+        return retcode == SQLITE_OK ? sqlite3_initialize() : retcode;
+    }
+}
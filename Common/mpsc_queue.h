@@ -0,0 +1,73 @@
+//
+// mpsc_queue.h
+//
+// Unbounded multi-producer single-consumer queue (Vyukov's intrusive list
+// with a stub node). Push is one atomic exchange and never blocks; only the
+// single consumer may call TryPop or Empty.
+//
+
+#pragma once
+
+#include <atomic>
+#include <utility>
+
+namespace sqlite3tests {
+
+    template <typename T>
+    class MpscQueue {
+    public:
+        MpscQueue() : head_(new Node()), tail_(head_.load(std::memory_order_relaxed)) {}
+
+        MpscQueue(const MpscQueue&) = delete;
+        MpscQueue& operator=(const MpscQueue&) = delete;
+
+        ~MpscQueue() {
+            T discarded;
+            while (TryPop(discarded)) {
+            }
+            delete tail_;
+        }
+
+        /// <summary>
+        /// Safe from any number of threads concurrently.
+        /// </summary>
+        void Push(T value) {
+            Node* node = new Node();
+            node->value = std::move(value);
+            Node* prev = head_.exchange(node, std::memory_order_acq_rel);
+            prev->next.store(node, std::memory_order_release);
+        }
+
+        /// <summary>
+        /// Consumer only. A push that has swapped head_ but not yet linked its
+        /// node is reported as not-yet-available; the producer's subsequent
+        /// wake-up covers that window.
+        /// </summary>
+        bool TryPop(T& out) {
+            Node* next = tail_->next.load(std::memory_order_acquire);
+            if (next == nullptr) {
+                return false;
+            }
+            out = std::move(next->value);
+            delete tail_;
+            tail_ = next;
+            return true;
+        }
+
+        /// <summary>
+        /// Consumer only.
+        /// </summary>
+        bool Empty() const {
+            return tail_->next.load(std::memory_order_acquire) == nullptr;
+        }
+
+    private:
+        struct Node {
+            std::atomic<Node*> next{ nullptr };
+            T value{};
+        };
+
+        std::atomic<Node*> head_;
+        Node* tail_;
+    };
+}
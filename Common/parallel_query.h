@@ -0,0 +1,410 @@
+//
+// parallel_query.h
+//
+// A statement runs on one connection and one thread, so
+// "select COUNT(SID) from Students" scans the whole table on a single core.
+// ParallelQuery splits a table into rowid ranges and runs each range on its
+// own pooled connection and thread. Range lookups on the rowid are b-tree
+// seeks, so each range reads only its own pages. Partial aggregates
+// (COUNT/SUM/MIN/MAX/AVG) are merged back into one value, and ordered
+// streams are merged by their first column.
+//
+// Each range reads its own snapshot. Under concurrent writes, the merged
+// result can mix commits; pin a SnapshotReaders set when that matters.
+//
+
+#pragma once
+
+#include "sqlite3.h"
+
+#include "connection_pool.h"
+#include "scan_value.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace sqlite3tests {
+
+    enum class AggregateKind { Count, Sum, Min, Max, Avg };
+
+    /// <summary>
+    /// An inclusive rowid range.
+    /// </summary>
+    struct RowidRange {
+        int64_t first = 0;
+        int64_t last = -1;
+    };
+
+    struct ParallelQueryOptions {
+        std::string table;
+        /// <summary>
+        /// Optional filter, SQL text ANDed to every range's WHERE clause.
+        /// </summary>
+        std::string where;
+        /// <summary>
+        /// Number of rowid ranges, at most the pool's capacity; 0 means one
+        /// per pooled connection.
+        /// </summary>
+        int partitions = 0;
+    };
+
+    namespace detail {
+        inline std::string RangeSql(const std::string& select, const ParallelQueryOptions& options) {
+            std::string sql = "select " + select + " from " + options.table + " where rowid between ? and ?";
+            if (!options.where.empty()) {
+                sql += " and (" + options.where + ")";
+            }
+            return sql;
+        }
+
+        /// <summary>
+        /// Rows of one range on their way from its producer thread to the
+        /// merge; bounded, so a fast range cannot buffer the whole table.
+        /// </summary>
+        struct RowChannel {
+            static constexpr size_t kBatchRows = 256;
+            static constexpr size_t kMaxBatches = 4;
+
+            std::mutex mutex;
+            std::condition_variable changed;
+            std::deque<std::vector<ScanRow>> batches;
+            bool done = false;
+            int status = SQLITE_OK;
+        };
+    }
+
+    class ParallelQuery {
+    public:
+        explicit ParallelQuery(ConnectionPool& pool) : pool_(pool) {}
+
+        /// <summary>
+        /// Splits table's rowids into up to partitions ranges of equal width.
+        /// An empty table gives no ranges. Deleted rowids are not looked
+        /// at, so sparse tables can give uneven ranges.
+        /// </summary>
+        int Partition(const std::string& table, int partitions, std::vector<RowidRange>* ranges) {
+            ranges->clear();
+            PooledConnection conn;
+            int retcode = pool_.Checkout(&conn);
+            sqlite3_stmt* stmt = 0;
+            if (retcode == SQLITE_OK) {
+                // Separate subqueries: min() and max() in one select would
+                // scan the table instead of seeking to either end.
+                std::string sql = "select (select min(rowid) from " + table + "), (select max(rowid) from " + table + ")";
+                retcode = conn.Prepare(sql.c_str(), &stmt);
+            }
+            if (retcode != SQLITE_OK) {
+                return retcode;
+            }
+            retcode = sqlite3_step(stmt);
+            if (retcode != SQLITE_ROW) {
+                return retcode == SQLITE_DONE ? SQLITE_ERROR : retcode;
+            }
+            if (sqlite3_column_type(stmt, 0) == SQLITE_NULL) {
+                return SQLITE_OK;
+            }
+            int64_t first = sqlite3_column_int64(stmt, 0);
+            int64_t last = sqlite3_column_int64(stmt, 1);
+            // In unsigned arithmetic, so that the full rowid span cannot overflow.
+            // The span is one less than the rowid count, which may not fit.
+            uint64_t span = static_cast<uint64_t>(last) - static_cast<uint64_t>(first);
+            uint64_t count = static_cast<uint64_t>(std::max(1, partitions));
+            uint64_t width = std::max<uint64_t>(1, span / count + (span % count != 0));
+            for (uint64_t i = 0, start = 0;; ++i, start += width) {
+                RowidRange range;
+                range.first = static_cast<int64_t>(static_cast<uint64_t>(first) + start);
+                // The last range takes whatever is left.
+                if (i + 1 == count || span - start < width) {
+                    range.last = last;
+                    ranges->push_back(range);
+                    break;
+                }
+                range.last = static_cast<int64_t>(static_cast<uint64_t>(first) + start + width - 1);
+                ranges->push_back(range);
+            }
+            return SQLITE_OK;
+        }
+
+        /// <summary>
+        /// Computes kind(column) over the table, one range per thread, and
+        /// merges the partial results as SQLite would: SUM stays an integer
+        /// unless a partial is real, and COUNT is 0 but the others are NULL
+        /// when no row qualifies.
+        /// </summary>
+        int Aggregate(const ParallelQueryOptions& options, AggregateKind kind, const std::string& column,
+                      ScanValue* result) {
+            *result = ScanValue();
+            std::vector<RowidRange> ranges;
+            int retcode = Partition(options.table, Partitions(options), &ranges);
+            if (retcode != SQLITE_OK) {
+                return retcode;
+            }
+            std::string select;
+            switch (kind) {
+            case AggregateKind::Count: select = "count(" + column + ")"; break;
+            case AggregateKind::Sum: select = "sum(" + column + ")"; break;
+            case AggregateKind::Min: select = "min(" + column + ")"; break;
+            case AggregateKind::Max: select = "max(" + column + ")"; break;
+            case AggregateKind::Avg: select = "sum(" + column + "), count(" + column + ")"; break;
+            }
+            std::string sql = detail::RangeSql(select, options);
+
+            std::vector<ScanRow> partials(ranges.size());
+            retcode = RunRanges(ranges, sql, [&](size_t i, sqlite3_stmt* stmt) {
+                int stepped = sqlite3_step(stmt);
+                if (stepped != SQLITE_ROW) {
+                    return stepped == SQLITE_DONE ? SQLITE_ERROR : stepped;
+                }
+                for (int c = 0; c < sqlite3_column_count(stmt); ++c) {
+                    partials[i].push_back(detail::ReadScanValue(stmt, c));
+                }
+                return SQLITE_OK;
+            });
+            if (retcode != SQLITE_OK) {
+                return retcode;
+            }
+            return Merge(kind, partials, result);
+        }
+
+        /// <summary>
+        /// Streams "select columns ... order by 1" across all ranges, merged
+        /// into one order by the first column, ascending or descending.
+        /// Equal keys come in rowid order. body returns false to stop early.
+        /// Every range keeps a pooled connection until the merge is done, so
+        /// the caller must not hold one of its own meanwhile.
+        /// </summary>
+        int Ordered(const ParallelQueryOptions& options, const std::string& columns, bool descending,
+                    const std::function<bool(const ScanRow&)>& body) {
+            std::vector<RowidRange> ranges;
+            int retcode = Partition(options.table, Partitions(options), &ranges);
+            if (retcode != SQLITE_OK || ranges.empty()) {
+                return retcode;
+            }
+            std::string sql = detail::RangeSql(columns, options) + (descending ? " order by 1 desc" : " order by 1");
+
+            std::vector<detail::RowChannel> channels(ranges.size());
+            std::atomic<bool> stop{ false };
+            std::vector<std::thread> producers;
+            for (size_t i = 0; i < ranges.size(); ++i) {
+                producers.emplace_back([&, i] { Produce(ranges[i], sql, stop, channels[i]); });
+            }
+
+            // The current batch of each range and the position in it.
+            std::vector<std::vector<ScanRow>> heads(ranges.size());
+            std::vector<size_t> positions(ranges.size(), 0);
+            auto advance = [&](size_t i) {
+                if (++positions[i] < heads[i].size()) {
+                    return true;
+                }
+                detail::RowChannel& channel = channels[i];
+                std::unique_lock<std::mutex> lock(channel.mutex);
+                channel.changed.wait(lock, [&channel] { return !channel.batches.empty() || channel.done; });
+                if (channel.batches.empty()) {
+                    if (retcode == SQLITE_OK) {
+                        retcode = channel.status;
+                    }
+                    return false;
+                }
+                heads[i] = std::move(channel.batches.front());
+                channel.batches.pop_front();
+                positions[i] = 0;
+                channel.changed.notify_all();
+                return true;
+            };
+            auto later = [&](size_t a, size_t b) {
+                int c = CompareScanValues(heads[a][positions[a]][0], heads[b][positions[b]][0]);
+                if (descending) {
+                    c = -c;
+                }
+                return c != 0 ? c > 0 : a > b;
+            };
+            std::priority_queue<size_t, std::vector<size_t>, decltype(later)> next(later);
+            for (size_t i = 0; i < ranges.size(); ++i) {
+                if (advance(i)) {
+                    next.push(i);
+                }
+            }
+            while (!next.empty() && retcode == SQLITE_OK) {
+                size_t i = next.top();
+                next.pop();
+                if (!body(heads[i][positions[i]])) {
+                    break;
+                }
+                if (advance(i)) {
+                    next.push(i);
+                }
+            }
+
+            stop = true;
+            for (detail::RowChannel& channel : channels) {
+                std::lock_guard<std::mutex> lock(channel.mutex);
+                channel.changed.notify_all();
+            }
+            for (std::thread& producer : producers) {
+                producer.join();
+            }
+            return retcode;
+        }
+
+    private:
+        int Partitions(const ParallelQueryOptions& options) const {
+            // Ordered streams hold a connection per range until the merge
+            // is done, so there can be no more ranges than connections.
+            int capacity = pool_.Capacity();
+            return options.partitions > 0 ? std::min(options.partitions, capacity) : capacity;
+        }
+
+        /// <summary>
+        /// Runs body(index, stmt) for every range on a thread and connection
+        /// of its own, with sql prepared and the range bound to it.
+        /// </summary>
+        template <class Body>
+        int RunRanges(const std::vector<RowidRange>& ranges, const std::string& sql, Body body) {
+            std::vector<int> retcodes(ranges.size(), SQLITE_OK);
+            std::vector<std::thread> threads;
+            for (size_t i = 0; i < ranges.size(); ++i) {
+                threads.emplace_back([&, i] {
+                    PooledConnection conn;
+                    sqlite3_stmt* stmt = 0;
+                    int retcode = pool_.Checkout(&conn);
+                    if (retcode == SQLITE_OK) {
+                        retcode = conn.Prepare(sql.c_str(), &stmt);
+                    }
+                    if (retcode == SQLITE_OK) {
+                        sqlite3_bind_int64(stmt, 1, ranges[i].first);
+                        sqlite3_bind_int64(stmt, 2, ranges[i].last);
+                        retcode = body(i, stmt);
+                    }
+                    retcodes[i] = retcode;
+                });
+            }
+            for (std::thread& thread : threads) {
+                thread.join();
+            }
+            for (int retcode : retcodes) {
+                if (retcode != SQLITE_OK) {
+                    return retcode;
+                }
+            }
+            return SQLITE_OK;
+        }
+
+        void Produce(const RowidRange& range, const std::string& sql, const std::atomic<bool>& stop,
+                     detail::RowChannel& channel) {
+            PooledConnection conn;
+            sqlite3_stmt* stmt = 0;
+            int retcode = pool_.Checkout(&conn);
+            if (retcode == SQLITE_OK) {
+                retcode = conn.Prepare(sql.c_str(), &stmt);
+            }
+            if (retcode == SQLITE_OK) {
+                sqlite3_bind_int64(stmt, 1, range.first);
+                sqlite3_bind_int64(stmt, 2, range.last);
+            }
+            std::vector<ScanRow> batch;
+            while (retcode == SQLITE_OK && !stop) {
+                int stepped = sqlite3_step(stmt);
+                if (stepped == SQLITE_ROW) {
+                    ScanRow& row = batch.emplace_back();
+                    for (int c = 0; c < sqlite3_column_count(stmt); ++c) {
+                        row.push_back(detail::ReadScanValue(stmt, c));
+                    }
+                    if (batch.size() < detail::RowChannel::kBatchRows) {
+                        continue;
+                    }
+                }
+                else if (stepped != SQLITE_DONE) {
+                    retcode = stepped;
+                    break;
+                }
+                if (!batch.empty()) {
+                    std::unique_lock<std::mutex> lock(channel.mutex);
+                    channel.changed.wait(lock, [&] {
+                        return channel.batches.size() < detail::RowChannel::kMaxBatches || stop;
+                    });
+                    channel.batches.push_back(std::move(batch));
+                    batch.clear();
+                    channel.changed.notify_all();
+                }
+                if (stepped == SQLITE_DONE) {
+                    break;
+                }
+            }
+            std::lock_guard<std::mutex> lock(channel.mutex);
+            channel.done = true;
+            channel.status = retcode;
+            channel.changed.notify_all();
+        }
+
+        static int Merge(AggregateKind kind, const std::vector<ScanRow>& partials, ScanValue* result) {
+            if (kind == AggregateKind::Count) {
+                result->type = SQLITE_INTEGER;
+            }
+            int64_t count = 0;
+            bool real = false;
+            double realSum = 0;
+            for (const ScanRow& partial : partials) {
+                const ScanValue& value = partial[0];
+                switch (kind) {
+                case AggregateKind::Count:
+                    result->integer += value.integer;
+                    break;
+                case AggregateKind::Min:
+                case AggregateKind::Max:
+                    if (value.type != SQLITE_NULL &&
+                        (result->type == SQLITE_NULL ||
+                         (CompareScanValues(value, *result) < 0) == (kind == AggregateKind::Min))) {
+                        *result = value;
+                    }
+                    break;
+                case AggregateKind::Sum:
+                case AggregateKind::Avg:
+                    if (kind == AggregateKind::Avg) {
+                        count += partial[1].integer;
+                    }
+                    if (value.type == SQLITE_NULL) {
+                        break;
+                    }
+                    realSum += value.AsDouble();
+                    real = real || value.type == SQLITE_FLOAT;
+                    if (result->type == SQLITE_NULL) {
+                        result->type = SQLITE_INTEGER;
+                    }
+                    else if (kind == AggregateKind::Sum && !real && ((value.integer > 0 && result->integer > INT64_MAX - value.integer) ||
+                                       (value.integer < 0 && result->integer < INT64_MIN - value.integer))) {
+                        // As sum() does on integer overflow.
+                        return SQLITE_ERROR;
+                    }
+                    result->integer += value.integer;
+                    break;
+                }
+            }
+            if ((kind == AggregateKind::Sum || kind == AggregateKind::Avg) && real) {
+                result->type = SQLITE_FLOAT;
+                result->real = realSum;
+            }
+            if (kind == AggregateKind::Avg) {
+                if (count == 0) {
+                    *result = ScanValue();
+                }
+                else {
+                    // avg() accumulates in floating point and cannot overflow.
+                    result->type = SQLITE_FLOAT;
+                    result->real = realSum / count;
+                }
+            }
+            return SQLITE_OK;
+        }
+
+        ConnectionPool& pool_;
+    };
+}
@@ -0,0 +1,220 @@
+//
+// reader_writer_harness.h
+//
+// One writer connection and N reader connections on the same Students
+// database, in a chosen journal mode. In the rollback-journal modes (DELETE,
+// TRUNCATE, PERSIST) a committing writer locks readers out. In WAL mode
+// readers keep reading the last committed snapshot while the writer appends
+// to the -wal file. The harness drives both paths of normal_test.cpp,
+// SELECT COUNT(SID) on the readers and INSERT on the writer, either one call
+// at a time or with every connection on its own thread.
+//
+
+#pragma once
+
+#include "sqlite3.h"
+
+#include "test_support.h"
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace sqlite3tests {
+
+    enum class JournalMode { Delete, Truncate, Persist, Wal };
+
+    inline const char* JournalModeName(JournalMode mode) {
+        switch (mode) {
+        case JournalMode::Delete: return "delete";
+        case JournalMode::Truncate: return "truncate";
+        case JournalMode::Persist: return "persist";
+        default: return "wal";
+        }
+    }
+
+    struct ReaderWriterOptions {
+        std::string path;
+        JournalMode mode = JournalMode::Wal;
+        int readers = 4;
+        /// <summary>
+        /// Applied to every connection. With 0, a blocked call returns
+        /// SQLITE_BUSY at once and is counted instead of waited out.
+        /// </summary>
+        int busyTimeoutMs = 5000;
+    };
+
+    struct ReaderWriterStats {
+        long long reads = 0;
+        long long readBusy = 0;
+        long long writes = 0;
+        long long writeBusy = 0;
+        double seconds = 0;
+        double readP50Micros = 0;
+        double readP99Micros = 0;
+    };
+
+    class ReaderWriterHarness {
+    public:
+        ReaderWriterHarness() = default;
+        ReaderWriterHarness(const ReaderWriterHarness&) = delete;
+        ReaderWriterHarness& operator=(const ReaderWriterHarness&) = delete;
+
+        ~ReaderWriterHarness() { Close(); }
+
+        /// <summary>
+        /// Switches the database at options.path to options.mode through the
+        /// writer, then opens the readers read-only. The file must already
+        /// hold the Students table.
+        /// </summary>
+        int Open(const ReaderWriterOptions& options) {
+            Close();
+            options_ = options;
+            int retcode = OpenConnection(SQLITE_OPEN_READWRITE, &writer_);
+            if (retcode == SQLITE_OK) {
+                std::string sql = std::string("pragma journal_mode = ") + JournalModeName(options.mode);
+                retcode = sqlite3_exec(writer_, sql.c_str(), 0, 0, 0);
+            }
+            if (retcode == SQLITE_OK) {
+                retcode = sqlite3_prepare_v2(writer_, "insert into Students values (?)", -1, &insert_, 0);
+            }
+            for (int i = 0; retcode == SQLITE_OK && i < options.readers; ++i) {
+                sqlite3* reader = 0;
+                retcode = OpenConnection(SQLITE_OPEN_READONLY, &reader);
+                readers_.push_back(reader);
+                counts_.push_back(0);
+                if (retcode == SQLITE_OK) {
+                    retcode = sqlite3_prepare_v2(reader, "select COUNT(SID) from Students", -1, &counts_.back(), 0);
+                }
+            }
+            if (retcode != SQLITE_OK) {
+                Close();
+            }
+            return retcode;
+        }
+
+        void Close() {
+            for (size_t i = 0; i < readers_.size(); ++i) {
+                sqlite3_finalize(counts_[i]);
+                sqlite3_close(readers_[i]);
+            }
+            readers_.clear();
+            counts_.clear();
+            sqlite3_finalize(insert_);
+            insert_ = 0;
+            sqlite3_close(writer_);
+            writer_ = 0;
+        }
+
+        /// <summary>
+        /// The journal mode the writer reports, e.g. to confirm WAL took.
+        /// </summary>
+        std::string ActiveJournalMode() {
+            std::string mode;
+            sqlite3_stmt* stmt = 0;
+            if (sqlite3_prepare_v2(writer_, "pragma journal_mode", -1, &stmt, 0) == SQLITE_OK &&
+                sqlite3_step(stmt) == SQLITE_ROW) {
+                mode = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
+            }
+            sqlite3_finalize(stmt);
+            return mode;
+        }
+
+        sqlite3* Writer() const { return writer_; }
+
+        sqlite3* Reader(int index) const { return readers_[index]; }
+
+        int Readers() const { return static_cast<int>(readers_.size()); }
+
+        /// <summary>
+        /// INSERT of normal_test.cpp on the writer; commits on its own unless
+        /// the caller has opened a transaction.
+        /// </summary>
+        int Insert(long long sid) {
+            sqlite3_bind_int64(insert_, 1, sid);
+            int retcode = sqlite3_step(insert_);
+            sqlite3_reset(insert_);
+            return retcode == SQLITE_DONE ? SQLITE_OK : retcode;
+        }
+
+        /// <summary>
+        /// SELECT COUNT(SID) of normal_test.cpp on reader index.
+        /// </summary>
+        int CountStudents(int index, long long* count) {
+            sqlite3_stmt* stmt = counts_[index];
+            int retcode = sqlite3_step(stmt);
+            if (retcode == SQLITE_ROW) {
+                *count = sqlite3_column_int64(stmt, 0);
+                retcode = SQLITE_OK;
+            }
+            sqlite3_reset(stmt);
+            return retcode;
+        }
+
+        /// <summary>
+        /// Runs every reader and the writer on threads of their own for the
+        /// given time. The writer commits one insert after another.
+        /// </summary>
+        ReaderWriterStats Run(std::chrono::milliseconds duration) {
+            std::atomic<bool> stop(false);
+            std::atomic<long long> reads(0);
+            std::atomic<long long> readBusy(0);
+            std::atomic<long long> writes(0);
+            std::atomic<long long> writeBusy(0);
+            std::vector<std::vector<double>> latencies(readers_.size());
+            int numReaders = Readers();
+
+            ReaderWriterStats stats;
+            std::thread timer([&] {
+                std::this_thread::sleep_for(duration);
+                stop = true;
+            });
+            stats.seconds = RunThreads(numReaders + 1, [&](int thread) {
+                if (thread == numReaders) {
+                    for (long long sid = 1; !stop; ++sid) {
+                        int retcode = Insert(sid);
+                        ++(retcode == SQLITE_OK ? writes : writeBusy);
+                    }
+                    return;
+                }
+                long long count = 0;
+                while (!stop) {
+                    Stopwatch watch;
+                    int retcode = CountStudents(thread, &count);
+                    latencies[thread].push_back(watch.Micros());
+                    ++(retcode == SQLITE_OK ? reads : readBusy);
+                }
+            });
+            timer.join();
+
+            std::vector<double> all;
+            for (auto& samples : latencies) {
+                all.insert(all.end(), samples.begin(), samples.end());
+            }
+            stats.reads = reads;
+            stats.readBusy = readBusy;
+            stats.writes = writes;
+            stats.writeBusy = writeBusy;
+            stats.readP50Micros = Percentile(all, 50);
+            stats.readP99Micros = Percentile(all, 99);
+            return stats;
+        }
+
+    private:
+        int OpenConnection(int flags, sqlite3** db) {
+            int retcode = sqlite3_open_v2(options_.path.c_str(), db, flags, 0);
+            if (retcode == SQLITE_OK) {
+                sqlite3_busy_timeout(*db, options_.busyTimeoutMs);
+            }
+            return retcode;
+        }
+
+        ReaderWriterOptions options_;
+        sqlite3* writer_ = 0;
+        sqlite3_stmt* insert_ = 0;
+        std::vector<sqlite3*> readers_;
+        std::vector<sqlite3_stmt*> counts_;
+    };
+}
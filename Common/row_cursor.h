@@ -0,0 +1,208 @@
+//
+// row_cursor.h
+//
+// A typed, allocation-free way to read result rows. sqlite3_exec hands its
+// callback every value as text, so integers are formatted into a buffer by
+// SQLite and parsed back by the caller on every row. RowCursor steps the
+// statement itself and reads columns with the sqlite3_column_* accessor
+// matching the type asked for. Text and blobs come back as views into
+// SQLite's own buffers.
+//
+// Views stay valid until the cursor moves to the next row, or the statement
+// is reset or finalized.
+//
+// Requires C++20 for std::span.
+//
+
+#pragma once
+
+#include "sqlite3.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <span>
+#include <string_view>
+#include <type_traits>
+
+namespace sqlite3tests {
+
+    /// <summary>
+    /// The current row of a RowCursor.
+    /// </summary>
+    class Row {
+    public:
+        explicit Row(sqlite3_stmt* stmt = 0) : stmt_(stmt) {}
+
+        int Columns() const { return sqlite3_column_count(stmt_); }
+
+        const char* Name(int column) const { return sqlite3_column_name(stmt_, column); }
+
+        /// <summary>
+        /// SQLITE_INTEGER, SQLITE_FLOAT, SQLITE_TEXT, SQLITE_BLOB or
+        /// SQLITE_NULL, before any conversion by the accessors below.
+        /// </summary>
+        int Type(int column) const { return sqlite3_column_type(stmt_, column); }
+
+        bool IsNull(int column) const { return Type(column) == SQLITE_NULL; }
+
+        int Int(int column) const { return sqlite3_column_int(stmt_, column); }
+
+        int64_t Int64(int column) const { return sqlite3_column_int64(stmt_, column); }
+
+        double Double(int column) const { return sqlite3_column_double(stmt_, column); }
+
+        std::string_view Text(int column) const {
+            // The pointer first: sqlite3_column_bytes then measures the same
+            // representation.
+            const unsigned char* text = sqlite3_column_text(stmt_, column);
+            int bytes = sqlite3_column_bytes(stmt_, column);
+            return text != nullptr ? std::string_view(reinterpret_cast<const char*>(text), bytes) : std::string_view();
+        }
+
+        std::span<const std::byte> Blob(int column) const {
+            const void* blob = sqlite3_column_blob(stmt_, column);
+            int bytes = sqlite3_column_bytes(stmt_, column);
+            return blob != nullptr ? std::span<const std::byte>(static_cast<const std::byte*>(blob), bytes)
+                                   : std::span<const std::byte>();
+        }
+
+        /// <summary>
+        /// Get&lt;int64_t&gt;(0) and so on, for generic code.
+        /// </summary>
+        template <class T>
+        T Get(int column) const {
+            if constexpr (std::is_same_v<T, int>) {
+                return Int(column);
+            }
+            else if constexpr (std::is_same_v<T, int64_t>) {
+                return Int64(column);
+            }
+            else if constexpr (std::is_same_v<T, double>) {
+                return Double(column);
+            }
+            else if constexpr (std::is_same_v<T, std::string_view>) {
+                return Text(column);
+            }
+            else {
+                static_assert(std::is_same_v<T, std::span<const std::byte>>, "unsupported column type");
+                return Blob(column);
+            }
+        }
+
+        sqlite3_stmt* Statement() const { return stmt_; }
+
+    private:
+        sqlite3_stmt* stmt_;
+    };
+
+    /// <summary>
+    /// Steps a statement row by row. Either borrows a statement, which is
+    /// reset when the cursor ends, or owns one made by Open.
+    /// </summary>
+    class RowCursor {
+    public:
+        RowCursor() = default;
+
+        explicit RowCursor(sqlite3_stmt* stmt) : stmt_(stmt) {}
+
+        RowCursor(const RowCursor&) = delete;
+        RowCursor& operator=(const RowCursor&) = delete;
+
+        ~RowCursor() { Close(); }
+
+        /// <summary>
+        /// Prepares sql into a statement the cursor owns.
+        /// </summary>
+        int Open(sqlite3* db, const char* sql) {
+            Close();
+            status_ = sqlite3_prepare_v2(db, sql, -1, &stmt_, 0);
+            owned_ = true;
+            return status_;
+        }
+
+        void Close() {
+            if (stmt_ != 0) {
+                if (owned_) {
+                    sqlite3_finalize(stmt_);
+                }
+                else {
+                    sqlite3_reset(stmt_);
+                }
+            }
+            stmt_ = 0;
+            owned_ = false;
+        }
+
+        /// <summary>
+        /// Moves to the next row; false at the end or on error, which
+        /// Status() then tells apart.
+        /// </summary>
+        bool Next() {
+            if (stmt_ == 0) {
+                return false;
+            }
+            int retcode = sqlite3_step(stmt_);
+            if (retcode == SQLITE_ROW) {
+                return true;
+            }
+            status_ = retcode == SQLITE_DONE ? SQLITE_OK : retcode;
+            return false;
+        }
+
+        /// <summary>
+        /// SQLITE_OK, or the error that ended the rows.
+        /// </summary>
+        int Status() const { return status_; }
+
+        Row Current() const { return Row(stmt_); }
+
+        class iterator {
+        public:
+            using iterator_category = std::input_iterator_tag;
+            using value_type = Row;
+            using difference_type = std::ptrdiff_t;
+            using pointer = const Row*;
+            using reference = const Row&;
+
+            iterator() = default;
+
+            explicit iterator(RowCursor* cursor) : cursor_(cursor), row_(cursor->stmt_) {
+                if (!cursor_->Next()) {
+                    cursor_ = nullptr;
+                }
+            }
+
+            const Row& operator*() const { return row_; }
+
+            const Row* operator->() const { return &row_; }
+
+            iterator& operator++() {
+                if (!cursor_->Next()) {
+                    cursor_ = nullptr;
+                }
+                return *this;
+            }
+
+            bool operator==(const iterator& other) const { return cursor_ == other.cursor_; }
+
+            bool operator!=(const iterator& other) const { return cursor_ != other.cursor_; }
+
+        private:
+            RowCursor* cursor_ = nullptr;
+            Row row_;
+        };
+
+        /// <summary>
+        /// Range-for over the remaining rows: for (const Row&amp; row : cursor).
+        /// </summary>
+        iterator begin() { return iterator(this); }
+
+        iterator end() { return iterator(); }
+
+    private:
+        sqlite3_stmt* stmt_ = 0;
+        bool owned_ = false;
+        int status_ = SQLITE_OK;
+    };
+}
@@ -0,0 +1,87 @@
+//
+// scan_value.h
+//
+// Column values copied out of a statement, for results that must outlive
+// the next sqlite3_step: rows handed between threads, partial results, and
+// rows held by in-memory virtual tables.
+//
+
+#pragma once
+
+#include "sqlite3.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace sqlite3tests {
+
+    /// <summary>
+    /// A copied column value: type is SQLITE_NULL, SQLITE_INTEGER,
+    /// SQLITE_FLOAT, SQLITE_TEXT or SQLITE_BLOB; text and blobs use bytes.
+    /// </summary>
+    struct ScanValue {
+        int type = SQLITE_NULL;
+        int64_t integer = 0;
+        double real = 0;
+        std::string bytes;
+
+        double AsDouble() const { return type == SQLITE_INTEGER ? static_cast<double>(integer) : real; }
+    };
+
+    using ScanRow = std::vector<ScanValue>;
+
+    /// <summary>
+    /// Orders values the way SQLite does with the BINARY collation: NULLs,
+    /// then numbers, then text, then blobs.
+    /// </summary>
+    inline int CompareScanValues(const ScanValue& a, const ScanValue& b) {
+        auto rank = [](int type) { return type == SQLITE_FLOAT ? SQLITE_INTEGER : type == SQLITE_NULL ? 0 : type; };
+        if (rank(a.type) != rank(b.type)) {
+            return rank(a.type) < rank(b.type) ? -1 : 1;
+        }
+        switch (a.type) {
+        case SQLITE_NULL:
+            return 0;
+        case SQLITE_INTEGER:
+        case SQLITE_FLOAT:
+            if (a.type == SQLITE_INTEGER && b.type == SQLITE_INTEGER) {
+                return a.integer < b.integer ? -1 : a.integer > b.integer ? 1 : 0;
+            }
+            return a.AsDouble() < b.AsDouble() ? -1 : a.AsDouble() > b.AsDouble() ? 1 : 0;
+        default: {
+            int c = std::memcmp(a.bytes.data(), b.bytes.data(), std::min(a.bytes.size(), b.bytes.size()));
+            if (c != 0) {
+                return c;
+            }
+            return a.bytes.size() < b.bytes.size() ? -1 : a.bytes.size() > b.bytes.size() ? 1 : 0;
+        }
+        }
+    }
+
+    namespace detail {
+        inline ScanValue ReadScanValue(sqlite3_stmt* stmt, int column) {
+            ScanValue value;
+            value.type = sqlite3_column_type(stmt, column);
+            switch (value.type) {
+            case SQLITE_INTEGER:
+                value.integer = sqlite3_column_int64(stmt, column);
+                break;
+            case SQLITE_FLOAT:
+                value.real = sqlite3_column_double(stmt, column);
+                break;
+            case SQLITE_TEXT:
+            case SQLITE_BLOB: {
+                const char* data = static_cast<const char*>(sqlite3_column_blob(stmt, column));
+                value.bytes.assign(data != nullptr ? data : "", sqlite3_column_bytes(stmt, column));
+                break;
+            }
+            default:
+                break;
+            }
+            return value;
+        }
+    }
+}
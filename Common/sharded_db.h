@@ -0,0 +1,210 @@
+//
+// sharded_db.h
+//
+// LIB_CONN_DB_CONN attaches MyDBExtn to MyDB so that one connection can join
+// across both files, but every write still goes through one database lock.
+// ShardedDb spreads a table over N files, hash-partitioned by a key such as
+// SID. Each shard has a connection of its own, so a point write locks only
+// its own file, and writers on different shards commit in parallel.
+// Scatter/gather queries run on every shard connection at once, on a thread
+// per shard.
+//
+// Optionally, one more connection ATTACHes every shard as shard0..shardN-1.
+// It serves ad-hoc SQL across shards through temp UNION ALL views, and can
+// run transactions that span shards. Those are atomic across files only in
+// rollback-journal mode, not in WAL. It is limited by SQLITE_MAX_ATTACHED,
+// which defaults to 10.
+//
+
+#pragma once
+
+#include "sqlite3.h"
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace sqlite3tests {
+
+    struct ShardedDbOptions {
+        /// <summary>
+        /// One database file per shard; the order fixes the key mapping.
+        /// </summary>
+        std::vector<std::string> paths;
+        int busyTimeoutMs = 5000;
+        /// <summary>
+        /// Executed once on every shard connection, e.g. journal settings.
+        /// </summary>
+        std::vector<std::string> warmupSql;
+        /// <summary>
+        /// Also open the connection with every shard attached.
+        /// </summary>
+        bool attach = false;
+    };
+
+    class ShardedDb {
+    public:
+        using Work = std::function<int(sqlite3*)>;
+
+        ShardedDb() = default;
+        ShardedDb(const ShardedDb&) = delete;
+        ShardedDb& operator=(const ShardedDb&) = delete;
+
+        ~ShardedDb() { Close(); }
+
+        int Open(const ShardedDbOptions& options) {
+            if (options.paths.empty() || !shards_.empty()) {
+                return SQLITE_MISUSE;
+            }
+            int retcode = SQLITE_OK;
+            for (size_t i = 0; retcode == SQLITE_OK && i < options.paths.size(); ++i) {
+                std::unique_ptr<Shard> shard(new Shard());
+                retcode = OpenConnection(options.paths[i], options.busyTimeoutMs, &shard->db);
+                for (size_t j = 0; retcode == SQLITE_OK && j < options.warmupSql.size(); ++j) {
+                    retcode = sqlite3_exec(shard->db, options.warmupSql[j].c_str(), 0, 0, 0);
+                }
+                shards_.push_back(std::move(shard));
+            }
+            if (retcode == SQLITE_OK && options.attach) {
+                retcode = OpenConnection(":memory:", options.busyTimeoutMs, &attached_);
+                for (size_t i = 0; retcode == SQLITE_OK && i < options.paths.size(); ++i) {
+                    char* sql = sqlite3_mprintf("attach database %Q as shard%d", options.paths[i].c_str(), static_cast<int>(i));
+                    retcode = sqlite3_exec(attached_, sql, 0, 0, 0);
+                    sqlite3_free(sql);
+                }
+            }
+            if (retcode != SQLITE_OK) {
+                Close();
+            }
+            return retcode;
+        }
+
+        void Close() {
+            for (auto& shard : shards_) {
+                sqlite3_close(shard->db);
+            }
+            shards_.clear();
+            sqlite3_close(attached_);
+            attached_ = 0;
+        }
+
+        int Shards() const { return static_cast<int>(shards_.size()); }
+
+        /// <summary>
+        /// The shard that owns key. Keys are mixed first, so that sequential
+        /// SIDs spread evenly instead of striping by key % N. -1 when no
+        /// shards are open, which Route and OnShard reject as SQLITE_MISUSE.
+        /// </summary>
+        int ShardOf(int64_t key) const {
+            if (shards_.empty()) {
+                return -1;
+            }
+            uint64_t x = static_cast<uint64_t>(key);
+            x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+            x ^= x >> 31;
+            return static_cast<int>(x % shards_.size());
+        }
+
+        /// <summary>
+        /// Runs work on the connection of the shard that owns key, holding
+        /// only that shard's lock.
+        /// </summary>
+        int Route(int64_t key, const Work& work) {
+            return OnShard(ShardOf(key), work);
+        }
+
+        /// <summary>
+        /// Runs work on one shard's connection. Calls for the same shard are
+        /// serialized, because a connection serves one thread at a time in
+        /// multi-thread mode.
+        /// </summary>
+        int OnShard(int shard, const Work& work) {
+            if (shard < 0 || shard >= Shards()) {
+                return SQLITE_MISUSE;
+            }
+            std::lock_guard<std::mutex> lock(shards_[shard]->mutex);
+            return work(shards_[shard]->db);
+        }
+
+        /// <summary>
+        /// Runs body(db, shard) on every shard in parallel, a thread per
+        /// shard, and returns the first error. Used for scatter/gather
+        /// queries and for schema changes that every shard needs.
+        /// </summary>
+        int ScatterGather(const std::function<int(sqlite3*, int)>& body) {
+            std::vector<int> retcodes(shards_.size(), SQLITE_OK);
+            std::vector<std::thread> threads;
+            for (int i = 0; i < Shards(); ++i) {
+                threads.emplace_back([this, &body, &retcodes, i] {
+                    retcodes[i] = OnShard(i, [&body, i](sqlite3* db) { return body(db, i); });
+                });
+            }
+            for (std::thread& thread : threads) {
+                thread.join();
+            }
+            for (int retcode : retcodes) {
+                if (retcode != SQLITE_OK) {
+                    return retcode;
+                }
+            }
+            return SQLITE_OK;
+        }
+
+        /// <summary>
+        /// Executes sql on every shard, e.g. "create table Students(SID INTEGER)".
+        /// </summary>
+        int ExecAll(const std::string& sql) {
+            return ScatterGather([&sql](sqlite3* db, int) { return sqlite3_exec(db, sql.c_str(), 0, 0, 0); });
+        }
+
+        /// <summary>
+        /// The connection with every shard attached, or null without
+        /// options.attach. Callers serialize their own use of it.
+        /// </summary>
+        sqlite3* Attached() const { return attached_; }
+
+        /// <summary>
+        /// Creates the temp view "table" on the attached connection as the
+        /// UNION ALL of the table on every shard.
+        /// </summary>
+        int CreateUnionView(const std::string& table) {
+            if (attached_ == 0) {
+                return SQLITE_MISUSE;
+            }
+            char* sql = sqlite3_mprintf("create temp view \"%w\" as ", table.c_str());
+            std::string view = sql;
+            sqlite3_free(sql);
+            for (int i = 0; i < Shards(); ++i) {
+                sql = sqlite3_mprintf("%sselect * from shard%d.\"%w\"", i == 0 ? "" : " union all ", i, table.c_str());
+                view += sql;
+                sqlite3_free(sql);
+            }
+            return sqlite3_exec(attached_, view.c_str(), 0, 0, 0);
+        }
+
+    private:
+        struct Shard {
+            sqlite3* db = 0;
+            std::mutex mutex;
+        };
+
+        static int OpenConnection(const std::string& path, int busyTimeoutMs, sqlite3** db) {
+            int retcode = sqlite3_open(path.c_str(), db);
+            if (retcode != SQLITE_OK) {
+                sqlite3_close(*db);
+                *db = 0;
+                return retcode;
+            }
+            sqlite3_busy_timeout(*db, busyTimeoutMs);
+            return SQLITE_OK;
+        }
+
+        std::vector<std::unique_ptr<Shard>> shards_;
+        sqlite3* attached_ = 0;
+    };
+}
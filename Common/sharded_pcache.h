@@ -0,0 +1,475 @@
+//
+// sharded_pcache.h
+//
+// An sqlite3_pcache_methods2 implementation for SQLITE_CONFIG_PCACHE2.
+//
+// Page memory comes from one slab preallocated at sqlite3_initialize and
+// split into shards, each with its own lock and free list; a thread takes
+// pages from its home shard and only visits the others when that runs dry.
+// The built-in cache serves a SQLITE_CONFIG_PAGECACHE slab under a single
+// global mutex, which is what every connection in a pooled deployment ends
+// up queueing on.
+//
+// Each sqlite3_pcache belongs to one connection, and SQLite never calls into
+// it from two threads at once, so the per-cache hash table and CLOCK ring
+// need no locking.
+//
+
+#pragma once
+
+#include "sqlite3.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+namespace sqlite3tests {
+
+    struct ShardedPageCacheOptions {
+        int shards = 16;
+        /// <summary>
+        /// Size of the preallocated slab; 0 takes every page from the heap.
+        /// </summary>
+        long long slabBytes = 32LL * 1024 * 1024;
+        /// <summary>
+        /// Largest szPage + szExtra a slab slot holds; caches with bigger pages
+        /// use the heap.
+        /// </summary>
+        int slotBytes = 4096 + 512;
+    };
+
+    struct PageCacheStats {
+        long long hits = 0;
+        long long misses = 0;
+        long long evictions = 0;
+        long long slabPages = 0;
+        long long heapPages = 0;
+    };
+
+    namespace detail {
+
+        const std::uint8_t kHeapOrigin = 0xff;
+
+        struct CachePage {
+            sqlite3_pcache_page base;
+            CachePage* hashNext;
+            unsigned key;
+            std::uint32_t clockIndex;
+            bool pinned;
+            bool referenced;
+            std::uint8_t origin;
+        };
+
+        struct SlabShard {
+            std::mutex lock;
+            std::vector<char*> free;
+        };
+
+        struct CacheCounters {
+            std::atomic<long long> hits{ 0 };
+            std::atomic<long long> misses{ 0 };
+            std::atomic<long long> evictions{ 0 };
+
+            // Only the owning connection writes, so a plain add is enough.
+            static void Bump(std::atomic<long long>& counter) {
+                counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            }
+        };
+
+        struct PcacheGlobals {
+            ShardedPageCacheOptions options;
+            char* slab = nullptr;
+            std::vector<SlabShard> shards;
+            std::atomic<long long> heapPages{ 0 };
+
+            std::mutex registryLock;
+            std::unordered_set<CacheCounters*> live;
+            PageCacheStats retired;
+        };
+
+        inline PcacheGlobals& Pcache() {
+            static PcacheGlobals globals;
+            return globals;
+        }
+
+        inline int HomeShard(int shards) {
+            static thread_local int home = static_cast<int>(
+                std::hash<std::thread::id>()(std::this_thread::get_id()) % 0x7fffffff);
+            return home % shards;
+        }
+
+        inline char* AllocSlot(int bytes, std::uint8_t* origin) {
+            PcacheGlobals& globals = Pcache();
+            int shards = static_cast<int>(globals.shards.size());
+            if (shards > 0 && bytes <= globals.options.slotBytes) {
+                int home = HomeShard(shards);
+                for (int i = 0; i < shards; ++i) {
+                    SlabShard& shard = globals.shards[(home + i) % shards];
+                    std::lock_guard<std::mutex> lock(shard.lock);
+                    if (!shard.free.empty()) {
+                        char* slot = shard.free.back();
+                        shard.free.pop_back();
+                        *origin = static_cast<std::uint8_t>((home + i) % shards);
+                        return slot;
+                    }
+                }
+            }
+            char* slot = static_cast<char*>(std::malloc(bytes));
+            if (slot != nullptr) {
+                *origin = kHeapOrigin;
+                globals.heapPages.fetch_add(1, std::memory_order_relaxed);
+            }
+            return slot;
+        }
+
+        inline void FreeSlot(char* slot, std::uint8_t origin) {
+            PcacheGlobals& globals = Pcache();
+            if (origin == kHeapOrigin) {
+                globals.heapPages.fetch_sub(1, std::memory_order_relaxed);
+                std::free(slot);
+                return;
+            }
+            SlabShard& shard = globals.shards[origin];
+            std::lock_guard<std::mutex> lock(shard.lock);
+            shard.free.push_back(slot);
+        }
+
+        struct ShardedCache {
+            int szPage = 0;
+            int szExtra = 0;
+            bool purgeable = false;
+            unsigned maxPages = 100;
+            std::vector<CachePage*> buckets;
+            std::vector<CachePage*> clock;
+            std::uint32_t hand = 0;
+            CacheCounters counters;
+
+            CachePage** Bucket(unsigned key) {
+                return &buckets[(key * 2654435761u) & (buckets.size() - 1)];
+            }
+
+            CachePage* Find(unsigned key) {
+                for (CachePage* page = *Bucket(key); page != nullptr; page = page->hashNext) {
+                    if (page->key == key) {
+                        return page;
+                    }
+                }
+                return nullptr;
+            }
+
+            void Unlink(CachePage* page) {
+                CachePage** link = Bucket(page->key);
+                while (*link != page) {
+                    link = &(*link)->hashNext;
+                }
+                *link = page->hashNext;
+            }
+
+            void Link(CachePage* page) {
+                CachePage** bucket = Bucket(page->key);
+                page->hashNext = *bucket;
+                *bucket = page;
+            }
+
+            void Grow() {
+                std::vector<CachePage*> old;
+                old.swap(buckets);
+                buckets.assign(old.size() * 2, nullptr);
+                for (CachePage* head : old) {
+                    while (head != nullptr) {
+                        CachePage* next = head->hashNext;
+                        Link(head);
+                        head = next;
+                    }
+                }
+            }
+
+            void Remove(CachePage* page) {
+                Unlink(page);
+                CachePage* last = clock.back();
+                clock[page->clockIndex] = last;
+                last->clockIndex = page->clockIndex;
+                clock.pop_back();
+                if (hand >= clock.size()) {
+                    hand = 0;
+                }
+                FreeSlot(reinterpret_cast<char*>(page), page->origin);
+            }
+
+            /// <summary>
+            /// CLOCK: sweep from the hand, giving referenced pages a second
+            /// chance, and take the first unpinned, unreferenced page.
+            /// </summary>
+            CachePage* Victim() {
+                size_t n = clock.size();
+                for (size_t step = 0; step < 2 * n; ++step) {
+                    CachePage* page = clock[hand];
+                    hand = (hand + 1) % static_cast<std::uint32_t>(n);
+                    if (page->pinned) {
+                        continue;
+                    }
+                    if (page->referenced) {
+                        page->referenced = false;
+                        continue;
+                    }
+                    return page;
+                }
+                return nullptr;
+            }
+
+            bool EvictOne() {
+                CachePage* victim = Victim();
+                if (victim == nullptr) {
+                    return false;
+                }
+                Remove(victim);
+                CacheCounters::Bump(counters.evictions);
+                return true;
+            }
+
+            CachePage* Create(unsigned key, int createFlag) {
+                int bytes = static_cast<int>(sizeof(CachePage)) + szPage + szExtra;
+                if (purgeable && clock.size() >= maxPages && !EvictOne() && createFlag == 1) {
+                    return nullptr;
+                }
+                std::uint8_t origin = kHeapOrigin;
+                char* slot = AllocSlot(bytes, &origin);
+                if (slot == nullptr) {
+                    return nullptr;
+                }
+                CachePage* page = reinterpret_cast<CachePage*>(slot);
+                page->base.pBuf = slot + sizeof(CachePage);
+                page->base.pExtra = slot + sizeof(CachePage) + szPage;
+                std::memset(page->base.pExtra, 0, szExtra);
+                page->key = key;
+                page->pinned = true;
+                // The creating fetch is a miss; only a later hit earns a second chance.
+                page->referenced = false;
+                page->origin = origin;
+                page->clockIndex = static_cast<std::uint32_t>(clock.size());
+                clock.push_back(page);
+                if (clock.size() > buckets.size()) {
+                    Grow();
+                }
+                Link(page);
+                return page;
+            }
+        };
+
+        inline ShardedCache* AsCache(sqlite3_pcache* cache) {
+            return reinterpret_cast<ShardedCache*>(cache);
+        }
+
+        inline CachePage* AsPage(sqlite3_pcache_page* page) {
+            return reinterpret_cast<CachePage*>(page);
+        }
+
+        inline int PcacheInit(void*) {
+            PcacheGlobals& globals = Pcache();
+            const ShardedPageCacheOptions& options = globals.options;
+            long long slots = options.slabBytes / options.slotBytes;
+            if (slots <= 0 || options.shards <= 0 || options.shards >= kHeapOrigin) {
+                return SQLITE_OK;
+            }
+            globals.slab = static_cast<char*>(std::malloc(static_cast<size_t>(slots * options.slotBytes)));
+            if (globals.slab == nullptr) {
+                return SQLITE_NOMEM;
+            }
+            globals.shards = std::vector<SlabShard>(options.shards);
+            for (long long i = 0; i < slots; ++i) {
+                globals.shards[i % options.shards].free.push_back(globals.slab + i * options.slotBytes);
+            }
+            return SQLITE_OK;
+        }
+
+        inline void PcacheShutdown(void*) {
+            PcacheGlobals& globals = Pcache();
+            globals.shards.clear();
+            std::free(globals.slab);
+            globals.slab = nullptr;
+        }
+
+        inline sqlite3_pcache* PcacheCreate(int szPage, int szExtra, int bPurgeable) {
+            ShardedCache* cache = new (std::nothrow) ShardedCache();
+            if (cache == nullptr) {
+                return 0;
+            }
+            cache->szPage = szPage;
+            cache->szExtra = szExtra;
+            cache->purgeable = bPurgeable != 0;
+            cache->buckets.assign(64, nullptr);
+            PcacheGlobals& globals = Pcache();
+            std::lock_guard<std::mutex> lock(globals.registryLock);
+            globals.live.insert(&cache->counters);
+            return reinterpret_cast<sqlite3_pcache*>(cache);
+        }
+
+        inline void PcacheCachesize(sqlite3_pcache* handle, int nCachesize) {
+            ShardedCache* cache = AsCache(handle);
+            cache->maxPages = nCachesize > 0 ? static_cast<unsigned>(nCachesize) : 1;
+            while (cache->purgeable && cache->clock.size() > cache->maxPages && cache->EvictOne()) {
+            }
+        }
+
+        inline int PcachePagecount(sqlite3_pcache* handle) {
+            return static_cast<int>(AsCache(handle)->clock.size());
+        }
+
+        inline sqlite3_pcache_page* PcacheFetch(sqlite3_pcache* handle, unsigned key, int createFlag) {
+            ShardedCache* cache = AsCache(handle);
+            CachePage* page = cache->Find(key);
+            if (page != nullptr) {
+                page->pinned = true;
+                page->referenced = true;
+                CacheCounters::Bump(cache->counters.hits);
+                return &page->base;
+            }
+            if (createFlag == 0) {
+                return 0;
+            }
+            page = cache->Create(key, createFlag);
+            if (page == nullptr) {
+                return 0;
+            }
+            CacheCounters::Bump(cache->counters.misses);
+            return &page->base;
+        }
+
+        inline void PcacheUnpin(sqlite3_pcache* handle, sqlite3_pcache_page* base, int discard) {
+            ShardedCache* cache = AsCache(handle);
+            CachePage* page = AsPage(base);
+            if (discard) {
+                cache->Remove(page);
+                return;
+            }
+            page->pinned = false;
+            while (cache->purgeable && cache->clock.size() > cache->maxPages && cache->EvictOne()) {
+            }
+        }
+
+        inline void PcacheRekey(sqlite3_pcache* handle, sqlite3_pcache_page* base, unsigned oldKey, unsigned newKey) {
+            ShardedCache* cache = AsCache(handle);
+            CachePage* page = AsPage(base);
+            if (oldKey == newKey) {
+                return;
+            }
+            // Whatever newKey held is stale, and never pinned.
+            CachePage* stale = cache->Find(newKey);
+            if (stale != nullptr) {
+                cache->Remove(stale);
+            }
+            cache->Unlink(page);
+            page->key = newKey;
+            cache->Link(page);
+        }
+
+        inline void PcacheTruncate(sqlite3_pcache* handle, unsigned limit) {
+            ShardedCache* cache = AsCache(handle);
+            for (size_t i = cache->clock.size(); i-- > 0;) {
+                if (i < cache->clock.size() && cache->clock[i]->key >= limit) {
+                    cache->Remove(cache->clock[i]);
+                }
+            }
+        }
+
+        inline void PcacheShrink(sqlite3_pcache* handle) {
+            ShardedCache* cache = AsCache(handle);
+            for (size_t i = cache->clock.size(); i-- > 0;) {
+                if (i < cache->clock.size() && !cache->clock[i]->pinned) {
+                    cache->Remove(cache->clock[i]);
+                }
+            }
+        }
+
+        inline void PcacheDestroy(sqlite3_pcache* handle) {
+            ShardedCache* cache = AsCache(handle);
+            while (!cache->clock.empty()) {
+                cache->Remove(cache->clock.back());
+            }
+            PcacheGlobals& globals = Pcache();
+            {
+                std::lock_guard<std::mutex> lock(globals.registryLock);
+                globals.live.erase(&cache->counters);
+                globals.retired.hits += cache->counters.hits.load();
+                globals.retired.misses += cache->counters.misses.load();
+                globals.retired.evictions += cache->counters.evictions.load();
+            }
+            delete cache;
+        }
+    }
+
+    inline const sqlite3_pcache_methods2* ShardedPageCacheMethods() {
+        static const sqlite3_pcache_methods2 methods = {
+            1,
+            0,
+            detail::PcacheInit,
+            detail::PcacheShutdown,
+            detail::PcacheCreate,
+            detail::PcacheCachesize,
+            detail::PcachePagecount,
+            detail::PcacheFetch,
+            detail::PcacheUnpin,
+            detail::PcacheRekey,
+            detail::PcacheTruncate,
+            detail::PcacheDestroy,
+            detail::PcacheShrink,
+        };
+        return &methods;
+    }
+
+    /// <summary>
+    /// Shuts SQLite down and re-initializes it on the sharded page cache.
+    /// Every connection must be closed first.
+    /// </summary>
+    inline int InstallShardedPageCache(const ShardedPageCacheOptions& options = ShardedPageCacheOptions()) {
+        int retcode = sqlite3_shutdown();
+        if (retcode == SQLITE_OK) {
+            detail::Pcache().options = options;
+            retcode = sqlite3_config(SQLITE_CONFIG_PCACHE2, ShardedPageCacheMethods());
+        }
+        return retcode == SQLITE_OK ? sqlite3_initialize() : retcode;
+    }
+
+    /// <summary>
+    /// Puts the built-in page cache back; a zeroed method table makes
+    /// sqlite3_initialize pick it again.
+    /// </summary>
+    inline int RestoreDefaultPageCache() {
+        int retcode = sqlite3_shutdown();
+        sqlite3_pcache_methods2 defaults = {};
+        if (retcode == SQLITE_OK) {
+            retcode = sqlite3_config(SQLITE_CONFIG_PCACHE2, &defaults);
+        }
+        return retcode == SQLITE_OK ? sqlite3_initialize() : retcode;
+    }
+
+    /// <summary>
+    /// Totals over live caches and caches already destroyed.
+    /// </summary>
+    inline PageCacheStats ShardedPageCacheCounters() {
+        detail::PcacheGlobals& globals = detail::Pcache();
+        std::lock_guard<std::mutex> lock(globals.registryLock);
+        PageCacheStats stats = globals.retired;
+        for (detail::CacheCounters* counters : globals.live) {
+            stats.hits += counters->hits.load(std::memory_order_relaxed);
+            stats.misses += counters->misses.load(std::memory_order_relaxed);
+            stats.evictions += counters->evictions.load(std::memory_order_relaxed);
+        }
+        stats.heapPages = globals.heapPages.load(std::memory_order_relaxed);
+        long long freeSlots = 0;
+        for (detail::SlabShard& shard : globals.shards) {
+            std::lock_guard<std::mutex> shardLock(shard.lock);
+            freeSlots += static_cast<long long>(shard.free.size());
+        }
+        if (globals.options.slotBytes > 0 && globals.slab != nullptr) {
+            stats.slabPages = globals.options.slabBytes / globals.options.slotBytes - freeSlots;
+        }
+        return stats;
+    }
+}
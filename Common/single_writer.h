@@ -0,0 +1,318 @@
+//
+// single_writer.h
+//
+// One thread owns the only write connection and applies writes submitted by
+// any number of producers. Everything queued when the writer wakes up is
+// applied inside one BEGIN IMMEDIATE/COMMIT, so N concurrent inserts cost one
+// journal sync instead of N and never see SQLITE_BUSY from each other.
+//
+// With a commit window the writer becomes a group-commit engine: a group
+// stays open until the window has passed since its first write or maxBatch
+// writes have joined, trading commit latency for fewer syncs.
+//
+
+#pragma once
+
+#include "sqlite3.h"
+#include "mpsc_queue.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace sqlite3tests {
+
+    struct SingleWriterOptions {
+        std::string path;
+        /// <summary>
+        /// Upper bound on writes coalesced into one transaction.
+        /// </summary>
+        int maxBatch = 1024;
+        /// <summary>
+        /// How long a group stays open after its first write waiting for more.
+        /// Zero commits whatever is already queued straight away.
+        /// </summary>
+        std::chrono::microseconds commitWindow{ 0 };
+        /// <summary>
+        /// Wraps every write in its own SAVEPOINT so a failing write is rolled
+        /// back alone instead of leaving partial effects in the group.
+        /// </summary>
+        bool isolateWrites = false;
+        int busyTimeoutMs = 5000;
+    };
+
+    struct SingleWriterStats {
+        long long writes = 0;
+        long long batches = 0;
+        /// <summary>
+        /// Groups that had to be replayed because a failing write took the
+        /// whole transaction down with it.
+        /// </summary>
+        long long replays = 0;
+    };
+
+    class SingleWriter {
+    public:
+        using Work = std::function<int(sqlite3*)>;
+
+        SingleWriter() = default;
+        SingleWriter(const SingleWriter&) = delete;
+        SingleWriter& operator=(const SingleWriter&) = delete;
+
+        ~SingleWriter() { Close(); }
+
+        int Open(const SingleWriterOptions& options) {
+            if (running_ || options.maxBatch <= 0) {
+                return SQLITE_MISUSE;
+            }
+            int retcode = sqlite3_open(options.path.c_str(), &db_);
+            if (retcode != SQLITE_OK) {
+                sqlite3_close(db_);
+                db_ = 0;
+                return retcode;
+            }
+            sqlite3_busy_timeout(db_, options.busyTimeoutMs);
+            options_ = options;
+            stopping_ = false;
+            running_ = true;
+            thread_ = std::thread(&SingleWriter::Run, this);
+            return SQLITE_OK;
+        }
+
+        /// <summary>
+        /// Queues one SQL statement. The future yields SQLITE_OK once the batch
+        /// containing it has committed, or the statement's own error code.
+        /// </summary>
+        std::future<int> Submit(std::string sql) {
+            return Submit([this, sql](sqlite3* db) { return Step(db, sql); });
+        }
+
+        /// <summary>
+        /// Queues arbitrary work to run on the writer connection inside the
+        /// current batch; it must not BEGIN or COMMIT itself.
+        /// Must not race with Close.
+        /// </summary>
+        std::future<int> Submit(Work work) {
+            Request request;
+            request.work = std::move(work);
+            request.done = std::make_shared<std::promise<int>>();
+            std::future<int> result = request.done->get_future();
+            if (!running_) {
+                request.done->set_value(SQLITE_MISUSE);
+                return result;
+            }
+            queue_.Push(std::move(request));
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (parked_.load()) {
+                std::lock_guard<std::mutex> lock(mutex_);
+                wake_.notify_one();
+            }
+            return result;
+        }
+
+        /// <summary>
+        /// Applies everything already queued, then stops the writer thread and
+        /// closes the connection.
+        /// </summary>
+        void Close() {
+            if (!running_) {
+                return;
+            }
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                stopping_ = true;
+                wake_.notify_one();
+            }
+            thread_.join();
+            running_ = false;
+            for (auto& entry : statements_) {
+                sqlite3_finalize(entry.second);
+            }
+            statements_.clear();
+            sqlite3_close(db_);
+            db_ = 0;
+        }
+
+        SingleWriterStats Stats() const {
+            SingleWriterStats stats;
+            stats.writes = writes_.load();
+            stats.batches = batches_.load();
+            stats.replays = replays_.load();
+            return stats;
+        }
+
+    private:
+        struct Request {
+            Work work;
+            std::shared_ptr<std::promise<int>> done;
+        };
+
+        int Step(sqlite3* db, const std::string& sql) {
+            sqlite3_stmt*& stmt = statements_[sql];
+            if (stmt == 0) {
+                int retcode = sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, 0);
+                if (retcode != SQLITE_OK) {
+                    statements_.erase(sql);
+                    return retcode;
+                }
+            }
+            int retcode;
+            while ((retcode = sqlite3_step(stmt)) == SQLITE_ROW) {
+            }
+            sqlite3_reset(stmt);
+            return retcode == SQLITE_DONE ? SQLITE_OK : retcode;
+        }
+
+        /// <summary>
+        /// Parks until the queue is non-empty, Close was called or the deadline
+        /// passes. parked_ is published before the final emptiness check so a
+        /// producer either sees it and notifies, or its item is seen here.
+        /// </summary>
+        void Park(const std::chrono::steady_clock::time_point* deadline = nullptr) {
+            parked_.store(true);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            std::unique_lock<std::mutex> lock(mutex_);
+            auto ready = [this] { return !queue_.Empty() || stopping_; };
+            if (deadline == nullptr) {
+                wake_.wait(lock, ready);
+            }
+            else {
+                wake_.wait_until(lock, *deadline, ready);
+            }
+            parked_.store(false);
+        }
+
+        bool Stopping() {
+            std::lock_guard<std::mutex> lock(mutex_);
+            return stopping_;
+        }
+
+        /// <summary>
+        /// Fills batch with the next group: everything queued, then whatever
+        /// arrives within the commit window, up to maxBatch.
+        /// </summary>
+        void CollectGroup(std::vector<Request>& batch) {
+            Request request;
+            auto full = [&] { return static_cast<int>(batch.size()) >= options_.maxBatch; };
+            while (!full() && queue_.TryPop(request)) {
+                batch.push_back(std::move(request));
+            }
+            if (batch.empty() || options_.commitWindow.count() == 0) {
+                return;
+            }
+            auto deadline = std::chrono::steady_clock::now() + options_.commitWindow;
+            while (!full() && std::chrono::steady_clock::now() < deadline && !Stopping()) {
+                if (!queue_.TryPop(request)) {
+                    Park(&deadline);
+                    continue;
+                }
+                batch.push_back(std::move(request));
+            }
+        }
+
+        int RunIsolated(Request& request) {
+            int retcode = Step(db_, "savepoint single_writer");
+            if (retcode != SQLITE_OK) {
+                return retcode;
+            }
+            int result = request.work(db_);
+            if (sqlite3_get_autocommit(db_)) {
+                // The transaction is gone, savepoint included; ApplyGroup replays.
+                return result;
+            }
+            if (result != SQLITE_OK) {
+                Step(db_, "rollback to single_writer");
+            }
+            Step(db_, "release single_writer");
+            return result;
+        }
+
+        /// <summary>
+        /// Applies one group in one transaction. A write that takes the whole
+        /// transaction down is failed on its own and the rest of the group is
+        /// replayed in a fresh transaction.
+        /// </summary>
+        void ApplyGroup(std::vector<Request>& batch, std::vector<int>& results) {
+            std::vector<bool> failed(batch.size(), false);
+            results.assign(batch.size(), SQLITE_OK);
+            while (true) {
+                int retcode = sqlite3_exec(db_, "begin immediate", 0, 0, 0);
+                if (retcode != SQLITE_OK) {
+                    for (size_t i = 0; i < batch.size(); ++i) {
+                        results[i] = failed[i] ? results[i] : retcode;
+                    }
+                    return;
+                }
+                bool replay = false;
+                for (size_t i = 0; i < batch.size() && !replay; ++i) {
+                    if (failed[i]) {
+                        continue;
+                    }
+                    results[i] = options_.isolateWrites ? RunIsolated(batch[i]) : batch[i].work(db_);
+                    if (sqlite3_get_autocommit(db_)) {
+                        results[i] = results[i] != SQLITE_OK ? results[i] : SQLITE_ABORT;
+                        failed[i] = true;
+                        replay = true;
+                        ++replays_;
+                    }
+                }
+                if (replay) {
+                    continue;
+                }
+                retcode = sqlite3_exec(db_, "commit", 0, 0, 0);
+                if (retcode != SQLITE_OK) {
+                    sqlite3_exec(db_, "rollback", 0, 0, 0);
+                    for (size_t i = 0; i < batch.size(); ++i) {
+                        results[i] = failed[i] ? results[i] : retcode;
+                    }
+                }
+                return;
+            }
+        }
+
+        void Run() {
+            std::vector<Request> batch;
+            std::vector<int> results;
+            while (true) {
+                batch.clear();
+                CollectGroup(batch);
+                if (batch.empty()) {
+                    if (Stopping() && queue_.Empty()) {
+                        return;
+                    }
+                    Park();
+                    continue;
+                }
+
+                ApplyGroup(batch, results);
+
+                writes_ += static_cast<long long>(batch.size());
+                ++batches_;
+                for (size_t i = 0; i < batch.size(); ++i) {
+                    batch[i].done->set_value(results[i]);
+                }
+            }
+        }
+
+        SingleWriterOptions options_;
+        sqlite3* db_ = 0;
+        std::unordered_map<std::string, sqlite3_stmt*> statements_;
+        MpscQueue<Request> queue_;
+        std::thread thread_;
+        std::mutex mutex_;
+        std::condition_variable wake_;
+        std::atomic<bool> parked_{ false };
+        bool stopping_ = false;
+        std::atomic<bool> running_{ false };
+        std::atomic<long long> writes_{ 0 };
+        std::atomic<long long> batches_{ 0 };
+        std::atomic<long long> replays_{ 0 };
+    };
+}
@@ -0,0 +1,246 @@
+//
+// snapshot_readers.h
+//
+// A set of WAL-mode reader connections that can all be pinned to the same
+// database snapshot, so a multi-step report can be split across threads and
+// still read one consistent state. Pin starts a read transaction on every
+// reader at one snapshot, and Release ends them.
+//
+// With SQLITE_ENABLE_SNAPSHOT, Pin takes the snapshot on a coordinator
+// connection with sqlite3_snapshot_get and opens it on each reader with
+// sqlite3_snapshot_open, and writers are never held up. Without it, or when
+// no snapshot can be taken yet (a WAL that has never been written), Pin
+// fences writers instead. The coordinator takes the write lock with BEGIN
+// IMMEDIATE, so nothing can commit while the readers start their read
+// transactions, and then gives the lock back. Either way, once Pin returns,
+// writers commit freely while the readers keep their snapshot.
+//
+
+#pragma once
+
+#include "sqlite3.h"
+
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace sqlite3tests {
+
+    enum class SnapshotMethod {
+        None,
+        /// <summary>
+        /// sqlite3_snapshot_get/sqlite3_snapshot_open.
+        /// </summary>
+        SnapshotApi,
+        /// <summary>
+        /// Read transactions started while the write lock was held.
+        /// </summary>
+        WriteFence,
+    };
+
+    inline const char* SnapshotMethodName(SnapshotMethod method) {
+        switch (method) {
+        case SnapshotMethod::SnapshotApi: return "snapshot";
+        case SnapshotMethod::WriteFence: return "fence";
+        default: return "none";
+        }
+    }
+
+    struct SnapshotReadersOptions {
+        std::string path;
+        int readers = 4;
+        /// <summary>
+        /// How long the write fence may wait for a writer to commit.
+        /// </summary>
+        int busyTimeoutMs = 5000;
+    };
+
+    class SnapshotReaders {
+    public:
+        SnapshotReaders() = default;
+        SnapshotReaders(const SnapshotReaders&) = delete;
+        SnapshotReaders& operator=(const SnapshotReaders&) = delete;
+
+        ~SnapshotReaders() { Close(); }
+
+        /// <summary>
+        /// Opens the readers and the coordinator; the database must already
+        /// be in WAL mode.
+        /// </summary>
+        int Open(const SnapshotReadersOptions& options) {
+            int retcode = OpenConnection(options, &coordinator_);
+            if (retcode == SQLITE_OK && !IsWal(coordinator_)) {
+                retcode = SQLITE_MISUSE;
+            }
+            for (int i = 0; retcode == SQLITE_OK && i < options.readers; ++i) {
+                sqlite3* reader = 0;
+                retcode = OpenConnection(options, &reader);
+                if (reader != 0) {
+                    readers_.push_back(reader);
+                }
+            }
+            if (retcode != SQLITE_OK) {
+                Close();
+            }
+            return retcode;
+        }
+
+        void Close() {
+            Release();
+            for (sqlite3* reader : readers_) {
+                sqlite3_close(reader);
+            }
+            readers_.clear();
+            sqlite3_close(coordinator_);
+            coordinator_ = 0;
+        }
+
+        int Readers() const { return static_cast<int>(readers_.size()); }
+
+        sqlite3* Reader(int i) const { return readers_[i]; }
+
+        /// <summary>
+        /// How the current pin was made; None when not pinned.
+        /// </summary>
+        SnapshotMethod Method() const { return method_; }
+
+        /// <summary>
+        /// Starts a read transaction on every reader, all at the same
+        /// snapshot: the latest commit at the time of the call.
+        /// </summary>
+        int Pin() {
+            if (method_ != SnapshotMethod::None || coordinator_ == 0) {
+                return SQLITE_MISUSE;
+            }
+#ifdef SQLITE_ENABLE_SNAPSHOT
+            if (PinSnapshot() == SQLITE_OK) {
+                method_ = SnapshotMethod::SnapshotApi;
+                return SQLITE_OK;
+            }
+#endif
+            int retcode = PinWithFence();
+            if (retcode == SQLITE_OK) {
+                method_ = SnapshotMethod::WriteFence;
+            }
+            return retcode;
+        }
+
+        /// <summary>
+        /// Ends the readers' read transactions.
+        /// </summary>
+        void Release() {
+            if (method_ == SnapshotMethod::None) {
+                return;
+            }
+            RollbackReaders(Readers());
+            method_ = SnapshotMethod::None;
+        }
+
+        /// <summary>
+        /// Runs body(reader, index, readers) on every reader in a thread of
+        /// its own and returns the first error. Readers are usually pinned.
+        /// </summary>
+        int ParallelScan(const std::function<int(sqlite3*, int, int)>& body) {
+            std::vector<int> retcodes(readers_.size(), SQLITE_OK);
+            std::vector<std::thread> threads;
+            for (int i = 0; i < Readers(); ++i) {
+                threads.emplace_back([this, &body, &retcodes, i] { retcodes[i] = body(readers_[i], i, Readers()); });
+            }
+            for (std::thread& thread : threads) {
+                thread.join();
+            }
+            for (int retcode : retcodes) {
+                if (retcode != SQLITE_OK) {
+                    return retcode;
+                }
+            }
+            return SQLITE_OK;
+        }
+
+    private:
+        static int OpenConnection(const SnapshotReadersOptions& options, sqlite3** db) {
+            int retcode = sqlite3_open_v2(options.path.c_str(), db, SQLITE_OPEN_READWRITE, 0);
+            if (retcode != SQLITE_OK) {
+                sqlite3_close(*db);
+                *db = 0;
+                return retcode;
+            }
+            sqlite3_busy_timeout(*db, options.busyTimeoutMs);
+            // Some I/O first, so that the connection knows it is in WAL
+            // mode, which sqlite3_snapshot_open needs.
+            return sqlite3_exec(*db, "pragma application_id", 0, 0, 0);
+        }
+
+        static bool IsWal(sqlite3* db) {
+            sqlite3_stmt* stmt = 0;
+            bool wal = false;
+            if (sqlite3_prepare_v2(db, "pragma journal_mode", -1, &stmt, 0) == SQLITE_OK &&
+                sqlite3_step(stmt) == SQLITE_ROW) {
+                wal = std::string(reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0))) == "wal";
+            }
+            sqlite3_finalize(stmt);
+            return wal;
+        }
+
+        // A BEGIN followed by a read opens the read transaction.
+        static int BeginRead(sqlite3* db) {
+            return sqlite3_exec(db, "begin; select count(*) from sqlite_master", 0, 0, 0);
+        }
+
+        void RollbackReaders(int count) {
+            for (int i = 0; i < count; ++i) {
+                if (!sqlite3_get_autocommit(readers_[i])) {
+                    sqlite3_exec(readers_[i], "rollback", 0, 0, 0);
+                }
+            }
+        }
+
+#ifdef SQLITE_ENABLE_SNAPSHOT
+        int PinSnapshot() {
+            sqlite3_snapshot* snapshot = 0;
+            int retcode = sqlite3_exec(coordinator_, "begin", 0, 0, 0);
+            if (retcode == SQLITE_OK) {
+                retcode = sqlite3_snapshot_get(coordinator_, "main", &snapshot);
+            }
+            int opened = 0;
+            for (; retcode == SQLITE_OK && opened < Readers(); ++opened) {
+                retcode = sqlite3_exec(readers_[opened], "begin", 0, 0, 0);
+                if (retcode == SQLITE_OK) {
+                    retcode = sqlite3_snapshot_open(readers_[opened], "main", snapshot);
+                }
+            }
+            if (retcode != SQLITE_OK) {
+                RollbackReaders(opened);
+            }
+            // The readers hold the snapshot now; the coordinator only kept
+            // the WAL from being reset meanwhile.
+            sqlite3_exec(coordinator_, "commit", 0, 0, 0);
+            if (snapshot != 0) {
+                sqlite3_snapshot_free(snapshot);
+            }
+            return retcode;
+        }
+#endif
+
+        int PinWithFence() {
+            int retcode = sqlite3_exec(coordinator_, "begin immediate", 0, 0, 0);
+            if (retcode != SQLITE_OK) {
+                return retcode;
+            }
+            int started = 0;
+            for (; retcode == SQLITE_OK && started < Readers(); ++started) {
+                retcode = BeginRead(readers_[started]);
+            }
+            if (retcode != SQLITE_OK) {
+                RollbackReaders(started);
+            }
+            sqlite3_exec(coordinator_, "rollback", 0, 0, 0);
+            return retcode;
+        }
+
+        sqlite3* coordinator_ = 0;
+        std::vector<sqlite3*> readers_;
+        SnapshotMethod method_ = SnapshotMethod::None;
+    };
+}
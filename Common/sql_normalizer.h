@@ -0,0 +1,421 @@
+//
+// sql_normalizer.h
+//
+// Rewrites the literal constants of ad-hoc SQL into bound parameters, so
+// that "delete from Students where SID = 2000" and "... SID = 2001" both
+// become "delete from Students where SID = ?" and share one prepared
+// statement in a StatementCache. The tokenizer follows SQLite's lexical
+// rules: it collapses whitespace and comments, keeps quoted identifiers
+// verbatim and turns integer, real, string and blob literals into '?'.
+//
+// SQL is left alone when rewriting could change its meaning or fail to
+// compile: anything but a single DML statement (DDL cannot take
+// parameters), SQL that already has parameters, positional ORDER BY or
+// GROUP BY terms, where "1" means the first result column, and the sizes of
+// type names such as CAST(x AS varchar(10)). Result columns that were bare
+// literals get '?' as their name. Should a rewrite still fail to compile,
+// AcquireNormalized and ExecNormalized fall back to the SQL as written.
+//
+
+#pragma once
+
+#include "sqlite3.h"
+
+#include "statement_cache.h"
+
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+namespace sqlite3tests {
+
+    struct SqlLiteral {
+        /// <summary>
+        /// SQLITE_INTEGER, SQLITE_FLOAT, SQLITE_TEXT or SQLITE_BLOB.
+        /// </summary>
+        int type = SQLITE_NULL;
+        long long integer = 0;
+        double real = 0;
+        /// <summary>
+        /// Unescaped text, or the decoded bytes of a blob.
+        /// </summary>
+        std::string bytes;
+    };
+
+    struct NormalizedSql {
+        std::string sql;
+        std::vector<SqlLiteral> literals;
+    };
+
+    namespace detail {
+
+        inline bool IsIdChar(unsigned char c) {
+            return std::isalnum(c) || c == '_' || c == '$' || c >= 0x80;
+        }
+
+        inline std::string Lower(const std::string& word) {
+            std::string lower(word);
+            for (char& c : lower) {
+                c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+            }
+            return lower;
+        }
+
+        inline bool IsClauseKeyword(const std::string& word) {
+            static const char* const keywords[] = {
+                "select", "from", "where", "having", "window", "limit", "offset",
+                "union", "except", "intersect", "values", "set", "on", "returning"
+            };
+            for (const char* keyword : keywords) {
+                if (word == keyword) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        // Skips whitespace and comments; returns sql.size() when only those
+        // are left.
+        inline size_t SkipSpace(const std::string& sql, size_t i) {
+            while (i < sql.size()) {
+                unsigned char c = sql[i];
+                if (std::isspace(c)) {
+                    ++i;
+                }
+                else if (c == '-' && i + 1 < sql.size() && sql[i + 1] == '-') {
+                    while (i < sql.size() && sql[i] != '\n') {
+                        ++i;
+                    }
+                }
+                else if (c == '/' && i + 1 < sql.size() && sql[i + 1] == '*') {
+                    size_t end = sql.find("*/", i + 2);
+                    i = end == std::string::npos ? sql.size() : end + 2;
+                }
+                else {
+                    break;
+                }
+            }
+            return i;
+        }
+
+        inline int HexValue(char c) {
+            if (c >= '0' && c <= '9') return c - '0';
+            if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+            if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+            return -1;
+        }
+
+        // Parses the numeric literal at sql[*i]; false on a malformed one,
+        // which is left for sqlite3_prepare to report.
+        inline bool ScanNumber(const std::string& sql, size_t* i, SqlLiteral* literal) {
+            size_t start = *i;
+            size_t end = start;
+            if (sql[end] == '0' && end + 1 < sql.size() && (sql[end + 1] == 'x' || sql[end + 1] == 'X')) {
+                end += 2;
+                unsigned long long value = 0;
+                size_t digits = 0;
+                for (; end < sql.size() && HexValue(sql[end]) >= 0; ++end, ++digits) {
+                    value = value << 4 | static_cast<unsigned>(HexValue(sql[end]));
+                }
+                if (digits == 0 || digits > 16 || (end < sql.size() && IsIdChar(sql[end]))) {
+                    return false;
+                }
+                literal->type = SQLITE_INTEGER;
+                literal->integer = static_cast<long long>(value);
+                *i = end;
+                return true;
+            }
+
+            bool real = false;
+            while (end < sql.size() && std::isdigit(static_cast<unsigned char>(sql[end]))) {
+                ++end;
+            }
+            if (end < sql.size() && sql[end] == '.') {
+                real = true;
+                ++end;
+                while (end < sql.size() && std::isdigit(static_cast<unsigned char>(sql[end]))) {
+                    ++end;
+                }
+            }
+            if (end < sql.size() && (sql[end] == 'e' || sql[end] == 'E')) {
+                size_t exponent = end + 1;
+                if (exponent < sql.size() && (sql[exponent] == '+' || sql[exponent] == '-')) {
+                    ++exponent;
+                }
+                if (exponent >= sql.size() || !std::isdigit(static_cast<unsigned char>(sql[exponent]))) {
+                    return false;
+                }
+                real = true;
+                end = exponent;
+                while (end < sql.size() && std::isdigit(static_cast<unsigned char>(sql[end]))) {
+                    ++end;
+                }
+            }
+            if (end < sql.size() && IsIdChar(sql[end])) {
+                return false;
+            }
+
+            std::string text = sql.substr(start, end - start);
+            if (!real) {
+                errno = 0;
+                long long value = std::strtoll(text.c_str(), nullptr, 10);
+                // SQLite reads integers too large for 64 bits as reals.
+                if (errno != ERANGE) {
+                    literal->type = SQLITE_INTEGER;
+                    literal->integer = value;
+                    *i = end;
+                    return true;
+                }
+            }
+            literal->type = SQLITE_FLOAT;
+            literal->real = std::strtod(text.c_str(), nullptr);
+            *i = end;
+            return true;
+        }
+    }
+
+    /// <summary>
+    /// Rewrites the literals of sql into parameters. Returns false, leaving
+    /// normalized untouched, when sql must be prepared as written.
+    /// </summary>
+    inline bool NormalizeSql(const std::string& sql, NormalizedSql* normalized) {
+        NormalizedSql result;
+        result.sql.reserve(sql.size());
+        std::vector<bool> positional(1, false);
+        // Nesting depth of the parentheses of a type name, or 0 outside one.
+        size_t typeArgs = 0;
+        bool typeName = false;
+        std::string previous;
+        bool firstWord = true;
+        bool space = false;
+        size_t i = detail::SkipSpace(sql, 0);
+
+        auto emit = [&result, &space](const char* token, size_t length) {
+            if (space && !result.sql.empty()) {
+                result.sql += ' ';
+            }
+            space = false;
+            result.sql.append(token, length);
+        };
+
+        while (i < sql.size()) {
+            size_t next = detail::SkipSpace(sql, i);
+            if (next != i) {
+                space = true;
+                i = next;
+                continue;
+            }
+            char c = sql[i];
+            size_t start = i;
+
+            if ((c == 'x' || c == 'X') && i + 1 < sql.size() && sql[i + 1] == '\'') {
+                size_t end = sql.find('\'', i + 2);
+                if (end == std::string::npos || (end - i - 2) % 2 != 0) {
+                    return false;
+                }
+                SqlLiteral literal;
+                literal.type = SQLITE_BLOB;
+                for (size_t h = i + 2; h < end; h += 2) {
+                    int high = detail::HexValue(sql[h]);
+                    int low = detail::HexValue(sql[h + 1]);
+                    if (high < 0 || low < 0) {
+                        return false;
+                    }
+                    literal.bytes += static_cast<char>(high << 4 | low);
+                }
+                result.literals.push_back(literal);
+                emit("?", 1);
+                typeName = false;
+                previous = "?";
+                i = end + 1;
+            }
+            else if (detail::IsIdChar(static_cast<unsigned char>(c)) &&
+                     !std::isdigit(static_cast<unsigned char>(c)) && c != '$') {
+                while (i < sql.size() && detail::IsIdChar(static_cast<unsigned char>(sql[i]))) {
+                    ++i;
+                }
+                std::string word = detail::Lower(sql.substr(start, i - start));
+                if (firstWord) {
+                    firstWord = false;
+                    if (word != "select" && word != "insert" && word != "update" && word != "delete" &&
+                        word != "replace" && word != "with" && word != "values") {
+                        return false;
+                    }
+                }
+                // The words of a type name follow AS, e.g. "unsigned big int".
+                typeName = (previous == "as" || typeName) && word != "materialized" && word != "not";
+                if (word == "by" && (previous == "order" || previous == "group")) {
+                    positional.back() = true;
+                }
+                else if (detail::IsClauseKeyword(word)) {
+                    positional.back() = false;
+                }
+                emit(sql.data() + start, i - start);
+                previous = word;
+            }
+            else if (std::isdigit(static_cast<unsigned char>(c)) ||
+                     (c == '.' && i + 1 < sql.size() && std::isdigit(static_cast<unsigned char>(sql[i + 1])))) {
+                SqlLiteral literal;
+                if (!detail::ScanNumber(sql, &i, &literal)) {
+                    return false;
+                }
+                // A bare integer term of ORDER BY/GROUP BY names a column.
+                size_t after = detail::SkipSpace(sql, i);
+                bool bareTerm = after == sql.size() || sql[after] == ',' || sql[after] == ')' ||
+                                sql[after] == ';' || detail::IsIdChar(static_cast<unsigned char>(sql[after]));
+                if ((positional.back() && literal.type == SQLITE_INTEGER && bareTerm &&
+                        (previous == "by" || previous == ",")) || positional.size() == typeArgs) {
+                    emit(sql.data() + start, i - start);
+                }
+                else {
+                    result.literals.push_back(literal);
+                    emit("?", 1);
+                }
+                typeName = false;
+                previous = "?";
+            }
+            else if (c == '\'') {
+                SqlLiteral literal;
+                literal.type = SQLITE_TEXT;
+                for (++i;; ++i) {
+                    if (i >= sql.size()) {
+                        return false;
+                    }
+                    if (sql[i] == '\'') {
+                        if (i + 1 < sql.size() && sql[i + 1] == '\'') {
+                            ++i;
+                        }
+                        else {
+                            break;
+                        }
+                    }
+                    literal.bytes += sql[i];
+                }
+                ++i;
+                result.literals.push_back(literal);
+                emit("?", 1);
+                typeName = false;
+                previous = "?";
+            }
+            else if (c == '"' || c == '`' || c == '[') {
+                char close = c == '[' ? ']' : c;
+                for (++i;; ++i) {
+                    if (i >= sql.size()) {
+                        return false;
+                    }
+                    if (sql[i] == close) {
+                        if (close != ']' && i + 1 < sql.size() && sql[i + 1] == close) {
+                            ++i;
+                        }
+                        else {
+                            break;
+                        }
+                    }
+                }
+                ++i;
+                emit(sql.data() + start, i - start);
+                typeName = false;
+                previous = "id";
+            }
+            else if (c == '?' || c == ':' || c == '@' || c == '$' || c == '#') {
+                // Already parameterized; the caller binds these itself.
+                return false;
+            }
+            else if (c == ';') {
+                if (detail::SkipSpace(sql, i + 1) != sql.size()) {
+                    return false;
+                }
+                break;
+            }
+            else {
+                if (c == '(') {
+                    positional.push_back(false);
+                    typeArgs = typeName ? positional.size() : typeArgs;
+                }
+                else if (c == ')' && positional.size() > 1) {
+                    typeArgs = positional.size() == typeArgs ? 0 : typeArgs;
+                    positional.pop_back();
+                }
+                typeName = false;
+                ++i;
+                emit(&c, 1);
+                previous.assign(1, c);
+            }
+        }
+        if (firstWord) {
+            return false;
+        }
+        *normalized = std::move(result);
+        return true;
+    }
+
+    inline int BindLiterals(sqlite3_stmt* stmt, const std::vector<SqlLiteral>& literals) {
+        int retcode = SQLITE_OK;
+        for (size_t i = 0; retcode == SQLITE_OK && i < literals.size(); ++i) {
+            const SqlLiteral& literal = literals[i];
+            int index = static_cast<int>(i) + 1;
+            switch (literal.type) {
+            case SQLITE_INTEGER:
+                retcode = sqlite3_bind_int64(stmt, index, literal.integer);
+                break;
+            case SQLITE_FLOAT:
+                retcode = sqlite3_bind_double(stmt, index, literal.real);
+                break;
+            case SQLITE_TEXT:
+                retcode = sqlite3_bind_text(stmt, index, literal.bytes.data(),
+                    static_cast<int>(literal.bytes.size()), SQLITE_TRANSIENT);
+                break;
+            default:
+                retcode = sqlite3_bind_blob(stmt, index, literal.bytes.data(),
+                    static_cast<int>(literal.bytes.size()), SQLITE_TRANSIENT);
+                break;
+            }
+        }
+        return retcode;
+    }
+
+    /// <summary>
+    /// Leases the shared statement for the single statement sql from cache
+    /// with its literals bound, or sql itself when it cannot be normalized.
+    /// </summary>
+    inline int AcquireNormalized(StatementCache& cache, const std::string& sql, StatementLease* lease) {
+        NormalizedSql normalized;
+        if (!NormalizeSql(sql, &normalized) ||
+            normalized.literals.size() > static_cast<size_t>(sqlite3_limit(cache.Db(), SQLITE_LIMIT_VARIABLE_NUMBER, -1))) {
+            return cache.Acquire(sql, lease);
+        }
+        int retcode = cache.Acquire(normalized.sql, lease);
+        if (retcode != SQLITE_OK) {
+            // A literal the rewrite should have kept; sql as written may compile.
+            return cache.Acquire(sql, lease);
+        }
+        return BindLiterals(*lease, normalized.literals);
+    }
+
+    /// <summary>
+    /// sqlite3_exec without a callback: runs sql through the cache when it
+    /// normalizes, and through sqlite3_exec otherwise, so scripts of several
+    /// statements still work.
+    /// </summary>
+    inline int ExecNormalized(StatementCache& cache, const std::string& sql) {
+        NormalizedSql normalized;
+        if (!NormalizeSql(sql, &normalized) ||
+            normalized.literals.size() > static_cast<size_t>(sqlite3_limit(cache.Db(), SQLITE_LIMIT_VARIABLE_NUMBER, -1))) {
+            return sqlite3_exec(cache.Db(), sql.c_str(), 0, 0, 0);
+        }
+        StatementLease lease;
+        int retcode = cache.Acquire(normalized.sql, &lease);
+        if (retcode != SQLITE_OK) {
+            return sqlite3_exec(cache.Db(), sql.c_str(), 0, 0, 0);
+        }
+        retcode = BindLiterals(lease, normalized.literals);
+        if (retcode != SQLITE_OK) {
+            return retcode;
+        }
+        while ((retcode = sqlite3_step(lease)) == SQLITE_ROW) {
+        }
+        return retcode == SQLITE_DONE ? SQLITE_OK : retcode;
+    }
+}
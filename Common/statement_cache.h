@@ -0,0 +1,212 @@
+//
+// statement_cache.h
+//
+// A per-connection LRU cache of prepared statements keyed by SQL text.
+// Statements are compiled once with sqlite3_prepare_v3 and
+// SQLITE_PREPARE_PERSISTENT, which tells SQLite they will be reused and keeps
+// them out of its lookaside memory. They are lent out through RAII leases and
+// come back reset with bindings cleared. A connection, and so its cache, is
+// used by one thread at a time.
+//
+
+#pragma once
+
+#include "sqlite3.h"
+
+#include <list>
+#include <string>
+#include <unordered_map>
+
+namespace sqlite3tests {
+
+    struct StatementCacheStats {
+        long long hits = 0;
+        long long misses = 0;
+        long long evictions = 0;
+        /// <summary>
+        /// Misses because every cached copy of the SQL was already leased;
+        /// those leases get a statement finalized on release.
+        /// </summary>
+        long long transient = 0;
+    };
+
+    class StatementCache;
+
+    namespace detail {
+        struct CachedStatement {
+            std::string sql;
+            sqlite3_stmt* stmt;
+            bool leased;
+        };
+    }
+
+    /// <summary>
+    /// A statement borrowed from a StatementCache. Move-only; the statement
+    /// is reset, its bindings cleared and returned when the lease ends.
+    /// </summary>
+    class StatementLease {
+    public:
+        StatementLease() = default;
+        StatementLease(const StatementLease&) = delete;
+        StatementLease& operator=(const StatementLease&) = delete;
+
+        StatementLease(StatementLease&& other) noexcept
+            : cache_(other.cache_), stmt_(other.stmt_), entry_(other.entry_) {
+            other.cache_ = nullptr;
+            other.stmt_ = 0;
+        }
+
+        StatementLease& operator=(StatementLease&& other) noexcept {
+            if (this != &other) {
+                Release();
+                cache_ = other.cache_;
+                stmt_ = other.stmt_;
+                entry_ = other.entry_;
+                other.cache_ = nullptr;
+                other.stmt_ = 0;
+            }
+            return *this;
+        }
+
+        ~StatementLease() { Release(); }
+
+        sqlite3_stmt* Get() const { return stmt_; }
+
+        operator sqlite3_stmt*() const { return stmt_; }
+
+        explicit operator bool() const { return stmt_ != 0; }
+
+        void Release();
+
+    private:
+        friend class StatementCache;
+
+        StatementLease(StatementCache* cache, sqlite3_stmt* stmt, detail::CachedStatement* entry)
+            : cache_(cache), stmt_(stmt), entry_(entry) {}
+
+        StatementCache* cache_ = nullptr;
+        sqlite3_stmt* stmt_ = 0;
+        // The cache entry lent out, or null for a transient statement. List
+        // elements stay put, and a leased entry is never evicted.
+        detail::CachedStatement* entry_ = nullptr;
+    };
+
+    class StatementCache {
+    public:
+        explicit StatementCache(sqlite3* db, size_t capacity = 64)
+            : db_(db), capacity_(capacity > 0 ? capacity : 1) {}
+
+        StatementCache(const StatementCache&) = delete;
+        StatementCache& operator=(const StatementCache&) = delete;
+
+        /// <summary>
+        /// Finalizes every cached statement; no lease may outlive the cache.
+        /// </summary>
+        ~StatementCache() { Clear(); }
+
+        /// <summary>
+        /// Leases the statement for sql, compiling it on a miss.
+        /// </summary>
+        int Acquire(const std::string& sql, StatementLease* lease) {
+            auto found = index_.find(sql);
+            if (found != index_.end() && !found->second->leased) {
+                Entry& entry = *found->second;
+                entry.leased = true;
+                lru_.splice(lru_.begin(), lru_, found->second);
+                ++stats_.hits;
+                *lease = StatementLease(this, entry.stmt, &entry);
+                return SQLITE_OK;
+            }
+
+            sqlite3_stmt* stmt = 0;
+            int retcode = sqlite3_prepare_v3(db_, sql.c_str(), static_cast<int>(sql.size()),
+                SQLITE_PREPARE_PERSISTENT, &stmt, 0);
+            if (retcode != SQLITE_OK) {
+                return retcode;
+            }
+            ++stats_.misses;
+            if (found != index_.end()) {
+                // A nested use of a statement that is still leased.
+                ++stats_.transient;
+                *lease = StatementLease(this, stmt, nullptr);
+                return SQLITE_OK;
+            }
+            lru_.push_front(Entry{ sql, stmt, true });
+            index_[sql] = lru_.begin();
+            Evict();
+            *lease = StatementLease(this, stmt, &lru_.front());
+            return SQLITE_OK;
+        }
+
+        /// <summary>
+        /// Finalizes every statement not currently leased.
+        /// </summary>
+        void Clear() {
+            for (auto it = lru_.begin(); it != lru_.end();) {
+                if (it->leased) {
+                    ++it;
+                    continue;
+                }
+                sqlite3_finalize(it->stmt);
+                index_.erase(it->sql);
+                it = lru_.erase(it);
+            }
+        }
+
+        sqlite3* Db() const { return db_; }
+
+        size_t Size() const { return lru_.size(); }
+
+        size_t Capacity() const { return capacity_; }
+
+        StatementCacheStats Stats() const { return stats_; }
+
+    private:
+        friend class StatementLease;
+
+        using Entry = detail::CachedStatement;
+
+        // Unleases by the entry itself: sqlite3_sql() drops whatever follows
+        // the first statement, so it need not match the key.
+        void Return(sqlite3_stmt* stmt, Entry* entry) {
+            if (entry == nullptr) {
+                sqlite3_finalize(stmt);
+                return;
+            }
+            sqlite3_reset(stmt);
+            sqlite3_clear_bindings(stmt);
+            entry->leased = false;
+            Evict();
+        }
+
+        // Drops least recently used idle statements beyond capacity; leased
+        // ones are skipped and go once returned.
+        void Evict() {
+            auto it = lru_.end();
+            while (lru_.size() > capacity_ && it != lru_.begin()) {
+                --it;
+                if (it->leased) {
+                    continue;
+                }
+                sqlite3_finalize(it->stmt);
+                index_.erase(it->sql);
+                it = lru_.erase(it);
+                ++stats_.evictions;
+            }
+        }
+
+        sqlite3* db_;
+        size_t capacity_;
+        std::list<Entry> lru_;
+        std::unordered_map<std::string, std::list<Entry>::iterator> index_;
+        StatementCacheStats stats_;
+    };
+
+    inline void StatementLease::Release() {
+        if (stmt_ != 0) {
+            cache_->Return(stmt_, entry_);
+            cache_ = nullptr;
+            stmt_ = 0;
+        }
+    }
+}
@@ -0,0 +1,200 @@
+//
+// test_support.h
+//
+// Helpers shared by the test and benchmark files of all three projects:
+// scratch databases, single-value queries, timing and thread fan-out.
+//
+
+#pragma once
+
+#include "sqlite3.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace sqlite3tests {
+
+    /// <summary>
+    /// Multiplier for benchmark sizes, read from SQLITE3TESTS_BENCH_SCALE.
+    /// The default of 1 keeps every benchmark short enough to run with the
+    /// rest of the suite; large sweeps are opt-in.
+    /// </summary>
+    inline double BenchScale() {
+        const char* value = std::getenv("SQLITE3TESTS_BENCH_SCALE");
+        if (value == nullptr) {
+            return 1.0;
+        }
+        double scale = std::atof(value);
+        return scale > 0 ? scale : 1.0;
+    }
+
+    inline long long Scaled(long long n) {
+        return std::max(1LL, static_cast<long long>(n * BenchScale()));
+    }
+
+    class Stopwatch {
+    public:
+        Stopwatch() : start_(std::chrono::steady_clock::now()) {}
+
+        void Restart() { start_ = std::chrono::steady_clock::now(); }
+
+        double Seconds() const {
+            return std::chrono::duration<double>(std::chrono::steady_clock::now() - start_).count();
+        }
+
+        double Micros() const { return Seconds() * 1e6; }
+
+    private:
+        std::chrono::steady_clock::time_point start_;
+    };
+
+    /// <summary>
+    /// Returns the p-th percentile (0..100) of the samples; sorts in place.
+    /// </summary>
+    inline double Percentile(std::vector<double>& samples, double p) {
+        if (samples.empty()) {
+            return 0;
+        }
+        std::sort(samples.begin(), samples.end());
+        size_t index = static_cast<size_t>(p / 100.0 * (samples.size() - 1) + 0.5);
+        return samples[std::min(index, samples.size() - 1)];
+    }
+
+    /// <summary>
+    /// Starts numThreads threads running body(threadIndex), joins them and
+    /// returns the wall-clock seconds taken.
+    /// </summary>
+    inline double RunThreads(int numThreads, const std::function<void(int)>& body) {
+        std::vector<std::thread> threads;
+        Stopwatch watch;
+        for (int i = 0; i < numThreads; ++i) {
+            threads.push_back(std::thread(body, i));
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        return watch.Seconds();
+    }
+
+    /// <summary>
+    /// Deletes a database file together with its journal, WAL and shm files.
+    /// </summary>
+    inline void RemoveDb(const std::string& path) {
+        for (const char* suffix : { "", "-journal", "-wal", "-shm" }) {
+            std::remove((path + suffix).c_str());
+        }
+    }
+
+    /// <summary>
+    /// Steps stmt once and returns the first column of the row, or -1 when
+    /// there is no row. The statement is not reset.
+    /// </summary>
+    inline long long StepInt64(sqlite3_stmt* stmt) {
+        return sqlite3_step(stmt) == SQLITE_ROW ? sqlite3_column_int64(stmt, 0) : -1;
+    }
+
+    /// <summary>
+    /// The first column of the first row of sql, or -1 when it fails or
+    /// returns no rows.
+    /// </summary>
+    inline long long QueryInt64(sqlite3* db, const char* sql) {
+        sqlite3_stmt* stmt = 0;
+        long long value = -1;
+        if (sqlite3_prepare_v2(db, sql, -1, &stmt, 0) == SQLITE_OK) {
+            value = StepInt64(stmt);
+        }
+        sqlite3_finalize(stmt);
+        return value;
+    }
+
+    /// <summary>
+    /// QueryInt64 on a connection of its own to the database at path.
+    /// </summary>
+    inline long long QueryInt64(const std::string& path, const char* sql) {
+        sqlite3* db = 0;
+        long long value = -1;
+        if (sqlite3_open(path.c_str(), &db) == SQLITE_OK) {
+            value = QueryInt64(db, sql);
+        }
+        sqlite3_close(db);
+        return value;
+    }
+
+    /// <summary>
+    /// Runs sql, calling row for each result row; returns the final retcode.
+    /// </summary>
+    inline int ForEachRow(sqlite3* db, const char* sql, const std::function<void(sqlite3_stmt*)>& row) {
+        sqlite3_stmt* stmt = 0;
+        int retcode = sqlite3_prepare_v2(db, sql, -1, &stmt, 0);
+        while (retcode == SQLITE_OK && (retcode = sqlite3_step(stmt)) == SQLITE_ROW) {
+            row(stmt);
+            retcode = SQLITE_OK;
+        }
+        sqlite3_finalize(stmt);
+        return retcode == SQLITE_DONE ? SQLITE_OK : retcode;
+    }
+
+    /// <summary>
+    /// ForEachRow on a connection of its own to the database at path.
+    /// </summary>
+    inline int ForEachRow(const std::string& path, const char* sql, const std::function<void(sqlite3_stmt*)>& row) {
+        sqlite3* db = 0;
+        int retcode = sqlite3_open(path.c_str(), &db);
+        if (retcode == SQLITE_OK) {
+            retcode = ForEachRow(db, sql, row);
+        }
+        sqlite3_close(db);
+        return retcode;
+    }
+
+    /// <summary>
+    /// sqlite3_exec callback appending each row, as "col|col|...|", to the
+    /// std::vector&lt;std::string&gt; passed as its argument.
+    /// </summary>
+    inline int CollectCallback(void* rows, int argc, char** argv, char**) {
+        std::vector<std::string>* collected = static_cast<std::vector<std::string>*>(rows);
+        std::string row;
+        for (int i = 0; i < argc; i++) {
+            row += argv[i] ? argv[i] : "NULL";
+            row += '|';
+        }
+        collected->push_back(row);
+        return 0;
+    }
+
+    /// <summary>
+    /// Creates a fresh database with the Students(SID INTEGER) table of
+    /// MyDB.db filled with SIDs 1..rows, so tests do not mutate the fixtures.
+    /// </summary>
+    inline int CreateStudentsDb(const std::string& path, long long rows) {
+        RemoveDb(path);
+        sqlite3* db = 0;
+        int retcode = sqlite3_open(path.c_str(), &db);
+        if (retcode != SQLITE_OK) {
+            sqlite3_close(db);
+            return retcode;
+        }
+        retcode = sqlite3_exec(db, "create table Students(SID INTEGER); begin;", 0, 0, 0);
+        sqlite3_stmt* stmt = 0;
+        if (retcode == SQLITE_OK) {
+            retcode = sqlite3_prepare_v2(db, "insert into Students values (?)", -1, &stmt, 0);
+        }
+        for (long long i = 1; retcode == SQLITE_OK && i <= rows; ++i) {
+            sqlite3_bind_int64(stmt, 1, i);
+            retcode = sqlite3_step(stmt) == SQLITE_DONE ? SQLITE_OK : sqlite3_errcode(db);
+            sqlite3_reset(stmt);
+        }
+        sqlite3_finalize(stmt);
+        if (retcode == SQLITE_OK) {
+            retcode = sqlite3_exec(db, "commit", 0, 0, 0);
+        }
+        sqlite3_close(db);
+        return retcode;
+    }
+}
@@ -0,0 +1,155 @@
+//
+// thread_mode_bench.h
+//
+// The same point-select, insert and scan workloads for all three projects,
+// which differ only in SQLITE_THREADSAFE. Comparing the tables they print
+// puts a number on what SQLite's internal mutexes cost per call.
+//
+
+#pragma once
+
+#include "sqlite3.h"
+#include "test_support.h"
+
+#include <atomic>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace sqlite3tests {
+
+    inline const char* ThreadModeName(int threadsafe) {
+        switch (threadsafe) {
+        case 0: return "single-thread";
+        case 1: return "serialized";
+        case 2: return "multi-thread";
+        default: return "unknown";
+        }
+    }
+
+    /// <summary>
+    /// Thread counts the current build may legally run: single-thread mode
+    /// must not be entered from more than one thread at all.
+    /// </summary>
+    inline std::vector<int> ThreadModeThreadCounts() {
+        if (sqlite3_threadsafe() == 0) {
+            return { 1 };
+        }
+        return { 1, 2, 4, 8 };
+    }
+
+    /// <summary>
+    /// Prints ops/s for each workload and thread count. Every thread uses its
+    /// own connection; inserts go to a private in-memory database per thread
+    /// so that file locking does not hide the mutex cost. In serialized mode a
+    /// shared-handle point select is added, the InsertSingleDbHandle pattern.
+    /// Returns the number of failed operations.
+    /// </summary>
+    inline long long RunThreadModeBench(const std::string& path) {
+        const long long rows = 10000;
+        const long long pointOps = Scaled(20000);
+        const long long insertOps = Scaled(20000);
+        const long long scans = Scaled(20);
+        std::atomic<long long> errors(0);
+
+        if (CreateStudentsDb(path, rows) != SQLITE_OK) {
+            return 1;
+        }
+
+        int threadsafe = sqlite3_threadsafe();
+        printf("thread mode: %s (SQLITE_THREADSAFE=%d)\n", ThreadModeName(threadsafe), threadsafe);
+        printf("%8s %14s %14s %14s %14s\n", "threads", "select/s", "insert/s", "scan rows/s", "shared sel/s");
+
+        for (int numThreads : ThreadModeThreadCounts()) {
+            double selectSeconds = RunThreads(numThreads, [&](int thread) {
+                sqlite3* db = 0;
+                sqlite3_stmt* stmt = 0;
+                sqlite3_open_v2(path.c_str(), &db, SQLITE_OPEN_READONLY, 0);
+                if (sqlite3_prepare_v2(db, "select SID from Students where rowid = ?", -1, &stmt, 0) != SQLITE_OK) {
+                    ++errors;
+                }
+                for (long long i = 0; stmt && i < pointOps; ++i) {
+                    sqlite3_bind_int64(stmt, 1, 1 + (i * 7919 + thread) % rows);
+                    if (sqlite3_step(stmt) != SQLITE_ROW) {
+                        ++errors;
+                    }
+                    sqlite3_reset(stmt);
+                }
+                sqlite3_finalize(stmt);
+                sqlite3_close(db);
+            });
+
+            double insertSeconds = RunThreads(numThreads, [&](int) {
+                sqlite3* db = 0;
+                sqlite3_stmt* stmt = 0;
+                sqlite3_open(":memory:", &db);
+                sqlite3_exec(db, "create table Students(SID INTEGER); begin;", 0, 0, 0);
+                if (sqlite3_prepare_v2(db, "insert into Students values (?)", -1, &stmt, 0) != SQLITE_OK) {
+                    ++errors;
+                }
+                for (long long i = 0; stmt && i < insertOps; ++i) {
+                    sqlite3_bind_int64(stmt, 1, i);
+                    if (sqlite3_step(stmt) != SQLITE_DONE) {
+                        ++errors;
+                    }
+                    sqlite3_reset(stmt);
+                }
+                sqlite3_finalize(stmt);
+                sqlite3_exec(db, "commit", 0, 0, 0);
+                sqlite3_close(db);
+            });
+
+            double scanSeconds = RunThreads(numThreads, [&](int) {
+                sqlite3* db = 0;
+                sqlite3_stmt* stmt = 0;
+                sqlite3_open_v2(path.c_str(), &db, SQLITE_OPEN_READONLY, 0);
+                if (sqlite3_prepare_v2(db, "select SID from Students", -1, &stmt, 0) != SQLITE_OK) {
+                    ++errors;
+                }
+                for (long long i = 0; stmt && i < scans; ++i) {
+                    long long seen = 0;
+                    while (sqlite3_step(stmt) == SQLITE_ROW) {
+                        seen += sqlite3_column_int64(stmt, 0) != 0;
+                    }
+                    if (seen != rows) {
+                        ++errors;
+                    }
+                    sqlite3_reset(stmt);
+                }
+                sqlite3_finalize(stmt);
+                sqlite3_close(db);
+            });
+
+            double sharedRate = 0;
+            if (threadsafe == 1) {
+                sqlite3* db = 0;
+                sqlite3_open_v2(path.c_str(), &db, SQLITE_OPEN_READONLY, 0);
+                double sharedSeconds = RunThreads(numThreads, [&](int thread) {
+                    sqlite3_stmt* stmt = 0;
+                    if (sqlite3_prepare_v2(db, "select SID from Students where rowid = ?", -1, &stmt, 0) != SQLITE_OK) {
+                        ++errors;
+                    }
+                    for (long long i = 0; stmt && i < pointOps; ++i) {
+                        sqlite3_bind_int64(stmt, 1, 1 + (i * 7919 + thread) % rows);
+                        if (sqlite3_step(stmt) != SQLITE_ROW) {
+                            ++errors;
+                        }
+                        sqlite3_reset(stmt);
+                    }
+                    sqlite3_finalize(stmt);
+                });
+                sqlite3_close(db);
+                sharedRate = numThreads * pointOps / sharedSeconds;
+            }
+
+            printf("%8d %14.0f %14.0f %14.0f %14.0f\n", numThreads,
+                numThreads * pointOps / selectSeconds,
+                numThreads * insertOps / insertSeconds,
+                numThreads * scans * rows / scanSeconds,
+                sharedRate);
+        }
+
+        RemoveDb(path);
+        return errors.load();
+    }
+}
@@ -0,0 +1,258 @@
+//
+// transaction.h
+//
+// Scoped transactions and savepoints. SUBTRANSACTION runs BEGIN ... COMMIT
+// by hand: when one statement fails, only that statement is undone, and
+// there is no way to undo a larger piece of work while keeping the rest of
+// the transaction. A Savepoint scope is such a piece. Release keeps its work
+// and Rollback undoes it. Scopes nest, and a scope that ends without either
+// is rolled back, or released if it was opened with ScopeExit::Commit.
+//
+// Transaction and Savepoint are move-only handles, so a scope can be
+// returned from the function that opened it. ScopeExit::Commit still rolls
+// back when the scope is left by an exception.
+//
+
+#pragma once
+
+#include "sqlite3.h"
+
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <string>
+#include <utility>
+
+namespace sqlite3tests {
+
+    enum class TransactionMode { Deferred, Immediate, Exclusive };
+
+    /// <summary>
+    /// What a scope still open at destruction does with its work.
+    /// </summary>
+    enum class ScopeExit { Rollback, Commit };
+
+    namespace detail {
+        /// <summary>
+        /// State shared by Transaction and Savepoint: the connection while
+        /// the scope is open, and how to end it.
+        /// </summary>
+        class Scope {
+        public:
+            Scope() = default;
+            Scope(const Scope&) = delete;
+            Scope& operator=(const Scope&) = delete;
+
+            Scope(Scope&& other) noexcept { Take(other); }
+
+            Scope& operator=(Scope&& other) noexcept {
+                if (this != &other) {
+                    Take(other);
+                }
+                return *this;
+            }
+
+            bool Active() const { return db_ != 0; }
+
+            sqlite3* Db() const { return db_; }
+
+        protected:
+            void Opened(sqlite3* db, ScopeExit exit) {
+                db_ = db;
+                exit_ = exit;
+                exceptions_ = std::uncaught_exceptions();
+            }
+
+            // Commit on exit unless an exception is unwinding through the scope.
+            bool CommitOnExit() const { return exit_ == ScopeExit::Commit && std::uncaught_exceptions() <= exceptions_; }
+
+            // Some errors (SQLITE_FULL, SQLITE_IOERR, ON CONFLICT ROLLBACK)
+            // roll back the whole transaction, savepoints included.
+            bool TransactionGone() const { return sqlite3_get_autocommit(db_) != 0; }
+
+            void Closed() { db_ = 0; }
+
+            void Take(Scope& other) {
+                db_ = other.db_;
+                exit_ = other.exit_;
+                exceptions_ = other.exceptions_;
+                other.db_ = 0;
+            }
+
+            ~Scope() = default;
+
+        private:
+            sqlite3* db_ = 0;
+            ScopeExit exit_ = ScopeExit::Rollback;
+            int exceptions_ = 0;
+        };
+    }
+
+    class Transaction : public detail::Scope {
+    public:
+        Transaction() = default;
+        Transaction(Transaction&& other) noexcept = default;
+
+        Transaction& operator=(Transaction&& other) noexcept {
+            if (this != &other) {
+                End();
+                Scope::operator=(std::move(other));
+            }
+            return *this;
+        }
+
+        ~Transaction() { End(); }
+
+        /// <summary>
+        /// Starts a transaction. Fails as BEGIN does, e.g. with SQLITE_ERROR
+        /// inside another transaction or SQLITE_BUSY for Immediate.
+        /// </summary>
+        int Begin(sqlite3* db, TransactionMode mode = TransactionMode::Deferred, ScopeExit exit = ScopeExit::Rollback) {
+            if (Active()) {
+                return SQLITE_MISUSE;
+            }
+            const char* sql = mode == TransactionMode::Immediate ? "begin immediate"
+                            : mode == TransactionMode::Exclusive ? "begin exclusive" : "begin";
+            int retcode = sqlite3_exec(db, sql, 0, 0, 0);
+            if (retcode == SQLITE_OK) {
+                Opened(db, exit);
+            }
+            return retcode;
+        }
+
+        /// <summary>
+        /// Commits. On SQLITE_BUSY the transaction stays open and Commit can
+        /// be retried.
+        /// </summary>
+        int Commit() {
+            if (!Active()) {
+                return SQLITE_MISUSE;
+            }
+            int retcode = sqlite3_exec(Db(), "commit", 0, 0, 0);
+            if (retcode == SQLITE_OK || TransactionGone()) {
+                Closed();
+            }
+            return retcode;
+        }
+
+        int Rollback() {
+            if (!Active()) {
+                return SQLITE_MISUSE;
+            }
+            int retcode = TransactionGone() ? SQLITE_OK : sqlite3_exec(Db(), "rollback", 0, 0, 0);
+            Closed();
+            return retcode;
+        }
+
+    private:
+        void End() {
+            if (Active()) {
+                if (!CommitOnExit() || Commit() != SQLITE_OK) {
+                    Rollback();
+                }
+            }
+        }
+    };
+
+    class Savepoint : public detail::Scope {
+    public:
+        Savepoint() = default;
+
+        Savepoint(Savepoint&& other) noexcept : Scope(std::move(other)), name_(std::move(other.name_)) {}
+
+        Savepoint& operator=(Savepoint&& other) noexcept {
+            if (this != &other) {
+                End();
+                Scope::operator=(std::move(other));
+                name_ = std::move(other.name_);
+            }
+            return *this;
+        }
+
+        ~Savepoint() { End(); }
+
+        /// <summary>
+        /// Opens a savepoint: nested in the current transaction or savepoint,
+        /// or as a transaction of its own in autocommit mode.
+        /// </summary>
+        int Begin(sqlite3* db, ScopeExit exit = ScopeExit::Rollback) {
+            if (Active()) {
+                return SQLITE_MISUSE;
+            }
+            // Unique names, so that a scope moved out of order still
+            // releases its own savepoint.
+            static std::atomic<unsigned long long> next{ 0 };
+            std::string name = "sqlite3tests_sp" + std::to_string(++next);
+            int retcode = sqlite3_exec(db, ("savepoint " + name).c_str(), 0, 0, 0);
+            if (retcode == SQLITE_OK) {
+                name_ = std::move(name);
+                Opened(db, exit);
+            }
+            return retcode;
+        }
+
+        /// <summary>
+        /// Keeps the work and ends the scope; it becomes part of the
+        /// enclosing scope, or is committed when there is none.
+        /// </summary>
+        int Release() {
+            if (!Active()) {
+                return SQLITE_MISUSE;
+            }
+            if (TransactionGone()) {
+                Closed();
+                return SQLITE_ABORT;
+            }
+            int retcode = sqlite3_exec(Db(), ("release " + name_).c_str(), 0, 0, 0);
+            if (retcode == SQLITE_OK) {
+                Closed();
+            }
+            return retcode;
+        }
+
+        /// <summary>
+        /// Undoes the work since Begin, including released inner scopes,
+        /// and ends the scope.
+        /// </summary>
+        int Rollback() {
+            if (!Active()) {
+                return SQLITE_MISUSE;
+            }
+            int retcode = SQLITE_OK;
+            if (!TransactionGone()) {
+                retcode = sqlite3_exec(Db(), ("rollback to " + name_ + "; release " + name_).c_str(), 0, 0, 0);
+            }
+            Closed();
+            return retcode;
+        }
+
+    private:
+        void End() {
+            if (Active()) {
+                if (!CommitOnExit() || Release() != SQLITE_OK) {
+                    Rollback();
+                }
+            }
+        }
+
+        std::string name_;
+    };
+
+    /// <summary>
+    /// Runs work in a savepoint that is released if work returns SQLITE_OK
+    /// and rolled back otherwise, and returns work's result.
+    /// </summary>
+    inline int WithSavepoint(sqlite3* db, const std::function<int(sqlite3*)>& work) {
+        Savepoint savepoint;
+        int retcode = savepoint.Begin(db);
+        if (retcode != SQLITE_OK) {
+            return retcode;
+        }
+        retcode = work(db);
+        if (retcode != SQLITE_OK) {
+            savepoint.Rollback();
+            return retcode;
+        }
+        return savepoint.Release();
+    }
+}
@@ -0,0 +1,270 @@
+//
+// typed_query.h
+//
+// Queries declared together with their result type:
+//
+//     Query<"select SID from Students where SID > ?", std::tuple<int64_t>> query;
+//     query.Prepare(db);
+//     query.ForEach([](const auto& row) { ... std::get<0>(row) ... }, 30);
+//
+// The SQL text is a template argument and the decoding of each column is
+// chosen at compile time from the tuple, so the row loop calls
+// sqlite3_column_int64 and friends directly instead of switching on
+// sqlite3_column_type. The statement is prepared once, typically at
+// startup. On first use the result columns are checked against the tuple:
+// their number, and the affinity of columns that have a declared type.
+//
+// Column types: int, int64_t, double, std::string, std::string_view, and
+// std::optional of those for nullable columns. string_view columns view
+// SQLite's buffers and are valid only inside ForEach.
+//
+// Requires C++20 for string literal template arguments.
+//
+
+#pragma once
+
+#include "sqlite3.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace sqlite3tests {
+
+    /// <summary>
+    /// A string literal usable as a template argument.
+    /// </summary>
+    template <size_t N>
+    struct FixedString {
+        constexpr FixedString(const char (&text)[N]) {
+            std::copy_n(text, N, value);
+        }
+
+        constexpr std::string_view View() const { return std::string_view(value, N - 1); }
+
+        char value[N];
+    };
+
+    namespace detail {
+
+        template <class T>
+        struct IsOptional : std::false_type {};
+
+        template <class T>
+        struct IsOptional<std::optional<T>> : std::true_type {};
+
+        template <class T>
+        struct ColumnValue {
+            using type = T;
+        };
+
+        template <class T>
+        struct ColumnValue<std::optional<T>> {
+            using type = T;
+        };
+
+        template <class T>
+        constexpr bool IsColumnType = std::is_same_v<T, int> || std::is_same_v<T, int64_t> ||
+                                      std::is_same_v<T, double> || std::is_same_v<T, std::string> ||
+                                      std::is_same_v<T, std::string_view>;
+
+        template <class T>
+        constexpr bool IsView = std::is_same_v<typename ColumnValue<T>::type, std::string_view>;
+
+        template <class T>
+        T ReadColumn(sqlite3_stmt* stmt, int column) {
+            if constexpr (IsOptional<T>::value) {
+                if (sqlite3_column_type(stmt, column) == SQLITE_NULL) {
+                    return std::nullopt;
+                }
+                return ReadColumn<typename T::value_type>(stmt, column);
+            }
+            else if constexpr (std::is_same_v<T, int>) {
+                return sqlite3_column_int(stmt, column);
+            }
+            else if constexpr (std::is_same_v<T, int64_t>) {
+                return sqlite3_column_int64(stmt, column);
+            }
+            else if constexpr (std::is_same_v<T, double>) {
+                return sqlite3_column_double(stmt, column);
+            }
+            else {
+                const char* text = reinterpret_cast<const char*>(sqlite3_column_text(stmt, column));
+                int bytes = sqlite3_column_bytes(stmt, column);
+                return text != nullptr ? T(text, bytes) : T();
+            }
+        }
+
+        template <class Row, size_t... I>
+        Row ReadRow(sqlite3_stmt* stmt, std::index_sequence<I...>) {
+            return Row(ReadColumn<std::tuple_element_t<I, Row>>(stmt, static_cast<int>(I))...);
+        }
+
+        // Column affinity from a declared type, by SQLite's rules.
+        inline int DeclaredAffinity(const char* declared) {
+            std::string type;
+            for (const char* c = declared; *c != 0; ++c) {
+                type += static_cast<char>(std::toupper(static_cast<unsigned char>(*c)));
+            }
+            if (type.find("INT") != std::string::npos) return SQLITE_INTEGER;
+            if (type.find("CHAR") != std::string::npos || type.find("CLOB") != std::string::npos ||
+                type.find("TEXT") != std::string::npos) return SQLITE_TEXT;
+            if (type.empty() || type.find("BLOB") != std::string::npos) return SQLITE_BLOB;
+            if (type.find("REAL") != std::string::npos || type.find("FLOA") != std::string::npos ||
+                type.find("DOUB") != std::string::npos) return SQLITE_FLOAT;
+            // NUMERIC affinity.
+            return SQLITE_NULL;
+        }
+
+        template <class T>
+        bool AffinityFits(int affinity) {
+            using Value = typename ColumnValue<T>::type;
+            if constexpr (std::is_same_v<Value, int> || std::is_same_v<Value, int64_t>) {
+                return affinity == SQLITE_INTEGER || affinity == SQLITE_NULL;
+            }
+            else if constexpr (std::is_same_v<Value, double>) {
+                return affinity == SQLITE_INTEGER || affinity == SQLITE_FLOAT || affinity == SQLITE_NULL;
+            }
+            else {
+                return affinity == SQLITE_TEXT || affinity == SQLITE_BLOB;
+            }
+        }
+
+        template <class Row, size_t... I>
+        bool ColumnsFit(sqlite3_stmt* stmt, std::index_sequence<I...>) {
+            auto fits = [stmt](int column, auto fit) {
+                // Expressions and untyped columns have no declared type.
+                const char* declared = sqlite3_column_decltype(stmt, column);
+                return declared == nullptr || *declared == 0 || fit(DeclaredAffinity(declared));
+            };
+            return (fits(static_cast<int>(I), [](int affinity) {
+                return AffinityFits<std::tuple_element_t<I, Row>>(affinity);
+            }) && ...);
+        }
+
+        template <class T>
+        int BindParameter(sqlite3_stmt* stmt, int index, const T& value) {
+            if constexpr (std::is_same_v<T, std::nullptr_t>) {
+                return sqlite3_bind_null(stmt, index);
+            }
+            else if constexpr (std::is_integral_v<T>) {
+                return sqlite3_bind_int64(stmt, index, static_cast<sqlite3_int64>(value));
+            }
+            else if constexpr (std::is_floating_point_v<T>) {
+                return sqlite3_bind_double(stmt, index, static_cast<double>(value));
+            }
+            else {
+                // Parameters outlive the statement's run inside the Query call.
+                std::string_view text(value);
+                return sqlite3_bind_text(stmt, index, text.data(), static_cast<int>(text.size()), SQLITE_STATIC);
+            }
+        }
+    }
+
+    template <FixedString Sql, class Result>
+    class Query;
+
+    template <FixedString Sql, class... Columns>
+    class Query<Sql, std::tuple<Columns...>> {
+        static_assert((detail::IsColumnType<typename detail::ColumnValue<Columns>::type> && ...),
+            "Query columns must be int, int64_t, double, std::string, std::string_view or std::optional of those");
+
+    public:
+        using Row = std::tuple<Columns...>;
+
+        static constexpr std::string_view sql = Sql.View();
+        static constexpr size_t columns = sizeof...(Columns);
+
+        Query() = default;
+        Query(const Query&) = delete;
+        Query& operator=(const Query&) = delete;
+
+        ~Query() { sqlite3_finalize(stmt_); }
+
+        int Prepare(sqlite3* db) {
+            sqlite3_finalize(stmt_);
+            stmt_ = 0;
+            checked_ = false;
+            return sqlite3_prepare_v3(db, sql.data(), static_cast<int>(sql.size()), SQLITE_PREPARE_PERSISTENT, &stmt_, 0);
+        }
+
+        /// <summary>
+        /// Calls body(const Row&amp;) for every row of the query run with
+        /// params bound to its parameters in order.
+        /// </summary>
+        template <class Body, class... Params>
+        int ForEach(Body&& body, const Params&... params) {
+            int retcode = Start(params...);
+            while (retcode == SQLITE_OK && (retcode = sqlite3_step(stmt_)) == SQLITE_ROW) {
+                body(detail::ReadRow<Row>(stmt_, std::index_sequence_for<Columns...>()));
+                retcode = SQLITE_OK;
+            }
+            Finish();
+            return retcode == SQLITE_DONE ? SQLITE_OK : retcode;
+        }
+
+        /// <summary>
+        /// The first row; SQLITE_DONE when there is none.
+        /// </summary>
+        template <class... Params>
+        int One(Row* row, const Params&... params) {
+            static_assert(!(detail::IsView<Columns> || ...), "string_view columns are only valid inside ForEach");
+            int retcode = Start(params...);
+            if (retcode == SQLITE_OK) {
+                retcode = sqlite3_step(stmt_);
+                if (retcode == SQLITE_ROW) {
+                    *row = detail::ReadRow<Row>(stmt_, std::index_sequence_for<Columns...>());
+                    retcode = SQLITE_OK;
+                }
+            }
+            Finish();
+            return retcode;
+        }
+
+        template <class... Params>
+        int All(std::vector<Row>* rows, const Params&... params) {
+            static_assert(!(detail::IsView<Columns> || ...), "string_view columns are only valid inside ForEach");
+            return ForEach([rows](const Row& row) { rows->push_back(row); }, params...);
+        }
+
+    private:
+        template <class... Params>
+        int Start(const Params&... params) {
+            if (stmt_ == 0) {
+                return SQLITE_MISUSE;
+            }
+            if (!checked_) {
+                if (sqlite3_column_count(stmt_) != static_cast<int>(columns) ||
+                    !detail::ColumnsFit<Row>(stmt_, std::index_sequence_for<Columns...>())) {
+                    return SQLITE_MISMATCH;
+                }
+                checked_ = true;
+            }
+            if (sqlite3_bind_parameter_count(stmt_) != static_cast<int>(sizeof...(Params))) {
+                return SQLITE_RANGE;
+            }
+            int retcode = SQLITE_OK;
+            int index = 0;
+            ((retcode = retcode == SQLITE_OK ? detail::BindParameter(stmt_, ++index, params) : retcode), ...);
+            return retcode;
+        }
+
+        void Finish() {
+            if (stmt_ != 0) {
+                sqlite3_reset(stmt_);
+                sqlite3_clear_bindings(stmt_);
+            }
+        }
+
+        sqlite3_stmt* stmt_ = 0;
+        bool checked_ = false;
+    };
+}
@@ -0,0 +1,127 @@
+//
+// unlock_notify.h
+//
+// Blocking prepare and step for shared-cache connections. Connections that
+// share a cache lock each other at table level, and a conflicting statement
+// fails at once with SQLITE_LOCKED_SHAREDCACHE, whatever busy handler is
+// set. These wrappers park the thread on a condition variable until
+// sqlite3_unlock_notify reports that the blocking connection has finished its
+// transaction, then retry. This is the pattern of SQLite's unlock_notify
+// example.
+//
+// Requires a library built with SQLITE_ENABLE_UNLOCK_NOTIFY.
+//
+
+#pragma once
+
+#include "sqlite3.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+
+namespace sqlite3tests {
+
+    struct UnlockNotifyStats {
+        long long waits = 0;
+        /// <summary>
+        /// Waits refused because blocking would have deadlocked; the caller
+        /// gets SQLITE_LOCKED and should roll back.
+        /// </summary>
+        long long deadlocks = 0;
+    };
+
+    namespace detail {
+
+        struct UnlockNotification {
+            bool fired = false;
+            std::mutex lock;
+            std::condition_variable cv;
+        };
+
+        struct UnlockCounters {
+            std::atomic<long long> waits{ 0 };
+            std::atomic<long long> deadlocks{ 0 };
+        };
+
+        inline UnlockCounters& Unlocks() {
+            static UnlockCounters counters;
+            return counters;
+        }
+
+        // SQLite batches every notification that becomes due at once.
+        inline void UnlockNotifyCallback(void** args, int count) {
+            for (int i = 0; i < count; ++i) {
+                UnlockNotification* notification = static_cast<UnlockNotification*>(args[i]);
+                std::lock_guard<std::mutex> lock(notification->lock);
+                notification->fired = true;
+                notification->cv.notify_one();
+            }
+        }
+
+        inline bool IsSharedCacheLock(sqlite3* db, int retcode) {
+            return retcode == SQLITE_LOCKED_SHAREDCACHE ||
+                   ((retcode & 0xff) == SQLITE_LOCKED && sqlite3_extended_errcode(db) == SQLITE_LOCKED_SHAREDCACHE);
+        }
+    }
+
+    /// <summary>
+    /// Blocks until the connection holding the lock db just ran into ends
+    /// its transaction. Returns SQLITE_LOCKED instead of blocking when the
+    /// wait would deadlock.
+    /// </summary>
+    inline int WaitForUnlockNotify(sqlite3* db) {
+        detail::UnlockNotification notification;
+        int retcode = sqlite3_unlock_notify(db, detail::UnlockNotifyCallback, &notification);
+        if (retcode != SQLITE_OK) {
+            ++detail::Unlocks().deadlocks;
+            return retcode;
+        }
+        ++detail::Unlocks().waits;
+        // The callback may already have run inside sqlite3_unlock_notify.
+        std::unique_lock<std::mutex> lock(notification.lock);
+        notification.cv.wait(lock, [&notification] { return notification.fired; });
+        return SQLITE_OK;
+    }
+
+    /// <summary>
+    /// sqlite3_step that waits out shared-cache table locks.
+    /// </summary>
+    inline int BlockingStep(sqlite3_stmt* stmt) {
+        sqlite3* db = sqlite3_db_handle(stmt);
+        int retcode = 0;
+        while (detail::IsSharedCacheLock(db, retcode = sqlite3_step(stmt))) {
+            retcode = WaitForUnlockNotify(db);
+            if (retcode != SQLITE_OK) {
+                break;
+            }
+            sqlite3_reset(stmt);
+        }
+        return retcode;
+    }
+
+    /// <summary>
+    /// sqlite3_prepare_v2 that waits out a locked schema.
+    /// </summary>
+    inline int BlockingPrepare(sqlite3* db, const char* sql, int bytes, sqlite3_stmt** stmt, const char** tail) {
+        int retcode = 0;
+        while (detail::IsSharedCacheLock(db, retcode = sqlite3_prepare_v2(db, sql, bytes, stmt, tail))) {
+            retcode = WaitForUnlockNotify(db);
+            if (retcode != SQLITE_OK) {
+                break;
+            }
+        }
+        return retcode;
+    }
+
+    inline int OpenSharedCache(const char* path, sqlite3** db, int flags = SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE) {
+        return sqlite3_open_v2(path, db, flags | SQLITE_OPEN_SHAREDCACHE, 0);
+    }
+
+    inline UnlockNotifyStats UnlockNotifyCounters() {
+        UnlockNotifyStats stats;
+        stats.waits = detail::Unlocks().waits.load();
+        stats.deadlocks = detail::Unlocks().deadlocks.load();
+        return stats;
+    }
+}
@@ -0,0 +1,162 @@
+#include "gtest/gtest.h"
+#include "pch.h"
+#include "sqlite3.h"
+
+#include "arena_allocator.h"
+#include "test_support.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+using namespace sqlite3tests;
+
+namespace {
+
+    const char* kArenaDb = "ArenaTest.db";
+
+    TEST(ARENA_ALLOCATOR, SIZE_CLASSES) {
+        const sqlite3_mem_methods* methods = ArenaAllocatorMethods();
+        EXPECT_EQ(16, methods->xRoundup(1));
+        EXPECT_EQ(48, methods->xRoundup(33));
+        EXPECT_EQ(160, methods->xRoundup(129));
+
+        void* small = methods->xMalloc(100);
+        ASSERT_TRUE(small != nullptr);
+        EXPECT_EQ(methods->xRoundup(100), methods->xSize(small));
+        EXPECT_EQ(0u, reinterpret_cast<std::uintptr_t>(small) % 8);
+        std::memset(small, 0xab, 100);
+
+        // Growing within the size class keeps the block.
+        EXPECT_EQ(small, methods->xRealloc(small, 110));
+        void* grown = methods->xRealloc(small, 5000);
+        ASSERT_TRUE(grown != nullptr);
+        EXPECT_EQ(0xab, static_cast<unsigned char*>(grown)[99]);
+        methods->xFree(grown);
+
+        void* large = methods->xMalloc(1 << 20);
+        ASSERT_TRUE(large != nullptr);
+        EXPECT_EQ(1 << 20, methods->xSize(large));
+        methods->xFree(large);
+    }
+
+    TEST(ARENA_ALLOCATOR, REUSE_AND_CROSS_THREAD_FREE) {
+        const sqlite3_mem_methods* methods = ArenaAllocatorMethods();
+        long long before = ArenaAllocatorCounters().liveBytes;
+
+        void* first = methods->xMalloc(64);
+        methods->xFree(first);
+        EXPECT_EQ(first, methods->xMalloc(64));
+
+        std::vector<void*> blocks;
+        for (int i = 0; i < 1000; ++i) {
+            blocks.push_back(methods->xMalloc(200));
+        }
+        std::thread other([&] {
+            for (void* block : blocks) {
+                methods->xFree(block);
+            }
+        });
+        other.join();
+
+        // The remote frees come back to this thread's arena.
+        void* reused = methods->xMalloc(200);
+        EXPECT_NE(blocks.end(), std::find(blocks.begin(), blocks.end(), reused));
+        methods->xFree(reused);
+        methods->xFree(first);
+
+        EXPECT_EQ(before, ArenaAllocatorCounters().liveBytes);
+    }
+
+    /// <summary>
+    /// SELECT from normal_test.cpp with SQLite running on the arenas.
+    /// </summary>
+    TEST(ARENA_ALLOCATOR, SELECT) {
+        ASSERT_EQ(SQLITE_OK, InstallArenaAllocator());
+        ASSERT_EQ(SQLITE_OK, CreateStudentsDb(kArenaDb, 36));
+
+        sqlite3* db = 0;
+        sqlite3_stmt* stmt = 0;
+        ASSERT_EQ(SQLITE_OK, sqlite3_open(kArenaDb, &db));
+        ASSERT_EQ(SQLITE_OK, sqlite3_prepare_v2(db, "select COUNT(SID) from Students", -1, &stmt, 0));
+        ASSERT_EQ(SQLITE_ROW, sqlite3_step(stmt));
+        EXPECT_EQ(36, sqlite3_column_int(stmt, 0));
+        EXPECT_GT(ArenaAllocatorCounters().liveBytes, 0);
+        sqlite3_finalize(stmt);
+        sqlite3_close(db);
+
+        ArenaAllocatorStats stats = ArenaAllocatorCounters();
+        EXPECT_GE(stats.peakBytes, stats.liveBytes);
+        printf("live %lld, peak %lld, chunks %lld bytes in %d arenas\n",
+            stats.liveBytes, stats.peakBytes, stats.chunkBytes, stats.arenas);
+
+        EXPECT_EQ(SQLITE_OK, RestoreDefaultAllocator());
+        RemoveDb(kArenaDb);
+    }
+
+    /// <summary>
+    /// The insert and select helpers of normal_test.cpp, prepare/step/finalize
+    /// per operation, on a connection per thread.
+    /// </summary>
+    void AllocatorWorkload(int numThreads, long long perThread, double* insertRate, double* selectRate) {
+        std::atomic<long long> errors(0);
+        double seconds = RunThreads(numThreads, [&](int) {
+            sqlite3* db = 0;
+            sqlite3_open(":memory:", &db);
+            sqlite3_exec(db, "create table Students(SID INTEGER); begin;", 0, 0, 0);
+            for (long long i = 0; i < perThread; ++i) {
+                sqlite3_stmt* stmt = 0;
+                sqlite3_prepare_v2(db, "insert into Students values (100);", -1, &stmt, 0);
+                if (sqlite3_step(stmt) != SQLITE_DONE) {
+                    ++errors;
+                }
+                sqlite3_finalize(stmt);
+            }
+            sqlite3_exec(db, "commit", 0, 0, 0);
+            sqlite3_close(db);
+        });
+        *insertRate = numThreads * perThread / seconds;
+
+        seconds = RunThreads(numThreads, [&](int) {
+            sqlite3* db = 0;
+            sqlite3_open_v2(kArenaDb, &db, SQLITE_OPEN_READONLY, 0);
+            for (long long i = 0; i < perThread; ++i) {
+                sqlite3_stmt* stmt = 0;
+                sqlite3_prepare_v2(db, "select COUNT(SID) from Students", -1, &stmt, 0);
+                if (sqlite3_step(stmt) != SQLITE_ROW) {
+                    ++errors;
+                }
+                sqlite3_finalize(stmt);
+            }
+            sqlite3_close(db);
+        });
+        *selectRate = numThreads * perThread / seconds;
+        EXPECT_EQ(0, errors.load());
+    }
+
+    TEST(ARENA_ALLOCATOR_BENCH, INSERT_AND_SELECT) {
+        const long long perThread = Scaled(5000);
+        ASSERT_EQ(SQLITE_OK, CreateStudentsDb(kArenaDb, 36));
+        printf("%-22s %8s %14s %14s\n", "allocator", "threads", "insert/s", "select/s");
+
+        const char* modes[] = { "system", "system, no memstatus", "arena" };
+        for (int mode = 0; mode < 3; ++mode) {
+            ASSERT_EQ(SQLITE_OK, mode == 2 ? InstallArenaAllocator() : RestoreDefaultAllocator(mode == 0));
+            for (int numThreads = 1; numThreads <= 8; numThreads *= 2) {
+                double insertRate = 0;
+                double selectRate = 0;
+                AllocatorWorkload(numThreads, perThread, &insertRate, &selectRate);
+                printf("%-22s %8d %14.0f %14.0f\n", modes[mode], numThreads, insertRate, selectRate);
+            }
+        }
+        ArenaAllocatorStats stats = ArenaAllocatorCounters();
+        printf("arena peak %lld bytes, %lld bytes of chunks\n", stats.peakBytes, stats.chunkBytes);
+
+        EXPECT_EQ(SQLITE_OK, RestoreDefaultAllocator());
+        RemoveDb(kArenaDb);
+    }
+}
@@ -0,0 +1,224 @@
+#include "gtest/gtest.h"
+#include "pch.h"
+#include "sqlite3.h"
+
+#include "async_db.h"
+#include "test_support.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace sqlite3tests;
+
+namespace {
+
+    const char* kAsyncDb = "AsyncTest.db";
+
+    Task<long long> SumStudents(AsyncConnection& connection, std::thread::id* resumedOn) {
+        int retcode = co_await connection.Exec("insert into Students values (100);");
+        if (retcode != SQLITE_OK) {
+            co_return -1;
+        }
+        *resumedOn = std::this_thread::get_id();
+        long long sum = 0;
+        std::unique_ptr<AsyncRowStream> rows = connection.Rows("select SID from Students", 8);
+        while (co_await rows->Next()) {
+            sum += std::get<int64_t>(rows->Current()[0]);
+        }
+        co_return rows->Status() == SQLITE_OK ? sum : -1;
+    }
+
+    TEST(ASYNC_DB, EXEC_AND_ROWS) {
+        ASSERT_EQ(SQLITE_OK, CreateStudentsDb(kAsyncDb, 36));
+        AsyncConnection connection;
+        ASSERT_EQ(SQLITE_OK, connection.Open(kAsyncDb));
+
+        std::thread::id resumedOn;
+        EXPECT_EQ(36 * 37 / 2 + 100, SyncWait(SumStudents(connection, &resumedOn)));
+        EXPECT_EQ(connection.ExecutorId(), resumedOn);
+
+        long long count = SyncWait([&connection]() -> Task<long long> {
+            co_return co_await connection.Run([](sqlite3* db) { return QueryInt64(db, "select count(*) from Students"); });
+        }());
+        EXPECT_EQ(37, count);
+        connection.Close();
+        RemoveDb(kAsyncDb);
+    }
+
+    TEST(ASYNC_DB, ERRORS) {
+        AsyncConnection connection;
+        ASSERT_EQ(SQLITE_OK, connection.Open(":memory:"));
+        EXPECT_EQ(SQLITE_MISUSE, connection.Open(":memory:"));
+
+        auto failing = [&connection]() -> Task<int> {
+            int retcode = co_await connection.Exec("insert into Missing values (1)");
+            std::unique_ptr<AsyncRowStream> rows = connection.Rows("select * from Missing");
+            EXPECT_FALSE(co_await rows->Next());
+            EXPECT_EQ(SQLITE_ERROR, rows->Status());
+            co_return retcode;
+        };
+        EXPECT_EQ(SQLITE_ERROR, SyncWait(failing()));
+
+        auto throwing = [&connection]() -> Task<void> {
+            co_await connection.Exec("select 1");
+            throw std::runtime_error("client failed");
+        };
+        EXPECT_THROW(SyncWait(throwing()), std::runtime_error);
+    }
+
+    struct ClientsDone {
+        explicit ClientsDone(int clients) : remaining(clients) {}
+
+        void Finished() {
+            std::lock_guard<std::mutex> guard(lock);
+            if (--remaining == 0) {
+                done.notify_one();
+            }
+        }
+
+        void Wait() {
+            std::unique_lock<std::mutex> guard(lock);
+            done.wait(guard, [this] { return remaining == 0; });
+        }
+
+        std::mutex lock;
+        std::condition_variable done;
+        int remaining;
+    };
+
+    // Coroutines take their state as parameters: a lambda's captures would
+    // die with the closure before the coroutine finishes.
+    Task<void> InsertClient(AsyncConnection& connection, int client, std::atomic<int>& failures,
+                            std::mutex& threadsLock, std::set<std::thread::id>& threads) {
+        int retcode = co_await connection.Exec("insert into Students values (" + std::to_string(1000 + client) + ")");
+        failures += retcode != SQLITE_OK;
+        std::lock_guard<std::mutex> lock(threadsLock);
+        threads.insert(std::this_thread::get_id());
+    }
+
+    /// <summary>
+    /// Many logical clients, a few connections: every client's insert lands,
+    /// and only the executors ever run statements.
+    /// </summary>
+    TEST(ASYNC_DB, CLIENTS_SHARE_POOL) {
+        ASSERT_EQ(SQLITE_OK, CreateStudentsDb(kAsyncDb, 36));
+        AsyncConnectionPool pool;
+        AsyncPoolOptions options;
+        options.path = kAsyncDb;
+        options.connections = 3;
+        options.warmupSql = { "pragma journal_mode=wal", "pragma synchronous=normal" };
+        ASSERT_EQ(SQLITE_OK, pool.Open(options));
+
+        const int clients = 1000;
+        std::atomic<int> failures{ 0 };
+        std::mutex threadsLock;
+        std::set<std::thread::id> threads;
+        ClientsDone done(clients);
+        for (int client = 0; client < clients; ++client) {
+            Spawn(InsertClient(pool.Next(), client, failures, threadsLock, threads), [&done] { done.Finished(); });
+        }
+        done.Wait();
+        EXPECT_EQ(0, failures.load());
+        EXPECT_EQ(3u, threads.size());
+        EXPECT_EQ(36 + clients, QueryInt64(pool[0].Db(), "select count(*) from Students"));
+        pool.Close();
+        RemoveDb(kAsyncDb);
+    }
+
+    int CreateLookupDb(long long students) {
+        int retcode = CreateStudentsDb(kAsyncDb, students);
+        sqlite3* db = 0;
+        if (retcode == SQLITE_OK) {
+            retcode = sqlite3_open(kAsyncDb, &db);
+        }
+        if (retcode == SQLITE_OK) {
+            retcode = sqlite3_exec(db, "create index StudentsSID on Students(SID); pragma journal_mode=wal", 0, 0, 0);
+        }
+        sqlite3_close(db);
+        return retcode;
+    }
+
+    long long LookupSid(sqlite3* db, long long sid) {
+        sqlite3_stmt* stmt = 0;
+        long long found = 0;
+        if (sqlite3_prepare_v2(db, "select SID from Students where SID = ?", -1, &stmt, 0) == SQLITE_OK) {
+            sqlite3_bind_int64(stmt, 1, sid);
+            found = sqlite3_step(stmt) == SQLITE_ROW ? sqlite3_column_int64(stmt, 0) : 0;
+        }
+        sqlite3_finalize(stmt);
+        return found;
+    }
+
+    Task<void> LookupClient(AsyncConnection& connection, int client, int ops, long long students,
+                            double* latencies, std::atomic<long long>& misses) {
+        for (int op = 0; op < ops; ++op) {
+            long long sid = 1 + (static_cast<long long>(client) * 7919 + op * 104729) % students;
+            Stopwatch watch;
+            long long found = co_await connection.Run([sid](sqlite3* db) { return LookupSid(db, sid); });
+            latencies[op] = watch.Micros();
+            misses += found != sid;
+        }
+    }
+
+    TEST(ASYNC_DB_BENCH, CONCURRENT_CLIENTS) {
+        const long long students = 100000;
+        const int clients = static_cast<int>(Scaled(10000));
+        const int opsPerClient = 5;
+        ASSERT_EQ(SQLITE_OK, CreateLookupDb(students));
+
+        printf("%-10s %8s %8s %12s %10s %10s\n", "mode", "clients", "threads", "ops/s", "p50 us", "p99 us");
+        for (int connections = 1; connections <= 8; connections *= 2) {
+            AsyncConnectionPool pool;
+            AsyncPoolOptions options;
+            options.path = kAsyncDb;
+            options.connections = connections;
+            ASSERT_EQ(SQLITE_OK, pool.Open(options));
+
+            std::vector<double> latencies(static_cast<size_t>(clients) * opsPerClient);
+            std::atomic<long long> misses{ 0 };
+            ClientsDone done(clients);
+            Stopwatch watch;
+            for (int client = 0; client < clients; ++client) {
+                Spawn(LookupClient(pool.Next(), client, opsPerClient, students,
+                    &latencies[static_cast<size_t>(client) * opsPerClient], misses), [&done] { done.Finished(); });
+            }
+            done.Wait();
+            double seconds = watch.Seconds();
+            EXPECT_EQ(0, misses.load());
+            printf("%-10s %8d %8d %12.0f %10.1f %10.1f\n", "coroutine", clients, connections,
+                latencies.size() / seconds, Percentile(latencies, 50), Percentile(latencies, 99));
+            pool.Close();
+        }
+
+        // Baseline: a blocking OS thread and a connection per client. Only
+        // a tenth of the clients, to stay within thread limits.
+        const int threadClients = std::max(1, clients / 10);
+        std::vector<double> latencies(static_cast<size_t>(threadClients) * opsPerClient);
+        std::atomic<long long> misses{ 0 };
+        double seconds = RunThreads(threadClients, [&](int client) {
+            sqlite3* db = 0;
+            sqlite3_open_v2(kAsyncDb, &db, SQLITE_OPEN_READWRITE, 0);
+            sqlite3_busy_timeout(db, 5000);
+            for (int op = 0; op < opsPerClient; ++op) {
+                long long sid = 1 + (static_cast<long long>(client) * 7919 + op * 104729) % students;
+                Stopwatch opWatch;
+                misses += LookupSid(db, sid) != sid;
+                latencies[static_cast<size_t>(client) * opsPerClient + op] = opWatch.Micros();
+            }
+            sqlite3_close(db);
+        });
+        EXPECT_EQ(0, misses.load());
+        printf("%-10s %8d %8d %12.0f %10.1f %10.1f\n", "thread", threadClients, threadClients,
+            latencies.size() / seconds, Percentile(latencies, 50), Percentile(latencies, 99));
+        RemoveDb(kAsyncDb);
+    }
+}
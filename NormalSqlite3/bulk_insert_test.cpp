@@ -0,0 +1,180 @@
+#include "gtest/gtest.h"
+#include "pch.h"
+#include "sqlite3.h"
+
+#include "bulk_insert.h"
+#include "test_support.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace sqlite3tests;
+
+namespace {
+
+    const char* kBulkInsertDb = "BulkInsertTest.db";
+
+    std::vector<int64_t> Sids(long long rows) {
+        std::vector<int64_t> sids(static_cast<size_t>(rows));
+        for (long long i = 0; i < rows; ++i) {
+            sids[static_cast<size_t>(i)] = i + 1;
+        }
+        return sids;
+    }
+
+    TEST(BULK_INSERT, STUDENTS_SIDS) {
+        ASSERT_EQ(SQLITE_OK, CreateStudentsDb(kBulkInsertDb, 0));
+        sqlite3* db = 0;
+        ASSERT_EQ(SQLITE_OK, sqlite3_open(kBulkInsertDb, &db));
+        const std::vector<int64_t> sids = Sids(1005);
+
+        BulkInsertOptions options;
+        options.rowsPerStatement = 100;
+        BulkInsertStats stats;
+        ASSERT_EQ(SQLITE_OK, BulkInsert(db, "Students", "SID", sids, options, &stats));
+        EXPECT_EQ(1005, stats.rows);
+        EXPECT_EQ(11, stats.executions);
+        EXPECT_EQ(100, stats.rowsPerStatement);
+        EXPECT_EQ(1005, QueryInt64(db, "select count(*) from Students"));
+        EXPECT_EQ(1005LL * 1006 / 2, QueryInt64(db, "select sum(SID) from Students"));
+
+        options.rowsPerStatement = 0;
+        ASSERT_EQ(SQLITE_OK, BulkInsert(db, "Students", "SID", sids, options, &stats));
+        EXPECT_EQ(1, stats.executions);
+        options.multiRow = false;
+        ASSERT_EQ(SQLITE_OK, BulkInsert(db, "Students", "SID", sids, options, &stats));
+        EXPECT_EQ(1005, stats.executions);
+        EXPECT_EQ(3 * 1005, QueryInt64(db, "select count(*) from Students"));
+        EXPECT_TRUE(sqlite3_get_autocommit(db));
+
+        EXPECT_EQ(SQLITE_OK, sqlite3_close(db));
+        RemoveDb(kBulkInsertDb);
+    }
+
+    TEST(BULK_INSERT, MULTIPLE_COLUMNS) {
+        RemoveDb(kBulkInsertDb);
+        sqlite3* db = 0;
+        ASSERT_EQ(SQLITE_OK, sqlite3_open(kBulkInsertDb, &db));
+        ASSERT_EQ(SQLITE_OK, sqlite3_exec(db, "create table Courses(name, SID, credits)", 0, 0, 0));
+        const std::vector<std::string> names = { "Math", "Physics", "Chemistry" };
+        const std::vector<int64_t> sids = { 1, 2, 3 };
+        const std::vector<double> credits = { 4.0, 3.5, 3.0 };
+        const BulkColumn columns[] = {
+            BulkColumn("name", names), BulkColumn("SID", sids), BulkColumn("credits", credits)
+        };
+        ASSERT_EQ(SQLITE_OK, BulkInsert(db, "Courses", columns));
+        EXPECT_EQ(2, QueryInt64(db, "select SID from Courses where name = 'Physics' and credits = 3.5"));
+
+        const std::vector<int64_t> shorter = { 1, 2 };
+        const BulkColumn mismatched[] = { BulkColumn("name", names), BulkColumn("SID", shorter) };
+        EXPECT_EQ(SQLITE_MISUSE, BulkInsert(db, "Courses", mismatched));
+
+        // Empty strings stay '' rather than becoming NULL, as row by row.
+        const std::vector<std::string_view> views = { std::string_view(), std::string_view("") };
+        const std::vector<int64_t> emptySids = { 4, 5 };
+        for (bool multiRow : { true, false }) {
+            const BulkColumn empty[] = { BulkColumn("name", views), BulkColumn("SID", emptySids) };
+            BulkInsertOptions options;
+            options.multiRow = multiRow;
+            ASSERT_EQ(SQLITE_OK, BulkInsert(db, "Courses", empty, options));
+        }
+        EXPECT_EQ(4, QueryInt64(db, "select count(*) from Courses where name = ''"));
+        EXPECT_EQ(0, QueryInt64(db, "select count(*) from Courses where name is null"));
+
+        EXPECT_EQ(SQLITE_OK, sqlite3_close(db));
+        RemoveDb(kBulkInsertDb);
+    }
+
+    /// <summary>
+    /// A failing row rolls back the whole bulk insert, but not the work of
+    /// the enclosing transaction.
+    /// </summary>
+    TEST(BULK_INSERT, ALL_OR_NOTHING) {
+        RemoveDb(kBulkInsertDb);
+        sqlite3* db = 0;
+        ASSERT_EQ(SQLITE_OK, sqlite3_open(kBulkInsertDb, &db));
+        ASSERT_EQ(SQLITE_OK, sqlite3_exec(db, "create table t1(x check (x <= 10), y)", 0, 0, 0));
+        ASSERT_EQ(SQLITE_OK, sqlite3_exec(db, "begin; insert into t1 values (1, 1)", 0, 0, 0));
+
+        const std::vector<int64_t> xs = { 2, 3, 11, 4 };
+        BulkInsertOptions options;
+        options.rowsPerStatement = 2;
+        EXPECT_EQ(SQLITE_CONSTRAINT, BulkInsert(db, "t1", "x", xs, options));
+        EXPECT_FALSE(sqlite3_get_autocommit(db));
+        ASSERT_EQ(SQLITE_OK, sqlite3_exec(db, "commit", 0, 0, 0));
+        EXPECT_EQ(1, QueryInt64(db, "select count(*) from t1"));
+
+        EXPECT_EQ(SQLITE_OK, sqlite3_close(db));
+        RemoveDb(kBulkInsertDb);
+    }
+
+    // The repo's pattern: a freshly prepared single-row insert per value.
+    double LoopInsert(sqlite3* db, const std::vector<int64_t>& sids, bool transaction) {
+        Stopwatch watch;
+        if (transaction) {
+            sqlite3_exec(db, "begin", 0, 0, 0);
+        }
+        for (int64_t sid : sids) {
+            sqlite3_stmt* stmt = 0;
+            sqlite3_prepare_v2(db, "insert into Students values (?)", -1, &stmt, 0);
+            sqlite3_bind_int64(stmt, 1, sid);
+            sqlite3_step(stmt);
+            sqlite3_finalize(stmt);
+        }
+        if (transaction) {
+            sqlite3_exec(db, "commit", 0, 0, 0);
+        }
+        return watch.Seconds();
+    }
+
+    TEST(BULK_INSERT_BENCH, ROWS_PER_SECOND) {
+        std::vector<long long> sizes = { 1000, 10000, 100000 };
+        if (BenchScale() >= 8) {
+            sizes.push_back(1000000);
+        }
+        if (BenchScale() >= 64) {
+            sizes.push_back(10000000);
+        }
+        printf("%10s %-16s %14s %12s\n", "rows", "mode", "rows/s", "executions");
+        for (long long rows : sizes) {
+            const std::vector<int64_t> sids = Sids(rows);
+            for (int mode = 0; mode < 5; ++mode) {
+                // One autocommit transaction per row syncs the journal every
+                // time; only the smallest size finishes in reasonable time.
+                if (mode == 0 && rows > 1000) {
+                    continue;
+                }
+                ASSERT_EQ(SQLITE_OK, CreateStudentsDb(kBulkInsertDb, 0));
+                sqlite3* db = 0;
+                ASSERT_EQ(SQLITE_OK, sqlite3_open(kBulkInsertDb, &db));
+                BulkInsertStats stats;
+                stats.executions = rows;
+                double seconds = 0;
+                const char* label = "";
+                if (mode < 2) {
+                    seconds = LoopInsert(db, sids, mode == 1);
+                    label = mode == 0 ? "loop autocommit" : "loop";
+                }
+                else {
+                    BulkInsertOptions options;
+                    options.multiRow = mode > 2;
+                    if (mode == 4) {
+                        options.rowsPerStatement = 0;
+                    }
+                    Stopwatch watch;
+                    ASSERT_EQ(SQLITE_OK, BulkInsert(db, "Students", "SID", sids, options, &stats));
+                    seconds = watch.Seconds();
+                    const char* labels[] = { "bulk rebind", "bulk multi-row", "bulk max rows" };
+                    label = labels[mode - 2];
+                }
+                EXPECT_EQ(rows, QueryInt64(db, "select count(*) from Students"));
+                printf("%10lld %-16s %14.0f %12lld\n", rows, label, rows / seconds, stats.executions);
+                EXPECT_EQ(SQLITE_OK, sqlite3_close(db));
+                RemoveDb(kBulkInsertDb);
+            }
+        }
+    }
+}
@@ -0,0 +1,162 @@
+#include "gtest/gtest.h"
+#include "pch.h"
+#include "sqlite3.h"
+
+#include "busy_handler.h"
+#include "test_support.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace sqlite3tests;
+
+namespace {
+
+    const char* kBusyDb = "BusyTest.db";
+
+    TEST(BUSY_HANDLER, GIVES_UP_AT_DEADLINE) {
+        ASSERT_EQ(SQLITE_OK, CreateStudentsDb(kBusyDb, 36));
+        ResetBusyTelemetry();
+        sqlite3* holder = 0;
+        sqlite3* db = 0;
+        ASSERT_EQ(SQLITE_OK, sqlite3_open(kBusyDb, &holder));
+        ASSERT_EQ(SQLITE_OK, sqlite3_open(kBusyDb, &db));
+        ASSERT_EQ(SQLITE_OK, sqlite3_exec(holder, "begin exclusive", 0, 0, 0));
+
+        BusyPolicy policy;
+        policy.deadline = std::chrono::milliseconds(50);
+        AdaptiveBusyHandler handler;
+        ASSERT_EQ(SQLITE_OK, handler.Install(db, policy));
+        Stopwatch watch;
+        EXPECT_EQ(SQLITE_BUSY, sqlite3_exec(db, "insert into Students values (100);", 0, 0, 0));
+        EXPECT_GE(watch.Seconds(), 0.045);
+
+        BusyStats stats = handler.Stats();
+        EXPECT_EQ(1, stats.busyEvents);
+        EXPECT_EQ(1, stats.giveUps);
+        EXPECT_GE(stats.waitMs, 40);
+        // Backoff: far fewer retries than a 1 ms poll would make.
+        EXPECT_GT(stats.retries, 1);
+        EXPECT_LT(stats.retries, 20);
+
+        // A reset zeroes the totals that the installed handler keeps feeding.
+        const std::string path = sqlite3_db_filename(db, "main");
+        EXPECT_EQ(1, BusyTelemetry(path).giveUps);
+        ResetBusyTelemetry();
+        EXPECT_EQ(0, BusyTelemetry(path).busyEvents);
+        EXPECT_EQ(SQLITE_BUSY, sqlite3_exec(db, "insert into Students values (100);", 0, 0, 0));
+        EXPECT_EQ(1, BusyTelemetry(path).busyEvents);
+        EXPECT_EQ(1, BusyTelemetry(path).giveUps);
+
+        handler.Uninstall();
+        sqlite3_close(db);
+        sqlite3_exec(holder, "rollback", 0, 0, 0);
+        sqlite3_close(holder);
+        RemoveDb(kBusyDb);
+    }
+
+    TEST(BUSY_HANDLER, WAITS_OUT_LOCK) {
+        ASSERT_EQ(SQLITE_OK, CreateStudentsDb(kBusyDb, 36));
+        ResetBusyTelemetry();
+        sqlite3* holder = 0;
+        ASSERT_EQ(SQLITE_OK, sqlite3_open(kBusyDb, &holder));
+        ASSERT_EQ(SQLITE_OK, sqlite3_exec(holder, "begin exclusive", 0, 0, 0));
+        std::thread release([holder] {
+            std::this_thread::sleep_for(std::chrono::milliseconds(30));
+            sqlite3_exec(holder, "commit", 0, 0, 0);
+        });
+
+        std::vector<sqlite3*> dbs(2);
+        std::vector<AdaptiveBusyHandler> handlers(2);
+        for (int i = 0; i < 2; ++i) {
+            ASSERT_EQ(SQLITE_OK, sqlite3_open(kBusyDb, &dbs[i]));
+            ASSERT_EQ(SQLITE_OK, handlers[i].Install(dbs[i]));
+        }
+        EXPECT_EQ(SQLITE_OK, sqlite3_exec(dbs[0], "insert into Students values (100);", 0, 0, 0));
+        EXPECT_EQ(SQLITE_OK, sqlite3_exec(dbs[1], "insert into Students values (100);", 0, 0, 0));
+        release.join();
+
+        EXPECT_EQ(1, handlers[0].Stats().busyEvents);
+        EXPECT_EQ(0, handlers[0].Stats().giveUps);
+        BusyStats database = BusyTelemetry(sqlite3_db_filename(dbs[0], "main"));
+        EXPECT_EQ(handlers[0].Stats().retries + handlers[1].Stats().retries, database.retries);
+        EXPECT_EQ(0, database.giveUps);
+
+        for (int i = 0; i < 2; ++i) {
+            handlers[i].Uninstall();
+            sqlite3_close(dbs[i]);
+        }
+        sqlite3_close(holder);
+        RemoveDb(kBusyDb);
+    }
+
+    /// <summary>
+    /// InsertIsolatedDbHandle from every thread, each on its own connection,
+    /// with and without the handler.
+    /// </summary>
+    TEST(BUSY_HANDLER_BENCH, CONTENTION) {
+        const long long perThread = Scaled(100);
+        printf("%-8s %-9s %8s %10s %10s %10s %10s %10s\n",
+            "journal", "handler", "threads", "success", "p50 us", "p99 us", "busy", "give-ups");
+        for (const char* journal : { "delete", "wal" }) {
+            for (int handled = 0; handled < 2; ++handled) {
+                for (int numThreads = 1; numThreads <= 16; numThreads *= 2) {
+                    ASSERT_EQ(SQLITE_OK, CreateStudentsDb(kBusyDb, 36));
+                    sqlite3* setup = 0;
+                    sqlite3_open(kBusyDb, &setup);
+                    std::string sql = std::string("pragma journal_mode = ") + journal;
+                    sqlite3_exec(setup, sql.c_str(), 0, 0, 0);
+                    std::string path = sqlite3_db_filename(setup, "main");
+                    sqlite3_close(setup);
+                    ResetBusyTelemetry();
+
+                    std::atomic<long long> successes(0);
+                    std::mutex samplesLock;
+                    std::vector<double> samples;
+                    RunThreads(numThreads, [&](int) {
+                        sqlite3* db = 0;
+                        sqlite3_open(kBusyDb, &db);
+                        BusyPolicy policy;
+                        policy.deadline = std::chrono::milliseconds(200);
+                        AdaptiveBusyHandler handler;
+                        if (handled) {
+                            handler.Install(db, policy);
+                        }
+                        sqlite3_stmt* stmt = 0;
+                        std::vector<double> local;
+                        for (long long i = 0; i < perThread; ++i) {
+                            Stopwatch watch;
+                            // Loading the schema can hit the lock too; a
+                            // failed prepare is retried on the next insert.
+                            if (stmt == 0) {
+                                sqlite3_prepare_v2(db, "insert into Students values (100);", -1, &stmt, 0);
+                            }
+                            if (stmt != 0 && sqlite3_step(stmt) == SQLITE_DONE) {
+                                ++successes;
+                            }
+                            sqlite3_reset(stmt);
+                            local.push_back(watch.Micros());
+                        }
+                        sqlite3_finalize(stmt);
+                        handler.Uninstall();
+                        sqlite3_close(db);
+                        std::lock_guard<std::mutex> lock(samplesLock);
+                        samples.insert(samples.end(), local.begin(), local.end());
+                    });
+
+                    BusyStats stats = BusyTelemetry(path);
+                    printf("%-8s %-9s %8d %9.1f%% %10.1f %10.1f %10lld %10lld\n", journal,
+                        handled ? "adaptive" : "none", numThreads,
+                        100.0 * successes / (numThreads * perThread),
+                        Percentile(samples, 50), Percentile(samples, 99), stats.busyEvents, stats.giveUps);
+                    RemoveDb(kBusyDb);
+                }
+            }
+        }
+    }
+}
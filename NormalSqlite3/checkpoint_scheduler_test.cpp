@@ -0,0 +1,160 @@
+#include "gtest/gtest.h"
+#include "pch.h"
+#include "sqlite3.h"
+
+#include "checkpoint_scheduler.h"
+#include "test_support.h"
+
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+using namespace sqlite3tests;
+
+namespace {
+
+    const char* kCheckpointDb = "CheckpointTest.db";
+
+    long long WalFileBytes() {
+        std::FILE* file = std::fopen((std::string(kCheckpointDb) + "-wal").c_str(), "rb");
+        if (file == nullptr) {
+            return 0;
+        }
+        std::fseek(file, 0, SEEK_END);
+        long long bytes = std::ftell(file);
+        std::fclose(file);
+        return bytes;
+    }
+
+    sqlite3* OpenWalWriter() {
+        sqlite3* db = 0;
+        EXPECT_EQ(SQLITE_OK, CreateStudentsDb(kCheckpointDb, 36));
+        EXPECT_EQ(SQLITE_OK, sqlite3_open(kCheckpointDb, &db));
+        // RESTART and TRUNCATE hold the write lock while they rewind the log.
+        sqlite3_busy_timeout(db, 5000);
+        sqlite3_exec(db, "pragma journal_mode = wal; pragma synchronous = normal", 0, 0, 0);
+        return db;
+    }
+
+    bool WaitFor(CheckpointScheduler& scheduler, long long checkpoints) {
+        for (int i = 0; i < 200; ++i) {
+            CheckpointStats stats = scheduler.Stats();
+            if (stats.passive + stats.restart + stats.truncate + stats.busy >= checkpoints) {
+                return true;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        return false;
+    }
+
+    TEST(CHECKPOINT_SCHEDULER, MODE_CHOICE) {
+        CheckpointPolicy policy;
+        EXPECT_EQ(SQLITE_CHECKPOINT_PASSIVE, ChooseCheckpointMode(policy.passiveFrames, false, policy));
+        EXPECT_EQ(SQLITE_CHECKPOINT_RESTART, ChooseCheckpointMode(policy.restartFrames, false, policy));
+        EXPECT_EQ(SQLITE_CHECKPOINT_TRUNCATE, ChooseCheckpointMode(policy.truncateFrames, false, policy));
+        // Never fight a reader for a log it is still using.
+        EXPECT_EQ(SQLITE_CHECKPOINT_PASSIVE, ChooseCheckpointMode(policy.truncateFrames, true, policy));
+    }
+
+    TEST(CHECKPOINT_SCHEDULER, CHECKPOINTS_IN_BACKGROUND) {
+        sqlite3* db = OpenWalWriter();
+        CheckpointPolicy policy;
+        policy.passiveFrames = 20;
+        policy.restartFrames = 100;
+        policy.truncateFrames = 400;
+        CheckpointScheduler scheduler;
+        ASSERT_EQ(SQLITE_OK, scheduler.Attach(db, policy));
+        EXPECT_EQ(0, QueryInt64(db, "pragma wal_autocheckpoint"));
+
+        for (int i = 0; i < 300; ++i) {
+            ASSERT_EQ(SQLITE_OK, sqlite3_exec(db, "insert into Students values (100);", 0, 0, 0));
+        }
+        EXPECT_TRUE(WaitFor(scheduler, 1));
+        CheckpointStats stats = scheduler.Stats();
+        EXPECT_GE(stats.maxWalFrames, policy.passiveFrames);
+        EXPECT_GT(stats.maxMs, 0);
+        EXPECT_EQ(stats.passive + stats.restart + stats.truncate + stats.busy,
+            static_cast<long long>(scheduler.Durations().size()));
+
+        scheduler.Detach();
+        EXPECT_EQ(1000, QueryInt64(db, "pragma wal_autocheckpoint"));
+        EXPECT_EQ(0, WalFileBytes());
+        EXPECT_EQ(336, QueryInt64(db, "select COUNT(SID) from Students"));
+        sqlite3_close(db);
+        RemoveDb(kCheckpointDb);
+    }
+
+    TEST(CHECKPOINT_SCHEDULER, READER_PINS_LOG) {
+        sqlite3* db = OpenWalWriter();
+        sqlite3* reader = 0;
+        ASSERT_EQ(SQLITE_OK, sqlite3_open(kCheckpointDb, &reader));
+        ASSERT_EQ(SQLITE_OK, sqlite3_exec(reader, "begin", 0, 0, 0));
+        EXPECT_EQ(36, QueryInt64(reader, "select COUNT(SID) from Students"));
+
+        CheckpointPolicy policy;
+        policy.passiveFrames = 20;
+        policy.restartFrames = 60;
+        policy.idleInterval = std::chrono::milliseconds(50);
+        CheckpointScheduler scheduler;
+        ASSERT_EQ(SQLITE_OK, scheduler.Attach(db, policy));
+        for (int i = 0; i < 200; ++i) {
+            ASSERT_EQ(SQLITE_OK, sqlite3_exec(db, "insert into Students values (100);", 0, 0, 0));
+        }
+        EXPECT_TRUE(WaitFor(scheduler, 1));
+        std::this_thread::sleep_for(std::chrono::milliseconds(300));
+        CheckpointStats stats = scheduler.Stats();
+        // The open snapshot keeps the log from being rewound.
+        EXPECT_EQ(0, stats.restart + stats.truncate);
+        EXPECT_GT(stats.walFrames, 0);
+        // Nor is the log checkpointed over and over while it is held: one
+        // pass per passiveFrames commits, and one per idleInterval after.
+        EXPECT_LE(stats.passive + stats.busy, 200 / policy.passiveFrames + 10);
+
+        sqlite3_exec(reader, "commit", 0, 0, 0);
+        sqlite3_close(reader);
+        scheduler.Detach();
+        EXPECT_EQ(0, WalFileBytes());
+        sqlite3_close(db);
+        RemoveDb(kCheckpointDb);
+    }
+
+    /// <summary>
+    /// Single-row inserts, each its own commit, timed one by one: with
+    /// auto-checkpoint every thousandth commit pays for a checkpoint.
+    /// </summary>
+    TEST(CHECKPOINT_SCHEDULER_BENCH, SUSTAINED_INSERTS) {
+        const long long inserts = Scaled(20000);
+        printf("%-12s %10s %10s %10s %10s %10s %12s %10s\n",
+            "checkpoint", "inserts/s", "p50 us", "p99 us", "p99.9 us", "max us", "max frames", "ckpt ms");
+        for (int mode = 0; mode < 2; ++mode) {
+            sqlite3* db = OpenWalWriter();
+            CheckpointScheduler scheduler;
+            if (mode == 1) {
+                ASSERT_EQ(SQLITE_OK, scheduler.Attach(db));
+            }
+            sqlite3_stmt* stmt = 0;
+            sqlite3_prepare_v2(db, "insert into Students values (?)", -1, &stmt, 0);
+            std::vector<double> samples;
+            Stopwatch total;
+            for (long long i = 0; i < inserts; ++i) {
+                Stopwatch watch;
+                sqlite3_bind_int64(stmt, 1, i);
+                EXPECT_EQ(SQLITE_DONE, sqlite3_step(stmt));
+                sqlite3_reset(stmt);
+                samples.push_back(watch.Micros());
+            }
+            double seconds = total.Seconds();
+            sqlite3_finalize(stmt);
+
+            CheckpointStats stats = scheduler.Stats();
+            printf("%-12s %10.0f %10.1f %10.1f %10.1f %10.1f %12lld %10.2f\n",
+                mode == 0 ? "auto" : "background", inserts / seconds,
+                Percentile(samples, 50), Percentile(samples, 99), Percentile(samples, 99.9),
+                Percentile(samples, 100), mode == 0 ? -1LL : stats.maxWalFrames, stats.maxMs);
+            scheduler.Detach();
+            sqlite3_close(db);
+            RemoveDb(kCheckpointDb);
+        }
+    }
+}
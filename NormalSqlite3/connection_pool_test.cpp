@@ -0,0 +1,206 @@
+#include "gtest/gtest.h"
+#include "pch.h"
+#include "sqlite3.h"
+
+#include "connection_pool.h"
+#include "test_support.h"
+
+#include <atomic>
+#include <cstdio>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+using namespace sqlite3tests;
+
+namespace {
+
+    const char* kPoolDb = "PoolTest.db";
+
+    ConnectionPoolOptions PoolOptions(int capacity) {
+        ConnectionPoolOptions options;
+        options.path = kPoolDb;
+        options.capacity = capacity;
+        return options;
+    }
+
+    /// <summary>
+    /// The pooled counterpart of InsertIsolatedDbHandle: the connection and
+    /// the compiled insert survive between calls.
+    /// </summary>
+    int InsertPooled(ConnectionPool& pool) {
+        PooledConnection conn;
+        int retcode = pool.Checkout(&conn);
+        if (retcode != SQLITE_OK) {
+            return retcode;
+        }
+        sqlite3_stmt* stmt = 0;
+        retcode = conn.Prepare("insert into Students values (100);", &stmt);
+        if (retcode != SQLITE_OK) {
+            return retcode;
+        }
+        retcode = sqlite3_step(stmt);
+        return retcode == SQLITE_DONE ? SQLITE_OK : retcode;
+    }
+
+    TEST(CONNECTION_POOL, ISOLATED_DB_HANDLE) {
+        ASSERT_EQ(SQLITE_OK, CreateStudentsDb(kPoolDb, 36));
+        ConnectionPool pool;
+        ASSERT_EQ(SQLITE_OK, pool.Open(PoolOptions(3)));
+
+        std::atomic<int> failures(0);
+        RunThreads(5, [&](int) {
+            if (InsertPooled(pool) != SQLITE_OK) {
+                ++failures;
+            }
+        });
+        EXPECT_EQ(0, failures.load());
+
+        PooledConnection conn;
+        ASSERT_EQ(SQLITE_OK, pool.Checkout(&conn));
+        sqlite3_stmt* stmt = 0;
+        ASSERT_EQ(SQLITE_OK, conn.Prepare("select COUNT(SID) from Students where SID = 100", &stmt));
+        EXPECT_EQ(5, StepInt64(stmt));
+        conn.Release();
+
+        pool.Close();
+        RemoveDb(kPoolDb);
+    }
+
+    TEST(CONNECTION_POOL, CHECKOUT_TIMEOUT) {
+        ASSERT_EQ(SQLITE_OK, CreateStudentsDb(kPoolDb, 1));
+        ConnectionPool pool;
+        ASSERT_EQ(SQLITE_OK, pool.Open(PoolOptions(1)));
+
+        PooledConnection first;
+        ASSERT_EQ(SQLITE_OK, pool.Checkout(&first));
+        EXPECT_EQ(0, pool.Idle());
+
+        PooledConnection second;
+        EXPECT_EQ(SQLITE_BUSY, pool.Checkout(&second, std::chrono::milliseconds(10)));
+        EXPECT_FALSE(second);
+
+        first.Release();
+        EXPECT_EQ(SQLITE_OK, pool.Checkout(&second, std::chrono::milliseconds(10)));
+        second.Release();
+
+        ConnectionPoolStats stats = pool.Stats();
+        EXPECT_EQ(2, stats.checkouts);
+        EXPECT_EQ(1, stats.timeouts);
+
+        pool.Close();
+        EXPECT_EQ(SQLITE_MISUSE, pool.Checkout(&second));
+        RemoveDb(kPoolDb);
+    }
+
+    TEST(CONNECTION_POOL, STATEMENT_RETENTION) {
+        ASSERT_EQ(SQLITE_OK, CreateStudentsDb(kPoolDb, 36));
+        ConnectionPool pool;
+        ASSERT_EQ(SQLITE_OK, pool.Open(PoolOptions(1)));
+
+        sqlite3_stmt* first = 0;
+        {
+            PooledConnection conn;
+            ASSERT_EQ(SQLITE_OK, pool.Checkout(&conn));
+            ASSERT_EQ(SQLITE_OK, conn.Prepare("select COUNT(SID) from Students", &first));
+            // Left mid-step on purpose: checkin has to reset it.
+            ASSERT_EQ(SQLITE_ROW, sqlite3_step(first));
+        }
+        {
+            PooledConnection conn;
+            ASSERT_EQ(SQLITE_OK, pool.Checkout(&conn));
+            sqlite3_stmt* second = 0;
+            ASSERT_EQ(SQLITE_OK, conn.Prepare("select COUNT(SID) from Students", &second));
+            EXPECT_EQ(first, second);
+            EXPECT_EQ(36, StepInt64(second));
+        }
+
+        ConnectionPoolStats stats = pool.Stats();
+        EXPECT_EQ(1, stats.statementHits);
+        EXPECT_EQ(1, stats.statementMisses);
+
+        pool.Close();
+        RemoveDb(kPoolDb);
+    }
+
+    TEST(CONNECTION_POOL, ROLLBACK_ON_CHECKIN) {
+        ASSERT_EQ(SQLITE_OK, CreateStudentsDb(kPoolDb, 1));
+        ConnectionPool pool;
+        ASSERT_EQ(SQLITE_OK, pool.Open(PoolOptions(1)));
+        {
+            PooledConnection conn;
+            ASSERT_EQ(SQLITE_OK, pool.Checkout(&conn));
+            ASSERT_EQ(SQLITE_OK, sqlite3_exec(conn.Handle(), "begin; insert into Students values (7);", 0, 0, 0));
+        }
+        PooledConnection conn;
+        ASSERT_EQ(SQLITE_OK, pool.Checkout(&conn));
+        EXPECT_NE(0, sqlite3_get_autocommit(conn.Handle()));
+        sqlite3_stmt* stmt = 0;
+        ASSERT_EQ(SQLITE_OK, conn.Prepare("select COUNT(SID) from Students", &stmt));
+        EXPECT_EQ(1, StepInt64(stmt));
+        conn.Release();
+
+        pool.Close();
+        RemoveDb(kPoolDb);
+    }
+
+    /// <summary>
+    /// Point reads per second for the open-prepare-close pattern of
+    /// InsertIsolatedDbHandle against the pool, from 1 to 64 threads.
+    /// </summary>
+    TEST(CONNECTION_POOL_BENCH, OPEN_PER_CALL_VS_POOL) {
+        ASSERT_EQ(SQLITE_OK, CreateStudentsDb(kPoolDb, 1000));
+        const long long requestsPerThread = Scaled(200);
+        const char* sql = "select SID from Students where rowid = ?";
+
+        ConnectionPool pool;
+        ASSERT_EQ(SQLITE_OK, pool.Open(PoolOptions(8)));
+
+        printf("%8s %16s %16s %8s\n", "threads", "open/call req/s", "pooled req/s", "speedup");
+        for (int numThreads = 1; numThreads <= 64; numThreads *= 2) {
+            std::atomic<long long> errors(0);
+
+            double openSeconds = RunThreads(numThreads, [&](int thread) {
+                for (long long i = 0; i < requestsPerThread; ++i) {
+                    sqlite3* db = 0;
+                    sqlite3_stmt* stmt = 0;
+                    if (sqlite3_open(kPoolDb, &db) != SQLITE_OK ||
+                        sqlite3_prepare_v2(db, sql, -1, &stmt, 0) != SQLITE_OK) {
+                        ++errors;
+                    }
+                    else {
+                        sqlite3_bind_int64(stmt, 1, 1 + (thread + i) % 1000);
+                        if (sqlite3_step(stmt) != SQLITE_ROW) {
+                            ++errors;
+                        }
+                    }
+                    sqlite3_finalize(stmt);
+                    sqlite3_close(db);
+                }
+            });
+
+            double pooledSeconds = RunThreads(numThreads, [&](int thread) {
+                for (long long i = 0; i < requestsPerThread; ++i) {
+                    PooledConnection conn;
+                    sqlite3_stmt* stmt = 0;
+                    if (pool.Checkout(&conn) != SQLITE_OK || conn.Prepare(sql, &stmt) != SQLITE_OK) {
+                        ++errors;
+                        continue;
+                    }
+                    sqlite3_bind_int64(stmt, 1, 1 + (thread + i) % 1000);
+                    if (sqlite3_step(stmt) != SQLITE_ROW) {
+                        ++errors;
+                    }
+                }
+            });
+
+            EXPECT_EQ(0, errors.load());
+            double total = static_cast<double>(numThreads * requestsPerThread);
+            printf("%8d %16.0f %16.0f %7.1fx\n", numThreads, total / openSeconds,
+                total / pooledSeconds, openSeconds / pooledSeconds);
+        }
+
+        pool.Close();
+        RemoveDb(kPoolDb);
+    }
+}
@@ -0,0 +1,207 @@
+#include "gtest/gtest.h"
+#include "pch.h"
+#include "sqlite3.h"
+
+#include "connection_pool.h"
+#include "mmap_tuning.h"
+#include "test_support.h"
+
+#include <cstdio>
+#include <vector>
+
+using namespace sqlite3tests;
+
+namespace {
+
+    const char* kMmapDb = "MmapTest.db";
+
+    TEST(MMAP_IO, SIZED_FROM_FILE) {
+        ASSERT_EQ(SQLITE_OK, CreateStudentsDb(kMmapDb, 100000));
+        MmapTuning tuning;
+        tuning.minBytes = 64 * 1024;
+        sqlite3* db = 0;
+        MmapTuner tuner;
+        ASSERT_EQ(SQLITE_OK, OpenMmapped(kMmapDb, &db, SQLITE_OPEN_READONLY, &tuner, tuning));
+
+        long long fileBytes = QueryInt64(db, "pragma page_count") * QueryInt64(db, "pragma page_size");
+        EXPECT_EQ(fileBytes, tuner.FileBytes());
+        EXPECT_GE(tuner.MappedLimit(), fileBytes);
+        EXPECT_LE(tuner.MappedLimit(), 2 * static_cast<long long>(fileBytes * tuning.headroom));
+        EXPECT_EQ(tuner.MappedLimit(), QueryInt64(db, "pragma mmap_size"));
+        EXPECT_EQ(100000, QueryInt64(db, "select COUNT(SID) from Students"));
+
+        bool retuned = true;
+        EXPECT_EQ(SQLITE_OK, tuner.Refresh(&retuned));
+        EXPECT_FALSE(retuned);
+        tuner.Detach();
+        sqlite3_close(db);
+        RemoveDb(kMmapDb);
+    }
+
+    TEST(MMAP_IO, RETUNES_ON_GROWTH) {
+        ASSERT_EQ(SQLITE_OK, CreateStudentsDb(kMmapDb, 36));
+        MmapTuning tuning;
+        tuning.minBytes = 16 * 1024;
+        sqlite3* reader = 0;
+        MmapTuner tuner;
+        ASSERT_EQ(SQLITE_OK, OpenMmapped(kMmapDb, &reader, SQLITE_OPEN_READWRITE, &tuner, tuning));
+        long long initial = tuner.MappedLimit();
+        EXPECT_EQ(tuning.minBytes, initial);
+
+        // Growth committed by another connection shows up in data_version.
+        sqlite3* writer = 0;
+        ASSERT_EQ(SQLITE_OK, sqlite3_open(kMmapDb, &writer));
+        ASSERT_EQ(SQLITE_OK, sqlite3_exec(writer,
+            "with recursive n(x) as (select 1 union all select x + 1 from n limit 50000) "
+            "insert into Students select x from n", 0, 0, 0));
+        sqlite3_close(writer);
+
+        bool retuned = false;
+        EXPECT_EQ(SQLITE_OK, tuner.Refresh(&retuned));
+        EXPECT_TRUE(retuned);
+        EXPECT_GT(tuner.MappedLimit(), initial);
+        EXPECT_GE(tuner.MappedLimit(), tuner.FileBytes());
+        EXPECT_EQ(50036, QueryInt64(reader, "select COUNT(SID) from Students"));
+
+        // So do writes made on the tuned connection itself.
+        long long before = tuner.MappedLimit();
+        ASSERT_EQ(SQLITE_OK, sqlite3_exec(reader,
+            "with recursive n(x) as (select 1 union all select x + 1 from n limit 200000) "
+            "insert into Students select x from n", 0, 0, 0));
+        EXPECT_EQ(SQLITE_OK, tuner.Refresh(&retuned));
+        EXPECT_TRUE(retuned);
+        EXPECT_GT(tuner.MappedLimit(), before);
+        EXPECT_EQ(tuner.MappedLimit(), QueryInt64(reader, "pragma mmap_size"));
+
+        tuner.Detach();
+        sqlite3_close(reader);
+        RemoveDb(kMmapDb);
+    }
+
+    TEST(MMAP_IO, POOL_OPTION) {
+        ASSERT_EQ(SQLITE_OK, CreateStudentsDb(kMmapDb, 36));
+        ConnectionPoolOptions options;
+        options.path = kMmapDb;
+        options.capacity = 2;
+        options.mmap = true;
+        ConnectionPool pool;
+        ASSERT_EQ(SQLITE_OK, pool.Open(options));
+        {
+            PooledConnection connection;
+            ASSERT_EQ(SQLITE_OK, pool.Checkout(&connection));
+            EXPECT_EQ(options.mmapTuning.minBytes, QueryInt64(connection.Handle(), "pragma mmap_size"));
+            EXPECT_EQ(36, QueryInt64(connection.Handle(), "select COUNT(SID) from Students"));
+        }
+        pool.Close();
+        RemoveDb(kMmapDb);
+    }
+
+    /// <summary>
+    /// Students with a 100-byte Name per row so that large files build in
+    /// reasonable time; the 8 KB case is MyDB.db's 36 rows.
+    /// </summary>
+    int CreateSizedDb(long long bytes) {
+        long long rows = bytes <= 8192 ? 36 : bytes / 128;
+        RemoveDb(kMmapDb);
+        sqlite3* db = 0;
+        int retcode = sqlite3_open(kMmapDb, &db);
+        char sql[256];
+        snprintf(sql, sizeof(sql),
+            "pragma journal_mode = off; pragma synchronous = off;"
+            "create table Students(SID INTEGER, Name BLOB);"
+            "with recursive n(x) as (select 1 union all select x + 1 from n limit %lld) "
+            "insert into Students select x, zeroblob(100) from n", rows);
+        if (retcode == SQLITE_OK) {
+            retcode = sqlite3_exec(db, sql, 0, 0, 0);
+        }
+        sqlite3_close(db);
+        return retcode;
+    }
+
+    struct ReadLatency {
+        double scanMs = 0;
+        double pointP50 = 0;
+        double pointP99 = 0;
+    };
+
+    ReadLatency MeasureReads(sqlite3* db, long long rows, long long lookups) {
+        ReadLatency latency;
+        sqlite3_stmt* scan = 0;
+        sqlite3_prepare_v2(db, "select COUNT(SID), SUM(length(Name)) from Students", -1, &scan, 0);
+        // One untimed pass so both modes start from a warm OS page cache.
+        for (int pass = 0; pass < 3; ++pass) {
+            Stopwatch watch;
+            EXPECT_EQ(SQLITE_ROW, sqlite3_step(scan));
+            EXPECT_EQ(rows, sqlite3_column_int64(scan, 0));
+            sqlite3_reset(scan);
+            if (pass > 0) {
+                latency.scanMs += watch.Seconds() * 1000 / 2;
+            }
+        }
+        sqlite3_finalize(scan);
+
+        sqlite3_stmt* point = 0;
+        sqlite3_prepare_v2(db, "select SID from Students where rowid = ?", -1, &point, 0);
+        std::vector<double> samples;
+        unsigned long long seed = 88172645463325252ULL;
+        for (long long i = 0; i < lookups; ++i) {
+            seed ^= seed << 13;
+            seed ^= seed >> 7;
+            seed ^= seed << 17;
+            sqlite3_bind_int64(point, 1, 1 + static_cast<long long>(seed % rows));
+            Stopwatch watch;
+            EXPECT_EQ(SQLITE_ROW, sqlite3_step(point));
+            sqlite3_reset(point);
+            samples.push_back(watch.Micros());
+        }
+        sqlite3_finalize(point);
+        latency.pointP50 = Percentile(samples, 50);
+        latency.pointP99 = Percentile(samples, 99);
+        return latency;
+    }
+
+    /// <summary>
+    /// 8 KB to 64 MB by default. SQLITE3TESTS_BENCH_SCALE of 16 adds 1 and
+    /// 4 GB files, 256 adds 16 and 32 GB; the mapped column shows where the
+    /// library's SQLITE_MAX_MMAP_SIZE capped the mapping.
+    /// </summary>
+    TEST(MMAP_IO_BENCH, SCAN_AND_POINT_LOOKUP) {
+        std::vector<long long> sizes = { 8LL << 10, 1LL << 20, 64LL << 20 };
+        if (BenchScale() >= 16) {
+            sizes.push_back(1LL << 30);
+            sizes.push_back(4LL << 30);
+        }
+        if (BenchScale() >= 256) {
+            sizes.push_back(16LL << 30);
+            sizes.push_back(32LL << 30);
+        }
+        const long long lookups = Scaled(20000);
+        ASSERT_EQ(SQLITE_OK, ConfigureMmapLimits(0, 1LL << 40));
+
+        printf("%12s %-6s %12s %12s %10s %10s\n", "file bytes", "io", "mapped", "scan ms", "p50 us", "p99 us");
+        for (long long size : sizes) {
+            ASSERT_EQ(SQLITE_OK, CreateSizedDb(size));
+            for (int mode = 0; mode < 2; ++mode) {
+                sqlite3* db = 0;
+                MmapTuner tuner;
+                if (mode == 0) {
+                    ASSERT_EQ(SQLITE_OK, sqlite3_open_v2(kMmapDb, &db, SQLITE_OPEN_READONLY, 0));
+                    sqlite3_exec(db, "pragma mmap_size = 0", 0, 0, 0);
+                }
+                else {
+                    ASSERT_EQ(SQLITE_OK, OpenMmapped(kMmapDb, &db, SQLITE_OPEN_READONLY, &tuner));
+                }
+                // A small page cache so reads go to the file, not to SQLite's cache.
+                sqlite3_exec(db, "pragma cache_size = 16", 0, 0, 0);
+                long long rows = QueryInt64(db, "select max(rowid) from Students");
+                long long fileBytes = QueryInt64(db, "pragma page_count") * QueryInt64(db, "pragma page_size");
+                ReadLatency latency = MeasureReads(db, rows, lookups);
+                printf("%12lld %-6s %12lld %12.3f %10.2f %10.2f\n", fileBytes, mode == 0 ? "read" : "mmap",
+                    tuner.MappedLimit(), latency.scanMs, latency.pointP50, latency.pointP99);
+                tuner.Detach();
+                sqlite3_close(db);
+            }
+        }
+        RemoveDb(kMmapDb);
+    }
+}
@@ -0,0 +1,252 @@
+#include "gtest/gtest.h"
+#include "pch.h"
+#include "sqlite3.h"
+
+#include "connection_pool.h"
+#include "parallel_query.h"
+#include "test_support.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace sqlite3tests;
+
+namespace {
+
+    const char* kParallelDb = "ParallelQueryTest.db";
+
+    ConnectionPoolOptions PoolOptions(int capacity) {
+        ConnectionPoolOptions options;
+        options.path = kParallelDb;
+        options.capacity = capacity;
+        options.openFlags = SQLITE_OPEN_READONLY;
+        return options;
+    }
+
+    ParallelQueryOptions StudentsQuery(int partitions, const std::string& where = "") {
+        ParallelQueryOptions options;
+        options.table = "Students";
+        options.where = where;
+        options.partitions = partitions;
+        return options;
+    }
+
+    ScanValue QueryValue(const char* sql) {
+        ScanValue value;
+        ForEachRow(kParallelDb, sql, [&value](sqlite3_stmt* stmt) { value = detail::ReadScanValue(stmt, 0); });
+        return value;
+    }
+
+    std::vector<int64_t> QuerySids(const char* sql) {
+        std::vector<int64_t> sids;
+        ForEachRow(kParallelDb, sql, [&sids](sqlite3_stmt* stmt) { sids.push_back(sqlite3_column_int64(stmt, 0)); });
+        return sids;
+    }
+
+    void ExpectSameValue(const ScanValue& expected, const ScanValue& actual) {
+        EXPECT_EQ(expected.type, actual.type);
+        if (expected.type == SQLITE_FLOAT) {
+            EXPECT_DOUBLE_EQ(expected.real, actual.real);
+        }
+        else {
+            EXPECT_EQ(expected.integer, actual.integer);
+        }
+    }
+
+    TEST(PARALLEL_QUERY, PARTITIONS_COVER_ROWIDS) {
+        ASSERT_EQ(SQLITE_OK, CreateStudentsDb(kParallelDb, 1000));
+        ConnectionPool pool;
+        ASSERT_EQ(SQLITE_OK, pool.Open(PoolOptions(4)));
+        ParallelQuery query(pool);
+
+        for (int partitions = 1; partitions <= 7; ++partitions) {
+            std::vector<RowidRange> ranges;
+            ASSERT_EQ(SQLITE_OK, query.Partition("Students", partitions, &ranges));
+            ASSERT_EQ(static_cast<size_t>(partitions), ranges.size());
+            EXPECT_EQ(1, ranges.front().first);
+            EXPECT_EQ(1000, ranges.back().last);
+            for (size_t i = 1; i < ranges.size(); ++i) {
+                EXPECT_EQ(ranges[i - 1].last + 1, ranges[i].first);
+            }
+        }
+        pool.Close();
+
+        ASSERT_EQ(SQLITE_OK, CreateStudentsDb(kParallelDb, 0));
+        ASSERT_EQ(SQLITE_OK, pool.Open(PoolOptions(2)));
+        std::vector<RowidRange> ranges;
+        EXPECT_EQ(SQLITE_OK, query.Partition("Students", 2, &ranges));
+        EXPECT_TRUE(ranges.empty());
+        ScanValue count;
+        ASSERT_EQ(SQLITE_OK, query.Aggregate(StudentsQuery(2), AggregateKind::Count, "SID", &count));
+        EXPECT_EQ(SQLITE_INTEGER, count.type);
+        EXPECT_EQ(0, count.integer);
+        ScanValue sum;
+        ASSERT_EQ(SQLITE_OK, query.Aggregate(StudentsQuery(2), AggregateKind::Sum, "SID", &sum));
+        EXPECT_EQ(SQLITE_NULL, sum.type);
+        pool.Close();
+
+        // The widest possible span.
+        sqlite3* db = 0;
+        ASSERT_EQ(SQLITE_OK, sqlite3_open(kParallelDb, &db));
+        ASSERT_EQ(SQLITE_OK, sqlite3_exec(db, "insert into Students(rowid, SID) values "
+            "(-9223372036854775808, 1), (9223372036854775807, 2)", 0, 0, 0));
+        sqlite3_close(db);
+        ASSERT_EQ(SQLITE_OK, pool.Open(PoolOptions(4)));
+        for (int partitions : { 1, 4 }) {
+            ASSERT_EQ(SQLITE_OK, query.Partition("Students", partitions, &ranges));
+            ASSERT_EQ(static_cast<size_t>(partitions), ranges.size());
+            EXPECT_EQ(INT64_MIN, ranges.front().first);
+            EXPECT_EQ(INT64_MAX, ranges.back().last);
+            for (size_t i = 1; i < ranges.size(); ++i) {
+                EXPECT_EQ(ranges[i - 1].last + 1, ranges[i].first);
+            }
+        }
+        ASSERT_EQ(SQLITE_OK, query.Aggregate(StudentsQuery(4), AggregateKind::Count, "SID", &count));
+        EXPECT_EQ(2, count.integer);
+        pool.Close();
+        RemoveDb(kParallelDb);
+    }
+
+    /// <summary>
+    /// Every merged aggregate equals the single-connection result, with
+    /// NULLs and a real value in the mix and with or without a filter.
+    /// </summary>
+    TEST(PARALLEL_QUERY, AGGREGATES_MATCH_SERIAL) {
+        ASSERT_EQ(SQLITE_OK, CreateStudentsDb(kParallelDb, 1000));
+        sqlite3* db = 0;
+        ASSERT_EQ(SQLITE_OK, sqlite3_open(kParallelDb, &db));
+        ASSERT_EQ(SQLITE_OK, sqlite3_exec(db,
+            "insert into Students values (null), (-7), (2.5); delete from Students where SID between 100 and 400", 0, 0, 0));
+        sqlite3_close(db);
+
+        ConnectionPool pool;
+        ASSERT_EQ(SQLITE_OK, pool.Open(PoolOptions(5)));
+        ParallelQuery query(pool);
+        const struct {
+            AggregateKind kind;
+            const char* function;
+        } aggregates[] = {
+            { AggregateKind::Count, "count" }, { AggregateKind::Sum, "sum" }, { AggregateKind::Min, "min" },
+            { AggregateKind::Max, "max" }, { AggregateKind::Avg, "avg" },
+        };
+        for (const char* where : { "", "SID % 3 = 0", "SID > 5000" }) {
+            for (const auto& aggregate : aggregates) {
+                std::string sql = std::string("select ") + aggregate.function + "(SID) from Students";
+                if (*where != 0) {
+                    sql += std::string(" where ") + where;
+                }
+                ScanValue expected = QueryValue(sql.c_str());
+                for (int partitions = 1; partitions <= 5; ++partitions) {
+                    SCOPED_TRACE(sql + " partitions " + std::to_string(partitions));
+                    ScanValue actual;
+                    ASSERT_EQ(SQLITE_OK, query.Aggregate(StudentsQuery(partitions, where), aggregate.kind, "SID", &actual));
+                    ExpectSameValue(expected, actual);
+                }
+            }
+        }
+        ScanValue missing;
+        EXPECT_EQ(SQLITE_ERROR, query.Aggregate(StudentsQuery(2), AggregateKind::Sum, "Missing", &missing));
+        pool.Close();
+        RemoveDb(kParallelDb);
+    }
+
+    TEST(PARALLEL_QUERY, ORDERED_MERGE) {
+        ASSERT_EQ(SQLITE_OK, CreateStudentsDb(kParallelDb, 0));
+        sqlite3* db = 0;
+        ASSERT_EQ(SQLITE_OK, sqlite3_open(kParallelDb, &db));
+        // SIDs out of rowid order, so every range holds keys from all over.
+        ASSERT_EQ(SQLITE_OK, sqlite3_exec(db,
+            "with recursive n(i) as (select 1 union all select i + 1 from n where i < 5000) "
+            "insert into Students select (i * 7919) % 5003 from n", 0, 0, 0));
+        sqlite3_close(db);
+
+        ConnectionPool pool;
+        ASSERT_EQ(SQLITE_OK, pool.Open(PoolOptions(4)));
+        ParallelQuery query(pool);
+        std::vector<int64_t> expected = QuerySids("select SID from Students where SID % 2 = 0 order by SID desc");
+        std::vector<int64_t> merged;
+        ASSERT_EQ(SQLITE_OK, query.Ordered(StudentsQuery(4, "SID % 2 = 0"), "SID", true, [&merged](const ScanRow& row) {
+            merged.push_back(row[0].integer);
+            return true;
+        }));
+        EXPECT_EQ(expected, merged);
+
+        // Stopping early leaves the producers nothing to wait for.
+        std::vector<int64_t> top;
+        ASSERT_EQ(SQLITE_OK, query.Ordered(StudentsQuery(4), "SID, rowid", false, [&top](const ScanRow& row) {
+            top.push_back(row[0].integer);
+            return top.size() < 10;
+        }));
+        EXPECT_EQ(QuerySids("select SID from Students order by SID limit 10"), top);
+        EXPECT_EQ(4, pool.Idle());
+
+        EXPECT_EQ(SQLITE_ERROR, query.Ordered(StudentsQuery(4), "Missing", false, [](const ScanRow&) { return true; }));
+        pool.Close();
+        RemoveDb(kParallelDb);
+    }
+
+    TEST(PARALLEL_QUERY_BENCH, SCALING) {
+        // About 10 bytes a row: SQLITE3TESTS_BENCH_SCALE=256 gives a multi-GB table.
+        const long long students = Scaled(4000000);
+        ASSERT_EQ(SQLITE_OK, CreateStudentsDb(kParallelDb, students));
+        // Doubling up to at least 8, plus the core count itself.
+        int cores = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+        std::vector<int> counts;
+        for (int partitions = 1; partitions <= std::max(8, cores); partitions *= 2) {
+            counts.push_back(partitions);
+        }
+        if (std::find(counts.begin(), counts.end(), cores) == counts.end()) {
+            counts.insert(std::upper_bound(counts.begin(), counts.end(), cores), cores);
+        }
+
+        printf("%-8s %10s %8s %10s %12s %8s\n", "query", "rows", "ranges", "ms", "rows/s", "speedup");
+        const struct {
+            const char* name;
+            AggregateKind kind;
+        } aggregates[] = { { "count", AggregateKind::Count }, { "sum", AggregateKind::Sum }, { "avg", AggregateKind::Avg } };
+        for (const auto& aggregate : aggregates) {
+            double baseline = 0;
+            for (int partitions : counts) {
+                ConnectionPool pool;
+                ASSERT_EQ(SQLITE_OK, pool.Open(PoolOptions(partitions)));
+                ParallelQuery query(pool);
+                ScanValue result;
+                Stopwatch watch;
+                ASSERT_EQ(SQLITE_OK, query.Aggregate(StudentsQuery(partitions), aggregate.kind, "SID", &result));
+                double seconds = watch.Seconds();
+                baseline = partitions == 1 ? seconds : baseline;
+                if (aggregate.kind == AggregateKind::Count) {
+                    EXPECT_EQ(students, result.integer);
+                }
+                printf("%-8s %10lld %8d %10.1f %12.0f %8.2f\n", aggregate.name, students, partitions, seconds * 1000,
+                    students / seconds, baseline / seconds);
+                pool.Close();
+            }
+        }
+
+        double baseline = 0;
+        for (int partitions : counts) {
+            ConnectionPool pool;
+            ASSERT_EQ(SQLITE_OK, pool.Open(PoolOptions(partitions)));
+            ParallelQuery query(pool);
+            long long rows = 0;
+            Stopwatch watch;
+            ASSERT_EQ(SQLITE_OK, query.Ordered(StudentsQuery(partitions, "SID % 10 = 0"), "SID", true,
+                [&rows](const ScanRow&) {
+                    ++rows;
+                    return true;
+                }));
+            double seconds = watch.Seconds();
+            baseline = partitions == 1 ? seconds : baseline;
+            EXPECT_EQ(students / 10, rows);
+            printf("%-8s %10lld %8d %10.1f %12.0f %8.2f\n", "ordered", rows, partitions, seconds * 1000,
+                students / seconds, baseline / seconds);
+            pool.Close();
+        }
+        RemoveDb(kParallelDb);
+    }
+}
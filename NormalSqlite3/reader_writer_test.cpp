@@ -0,0 +1,95 @@
+#include "gtest/gtest.h"
+#include "pch.h"
+#include "sqlite3.h"
+
+#include "reader_writer_harness.h"
+#include "test_support.h"
+
+#include <chrono>
+#include <cstdio>
+
+using namespace sqlite3tests;
+
+namespace {
+
+    const char* kReaderWriterDb = "ReaderWriterTest.db";
+
+    ReaderWriterOptions HarnessOptions(JournalMode mode, int readers, int busyTimeoutMs) {
+        ReaderWriterOptions options;
+        options.path = kReaderWriterDb;
+        options.mode = mode;
+        options.readers = readers;
+        options.busyTimeoutMs = busyTimeoutMs;
+        return options;
+    }
+
+    TEST(READER_WRITER, WAL_READERS_SEE_COMMITS) {
+        ASSERT_EQ(SQLITE_OK, CreateStudentsDb(kReaderWriterDb, 36));
+        ReaderWriterHarness harness;
+        ASSERT_EQ(SQLITE_OK, harness.Open(HarnessOptions(JournalMode::Wal, 3, 5000)));
+        EXPECT_EQ("wal", harness.ActiveJournalMode());
+
+        for (int i = 1; i <= 3; ++i) {
+            ASSERT_EQ(SQLITE_OK, harness.Insert(100));
+            for (int reader = 0; reader < harness.Readers(); ++reader) {
+                long long count = 0;
+                ASSERT_EQ(SQLITE_OK, harness.CountStudents(reader, &count));
+                EXPECT_EQ(36 + i, count);
+            }
+        }
+        harness.Close();
+        RemoveDb(kReaderWriterDb);
+    }
+
+    /// <summary>
+    /// A writer holding its transaction open: WAL readers keep reading the
+    /// committed snapshot, rollback-journal readers are locked out.
+    /// </summary>
+    TEST(READER_WRITER, READ_DURING_WRITE) {
+        const JournalMode modes[] = { JournalMode::Wal, JournalMode::Delete };
+        for (JournalMode mode : modes) {
+            ASSERT_EQ(SQLITE_OK, CreateStudentsDb(kReaderWriterDb, 36));
+            ReaderWriterHarness harness;
+            ASSERT_EQ(SQLITE_OK, harness.Open(HarnessOptions(mode, 1, 0)));
+            ASSERT_EQ(SQLITE_OK, sqlite3_exec(harness.Writer(), "begin exclusive", 0, 0, 0));
+            ASSERT_EQ(SQLITE_OK, harness.Insert(100));
+
+            long long count = 0;
+            int retcode = harness.CountStudents(0, &count);
+            if (mode == JournalMode::Wal) {
+                EXPECT_EQ(SQLITE_OK, retcode);
+                EXPECT_EQ(36, count);
+            }
+            else {
+                EXPECT_EQ(SQLITE_BUSY, retcode);
+            }
+
+            ASSERT_EQ(SQLITE_OK, sqlite3_exec(harness.Writer(), "commit", 0, 0, 0));
+            ASSERT_EQ(SQLITE_OK, harness.CountStudents(0, &count));
+            EXPECT_EQ(37, count);
+            harness.Close();
+            RemoveDb(kReaderWriterDb);
+        }
+    }
+
+    TEST(READER_WRITER_BENCH, READERS_DURING_COMMITS) {
+        const std::chrono::milliseconds duration(Scaled(300));
+        const JournalMode modes[] = { JournalMode::Delete, JournalMode::Truncate, JournalMode::Persist, JournalMode::Wal };
+        printf("%-9s %8s %12s %10s %10s %10s %12s\n",
+            "journal", "readers", "reads/s", "busy", "p50 us", "p99 us", "commits/s");
+        for (JournalMode mode : modes) {
+            for (int readers = 1; readers <= 8; readers *= 2) {
+                ASSERT_EQ(SQLITE_OK, CreateStudentsDb(kReaderWriterDb, 36));
+                ReaderWriterHarness harness;
+                ASSERT_EQ(SQLITE_OK, harness.Open(HarnessOptions(mode, readers, 5000)));
+                ReaderWriterStats stats = harness.Run(duration);
+                printf("%-9s %8d %12.0f %10lld %10.1f %10.1f %12.0f\n", JournalModeName(mode), readers,
+                    stats.reads / stats.seconds, stats.readBusy, stats.readP50Micros, stats.readP99Micros,
+                    stats.writes / stats.seconds);
+                EXPECT_EQ(0, stats.writeBusy);
+                harness.Close();
+                RemoveDb(kReaderWriterDb);
+            }
+        }
+    }
+}
@@ -0,0 +1,175 @@
+#include "gtest/gtest.h"
+#include "pch.h"
+#include "sqlite3.h"
+
+#include "sharded_db.h"
+#include "test_support.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+using namespace sqlite3tests;
+
+namespace {
+
+    std::vector<std::string> ShardPaths(int shards) {
+        std::vector<std::string> paths;
+        for (int i = 0; i < shards; ++i) {
+            paths.push_back("ShardTest" + std::to_string(i) + ".db");
+            RemoveDb(paths.back());
+        }
+        return paths;
+    }
+
+    void RemoveShards(const std::vector<std::string>& paths) {
+        for (const std::string& path : paths) {
+            RemoveDb(path);
+        }
+    }
+
+    int InsertStudent(sqlite3* db, int64_t sid) {
+        sqlite3_stmt* stmt = 0;
+        int retcode = sqlite3_prepare_v2(db, "insert into Students values (?)", -1, &stmt, 0);
+        if (retcode == SQLITE_OK) {
+            sqlite3_bind_int64(stmt, 1, sid);
+            retcode = sqlite3_step(stmt) == SQLITE_DONE ? SQLITE_OK : sqlite3_errcode(db);
+        }
+        sqlite3_finalize(stmt);
+        return retcode;
+    }
+
+    TEST(SHARDED_DB, ROUTES_BY_SID) {
+        std::vector<std::string> paths = ShardPaths(4);
+        ShardedDb db;
+        EXPECT_EQ(-1, db.ShardOf(1));
+        EXPECT_EQ(SQLITE_MISUSE, db.Route(1, [](sqlite3*) { return SQLITE_OK; }));
+        ShardedDbOptions options;
+        options.paths = paths;
+        options.warmupSql = { "pragma journal_mode=wal", "pragma synchronous=normal" };
+        options.attach = true;
+        ASSERT_EQ(SQLITE_OK, db.Open(options));
+        ASSERT_EQ(SQLITE_OK, db.ExecAll("create table Students(SID INTEGER)"));
+
+        const int students = 1000;
+        std::vector<long long> expected(db.Shards());
+        for (int64_t sid = 1; sid <= students; ++sid) {
+            ++expected[db.ShardOf(sid)];
+            ASSERT_EQ(SQLITE_OK, db.Route(sid, [sid](sqlite3* shard) { return InsertStudent(shard, sid); }));
+        }
+
+        // Every shard holds exactly its own keys, and none is left empty.
+        std::vector<long long> counts(db.Shards());
+        std::vector<long long> sums(db.Shards());
+        ASSERT_EQ(SQLITE_OK, db.ScatterGather([&](sqlite3* shard, int i) {
+            counts[i] = QueryInt64(shard, "select count(*) from Students");
+            sums[i] = QueryInt64(shard, "select sum(SID) from Students");
+            return counts[i] >= 0 ? SQLITE_OK : SQLITE_ERROR;
+        }));
+        long long total = 0;
+        long long sum = 0;
+        for (int i = 0; i < db.Shards(); ++i) {
+            EXPECT_EQ(expected[i], counts[i]);
+            EXPECT_GT(counts[i], students / 8);
+            total += counts[i];
+            sum += sums[i];
+        }
+        EXPECT_EQ(students, total);
+        EXPECT_EQ(students * (students + 1) / 2, sum);
+
+        // A point lookup only needs the owning shard.
+        long long found = 0;
+        ASSERT_EQ(SQLITE_OK, db.Route(36, [&found](sqlite3* shard) {
+            found = QueryInt64(shard, "select count(*) from Students where SID = 36");
+            return SQLITE_OK;
+        }));
+        EXPECT_EQ(1, found);
+
+        ASSERT_EQ(SQLITE_OK, db.CreateUnionView("Students"));
+        EXPECT_EQ(students, QueryInt64(db.Attached(), "select count(*) from Students"));
+        EXPECT_EQ(SQLITE_MISUSE, db.OnShard(db.Shards(), [](sqlite3*) { return SQLITE_OK; }));
+        db.Close();
+        RemoveShards(paths);
+    }
+
+    /// <summary>
+    /// The ISOLATED_DB_HANDLE workload against shards: concurrent writers
+    /// only contend when their keys share a shard, and every insert lands.
+    /// </summary>
+    TEST(SHARDED_DB, CONCURRENT_POINT_WRITES) {
+        std::vector<std::string> paths = ShardPaths(3);
+        ShardedDb db;
+        ShardedDbOptions options;
+        options.paths = paths;
+        options.warmupSql = { "pragma journal_mode=wal", "pragma synchronous=normal" };
+        ASSERT_EQ(SQLITE_OK, db.Open(options));
+        ASSERT_EQ(SQLITE_OK, db.ExecAll("create table Students(SID INTEGER)"));
+
+        const int threads = 5;
+        const int perThread = 100;
+        std::atomic<int> failures{ 0 };
+        RunThreads(threads, [&](int thread) {
+            for (int i = 0; i < perThread; ++i) {
+                int64_t sid = static_cast<int64_t>(thread) * perThread + i;
+                failures += db.Route(sid, [sid](sqlite3* shard) { return InsertStudent(shard, sid); }) != SQLITE_OK;
+            }
+        });
+        EXPECT_EQ(0, failures.load());
+        std::vector<long long> counts(db.Shards());
+        ASSERT_EQ(SQLITE_OK, db.ScatterGather([&counts](sqlite3* shard, int i) {
+            counts[i] = QueryInt64(shard, "select count(*) from Students");
+            return SQLITE_OK;
+        }));
+        EXPECT_EQ(threads * perThread, counts[0] + counts[1] + counts[2]);
+        db.Close();
+        RemoveShards(paths);
+    }
+
+    TEST(SHARDED_DB_BENCH, WRITE_THROUGHPUT) {
+        const int threads = 8;
+        const int perThread = static_cast<int>(Scaled(100));
+
+        printf("%-9s %7s %8s %10s %12s\n", "mode", "shards", "threads", "ms", "inserts/s");
+        // Baseline: ISOLATED_DB_HANDLE, a connection per thread on one file.
+        {
+            std::vector<std::string> paths = ShardPaths(1);
+            ASSERT_EQ(SQLITE_OK, CreateStudentsDb(paths[0], 0));
+            std::atomic<int> failures{ 0 };
+            double seconds = RunThreads(threads, [&](int thread) {
+                sqlite3* db = 0;
+                sqlite3_open(paths[0].c_str(), &db);
+                sqlite3_busy_timeout(db, 10000);
+                for (int i = 0; i < perThread; ++i) {
+                    failures += InsertStudent(db, static_cast<int64_t>(thread) * perThread + i) != SQLITE_OK;
+                }
+                sqlite3_close(db);
+            });
+            EXPECT_EQ(0, failures.load());
+            printf("%-9s %7d %8d %10.1f %12.0f\n", "isolated", 1, threads, seconds * 1000,
+                threads * perThread / seconds);
+            RemoveShards(paths);
+        }
+        for (int shards = 1; shards <= 8; shards *= 2) {
+            std::vector<std::string> paths = ShardPaths(shards);
+            ShardedDb db;
+            ShardedDbOptions options;
+            options.paths = paths;
+            ASSERT_EQ(SQLITE_OK, db.Open(options));
+            ASSERT_EQ(SQLITE_OK, db.ExecAll("create table Students(SID INTEGER)"));
+            std::atomic<int> failures{ 0 };
+            double seconds = RunThreads(threads, [&](int thread) {
+                for (int i = 0; i < perThread; ++i) {
+                    int64_t sid = static_cast<int64_t>(thread) * perThread + i;
+                    failures += db.Route(sid, [sid](sqlite3* shard) { return InsertStudent(shard, sid); }) != SQLITE_OK;
+                }
+            });
+            EXPECT_EQ(0, failures.load());
+            printf("%-9s %7d %8d %10.1f %12.0f\n", "sharded", shards, threads, seconds * 1000,
+                threads * perThread / seconds);
+            db.Close();
+            RemoveShards(paths);
+        }
+    }
+}
@@ -0,0 +1,179 @@
+#include "gtest/gtest.h"
+#include "pch.h"
+#include "sqlite3.h"
+
+#include "sharded_pcache.h"
+#include "test_support.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+using namespace sqlite3tests;
+
+namespace {
+
+    const char* kPcacheDb = "PcacheTest.db";
+
+    TEST(SHARDED_PCACHE, CLOCK_EVICTION) {
+        const sqlite3_pcache_methods2* methods = ShardedPageCacheMethods();
+        sqlite3_pcache* cache = methods->xCreate(1024, 64, 1);
+        ASSERT_TRUE(cache != 0);
+        methods->xCachesize(cache, 4);
+
+        sqlite3_pcache_page* pages[5] = {};
+        for (unsigned key = 1; key <= 4; ++key) {
+            pages[key] = methods->xFetch(cache, key, 1);
+            ASSERT_TRUE(pages[key] != 0);
+            const char* extra = static_cast<const char*>(pages[key]->pExtra);
+            EXPECT_EQ(64, std::count(extra, extra + 64, 0));
+        }
+        EXPECT_EQ(0, methods->xFetch(cache, 9, 0));
+        // Every page pinned: an easy create must fail, a hard one may grow.
+        EXPECT_EQ(0, methods->xFetch(cache, 5, 1));
+        for (unsigned key = 1; key <= 4; ++key) {
+            methods->xUnpin(cache, pages[key], 0);
+        }
+
+        // Touch page 1 again so CLOCK gives it a second chance.
+        EXPECT_EQ(pages[1], methods->xFetch(cache, 1, 0));
+        methods->xUnpin(cache, pages[1], 0);
+        sqlite3_pcache_page* fifth = methods->xFetch(cache, 5, 1);
+        ASSERT_TRUE(fifth != 0);
+        EXPECT_EQ(4, methods->xPagecount(cache));
+        EXPECT_TRUE(methods->xFetch(cache, 1, 0) != 0);
+        methods->xUnpin(cache, pages[1], 0);
+
+        methods->xRekey(cache, fifth, 5, 50);
+        EXPECT_EQ(fifth, methods->xFetch(cache, 50, 0));
+        EXPECT_EQ(0, methods->xFetch(cache, 5, 0));
+        methods->xUnpin(cache, fifth, 0);
+
+        // Rekeying onto a cached key discards the page that held it.
+        ASSERT_EQ(fifth, methods->xFetch(cache, 50, 0));
+        methods->xRekey(cache, fifth, 50, 1);
+        EXPECT_EQ(3, methods->xPagecount(cache));
+        EXPECT_EQ(fifth, methods->xFetch(cache, 1, 0));
+        methods->xUnpin(cache, fifth, 0);
+
+        methods->xTruncate(cache, 3);
+        for (unsigned key = 3; key <= 50; ++key) {
+            EXPECT_EQ(0, methods->xFetch(cache, key, 0));
+        }
+        methods->xShrink(cache);
+        EXPECT_EQ(0, methods->xPagecount(cache));
+        methods->xDestroy(cache);
+    }
+
+    TEST(SHARDED_PCACHE, SELECT_AND_INSERT) {
+        ASSERT_EQ(SQLITE_OK, InstallShardedPageCache());
+        ASSERT_EQ(SQLITE_OK, CreateStudentsDb(kPcacheDb, 20000));
+        PageCacheStats before = ShardedPageCacheCounters();
+
+        sqlite3* db = 0;
+        ASSERT_EQ(SQLITE_OK, sqlite3_open(kPcacheDb, &db));
+        sqlite3_exec(db, "pragma cache_size = 16", 0, 0, 0);
+        sqlite3_exec(db, "delete from Students where SID % 2 = 0", 0, 0, 0);
+        sqlite3_stmt* stmt = 0;
+        ASSERT_EQ(SQLITE_OK, sqlite3_prepare_v2(db, "select COUNT(SID), SUM(SID) from Students", -1, &stmt, 0));
+        ASSERT_EQ(SQLITE_ROW, sqlite3_step(stmt));
+        EXPECT_EQ(10000, sqlite3_column_int(stmt, 0));
+        EXPECT_EQ(100000000LL, sqlite3_column_int64(stmt, 1));
+        sqlite3_finalize(stmt);
+        ASSERT_EQ(SQLITE_OK, sqlite3_prepare_v2(db, "pragma integrity_check", -1, &stmt, 0));
+        ASSERT_EQ(SQLITE_ROW, sqlite3_step(stmt));
+        EXPECT_STREQ("ok", reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0)));
+        sqlite3_finalize(stmt);
+        EXPECT_GT(ShardedPageCacheCounters().slabPages, 0);
+        sqlite3_close(db);
+
+        PageCacheStats after = ShardedPageCacheCounters();
+        EXPECT_GT(after.hits, before.hits);
+        EXPECT_GT(after.misses, before.misses);
+        EXPECT_GT(after.evictions, before.evictions);
+        EXPECT_EQ(0, after.slabPages);
+
+        EXPECT_EQ(SQLITE_OK, RestoreDefaultPageCache());
+        RemoveDb(kPcacheDb);
+    }
+
+    /// <summary>
+    /// Random point reads, one connection per thread, with a cache small
+    /// enough that pages keep cycling through the allocator.
+    /// </summary>
+    double ReadHeavyRate(int numThreads, long long perThread, long long rows) {
+        std::atomic<long long> errors(0);
+        double seconds = RunThreads(numThreads, [&](int thread) {
+            sqlite3* db = 0;
+            sqlite3_stmt* stmt = 0;
+            sqlite3_open_v2(kPcacheDb, &db, SQLITE_OPEN_READONLY, 0);
+            sqlite3_exec(db, "pragma cache_size = 64", 0, 0, 0);
+            sqlite3_prepare_v2(db, "select SID from Students where rowid = ?", -1, &stmt, 0);
+            unsigned long long seed = 88172645463325252ULL + thread;
+            for (long long i = 0; i < perThread; ++i) {
+                seed ^= seed << 13;
+                seed ^= seed >> 7;
+                seed ^= seed << 17;
+                sqlite3_bind_int64(stmt, 1, 1 + static_cast<long long>(seed % rows));
+                if (sqlite3_step(stmt) != SQLITE_ROW) {
+                    ++errors;
+                }
+                sqlite3_reset(stmt);
+            }
+            sqlite3_finalize(stmt);
+            sqlite3_close(db);
+        });
+        EXPECT_EQ(0, errors.load());
+        return numThreads * perThread / seconds;
+    }
+
+    TEST(SHARDED_PCACHE_BENCH, READ_HEAVY) {
+        const long long rows = 200000;
+        const long long perThread = Scaled(20000);
+        ASSERT_EQ(SQLITE_OK, CreateStudentsDb(kPcacheDb, rows));
+
+        int headerBytes = 0;
+        sqlite3_config(SQLITE_CONFIG_PCACHE_HDRSZ, &headerBytes);
+        const int slotBytes = 4096 + headerBytes;
+        const int slots = 8192;
+        std::vector<char> builtinSlab(static_cast<size_t>(slotBytes) * slots);
+
+        printf("%-16s %8s %14s %10s\n", "page cache", "threads", "reads/s", "hit rate");
+        const char* modes[] = { "builtin", "builtin + slab", "sharded" };
+        for (int mode = 0; mode < 3; ++mode) {
+            if (mode == 2) {
+                ASSERT_EQ(SQLITE_OK, InstallShardedPageCache());
+            }
+            else {
+                ASSERT_EQ(SQLITE_OK, sqlite3_shutdown());
+                if (mode == 1) {
+                    sqlite3_config(SQLITE_CONFIG_PAGECACHE, builtinSlab.data(), slotBytes, slots);
+                }
+                else {
+                    sqlite3_config(SQLITE_CONFIG_PAGECACHE, (void*)0, 0, 0);
+                }
+                ASSERT_EQ(SQLITE_OK, RestoreDefaultPageCache());
+            }
+            for (int numThreads = 1; numThreads <= 8; numThreads *= 2) {
+                PageCacheStats before = ShardedPageCacheCounters();
+                double rate = ReadHeavyRate(numThreads, perThread, rows);
+                PageCacheStats after = ShardedPageCacheCounters();
+                long long hits = after.hits - before.hits;
+                long long lookups = hits + after.misses - before.misses;
+                if (mode == 2 && lookups > 0) {
+                    printf("%-16s %8d %14.0f %9.1f%%\n", modes[mode], numThreads, rate, 100.0 * hits / lookups);
+                }
+                else {
+                    printf("%-16s %8d %14.0f %10s\n", modes[mode], numThreads, rate, "-");
+                }
+            }
+        }
+
+        ASSERT_EQ(SQLITE_OK, sqlite3_shutdown());
+        sqlite3_config(SQLITE_CONFIG_PAGECACHE, (void*)0, 0, 0);
+        EXPECT_EQ(SQLITE_OK, RestoreDefaultPageCache());
+        RemoveDb(kPcacheDb);
+    }
+}
@@ -0,0 +1,166 @@
+#include "gtest/gtest.h"
+#include "pch.h"
+#include "sqlite3.h"
+
+#include "test_support.h"
+#include "unlock_notify.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+using namespace sqlite3tests;
+
+namespace {
+
+    const char* kSharedCacheDb = "SharedCacheTest.db";
+
+    /// <summary>
+    /// A second connection writing Students blocks a shared-cache reader:
+    /// plain step fails with SQLITE_LOCKED, BlockingStep waits for commit.
+    /// </summary>
+    TEST(SHARED_CACHE, BLOCKING_STEP) {
+        ASSERT_EQ(SQLITE_OK, CreateStudentsDb(kSharedCacheDb, 36));
+        sqlite3* writer = 0;
+        sqlite3* reader = 0;
+        ASSERT_EQ(SQLITE_OK, OpenSharedCache(kSharedCacheDb, &writer));
+        ASSERT_EQ(SQLITE_OK, OpenSharedCache(kSharedCacheDb, &reader));
+        sqlite3_extended_result_codes(reader, 1);
+
+        sqlite3_stmt* stmt = 0;
+        ASSERT_EQ(SQLITE_OK, BlockingPrepare(reader, "select COUNT(SID) from Students", -1, &stmt, 0));
+        ASSERT_EQ(SQLITE_OK, sqlite3_exec(writer, "begin; insert into Students values (100);", 0, 0, 0));
+        EXPECT_EQ(SQLITE_LOCKED_SHAREDCACHE, sqlite3_step(stmt));
+        sqlite3_reset(stmt);
+
+        UnlockNotifyStats before = UnlockNotifyCounters();
+        std::thread commit([writer] {
+            std::this_thread::sleep_for(std::chrono::milliseconds(30));
+            sqlite3_exec(writer, "commit", 0, 0, 0);
+        });
+        Stopwatch watch;
+        EXPECT_EQ(SQLITE_ROW, BlockingStep(stmt));
+        EXPECT_EQ(37, sqlite3_column_int(stmt, 0));
+        EXPECT_GE(watch.Seconds(), 0.02);
+        commit.join();
+        EXPECT_EQ(before.waits + 1, UnlockNotifyCounters().waits);
+
+        sqlite3_finalize(stmt);
+        sqlite3_close(reader);
+        sqlite3_close(writer);
+        RemoveDb(kSharedCacheDb);
+    }
+
+    TEST(SHARED_CACHE, DEADLOCK_IS_REPORTED) {
+        ASSERT_EQ(SQLITE_OK, CreateStudentsDb(kSharedCacheDb, 36));
+        sqlite3* first = 0;
+        sqlite3* second = 0;
+        ASSERT_EQ(SQLITE_OK, OpenSharedCache(kSharedCacheDb, &first));
+        ASSERT_EQ(SQLITE_OK, OpenSharedCache(kSharedCacheDb, &second));
+        ASSERT_EQ(SQLITE_OK, sqlite3_exec(first, "create table Courses(name TEXT, SID INTEGER)", 0, 0, 0));
+
+        // Each holds a write lock on the table the other needs.
+        ASSERT_EQ(SQLITE_OK, sqlite3_exec(first, "begin; insert into Students values (1);", 0, 0, 0));
+        sqlite3_stmt* stmt = 0;
+        ASSERT_EQ(SQLITE_OK, sqlite3_exec(second, "begin", 0, 0, 0));
+        ASSERT_EQ(SQLITE_OK, BlockingPrepare(second, "select COUNT(*) from Courses", -1, &stmt, 0));
+        EXPECT_EQ(SQLITE_ROW, BlockingStep(stmt));
+        sqlite3_finalize(stmt);
+        ASSERT_EQ(SQLITE_OK, BlockingPrepare(second, "select COUNT(SID) from Students", -1, &stmt, 0));
+        std::thread blocked([stmt] { EXPECT_EQ(SQLITE_ROW, BlockingStep(stmt)); });
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+        UnlockNotifyStats before = UnlockNotifyCounters();
+        sqlite3_stmt* insert = 0;
+        ASSERT_EQ(SQLITE_OK, BlockingPrepare(first, "insert into Courses values ('SQLite Database', 1)", -1, &insert, 0));
+        // second already waits on first, so first may not wait on second.
+        int retcode = BlockingStep(insert);
+        EXPECT_EQ(SQLITE_LOCKED, retcode & 0xff);
+        EXPECT_EQ(before.deadlocks + 1, UnlockNotifyCounters().deadlocks);
+        sqlite3_finalize(insert);
+
+        sqlite3_exec(first, "rollback", 0, 0, 0);
+        blocked.join();
+        sqlite3_finalize(stmt);
+        sqlite3_exec(second, "rollback", 0, 0, 0);
+        sqlite3_close(second);
+        sqlite3_close(first);
+        RemoveDb(kSharedCacheDb);
+    }
+
+    struct SharedCacheRun {
+        double readsPerSecond = 0;
+        long long peakBytes = 0;
+        long long waits = 0;
+    };
+
+    /// <summary>
+    /// Every thread scans Students on its own connection; with a writer the
+    /// last thread inserts instead, one short transaction at a time.
+    /// </summary>
+    SharedCacheRun ReadWorkload(bool shared, int numThreads, bool withWriter, std::chrono::milliseconds duration) {
+        std::vector<sqlite3*> dbs(numThreads);
+        for (int i = 0; i < numThreads; ++i) {
+            int flags = SQLITE_OPEN_READWRITE;
+            EXPECT_EQ(SQLITE_OK, shared ? OpenSharedCache(kSharedCacheDb, &dbs[i], flags)
+                                        : sqlite3_open_v2(kSharedCacheDb, &dbs[i], flags, 0));
+            sqlite3_busy_timeout(dbs[i], 5000);
+        }
+        int highwater = 0;
+        int current = 0;
+        sqlite3_status(SQLITE_STATUS_MEMORY_USED, &current, &highwater, 1);
+        UnlockNotifyStats before = UnlockNotifyCounters();
+
+        std::atomic<bool> stop(false);
+        std::atomic<long long> reads(0);
+        std::thread timer([&] {
+            std::this_thread::sleep_for(duration);
+            stop = true;
+        });
+        double seconds = RunThreads(numThreads, [&](int thread) {
+            sqlite3* db = dbs[thread];
+            sqlite3_stmt* stmt = 0;
+            bool writer = withWriter && thread == numThreads - 1;
+            BlockingPrepare(db, writer ? "insert into Students values (100)" : "select SUM(SID) from Students",
+                -1, &stmt, 0);
+            while (!stop) {
+                int retcode = BlockingStep(stmt);
+                if (!writer && retcode == SQLITE_ROW) {
+                    ++reads;
+                }
+                sqlite3_reset(stmt);
+            }
+            sqlite3_finalize(stmt);
+        });
+        timer.join();
+
+        SharedCacheRun run;
+        sqlite3_status(SQLITE_STATUS_MEMORY_USED, &current, &highwater, 0);
+        run.peakBytes = highwater;
+        run.readsPerSecond = reads / seconds;
+        run.waits = UnlockNotifyCounters().waits - before.waits;
+        for (sqlite3* db : dbs) {
+            sqlite3_close(db);
+        }
+        return run;
+    }
+
+    TEST(SHARED_CACHE_BENCH, PRIVATE_VS_SHARED) {
+        const std::chrono::milliseconds duration(Scaled(300));
+        ASSERT_EQ(SQLITE_OK, CreateStudentsDb(kSharedCacheDb, 200000));
+        printf("%-8s %-7s %8s %14s %12s %10s\n", "cache", "writer", "threads", "scans/s", "peak MB", "waits");
+        for (int withWriter = 0; withWriter < 2; ++withWriter) {
+            for (int shared = 0; shared < 2; ++shared) {
+                for (int numThreads = 2; numThreads <= 16; numThreads *= 2) {
+                    SharedCacheRun run = ReadWorkload(shared != 0, numThreads, withWriter != 0, duration);
+                    printf("%-8s %-7s %8d %14.1f %12.1f %10lld\n", shared ? "shared" : "private",
+                        withWriter ? "yes" : "no", numThreads, run.readsPerSecond,
+                        run.peakBytes / (1024.0 * 1024.0), run.waits);
+                }
+            }
+        }
+        RemoveDb(kSharedCacheDb);
+    }
+}
@@ -0,0 +1,141 @@
+#include "gtest/gtest.h"
+#include "pch.h"
+#include "sqlite3.h"
+
+#include "single_writer.h"
+#include "test_support.h"
+
+#include <atomic>
+#include <cstdio>
+#include <future>
+#include <thread>
+#include <vector>
+
+using namespace sqlite3tests;
+
+namespace {
+
+    const char* kWriterDb = "WriterTest.db";
+
+    TEST(MPSC_QUEUE, PER_PRODUCER_FIFO) {
+        MpscQueue<int> queue;
+        const int numThreads = 4;
+        const int perThread = 10000;
+        RunThreads(numThreads, [&](int thread) {
+            for (int i = 0; i < perThread; ++i) {
+                queue.Push(thread * perThread + i);
+            }
+        });
+
+        std::vector<int> last(numThreads, -1);
+        int value = 0;
+        int popped = 0;
+        while (queue.TryPop(value)) {
+            int thread = value / perThread;
+            EXPECT_LT(last[thread], value % perThread);
+            last[thread] = value % perThread;
+            ++popped;
+        }
+        EXPECT_EQ(numThreads * perThread, popped);
+        EXPECT_TRUE(queue.Empty());
+    }
+
+    /// <summary>
+    /// ISOLATED_DB_HANDLE through the writer: the same five racing inserts,
+    /// none of which can see SQLITE_BUSY.
+    /// </summary>
+    TEST(SINGLE_WRITER, ISOLATED_DB_HANDLE) {
+        ASSERT_EQ(SQLITE_OK, CreateStudentsDb(kWriterDb, 36));
+        SingleWriter writer;
+        SingleWriterOptions options;
+        options.path = kWriterDb;
+        ASSERT_EQ(SQLITE_OK, writer.Open(options));
+
+        const int numThreads = 5;
+        const int perThread = 200;
+        std::atomic<int> failures(0);
+        RunThreads(numThreads, [&](int) {
+            std::vector<std::future<int>> results;
+            for (int i = 0; i < perThread; ++i) {
+                results.push_back(writer.Submit("insert into Students values (100);"));
+            }
+            for (auto& result : results) {
+                if (result.get() != SQLITE_OK) {
+                    ++failures;
+                }
+            }
+        });
+        writer.Close();
+
+        EXPECT_EQ(0, failures.load());
+        EXPECT_EQ(numThreads * perThread, QueryInt64(kWriterDb, "select COUNT(SID) from Students where SID = 100"));
+        SingleWriterStats stats = writer.Stats();
+        EXPECT_EQ(numThreads * perThread, stats.writes);
+        EXPECT_LE(stats.batches, stats.writes);
+        printf("%lld writes in %lld batches\n", stats.writes, stats.batches);
+        RemoveDb(kWriterDb);
+    }
+
+    TEST(SINGLE_WRITER, FAILURE_IS_PER_SUBMISSION) {
+        ASSERT_EQ(SQLITE_OK, CreateStudentsDb(kWriterDb, 0));
+        SingleWriter writer;
+        SingleWriterOptions options;
+        options.path = kWriterDb;
+        ASSERT_EQ(SQLITE_OK, writer.Open(options));
+
+        std::future<int> good = writer.Submit("insert into Students values (1);");
+        std::future<int> bad = writer.Submit("insert into NoSuchTable values (1);");
+        std::future<int> custom = writer.Submit([](sqlite3* db) {
+            return sqlite3_exec(db, "insert into Students values (2);", 0, 0, 0);
+        });
+
+        EXPECT_EQ(SQLITE_OK, good.get());
+        EXPECT_EQ(SQLITE_ERROR, bad.get());
+        EXPECT_EQ(SQLITE_OK, custom.get());
+        writer.Close();
+
+        EXPECT_EQ(SQLITE_MISUSE, writer.Submit("insert into Students values (3);").get());
+        EXPECT_EQ(2, QueryInt64(kWriterDb, "select COUNT(SID) from Students"));
+        RemoveDb(kWriterDb);
+    }
+
+    /// <summary>
+    /// Inserts per second for the open-insert-close pattern (each insert its
+    /// own transaction, retried on SQLITE_BUSY) against the single writer.
+    /// </summary>
+    TEST(SINGLE_WRITER_BENCH, OPEN_PER_INSERT_VS_WRITER) {
+        const long long insertsPerThread = Scaled(50);
+        printf("%8s %18s %18s %10s\n", "threads", "isolated ins/s", "writer ins/s", "batches");
+        for (int numThreads = 1; numThreads <= 16; numThreads *= 2) {
+            ASSERT_EQ(SQLITE_OK, CreateStudentsDb(kWriterDb, 0));
+            std::atomic<long long> busy(0);
+            double isolatedSeconds = RunThreads(numThreads, [&](int) {
+                for (long long i = 0; i < insertsPerThread; ++i) {
+                    sqlite3* db = 0;
+                    sqlite3_open(kWriterDb, &db);
+                    while (sqlite3_exec(db, "insert into Students values (100);", 0, 0, 0) == SQLITE_BUSY) {
+                        ++busy;
+                        std::this_thread::yield();
+                    }
+                    sqlite3_close(db);
+                }
+            });
+
+            SingleWriter writer;
+            SingleWriterOptions options;
+            options.path = kWriterDb;
+            ASSERT_EQ(SQLITE_OK, writer.Open(options));
+            double writerSeconds = RunThreads(numThreads, [&](int) {
+                for (long long i = 0; i < insertsPerThread; ++i) {
+                    writer.Submit("insert into Students values (100);").wait();
+                }
+            });
+            writer.Close();
+
+            double total = static_cast<double>(numThreads * insertsPerThread);
+            printf("%8d %18.0f %18.0f %10lld   (%lld busy retries)\n", numThreads,
+                total / isolatedSeconds, total / writerSeconds, writer.Stats().batches, busy.load());
+            RemoveDb(kWriterDb);
+        }
+    }
+}
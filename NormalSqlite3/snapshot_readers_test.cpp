@@ -0,0 +1,201 @@
+#include "gtest/gtest.h"
+#include "pch.h"
+#include "sqlite3.h"
+
+#include "snapshot_readers.h"
+#include "test_support.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+using namespace sqlite3tests;
+
+namespace {
+
+    const char* kSnapshotDb = "SnapshotTest.db";
+
+    int CreateWalStudentsDb(long long rows, sqlite3** writer) {
+        int retcode = CreateStudentsDb(kSnapshotDb, rows);
+        if (retcode == SQLITE_OK) {
+            retcode = sqlite3_open(kSnapshotDb, writer);
+        }
+        if (retcode == SQLITE_OK) {
+            sqlite3_busy_timeout(*writer, 5000);
+            retcode = sqlite3_exec(*writer, "pragma journal_mode=wal", 0, 0, 0);
+        }
+        return retcode;
+    }
+
+    SnapshotReadersOptions ReaderOptions(int readers) {
+        SnapshotReadersOptions options;
+        options.path = kSnapshotDb;
+        options.readers = readers;
+        return options;
+    }
+
+    // Count and sum of SID over partition index of count, by rowid range;
+    // the range comes from the reader's own snapshot.
+    int ScanPartition(sqlite3* db, int index, int count, long long* rows, long long* sum) {
+        long long maxRowid = QueryInt64(db, "select coalesce(max(rowid), 0) from Students");
+        long long width = maxRowid / count + 1;
+        sqlite3_stmt* stmt = 0;
+        int retcode = sqlite3_prepare_v2(db,
+            "select count(*), total(SID) from Students where rowid >= ? and rowid < ?", -1, &stmt, 0);
+        if (retcode == SQLITE_OK) {
+            sqlite3_bind_int64(stmt, 1, index * width);
+            sqlite3_bind_int64(stmt, 2, (index + 1) * width);
+            retcode = sqlite3_step(stmt);
+            if (retcode == SQLITE_ROW) {
+                *rows = sqlite3_column_int64(stmt, 0);
+                *sum = static_cast<long long>(sqlite3_column_double(stmt, 1));
+                retcode = SQLITE_OK;
+            }
+        }
+        sqlite3_finalize(stmt);
+        return retcode;
+    }
+
+    TEST(SNAPSHOT_READERS, READERS_SHARE_SNAPSHOT) {
+        sqlite3* writer = 0;
+        ASSERT_EQ(SQLITE_OK, CreateWalStudentsDb(36, &writer));
+        SnapshotReaders readers;
+        ASSERT_EQ(SQLITE_OK, readers.Open(ReaderOptions(4)));
+        ASSERT_EQ(SQLITE_OK, sqlite3_exec(writer, "insert into Students values (100)", 0, 0, 0));
+
+        ASSERT_EQ(SQLITE_OK, readers.Pin());
+        EXPECT_NE(SnapshotMethod::None, readers.Method());
+        EXPECT_EQ(SQLITE_MISUSE, readers.Pin());
+        // Writers are not held up by pinned readers.
+        ASSERT_EQ(SQLITE_OK, sqlite3_exec(writer, "insert into Students values (101)", 0, 0, 0));
+        for (int i = 0; i < readers.Readers(); ++i) {
+            EXPECT_EQ(37, QueryInt64(readers.Reader(i), "select count(*) from Students"));
+        }
+        readers.Release();
+        EXPECT_EQ(SnapshotMethod::None, readers.Method());
+
+        ASSERT_EQ(SQLITE_OK, readers.Pin());
+        for (int i = 0; i < readers.Readers(); ++i) {
+            EXPECT_EQ(38, QueryInt64(readers.Reader(i), "select count(*) from Students"));
+        }
+        readers.Close();
+        EXPECT_EQ(SQLITE_OK, sqlite3_close(writer));
+        RemoveDb(kSnapshotDb);
+    }
+
+    TEST(SNAPSHOT_READERS, REQUIRES_WAL) {
+        ASSERT_EQ(SQLITE_OK, CreateStudentsDb(kSnapshotDb, 1));
+        SnapshotReaders readers;
+        EXPECT_EQ(SQLITE_MISUSE, readers.Open(ReaderOptions(2)));
+        EXPECT_EQ(0, readers.Readers());
+        RemoveDb(kSnapshotDb);
+    }
+
+    /// <summary>
+    /// Every commit adds a pair of rows with SIDs v and -v, so any
+    /// consistent view sums to zero. Partitions scanned in parallel by
+    /// pinned readers must add up to zero while the writer keeps going.
+    /// </summary>
+    TEST(SNAPSHOT_READERS, CONSISTENT_UNDER_WRITES) {
+        sqlite3* writer = 0;
+        ASSERT_EQ(SQLITE_OK, CreateWalStudentsDb(0, &writer));
+        SnapshotReaders readers;
+        ASSERT_EQ(SQLITE_OK, readers.Open(ReaderOptions(4)));
+
+        std::atomic<bool> stop{ false };
+        std::atomic<long long> commits{ 0 };
+        std::thread writing([&] {
+            sqlite3_stmt* stmt = 0;
+            sqlite3_prepare_v2(writer, "insert into Students values (?), (-?1)", -1, &stmt, 0);
+            for (long long v = 1; !stop; ++v) {
+                sqlite3_bind_int64(stmt, 1, v);
+                if (sqlite3_step(stmt) == SQLITE_DONE) {
+                    ++commits;
+                }
+                sqlite3_reset(stmt);
+                // A steady stream of commits, not a writer that never lets go.
+                std::this_thread::sleep_for(std::chrono::microseconds(200));
+            }
+            sqlite3_finalize(stmt);
+        });
+
+        for (int round = 0; round < 20; ++round) {
+            int retcode = readers.Pin();
+            EXPECT_EQ(SQLITE_OK, retcode);
+            std::vector<long long> rows(readers.Readers());
+            std::vector<long long> sums(readers.Readers());
+            if (retcode == SQLITE_OK) {
+                retcode = readers.ParallelScan([&](sqlite3* db, int index, int count) {
+                    // Give the writer time to commit between partitions.
+                    std::this_thread::sleep_for(std::chrono::milliseconds(index));
+                    return ScanPartition(db, index, count, &rows[index], &sums[index]);
+                });
+                EXPECT_EQ(SQLITE_OK, retcode);
+            }
+            readers.Release();
+            if (retcode != SQLITE_OK) {
+                break;
+            }
+            long long totalRows = 0;
+            long long totalSum = 0;
+            for (int i = 0; i < readers.Readers(); ++i) {
+                totalRows += rows[i];
+                totalSum += sums[i];
+            }
+            EXPECT_EQ(0, totalRows % 2);
+            EXPECT_EQ(0, totalSum);
+        }
+        stop = true;
+        writing.join();
+        EXPECT_GT(commits.load(), 0);
+        readers.Close();
+        EXPECT_EQ(SQLITE_OK, sqlite3_close(writer));
+        RemoveDb(kSnapshotDb);
+    }
+
+    TEST(SNAPSHOT_READERS_BENCH, PARALLEL_VS_SERIAL) {
+        const long long students = Scaled(1000000);
+        sqlite3* writer = 0;
+        ASSERT_EQ(SQLITE_OK, CreateWalStudentsDb(students, &writer));
+        ASSERT_EQ(SQLITE_OK, sqlite3_exec(writer, "insert into Students values (0)", 0, 0, 0));
+
+        printf("%-9s %8s %-9s %10s %12s\n", "scan", "readers", "method", "ms", "rows/s");
+        {
+            long long rows = 0;
+            long long sum = 0;
+            Stopwatch watch;
+            ASSERT_EQ(SQLITE_OK, sqlite3_exec(writer, "begin", 0, 0, 0));
+            ASSERT_EQ(SQLITE_OK, ScanPartition(writer, 0, 1, &rows, &sum));
+            ASSERT_EQ(SQLITE_OK, sqlite3_exec(writer, "commit", 0, 0, 0));
+            double seconds = watch.Seconds();
+            EXPECT_EQ(students + 1, rows);
+            printf("%-9s %8d %-9s %10.1f %12.0f\n", "serial", 1, "-", seconds * 1000, rows / seconds);
+        }
+        for (int count = 1; count <= 8; count *= 2) {
+            SnapshotReaders readers;
+            ASSERT_EQ(SQLITE_OK, readers.Open(ReaderOptions(count)));
+            std::vector<long long> rows(count);
+            std::vector<long long> sums(count);
+            Stopwatch watch;
+            ASSERT_EQ(SQLITE_OK, readers.Pin());
+            SnapshotMethod method = readers.Method();
+            ASSERT_EQ(SQLITE_OK, readers.ParallelScan([&](sqlite3* db, int index, int partitions) {
+                return ScanPartition(db, index, partitions, &rows[index], &sums[index]);
+            }));
+            readers.Release();
+            double seconds = watch.Seconds();
+            long long total = 0;
+            for (long long partition : rows) {
+                total += partition;
+            }
+            EXPECT_EQ(students + 1, total);
+            printf("%-9s %8d %-9s %10.1f %12.0f\n", "parallel", count, SnapshotMethodName(method),
+                seconds * 1000, total / seconds);
+            readers.Close();
+        }
+        EXPECT_EQ(SQLITE_OK, sqlite3_close(writer));
+        RemoveDb(kSnapshotDb);
+    }
+}
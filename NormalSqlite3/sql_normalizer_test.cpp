@@ -0,0 +1,191 @@
+#include "gtest/gtest.h"
+#include "pch.h"
+#include "sqlite3.h"
+
+#include "sql_normalizer.h"
+#include "statement_cache.h"
+#include "test_support.h"
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+using namespace sqlite3tests;
+
+namespace {
+
+    const char* kNormalizerDb = "NormalizerTest.db";
+
+    TEST(SQL_NORMALIZER, REWRITES_LITERALS) {
+        NormalizedSql normalized;
+        ASSERT_TRUE(NormalizeSql("insert into Students values (100);", &normalized));
+        EXPECT_EQ("insert into Students values (?)", normalized.sql);
+        ASSERT_EQ(1u, normalized.literals.size());
+        EXPECT_EQ(SQLITE_INTEGER, normalized.literals[0].type);
+        EXPECT_EQ(100, normalized.literals[0].integer);
+
+        ASSERT_TRUE(NormalizeSql("delete   from Students -- stale\n where SID = 2000", &normalized));
+        EXPECT_EQ("delete from Students where SID = ?", normalized.sql);
+
+        ASSERT_TRUE(NormalizeSql("select * from t3 where x='it''s' and y=x'0aFF' and z in (1.5e3, 0x10, .5)", &normalized));
+        EXPECT_EQ("select * from t3 where x=? and y=? and z in (?, ?, ?)", normalized.sql);
+        ASSERT_EQ(5u, normalized.literals.size());
+        EXPECT_EQ("it's", normalized.literals[0].bytes);
+        EXPECT_EQ(SQLITE_BLOB, normalized.literals[1].type);
+        EXPECT_EQ(std::string("\x0a\xff", 2), normalized.literals[1].bytes);
+        EXPECT_EQ(SQLITE_FLOAT, normalized.literals[2].type);
+        EXPECT_DOUBLE_EQ(1500.0, normalized.literals[2].real);
+        EXPECT_EQ(16, normalized.literals[3].integer);
+        EXPECT_DOUBLE_EQ(0.5, normalized.literals[4].real);
+
+        // Quoted identifiers and names containing digits stay as written.
+        ASSERT_TRUE(NormalizeSql("select \"col 1\", t1.y from t1 where [x 2] > 2", &normalized));
+        EXPECT_EQ("select \"col 1\", t1.y from t1 where [x 2] > ?", normalized.sql);
+        ASSERT_EQ(1u, normalized.literals.size());
+    }
+
+    TEST(SQL_NORMALIZER, LEAVES_UNSAFE_SQL) {
+        NormalizedSql normalized;
+        EXPECT_FALSE(NormalizeSql("create table t1(x check (x <= 10), y)", &normalized));
+        EXPECT_FALSE(NormalizeSql("pragma mmap_size = 268435456", &normalized));
+        EXPECT_FALSE(NormalizeSql("insert into t1 values (1, 2); insert into t1 values (3, 4)", &normalized));
+        EXPECT_FALSE(NormalizeSql("select * from t1 where x = ?1", &normalized));
+        EXPECT_FALSE(NormalizeSql("select 'unterminated", &normalized));
+        EXPECT_FALSE(NormalizeSql("select 12abc", &normalized));
+
+        ASSERT_TRUE(NormalizeSql("select x, count(*) from t1 where y > 5 group by 1 order by 2 desc, x + 1 limit 10", &normalized));
+        EXPECT_EQ("select x, count(*) from t1 where y > ? group by 1 order by 2 desc, x + ? limit ?", normalized.sql);
+        EXPECT_EQ(3u, normalized.literals.size());
+
+        // Type sizes are syntax, not values.
+        ASSERT_TRUE(NormalizeSql("select cast(SID as varchar(10)), cast(2.5 as decimal(10, -2)) from Students", &normalized));
+        EXPECT_EQ("select cast(SID as varchar(10)), cast(? as decimal(10, -2)) from Students", normalized.sql);
+        EXPECT_EQ(1u, normalized.literals.size());
+        ASSERT_TRUE(NormalizeSql("select cast(SID as unsigned big int) + 1 from Students", &normalized));
+        EXPECT_EQ("select cast(SID as unsigned big int) + ? from Students", normalized.sql);
+        ASSERT_TRUE(NormalizeSql("with s as materialized (select 5) select * from s", &normalized));
+        EXPECT_EQ("with s as materialized (select ?) select * from s", normalized.sql);
+    }
+
+    /// <summary>
+    /// Statements differing only by constants share one prepared statement
+    /// and still do what the literal SQL did.
+    /// </summary>
+    TEST(SQL_NORMALIZER, SHARES_PLANS) {
+        ASSERT_EQ(SQLITE_OK, CreateStudentsDb(kNormalizerDb, 36));
+        sqlite3* db = 0;
+        ASSERT_EQ(SQLITE_OK, sqlite3_open(kNormalizerDb, &db));
+        {
+            StatementCache cache(db);
+            EXPECT_EQ(SQLITE_OK, ExecNormalized(cache, "insert into Students values (100);"));
+            EXPECT_EQ(SQLITE_OK, ExecNormalized(cache, "insert into Students values (2000);"));
+            EXPECT_EQ(SQLITE_OK, ExecNormalized(cache, "delete from Students where SID = 2000"));
+            EXPECT_EQ(SQLITE_OK, ExecNormalized(cache, "delete from Students where SID = 1"));
+            EXPECT_EQ(2, cache.Stats().hits);
+            EXPECT_EQ(2, cache.Stats().misses);
+
+            StatementLease lease;
+            ASSERT_EQ(SQLITE_OK, AcquireNormalized(cache, "select COUNT(SID) from Students where SID >= 30", &lease));
+            ASSERT_EQ(SQLITE_ROW, sqlite3_step(lease));
+            EXPECT_EQ(8, sqlite3_column_int(lease, 0));
+            lease.Release();
+
+            // Multi-statement scripts fall back to sqlite3_exec.
+            EXPECT_EQ(SQLITE_OK, ExecNormalized(cache, "insert into Students values (7); insert into Students values (8)"));
+            EXPECT_EQ(3, cache.Stats().misses);
+
+            ASSERT_EQ(SQLITE_OK, AcquireNormalized(cache, "select cast(SID as varchar(10)) from Students where SID = 36", &lease));
+            ASSERT_EQ(SQLITE_ROW, sqlite3_step(lease));
+            EXPECT_EQ(std::string("36"), reinterpret_cast<const char*>(sqlite3_column_text(lease, 0)));
+            lease.Release();
+
+            // A quoted type name is not recognized, and "(?)" does not
+            // compile: the SQL runs as written instead.
+            const char* quoted = "select cast(SID as \"varchar\"(10)) from Students where SID = 36";
+            ASSERT_EQ(SQLITE_OK, AcquireNormalized(cache, quoted, &lease));
+            ASSERT_EQ(SQLITE_ROW, sqlite3_step(lease));
+            EXPECT_EQ(std::string("36"), reinterpret_cast<const char*>(sqlite3_column_text(lease, 0)));
+            lease.Release();
+            EXPECT_EQ(SQLITE_OK, ExecNormalized(cache, std::string("insert into Students ") + quoted));
+        }
+        EXPECT_EQ(39, QueryInt64(db, "select count(*) from Students"));
+        EXPECT_EQ(1, QueryInt64(db, "select count(*) from Students where SID = 100"));
+        EXPECT_EQ(SQLITE_OK, sqlite3_close(db));
+        RemoveDb(kNormalizerDb);
+    }
+
+    std::vector<std::string> ReplayWorkload(long long statements) {
+        std::vector<std::string> workload;
+        workload.reserve(static_cast<size_t>(statements));
+        char sql[128];
+        for (long long i = 0; i < statements; ++i) {
+            long long sid = 100000 + i;
+            switch (i % 4) {
+            case 0:
+                snprintf(sql, sizeof(sql), "insert into Students values (%lld);", sid);
+                break;
+            case 1:
+                snprintf(sql, sizeof(sql), "select COUNT(SID) from Students where SID > %lld", sid - 7);
+                break;
+            case 2:
+                snprintf(sql, sizeof(sql), "update Students set SID = %lld where SID = %lld", sid, sid - 2);
+                break;
+            default:
+                snprintf(sql, sizeof(sql), "delete from Students where SID = %lld", sid - 3);
+                break;
+            }
+            workload.push_back(sql);
+        }
+        return workload;
+    }
+
+    TEST(SQL_NORMALIZER_BENCH, REPLAYED_WORKLOAD) {
+        const std::vector<std::string> workload = ReplayWorkload(Scaled(40000));
+        printf("%-11s %10s %10s %12s %12s %12s\n",
+            "mode", "stmts", "compiles", "compile ms", "total ms", "stmts/s");
+        long long rows[2] = { 0, 0 };
+        for (int normalized = 0; normalized < 2; ++normalized) {
+            ASSERT_EQ(SQLITE_OK, CreateStudentsDb(kNormalizerDb, 1000));
+            sqlite3* db = 0;
+            ASSERT_EQ(SQLITE_OK, sqlite3_open(kNormalizerDb, &db));
+            ASSERT_EQ(SQLITE_OK, sqlite3_exec(db, "create index StudentsSID on Students(SID); begin", 0, 0, 0));
+            StatementCache cache(db);
+            long long compiles = 0;
+            double compileSeconds = 0;
+
+            Stopwatch total;
+            for (const std::string& sql : workload) {
+                Stopwatch compile;
+                if (normalized) {
+                    StatementLease lease;
+                    ASSERT_EQ(SQLITE_OK, AcquireNormalized(cache, sql, &lease));
+                    compileSeconds += compile.Seconds();
+                    while (sqlite3_step(lease) == SQLITE_ROW) {
+                    }
+                }
+                else {
+                    sqlite3_stmt* stmt = 0;
+                    ASSERT_EQ(SQLITE_OK, sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, 0));
+                    compileSeconds += compile.Seconds();
+                    ++compiles;
+                    while (sqlite3_step(stmt) == SQLITE_ROW) {
+                    }
+                    sqlite3_finalize(stmt);
+                }
+            }
+            double seconds = total.Seconds();
+            if (normalized) {
+                compiles = cache.Stats().misses;
+            }
+            printf("%-11s %10zu %10lld %12.1f %12.1f %12.0f\n", normalized ? "normalized" : "literal",
+                workload.size(), compiles, compileSeconds * 1000, seconds * 1000, workload.size() / seconds);
+
+            ASSERT_EQ(SQLITE_OK, sqlite3_exec(db, "commit", 0, 0, 0));
+            rows[normalized] = QueryInt64(db, "select total(SID) from Students");
+            cache.Clear();
+            EXPECT_EQ(SQLITE_OK, sqlite3_close(db));
+            RemoveDb(kNormalizerDb);
+        }
+        EXPECT_EQ(rows[0], rows[1]);
+    }
+}
@@ -0,0 +1,207 @@
+#include "gtest/gtest.h"
+#include "pch.h"
+#include "sqlite3.h"
+
+#include "statement_cache.h"
+#include "test_support.h"
+
+#include <cstdio>
+#include <string>
+
+using namespace sqlite3tests;
+
+namespace {
+
+    const char* kStatementCacheDb = "StatementCacheTest.db";
+
+    TEST(STATEMENT_CACHE, HIT_RETURNS_CLEARED_STATEMENT) {
+        sqlite3* db = 0;
+        ASSERT_EQ(SQLITE_OK, sqlite3_open(":memory:", &db));
+        StatementCache cache(db);
+
+        sqlite3_stmt* first = 0;
+        {
+            StatementLease lease;
+            ASSERT_EQ(SQLITE_OK, cache.Acquire("select ?", &lease));
+            first = lease;
+            sqlite3_bind_int(lease, 1, 42);
+            ASSERT_EQ(SQLITE_ROW, sqlite3_step(lease));
+            EXPECT_EQ(42, sqlite3_column_int(lease, 0));
+        }
+        {
+            StatementLease lease;
+            ASSERT_EQ(SQLITE_OK, cache.Acquire("select ?", &lease));
+            EXPECT_EQ(first, lease.Get());
+            ASSERT_EQ(SQLITE_ROW, sqlite3_step(lease));
+            EXPECT_EQ(SQLITE_NULL, sqlite3_column_type(lease, 0));
+        }
+        StatementCacheStats stats = cache.Stats();
+        EXPECT_EQ(1, stats.hits);
+        EXPECT_EQ(1, stats.misses);
+
+        StatementLease bad;
+        EXPECT_EQ(SQLITE_ERROR, cache.Acquire("select from", &bad));
+        EXPECT_FALSE(bad);
+        EXPECT_EQ(1u, cache.Size());
+
+        cache.Clear();
+        EXPECT_EQ(0u, cache.Size());
+        EXPECT_EQ(SQLITE_OK, sqlite3_close(db));
+    }
+
+    TEST(STATEMENT_CACHE, LRU_EVICTION) {
+        sqlite3* db = 0;
+        ASSERT_EQ(SQLITE_OK, sqlite3_open(":memory:", &db));
+        StatementCache cache(db, 2);
+        StatementLease lease;
+        ASSERT_EQ(SQLITE_OK, cache.Acquire("select 1", &lease));
+        ASSERT_EQ(SQLITE_OK, cache.Acquire("select 2", &lease));
+        ASSERT_EQ(SQLITE_OK, cache.Acquire("select 1", &lease));
+        ASSERT_EQ(SQLITE_OK, cache.Acquire("select 3", &lease));
+        lease.Release();
+        EXPECT_EQ(2u, cache.Size());
+        EXPECT_EQ(1, cache.Stats().evictions);
+
+        // "select 2" was least recently used.
+        ASSERT_EQ(SQLITE_OK, cache.Acquire("select 1", &lease));
+        EXPECT_EQ(2, cache.Stats().hits);
+        ASSERT_EQ(SQLITE_OK, cache.Acquire("select 2", &lease));
+        EXPECT_EQ(4, cache.Stats().misses);
+        lease.Release();
+
+        cache.Clear();
+        EXPECT_EQ(SQLITE_OK, sqlite3_close(db));
+    }
+
+    /// <summary>
+    /// Leased statements are never evicted, and a second lease of the same
+    /// SQL gets a statement of its own.
+    /// </summary>
+    TEST(STATEMENT_CACHE, LEASED_STATEMENTS) {
+        sqlite3* db = 0;
+        ASSERT_EQ(SQLITE_OK, sqlite3_open(":memory:", &db));
+        StatementCache cache(db, 1);
+        StatementLease outer;
+        ASSERT_EQ(SQLITE_OK, cache.Acquire("select 1", &outer));
+        {
+            StatementLease inner;
+            ASSERT_EQ(SQLITE_OK, cache.Acquire("select 1", &inner));
+            EXPECT_NE(outer.Get(), inner.Get());
+            StatementLease other;
+            ASSERT_EQ(SQLITE_OK, cache.Acquire("select 2", &other));
+            EXPECT_EQ(2u, cache.Size());
+        }
+        EXPECT_EQ(1u, cache.Size());
+        EXPECT_EQ(1, cache.Stats().transient);
+
+        sqlite3_stmt* stmt = outer;
+        StatementLease moved(std::move(outer));
+        EXPECT_FALSE(outer);
+        EXPECT_EQ(stmt, moved.Get());
+        moved.Release();
+        ASSERT_EQ(SQLITE_OK, cache.Acquire("select 1", &outer));
+        EXPECT_EQ(stmt, outer.Get());
+        outer.Release();
+
+        cache.Clear();
+        EXPECT_EQ(SQLITE_OK, sqlite3_close(db));
+    }
+
+    /// <summary>
+    /// Keys need not match sqlite3_sql(): a trailing ";\n" is dropped from
+    /// the statement text but the entry must still come back.
+    /// </summary>
+    TEST(STATEMENT_CACHE, KEY_WITH_TAIL) {
+        sqlite3* db = 0;
+        ASSERT_EQ(SQLITE_OK, sqlite3_open(":memory:", &db));
+        ASSERT_EQ(SQLITE_OK, sqlite3_exec(db, "create table Students(SID int)", 0, 0, 0));
+        StatementCache cache(db);
+        const std::string sql = "insert into Students values (100);\n";
+        for (int i = 0; i < 3; ++i) {
+            StatementLease lease;
+            ASSERT_EQ(SQLITE_OK, cache.Acquire(sql, &lease));
+            EXPECT_EQ(SQLITE_DONE, sqlite3_step(lease));
+        }
+        StatementCacheStats stats = cache.Stats();
+        EXPECT_EQ(2, stats.hits);
+        EXPECT_EQ(1, stats.misses);
+        EXPECT_EQ(0, stats.transient);
+
+        cache.Clear();
+        EXPECT_EQ(0u, cache.Size());
+        EXPECT_EQ(SQLITE_OK, sqlite3_close(db));
+    }
+
+    double InsertLoop(sqlite3* db, StatementCache* cache, long long rows) {
+        sqlite3_exec(db, "begin", 0, 0, 0);
+        Stopwatch watch;
+        for (long long i = 0; i < rows; ++i) {
+            if (cache != nullptr) {
+                StatementLease lease;
+                cache->Acquire("insert into Students values (?)", &lease);
+                sqlite3_bind_int64(lease, 1, i);
+                sqlite3_step(lease);
+            }
+            else {
+                sqlite3_stmt* stmt = 0;
+                sqlite3_prepare_v2(db, "insert into Students values (?)", -1, &stmt, 0);
+                sqlite3_bind_int64(stmt, 1, i);
+                sqlite3_step(stmt);
+                sqlite3_finalize(stmt);
+            }
+        }
+        double seconds = watch.Seconds();
+        sqlite3_exec(db, "commit", 0, 0, 0);
+        return seconds;
+    }
+
+    double SelectLoop(sqlite3* db, StatementCache* cache, long long rows, long long* found) {
+        Stopwatch watch;
+        for (long long i = 0; i < rows; ++i) {
+            if (cache != nullptr) {
+                StatementLease lease;
+                cache->Acquire("select SID from Students where rowid = ?", &lease);
+                sqlite3_bind_int64(lease, 1, i + 1);
+                *found += sqlite3_step(lease) == SQLITE_ROW;
+            }
+            else {
+                sqlite3_stmt* stmt = 0;
+                sqlite3_prepare_v2(db, "select SID from Students where rowid = ?", -1, &stmt, 0);
+                sqlite3_bind_int64(stmt, 1, i + 1);
+                *found += sqlite3_step(stmt) == SQLITE_ROW;
+                sqlite3_finalize(stmt);
+            }
+        }
+        return watch.Seconds();
+    }
+
+    TEST(STATEMENT_CACHE_BENCH, INSERT_AND_SELECT) {
+        const long long rows = Scaled(50000);
+        printf("%-8s %-10s %12s %10s %10s\n", "loop", "prepare", "ops/s", "hits", "misses");
+        for (bool cached : { false, true }) {
+            ASSERT_EQ(SQLITE_OK, CreateStudentsDb(kStatementCacheDb, 0));
+            sqlite3* db = 0;
+            ASSERT_EQ(SQLITE_OK, sqlite3_open(kStatementCacheDb, &db));
+            StatementCache cache(db);
+            StatementCache* use = cached ? &cache : nullptr;
+            const char* label = cached ? "cached" : "each";
+
+            double seconds = InsertLoop(db, use, rows);
+            StatementCacheStats stats = cache.Stats();
+            printf("%-8s %-10s %12.0f %10lld %10lld\n", "insert", label, rows / seconds, stats.hits, stats.misses);
+
+            long long found = 0;
+            seconds = SelectLoop(db, use, rows, &found);
+            EXPECT_EQ(rows, found);
+            stats = cache.Stats();
+            printf("%-8s %-10s %12.0f %10lld %10lld\n", "select", label, rows / seconds, stats.hits, stats.misses);
+            if (cached) {
+                EXPECT_EQ(2, stats.misses);
+            }
+
+            cache.Clear();
+            EXPECT_EQ(SQLITE_OK, sqlite3_close(db));
+            RemoveDb(kStatementCacheDb);
+        }
+    }
+}
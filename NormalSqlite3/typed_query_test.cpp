@@ -0,0 +1,180 @@
+#include "gtest/gtest.h"
+#include "pch.h"
+#include "sqlite3.h"
+
+#include "test_support.h"
+#include "typed_query.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <vector>
+
+using namespace sqlite3tests;
+
+namespace {
+
+    const char* kTypedQueryDb = "TypedQueryTest.db";
+
+    using CountStudents = Query<"select COUNT(SID) from Students", std::tuple<int64_t>>;
+    using StudentsAbove = Query<"select SID from Students where SID > ? order by SID", std::tuple<int>>;
+
+    static_assert(CountStudents::columns == 1);
+    static_assert(CountStudents::sql == "select COUNT(SID) from Students");
+
+    TEST(TYPED_QUERY, COUNT_AND_ROWS) {
+        ASSERT_EQ(SQLITE_OK, CreateStudentsDb(kTypedQueryDb, 36));
+        sqlite3* db = 0;
+        ASSERT_EQ(SQLITE_OK, sqlite3_open(kTypedQueryDb, &db));
+        {
+            CountStudents count;
+            StudentsAbove above;
+            ASSERT_EQ(SQLITE_OK, count.Prepare(db));
+            ASSERT_EQ(SQLITE_OK, above.Prepare(db));
+
+            CountStudents::Row total;
+            ASSERT_EQ(SQLITE_OK, count.One(&total));
+            EXPECT_EQ(36, std::get<0>(total));
+
+            std::vector<int> sids;
+            ASSERT_EQ(SQLITE_OK, above.ForEach([&sids](const StudentsAbove::Row& row) {
+                sids.push_back(std::get<0>(row));
+            }, 33));
+            EXPECT_EQ((std::vector<int>{ 34, 35, 36 }), sids);
+
+            // Prepared once, run again with other parameters.
+            std::vector<StudentsAbove::Row> rows;
+            ASSERT_EQ(SQLITE_OK, above.All(&rows, 35));
+            ASSERT_EQ(1u, rows.size());
+            EXPECT_EQ(SQLITE_RANGE, above.All(&rows));
+
+            Query<"select SID, nullif(SID, 1), 'S' || SID from Students order by SID limit 2",
+                std::tuple<int64_t, std::optional<int64_t>, std::string>> mixed;
+            ASSERT_EQ(SQLITE_OK, mixed.Prepare(db));
+            std::vector<decltype(mixed)::Row> mixedRows;
+            ASSERT_EQ(SQLITE_OK, mixed.All(&mixedRows));
+            ASSERT_EQ(2u, mixedRows.size());
+            EXPECT_FALSE(std::get<1>(mixedRows[0]).has_value());
+            EXPECT_EQ(2, std::get<1>(mixedRows[1]).value());
+            EXPECT_EQ("S2", std::get<2>(mixedRows[1]));
+        }
+        EXPECT_EQ(SQLITE_OK, sqlite3_close(db));
+        RemoveDb(kTypedQueryDb);
+    }
+
+    /// <summary>
+    /// A result type that does not match the schema fails on first use
+    /// instead of converting silently.
+    /// </summary>
+    TEST(TYPED_QUERY, SCHEMA_CHECK) {
+        ASSERT_EQ(SQLITE_OK, CreateStudentsDb(kTypedQueryDb, 3));
+        sqlite3* db = 0;
+        ASSERT_EQ(SQLITE_OK, sqlite3_open(kTypedQueryDb, &db));
+        ASSERT_EQ(SQLITE_OK, sqlite3_exec(db, "create table Courses(name TEXT, SID)", 0, 0, 0));
+        {
+            Query<"select SID from Students", std::tuple<std::string>> wrongType;
+            ASSERT_EQ(SQLITE_OK, wrongType.Prepare(db));
+            std::vector<decltype(wrongType)::Row> rows;
+            EXPECT_EQ(SQLITE_MISMATCH, wrongType.All(&rows));
+
+            Query<"select SID, SID from Students", std::tuple<int64_t>> wrongCount;
+            ASSERT_EQ(SQLITE_OK, wrongCount.Prepare(db));
+            EXPECT_EQ(SQLITE_MISMATCH, wrongCount.ForEach([](const auto&) {}));
+
+            // The untyped Courses.SID column accepts any mapping.
+            Query<"select name, SID from Courses", std::tuple<std::string_view, double>> courses;
+            ASSERT_EQ(SQLITE_OK, courses.Prepare(db));
+            EXPECT_EQ(SQLITE_OK, courses.ForEach([](const auto&) {}));
+
+            Query<"select * from Missing", std::tuple<int>> missing;
+            EXPECT_EQ(SQLITE_ERROR, missing.Prepare(db));
+            EXPECT_EQ(SQLITE_MISUSE, missing.ForEach([](const auto&) {}));
+        }
+        EXPECT_EQ(SQLITE_OK, sqlite3_close(db));
+        RemoveDb(kTypedQueryDb);
+    }
+
+    struct ScanTotals {
+        long long rows = 0;
+        long long integers = 0;
+        double reals = 0;
+        long long textBytes = 0;
+
+        bool operator==(const ScanTotals& other) const {
+            return rows == other.rows && integers == other.integers && reals == other.reals &&
+                   textBytes == other.textBytes;
+        }
+    };
+
+    TEST(TYPED_QUERY_BENCH, ROW_DECODE) {
+        const long long rows = Scaled(200000);
+        sqlite3* db = 0;
+        ASSERT_EQ(SQLITE_OK, sqlite3_open(":memory:", &db));
+        ASSERT_EQ(SQLITE_OK, sqlite3_exec(db, "create table Grades(SID INTEGER, score REAL, course TEXT)", 0, 0, 0));
+        sqlite3_stmt* insert = 0;
+        ASSERT_EQ(SQLITE_OK, sqlite3_exec(db, "begin", 0, 0, 0));
+        ASSERT_EQ(SQLITE_OK, sqlite3_prepare_v2(db, "insert into Grades values (?, ?, 'Course ' || (?1 % 7))", -1, &insert, 0));
+        for (long long i = 1; i <= rows; ++i) {
+            sqlite3_bind_int64(insert, 1, i);
+            sqlite3_bind_double(insert, 2, i * 0.5);
+            sqlite3_step(insert);
+            sqlite3_reset(insert);
+        }
+        sqlite3_finalize(insert);
+        ASSERT_EQ(SQLITE_OK, sqlite3_exec(db, "commit", 0, 0, 0));
+
+        const char* sql = "select SID, score, course from Grades";
+        printf("%-10s %10s %12s %10s\n", "decode", "rows", "rows/s", "ns/row");
+        ScanTotals totals[2];
+
+        // Runtime dispatch on each value's type.
+        sqlite3_stmt* stmt = 0;
+        ASSERT_EQ(SQLITE_OK, sqlite3_prepare_v2(db, sql, -1, &stmt, 0));
+        Stopwatch watch;
+        while (sqlite3_step(stmt) == SQLITE_ROW) {
+            ++totals[0].rows;
+            for (int column = 0; column < sqlite3_column_count(stmt); ++column) {
+                switch (sqlite3_column_type(stmt, column)) {
+                case SQLITE_INTEGER:
+                    totals[0].integers += sqlite3_column_int64(stmt, column);
+                    break;
+                case SQLITE_FLOAT:
+                    totals[0].reals += sqlite3_column_double(stmt, column);
+                    break;
+                case SQLITE_TEXT:
+                    sqlite3_column_text(stmt, column);
+                    totals[0].textBytes += sqlite3_column_bytes(stmt, column);
+                    break;
+                default:
+                    break;
+                }
+            }
+        }
+        double seconds = watch.Seconds();
+        sqlite3_finalize(stmt);
+        printf("%-10s %10lld %12.0f %10.1f\n", "runtime", totals[0].rows, totals[0].rows / seconds,
+            seconds * 1e9 / totals[0].rows);
+
+        {
+            Query<"select SID, score, course from Grades", std::tuple<int64_t, double, std::string_view>> typed;
+            ASSERT_EQ(SQLITE_OK, typed.Prepare(db));
+            ScanTotals& typedTotals = totals[1];
+            watch.Restart();
+            ASSERT_EQ(SQLITE_OK, typed.ForEach([&typedTotals](const auto& row) {
+                ++typedTotals.rows;
+                typedTotals.integers += std::get<0>(row);
+                typedTotals.reals += std::get<1>(row);
+                typedTotals.textBytes += static_cast<long long>(std::get<2>(row).size());
+            }));
+            seconds = watch.Seconds();
+        }
+        printf("%-10s %10lld %12.0f %10.1f\n", "typed", totals[1].rows, totals[1].rows / seconds,
+            seconds * 1e9 / totals[1].rows);
+        EXPECT_EQ(rows, totals[1].rows);
+        EXPECT_TRUE(totals[0] == totals[1]);
+        EXPECT_EQ(SQLITE_OK, sqlite3_close(db));
+    }
+}
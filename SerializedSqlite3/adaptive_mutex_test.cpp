@@ -0,0 +1,154 @@
+#include "gtest/gtest.h"
+#include "pch.h"
+#include "sqlite3.h"
+
+#include "adaptive_mutex.h"
+#include "test_support.h"
+
+#include <atomic>
+#include <cstdio>
+#include <thread>
+
+using namespace sqlite3tests;
+
+namespace {
+
+    const char* kMutexDb = "MutexTest.db";
+
+    TEST(ADAPTIVE_MUTEX, RECURSIVE_AND_TRY) {
+        const sqlite3_mutex_methods* methods = AdaptiveMutexMethods();
+        sqlite3_mutex* recursive = methods->xMutexAlloc(SQLITE_MUTEX_RECURSIVE);
+        sqlite3_mutex* fast = methods->xMutexAlloc(SQLITE_MUTEX_FAST);
+        ASSERT_TRUE(recursive != 0 && fast != 0);
+
+        methods->xMutexEnter(recursive);
+        methods->xMutexEnter(recursive);
+        EXPECT_EQ(SQLITE_OK, methods->xMutexTry(recursive));
+        EXPECT_TRUE(methods->xMutexHeld(recursive));
+        methods->xMutexEnter(fast);
+
+        std::thread other([&] {
+            EXPECT_EQ(SQLITE_BUSY, methods->xMutexTry(recursive));
+            EXPECT_EQ(SQLITE_BUSY, methods->xMutexTry(fast));
+            EXPECT_TRUE(methods->xMutexNotheld(recursive));
+        });
+        other.join();
+
+        methods->xMutexLeave(fast);
+        methods->xMutexLeave(recursive);
+        methods->xMutexLeave(recursive);
+        EXPECT_TRUE(methods->xMutexHeld(recursive));
+        methods->xMutexLeave(recursive);
+        EXPECT_TRUE(methods->xMutexNotheld(recursive));
+
+        methods->xMutexFree(fast);
+        methods->xMutexFree(recursive);
+        EXPECT_EQ(methods->xMutexAlloc(SQLITE_MUTEX_STATIC_MAIN), methods->xMutexAlloc(SQLITE_MUTEX_STATIC_MAIN));
+    }
+
+    TEST(ADAPTIVE_MUTEX, MUTUAL_EXCLUSION) {
+        const sqlite3_mutex_methods* methods = AdaptiveMutexMethods();
+        sqlite3_mutex* mutex = methods->xMutexAlloc(SQLITE_MUTEX_FAST);
+        long long counter = 0;
+        const int perThread = 100000;
+        RunThreads(4, [&](int) {
+            for (int i = 0; i < perThread; ++i) {
+                methods->xMutexEnter(mutex);
+                ++counter;
+                methods->xMutexLeave(mutex);
+            }
+        });
+        EXPECT_EQ(4LL * perThread, counter);
+        methods->xMutexFree(mutex);
+    }
+
+    /// <summary>
+    /// SINGLE_DB_HANDLE on top of the adaptive mutexes, with counters on.
+    /// </summary>
+    TEST(ADAPTIVE_MUTEX, SINGLE_DB_HANDLE) {
+        ASSERT_EQ(SQLITE_OK, InstallAdaptiveMutex(true));
+        ASSERT_EQ(SQLITE_OK, CreateStudentsDb(kMutexDb, 0));
+
+        sqlite3* db = 0;
+        ASSERT_EQ(SQLITE_OK, sqlite3_open(kMutexDb, &db));
+        sqlite3_exec(db, "begin", 0, 0, 0);
+        std::atomic<int> failures(0);
+        RunThreads(5, [&](int) {
+            for (int i = 0; i < 200; ++i) {
+                if (sqlite3_exec(db, "insert into Students values (100);", 0, 0, 0) != SQLITE_OK) {
+                    ++failures;
+                }
+            }
+        });
+        sqlite3_exec(db, "commit", 0, 0, 0);
+        EXPECT_EQ(0, failures.load());
+
+        long long acquisitions = 0;
+        for (const MutexContentionStats& stats : AdaptiveMutexContention()) {
+            acquisitions += stats.acquisitions;
+        }
+        EXPECT_GT(acquisitions, 1000);
+
+        sqlite3_close(db);
+        EXPECT_EQ(SQLITE_OK, RestoreDefaultMutex());
+        RemoveDb(kMutexDb);
+    }
+
+    double SharedHandleRate(sqlite3* db, int numThreads, long long perThread, const char* sql, bool bind) {
+        std::atomic<long long> errors(0);
+        double seconds = RunThreads(numThreads, [&](int thread) {
+            sqlite3_stmt* stmt = 0;
+            sqlite3_prepare_v2(db, sql, -1, &stmt, 0);
+            for (long long i = 0; i < perThread; ++i) {
+                if (bind) {
+                    sqlite3_bind_int64(stmt, 1, 1 + (i * 7919 + thread) % 1000);
+                }
+                int retcode = sqlite3_step(stmt);
+                if (retcode != SQLITE_ROW && retcode != SQLITE_DONE) {
+                    ++errors;
+                }
+                sqlite3_reset(stmt);
+            }
+            sqlite3_finalize(stmt);
+        });
+        EXPECT_EQ(0, errors.load());
+        return numThreads * perThread / seconds;
+    }
+
+    /// <summary>
+    /// Shared-handle selects and inserts, the InsertSingleDbHandle scenario,
+    /// under the default mutexes and the adaptive ones.
+    /// </summary>
+    TEST(ADAPTIVE_MUTEX_BENCH, SHARED_HANDLE) {
+        const long long perThread = Scaled(20000);
+        ASSERT_EQ(SQLITE_OK, CreateStudentsDb(kMutexDb, 1000));
+        printf("%-18s %8s %14s %14s %12s\n", "mutex", "threads", "select/s", "insert/s", "contended");
+
+        const char* modes[] = { "default", "adaptive", "adaptive+counters" };
+        for (int mode = 0; mode < 3; ++mode) {
+            ASSERT_EQ(SQLITE_OK, mode == 0 ? RestoreDefaultMutex() : InstallAdaptiveMutex(mode == 2));
+            for (int numThreads = 1; numThreads <= 8; numThreads *= 2) {
+                sqlite3* db = 0;
+                ASSERT_EQ(SQLITE_OK, sqlite3_open(kMutexDb, &db));
+                double selects = SharedHandleRate(db, numThreads, perThread,
+                    "select SID from Students where rowid = ?", true);
+                sqlite3_exec(db, "begin", 0, 0, 0);
+                double inserts = SharedHandleRate(db, numThreads, perThread,
+                    "insert into Students values (100);", false);
+                sqlite3_exec(db, "rollback", 0, 0, 0);
+                sqlite3_close(db);
+
+                long long contended = 0;
+                if (mode == 2) {
+                    for (const MutexContentionStats& stats : AdaptiveMutexContention()) {
+                        contended += stats.contended;
+                    }
+                }
+                printf("%-18s %8d %14.0f %14.0f %12lld\n", modes[mode], numThreads, selects, inserts, contended);
+            }
+        }
+
+        EXPECT_EQ(SQLITE_OK, RestoreDefaultMutex());
+        RemoveDb(kMutexDb);
+    }
+}
@@ -0,0 +1,180 @@
+#include "gtest/gtest.h"
+#include "pch.h"
+#include "sqlite3.h"
+
+#include "single_writer.h"
+#include "test_support.h"
+
+#include <cstdio>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <vector>
+
+using namespace sqlite3tests;
+
+namespace {
+
+    const char* kGroupDb = "GroupCommitTest.db";
+
+    /// <summary>
+    /// Same t1 as the Tables fixture used by SUBTRANSACTION.
+    /// </summary>
+    void CreateTablesDb() {
+        RemoveDb(kGroupDb);
+        sqlite3* db = 0;
+        sqlite3_open(kGroupDb, &db);
+        sqlite3_exec(db, "create table t1(x int check (x <= 10), y int);", 0, 0, 0);
+        sqlite3_close(db);
+    }
+
+    SingleWriterOptions GroupOptions(int maxBatch, std::chrono::microseconds window) {
+        SingleWriterOptions options;
+        options.path = kGroupDb;
+        options.maxBatch = maxBatch;
+        options.commitWindow = window;
+        options.isolateWrites = true;
+        return options;
+    }
+
+    /// <summary>
+    /// The SUBTRANSACTION statements as one group: the CHECK failures are
+    /// rolled back to their own savepoints and the rest commits together.
+    /// </summary>
+    TEST(GROUP_COMMIT, SAVEPOINT_ISOLATION) {
+        CreateTablesDb();
+        SingleWriter writer;
+        ASSERT_EQ(SQLITE_OK, writer.Open(GroupOptions(100, std::chrono::milliseconds(200))));
+
+        std::future<int> first = writer.Submit("insert into t1 values(10, 11);");
+        // Two statements in one write: the first must not survive the second.
+        std::future<int> partial = writer.Submit([](sqlite3* db) {
+            return sqlite3_exec(db, "insert into t1 values(1, 1); insert into t1 values(11, 1);", 0, 0, 0);
+        });
+        std::future<int> update = writer.Submit("update t1 set x=x+1 where y > 10;");
+        std::future<int> last = writer.Submit("insert into t1 values(9, 11);");
+
+        EXPECT_EQ(SQLITE_OK, first.get());
+        EXPECT_EQ(SQLITE_CONSTRAINT, partial.get());
+        EXPECT_EQ(SQLITE_CONSTRAINT, update.get());
+        EXPECT_EQ(SQLITE_OK, last.get());
+        writer.Close();
+
+        EXPECT_EQ(1, writer.Stats().batches);
+        EXPECT_EQ(2, QueryInt64(kGroupDb, "select count(*) from t1"));
+        EXPECT_EQ(0, QueryInt64(kGroupDb, "select count(*) from t1 where y = 1"));
+        RemoveDb(kGroupDb);
+    }
+
+    TEST(GROUP_COMMIT, LOST_TRANSACTION_IS_REPLAYED) {
+        CreateTablesDb();
+        SingleWriter writer;
+        ASSERT_EQ(SQLITE_OK, writer.Open(GroupOptions(100, std::chrono::milliseconds(200))));
+
+        std::future<int> before = writer.Submit("insert into t1 values(1, 1);");
+        std::future<int> fatal = writer.Submit([](sqlite3* db) {
+            sqlite3_exec(db, "rollback", 0, 0, 0);
+            return SQLITE_FULL;
+        });
+        std::future<int> after = writer.Submit("insert into t1 values(2, 2);");
+
+        EXPECT_EQ(SQLITE_OK, before.get());
+        EXPECT_EQ(SQLITE_FULL, fatal.get());
+        EXPECT_EQ(SQLITE_OK, after.get());
+        writer.Close();
+
+        EXPECT_EQ(1, writer.Stats().replays);
+        EXPECT_EQ(2, QueryInt64(kGroupDb, "select count(*) from t1"));
+        RemoveDb(kGroupDb);
+    }
+
+    TEST(GROUP_COMMIT, COUNT_BOUND_CLOSES_WINDOW) {
+        CreateTablesDb();
+        SingleWriter writer;
+        ASSERT_EQ(SQLITE_OK, writer.Open(GroupOptions(4, std::chrono::seconds(2))));
+
+        Stopwatch watch;
+        std::vector<std::future<int>> results;
+        for (int i = 0; i < 8; ++i) {
+            results.push_back(writer.Submit("insert into t1 values(1, 1);"));
+        }
+        for (auto& result : results) {
+            EXPECT_EQ(SQLITE_OK, result.get());
+        }
+        EXPECT_LT(watch.Seconds(), 2.0);
+        writer.Close();
+
+        EXPECT_EQ(2, writer.Stats().batches);
+        RemoveDb(kGroupDb);
+    }
+
+    struct LatencyResult {
+        double writesPerSecond;
+        double commitsPerSecond;
+        double p50;
+        double p99;
+    };
+
+    /// <summary>
+    /// Closed-loop producers: each thread issues one insert and waits for it
+    /// to commit before issuing the next.
+    /// </summary>
+    LatencyResult MeasureLatency(int numThreads, long long perThread,
+                                 const std::function<void()>& insert,
+                                 const std::function<long long()>& commits) {
+        std::mutex mutex;
+        std::vector<double> latencies;
+        double seconds = RunThreads(numThreads, [&](int) {
+            std::vector<double> local;
+            for (long long i = 0; i < perThread; ++i) {
+                Stopwatch watch;
+                insert();
+                local.push_back(watch.Micros());
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            latencies.insert(latencies.end(), local.begin(), local.end());
+        });
+        LatencyResult result;
+        result.writesPerSecond = latencies.size() / seconds;
+        result.commitsPerSecond = commits() / seconds;
+        result.p50 = Percentile(latencies, 50);
+        result.p99 = Percentile(latencies, 99);
+        return result;
+    }
+
+    /// <summary>
+    /// One insert per transaction on a shared handle (InsertSingleDbHandle)
+    /// against group commit with growing windows.
+    /// </summary>
+    TEST(GROUP_COMMIT_BENCH, WINDOW_SWEEP) {
+        const int numThreads = 8;
+        const long long perThread = Scaled(25);
+        printf("%-14s %12s %12s %10s %10s\n", "mode", "writes/s", "commits/s", "p50 us", "p99 us");
+
+        CreateTablesDb();
+        sqlite3* db = 0;
+        ASSERT_EQ(SQLITE_OK, sqlite3_open(kGroupDb, &db));
+        LatencyResult single = MeasureLatency(numThreads, perThread,
+            [&] { sqlite3_exec(db, "insert into t1 values(1, 1);", 0, 0, 0); },
+            [&] { return numThreads * perThread; });
+        sqlite3_close(db);
+        printf("%-14s %12.0f %12.0f %10.0f %10.0f\n", "single handle",
+            single.writesPerSecond, single.commitsPerSecond, single.p50, single.p99);
+
+        const long long windowsUs[] = { 0, 100, 500, 1000, 5000, 20000 };
+        for (long long windowUs : windowsUs) {
+            CreateTablesDb();
+            SingleWriter writer;
+            ASSERT_EQ(SQLITE_OK, writer.Open(GroupOptions(1024, std::chrono::microseconds(windowUs))));
+            LatencyResult group = MeasureLatency(numThreads, perThread,
+                [&] { writer.Submit("insert into t1 values(1, 1);").wait(); },
+                [&] { return writer.Stats().batches; });
+            writer.Close();
+            char mode[32];
+            snprintf(mode, sizeof(mode), "window %lldus", windowUs);
+            printf("%-14s %12.0f %12.0f %10.0f %10.0f\n", mode,
+                group.writesPerSecond, group.commitsPerSecond, group.p50, group.p99);
+        }
+        RemoveDb(kGroupDb);
+    }
+}
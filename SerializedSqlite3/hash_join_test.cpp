@@ -0,0 +1,165 @@
+#include "gtest/gtest.h"
+#include "pch.h"
+#include "sqlite3.h"
+
+#include "hash_join.h"
+#include "memdb_fixture.h"
+#include "test_support.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+using namespace sqlite3tests;
+
+namespace {
+
+    const char* kJoinSql = "select * from Students S, Courses C where S.sid = C.sid";
+
+    std::vector<std::string> SortedRows(sqlite3* db, const std::string& sql) {
+        std::vector<std::string> rows;
+        EXPECT_EQ(SQLITE_OK, sqlite3_exec(db, sql.c_str(), CollectCallback, &rows, 0));
+        std::sort(rows.begin(), rows.end());
+        return rows;
+    }
+
+    std::string QueryPlan(sqlite3* db, const std::string& sql) {
+        std::vector<std::string> rows;
+        sqlite3_exec(db, ("explain query plan " + sql).c_str(), CollectCallback, &rows, 0);
+        std::string plan;
+        for (const std::string& row : rows) {
+            plan += row + '\n';
+        }
+        return plan;
+    }
+
+    /// <summary>
+    /// The join of LIB_CONN_DB_CONN returns the same rows with either side
+    /// replaced by its hash index, and the planner probes the index.
+    /// </summary>
+    TEST(HASH_JOIN, MATCHES_NATIVE_JOIN) {
+        sqlite3* db = 0;
+        ASSERT_EQ(SQLITE_OK, OpenFixture("MyDB", &db));
+        ASSERT_EQ(SQLITE_OK, AttachFixture(db, "MyDBExtn", "DB1"));
+        ASSERT_EQ(SQLITE_OK, RegisterHashIndexModule(db));
+        std::vector<std::string> expected = SortedRows(db, kJoinSql);
+        ASSERT_FALSE(expected.empty());
+        {
+            HashJoinIndex courses;
+            ASSERT_EQ(SQLITE_OK, courses.Create(db, "CoursesBySid", { "DB1.Courses", "SID" }));
+            std::string sql = "select * from Students S, CoursesBySid C where S.sid = C.sid";
+            EXPECT_EQ(expected, SortedRows(db, sql));
+            EXPECT_NE(std::string::npos, QueryPlan(db, sql).find("VIRTUAL TABLE INDEX 1"));
+
+            int indexed = -1;
+            HashJoinIndex smaller;
+            ASSERT_EQ(SQLITE_OK, smaller.CreateOverSmaller(db, "Smaller", { "Students", "SID" }, { "DB1.Courses", "SID" },
+                &indexed));
+            // MyDB holds fewer Students than MyDBExtn holds Courses.
+            ASSERT_EQ(0, indexed);
+            EXPECT_EQ(expected, SortedRows(db, "select * from Smaller S, Courses C where S.sid = C.sid"));
+        }
+        // Dropped with their owners.
+        EXPECT_EQ(-1, QueryInt64(db, "select count(*) from CoursesBySid"));
+        EXPECT_EQ(SQLITE_OK, sqlite3_close(db));
+    }
+
+    TEST(HASH_JOIN, KEY_TYPES) {
+        sqlite3* db = 0;
+        ASSERT_EQ(SQLITE_OK, sqlite3_open(":memory:", &db));
+        ASSERT_EQ(SQLITE_OK, RegisterHashIndexModule(db));
+        ASSERT_EQ(SQLITE_OK, sqlite3_exec(db,
+            "create table t3(k, v);"
+            "insert into t3 values (2, 'int'), (2.0, 'real'), (2.5, 'fraction'), ('2', 'text'), (x'02', 'blob'),"
+            " (null, 'null'), (2, 'again');", 0, 0, 0));
+
+        HashJoinIndex index;
+        ASSERT_EQ(SQLITE_OK, index.Create(db, "t3ByK", { "t3", "k" }));
+        EXPECT_EQ(7, QueryInt64(db, "select count(*) from t3ByK"));
+        EXPECT_EQ(3, QueryInt64(db, "select count(*) from t3ByK where k = 2"));
+        EXPECT_EQ(1, QueryInt64(db, "select count(*) from t3ByK where k = 2.5"));
+        EXPECT_EQ(1, QueryInt64(db, "select count(*) from t3ByK where k = '2'"));
+        EXPECT_EQ(1, QueryInt64(db, "select count(*) from t3ByK where k = x'02'"));
+        EXPECT_EQ(0, QueryInt64(db, "select count(*) from t3ByK where k = null"));
+        EXPECT_EQ(0, QueryInt64(db, "select count(*) from t3ByK where k = 3"));
+
+        // A snapshot: rows inserted later are not in the index.
+        ASSERT_EQ(SQLITE_OK, sqlite3_exec(db, "insert into t3 values (3, 'late')", 0, 0, 0));
+        EXPECT_EQ(0, QueryInt64(db, "select count(*) from t3ByK where k = 3"));
+
+        HashJoinIndex missing;
+        EXPECT_EQ(SQLITE_ERROR, missing.Create(db, "Bad", { "t3", "nope" }));
+        EXPECT_EQ(SQLITE_ERROR, missing.Create(db, "Bad", { "Missing", "k" }));
+        index.Drop();
+        EXPECT_EQ(SQLITE_OK, sqlite3_close(db));
+    }
+
+    TEST(HASH_JOIN_BENCH, COURSES_GROWTH) {
+        const long long students = Scaled(2000);
+        sqlite3* db = 0;
+        ASSERT_EQ(SQLITE_OK, sqlite3_open(":memory:", &db));
+        ASSERT_EQ(SQLITE_OK, RegisterHashIndexModule(db));
+        ASSERT_EQ(SQLITE_OK, sqlite3_exec(db,
+            "attach database ':memory:' as DB1;"
+            "create table Students(SID int);"
+            "create table DB1.Courses(name nvarchar(50), SID int);", 0, 0, 0));
+        char* sql = sqlite3_mprintf(
+            "with recursive n(i) as (select 1 union all select i + 1 from n where i < %lld) "
+            "insert into Students select i from n", students);
+        ASSERT_EQ(SQLITE_OK, sqlite3_exec(db, sql, 0, 0, 0));
+        sqlite3_free(sql);
+
+        std::vector<long long> sizes = { 1000, 10000, 100000 };
+        if (BenchScale() >= 8) {
+            sizes.push_back(1000000);
+        }
+        printf("%-10s %10s %10s %10s %12s %10s\n", "join", "students", "courses", "ms", "rows", "build ms");
+        long long courses = 0;
+        for (long long target : sizes) {
+            sql = sqlite3_mprintf(
+                "with recursive n(i) as (select %lld union all select i + 1 from n where i < %lld) "
+                "insert into Courses select 'Course ' || i, i %% (2 * %lld) + 1 from n", courses + 1, target, students);
+            ASSERT_EQ(SQLITE_OK, sqlite3_exec(db, sql, 0, 0, 0));
+            sqlite3_free(sql);
+            courses = target;
+
+            const char* count = "select count(*) from Students S, Courses C where S.sid = C.sid";
+            long long expected = -1;
+            // A true nested loop only while it finishes in seconds.
+            if (students * courses <= 100000000LL) {
+                ASSERT_EQ(SQLITE_OK, sqlite3_exec(db, "pragma automatic_index=off", 0, 0, 0));
+                Stopwatch watch;
+                expected = QueryInt64(db, count);
+                printf("%-10s %10lld %10lld %10.1f %12lld %10s\n", "nested", students, courses, watch.Seconds() * 1000,
+                    expected, "-");
+                ASSERT_EQ(SQLITE_OK, sqlite3_exec(db, "pragma automatic_index=on", 0, 0, 0));
+            }
+            {
+                // The planner's own transient index, rebuilt per statement.
+                Stopwatch watch;
+                long long rows = QueryInt64(db, count);
+                printf("%-10s %10lld %10lld %10.1f %12lld %10s\n", "autoindex", students, courses,
+                    watch.Seconds() * 1000, rows, "-");
+                EXPECT_TRUE(expected < 0 || expected == rows);
+                expected = rows;
+            }
+            {
+                HashJoinIndex index;
+                int indexed = -1;
+                Stopwatch watch;
+                ASSERT_EQ(SQLITE_OK, index.CreateOverSmaller(db, "JoinIndex", { "Students", "SID" },
+                    { "DB1.Courses", "SID" }, &indexed));
+                double build = watch.Seconds();
+                watch.Restart();
+                long long rows = QueryInt64(db, indexed == 0
+                    ? "select count(*) from JoinIndex S, Courses C where S.sid = C.sid"
+                    : "select count(*) from Students S, JoinIndex C where S.sid = C.sid");
+                printf("%-10s %10lld %10lld %10.1f %12lld %10.1f\n", indexed == 0 ? "hash(S)" : "hash(C)", students,
+                    courses, watch.Seconds() * 1000, rows, build * 1000);
+                EXPECT_EQ(expected, rows);
+            }
+        }
+        EXPECT_EQ(SQLITE_OK, sqlite3_close(db));
+    }
+}
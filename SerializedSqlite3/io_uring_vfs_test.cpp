@@ -0,0 +1,250 @@
+#include "gtest/gtest.h"
+#include "pch.h"
+#include "sqlite3.h"
+
+#include "io_uring_vfs.h"
+#include "test_support.h"
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+using namespace sqlite3tests;
+
+namespace {
+
+    const char* kVfsDb = "VfsTest.db";
+    const char* kVfsExtnDb = "VfsExtnTest.db";
+
+    /// <summary>
+    /// Scratch copies of MyDB and MyDBExtn: Students and Courses.
+    /// </summary>
+    void CreateTransactionDbs(const char* journalMode) {
+        ASSERT_EQ(SQLITE_OK, CreateStudentsDb(kVfsDb, 36));
+        RemoveDb(kVfsExtnDb);
+        sqlite3* db = 0;
+        ASSERT_EQ(SQLITE_OK, sqlite3_open(kVfsExtnDb, &db));
+        ASSERT_EQ(SQLITE_OK, sqlite3_exec(db, "create table Courses(name TEXT, SID INTEGER)", 0, 0, 0));
+        sqlite3_close(db);
+        std::string sql = std::string("pragma journal_mode = ") + journalMode;
+        for (const char* path : { kVfsDb, kVfsExtnDb }) {
+            ASSERT_EQ(SQLITE_OK, sqlite3_open(path, &db));
+            ASSERT_EQ(SQLITE_OK, sqlite3_exec(db, sql.c_str(), 0, 0, 0));
+            sqlite3_close(db);
+        }
+    }
+
+    int OpenTransactionDb(const char* vfs, sqlite3** db) {
+        int retcode = sqlite3_open_v2(kVfsDb, db, SQLITE_OPEN_READWRITE, vfs);
+        if (retcode == SQLITE_OK) {
+            std::string attach = std::string("attach database '") + kVfsExtnDb + "' as DB1";
+            retcode = sqlite3_exec(*db, attach.c_str(), 0, 0, 0);
+        }
+        return retcode;
+    }
+
+    /// <summary>
+    /// The TRANSACTION test of serialized_test.cpp, without the pause: one
+    /// commit across Students and the attached Courses.
+    /// </summary>
+    int RunTransaction(sqlite3* db, int sid, double* commitMicros) {
+        char sql[512];
+        snprintf(sql, sizeof(sql),
+            "begin;"
+            "delete from Students where SID = %d;"
+            "delete from Courses where SID = %d;"
+            "insert into Students values (%d);"
+            "insert into Courses values ('SQLite Database', %d);", sid, sid, sid, sid);
+        int retcode = sqlite3_exec(db, sql, 0, 0, 0);
+        Stopwatch watch;
+        if (retcode == SQLITE_OK) {
+            retcode = sqlite3_exec(db, "commit", 0, 0, 0);
+        }
+        if (commitMicros != nullptr) {
+            *commitMicros = watch.Micros();
+        }
+        return retcode;
+    }
+
+    void ExpectTransactionsApplied(int count) {
+        sqlite3* db = 0;
+        ASSERT_EQ(SQLITE_OK, OpenTransactionDb(0, &db));
+        EXPECT_EQ(36 + count, QueryInt64(db, "select COUNT(SID) from Students"));
+        EXPECT_EQ(count, QueryInt64(db, "select COUNT(*) from Courses"));
+        sqlite3_stmt* stmt = 0;
+        ASSERT_EQ(SQLITE_OK, sqlite3_prepare_v2(db, "pragma integrity_check", -1, &stmt, 0));
+        ASSERT_EQ(SQLITE_ROW, sqlite3_step(stmt));
+        EXPECT_STREQ("ok", reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0)));
+        sqlite3_finalize(stmt);
+        sqlite3_close(db);
+    }
+
+    TEST(IO_URING_VFS, TRANSACTION) {
+        ASSERT_EQ(SQLITE_OK, RegisterIoUringVfs());
+        ASSERT_TRUE(sqlite3_vfs_find(kIoUringVfsName) != 0);
+        CreateTransactionDbs("delete");
+        IoUringVfsStats before = IoUringVfsCounters();
+
+        sqlite3* db = 0;
+        ASSERT_EQ(SQLITE_OK, OpenTransactionDb(kIoUringVfsName, &db));
+        for (int i = 0; i < 20; ++i) {
+            ASSERT_EQ(SQLITE_OK, RunTransaction(db, 2000 + i, 0));
+        }
+        char* vfsName = 0;
+        sqlite3_file_control(db, "main", SQLITE_FCNTL_VFSNAME, &vfsName);
+        EXPECT_EQ(0, std::string(vfsName).find(kIoUringVfsName));
+        sqlite3_free(vfsName);
+        sqlite3_close(db);
+        ExpectTransactionsApplied(20);
+
+        IoUringVfsStats after = IoUringVfsCounters();
+        if (IoUringAvailable()) {
+            long long submissions = after.submissions - before.submissions;
+            long long operations = after.writes - before.writes + after.syncs - before.syncs;
+            EXPECT_GT(after.syncs, before.syncs);
+            // Journal and database writes go out in batches, not one by one.
+            EXPECT_LT(submissions, operations + after.reads - before.reads);
+        }
+        else {
+            printf("io_uring unavailable, shim ran as passthrough\n");
+        }
+        EXPECT_EQ(SQLITE_OK, UnregisterIoUringVfs());
+        RemoveDb(kVfsDb);
+        RemoveDb(kVfsExtnDb);
+    }
+
+    TEST(IO_URING_VFS, WAL_FRAMES_VISIBLE_TO_OTHER_CONNECTIONS) {
+        ASSERT_EQ(SQLITE_OK, RegisterIoUringVfs());
+        CreateTransactionDbs("wal");
+        sqlite3* writer = 0;
+        sqlite3* reader = 0;
+        ASSERT_EQ(SQLITE_OK, OpenTransactionDb(kIoUringVfsName, &writer));
+        ASSERT_EQ(SQLITE_OK, OpenTransactionDb(0, &reader));
+        // With synchronous=normal a WAL commit has no xSync: the frames must
+        // still be written before the wal-index points at them.
+        sqlite3_exec(writer, "pragma synchronous = normal; pragma DB1.synchronous = normal", 0, 0, 0);
+        for (int i = 0; i < 10; ++i) {
+            ASSERT_EQ(SQLITE_OK, RunTransaction(writer, 3000 + i, 0));
+            EXPECT_EQ(37 + i, QueryInt64(reader, "select COUNT(SID) from Students"));
+            EXPECT_EQ(1 + i, QueryInt64(reader, "select COUNT(*) from Courses"));
+        }
+        sqlite3_close(reader);
+        sqlite3_close(writer);
+        ExpectTransactionsApplied(10);
+        EXPECT_EQ(SQLITE_OK, UnregisterIoUringVfs());
+        RemoveDb(kVfsDb);
+        RemoveDb(kVfsExtnDb);
+    }
+
+    /// <summary>
+    /// Writes to a range that is still queued must land in the order they
+    /// were made, although one submission does not order its writes.
+    /// </summary>
+    TEST(IO_URING_VFS, REWRITE_QUEUED_RANGE) {
+        ASSERT_EQ(SQLITE_OK, RegisterIoUringVfs());
+        // The unix VFS takes a journal's permissions from its database.
+        RemoveDb("VfsRewrite.db");
+        fclose(fopen("VfsRewrite.db", "wb"));
+        const char* path = "VfsRewrite.db-journal";
+        sqlite3_vfs* vfs = sqlite3_vfs_find(kIoUringVfsName);
+        ASSERT_NE(nullptr, vfs);
+        std::vector<char> storage(static_cast<size_t>(vfs->szOsFile));
+        sqlite3_file* file = reinterpret_cast<sqlite3_file*>(storage.data());
+        int flags = SQLITE_OPEN_MAIN_JOURNAL | SQLITE_OPEN_CREATE | SQLITE_OPEN_READWRITE;
+        ASSERT_EQ(SQLITE_OK, vfs->xOpen(vfs, path, file, flags, &flags));
+
+        std::string expected(4096, '\0');
+        for (char fill : { 'a', 'b', 'c' }) {
+            std::string page(4096, fill);
+            ASSERT_EQ(SQLITE_OK, file->pMethods->xWrite(file, page.data(), 4096, 0));
+            expected = page;
+        }
+        // Partly overlaps the queued page.
+        std::string tail(1024, 'd');
+        ASSERT_EQ(SQLITE_OK, file->pMethods->xWrite(file, tail.data(), 1024, 3584));
+        expected.replace(3584, 512, tail.data(), 512);
+        expected.append(tail, 512, std::string::npos);
+        ASSERT_EQ(SQLITE_OK, file->pMethods->xSync(file, SQLITE_SYNC_NORMAL));
+
+        std::string read(expected.size(), '\0');
+        ASSERT_EQ(SQLITE_OK, file->pMethods->xRead(file, &read[0], static_cast<int>(read.size()), 0));
+        EXPECT_TRUE(read == expected);
+        file->pMethods->xClose(file);
+
+        std::string onDisk(expected.size(), '\0');
+        FILE* raw = fopen(path, "rb");
+        ASSERT_NE(nullptr, raw);
+        EXPECT_EQ(onDisk.size(), fread(&onDisk[0], 1, onDisk.size(), raw));
+        fclose(raw);
+        EXPECT_TRUE(onDisk == expected);
+        RemoveDb("VfsRewrite.db");
+        EXPECT_EQ(SQLITE_OK, UnregisterIoUringVfs());
+    }
+
+    TEST(IO_URING_VFS, FALLBACK_WITHOUT_RING) {
+        IoUringVfsOptions options;
+        options.disableRing = true;
+        ASSERT_EQ(SQLITE_OK, RegisterIoUringVfs(options));
+        EXPECT_FALSE(IoUringAvailable());
+        CreateTransactionDbs("delete");
+        IoUringVfsStats before = IoUringVfsCounters();
+
+        sqlite3* db = 0;
+        ASSERT_EQ(SQLITE_OK, OpenTransactionDb(kIoUringVfsName, &db));
+        for (int i = 0; i < 5; ++i) {
+            ASSERT_EQ(SQLITE_OK, RunTransaction(db, 2000 + i, 0));
+        }
+        sqlite3_close(db);
+        ExpectTransactionsApplied(5);
+
+        IoUringVfsStats after = IoUringVfsCounters();
+        EXPECT_EQ(before.submissions, after.submissions);
+        EXPECT_GT(after.passthroughFiles, before.passthroughFiles);
+        EXPECT_EQ(SQLITE_OK, UnregisterIoUringVfs());
+        RemoveDb(kVfsDb);
+        RemoveDb(kVfsExtnDb);
+    }
+
+    TEST(IO_URING_VFS_BENCH, TRANSACTION_COMMIT) {
+        const int commits = static_cast<int>(Scaled(200));
+        ASSERT_EQ(SQLITE_OK, RegisterIoUringVfs());
+        printf("io_uring %s\n", IoUringAvailable() ? "available" : "unavailable, shim is passthrough");
+        printf("%-10s %-8s %10s %10s %10s %14s\n", "vfs", "journal", "commits/s", "p50 us", "p99 us", "ops/submit");
+
+        for (const char* journalMode : { "delete", "wal" }) {
+            for (const char* vfs : { "default", kIoUringVfsName }) {
+                CreateTransactionDbs(journalMode);
+                bool shim = std::string(vfs) == kIoUringVfsName;
+                sqlite3* db = 0;
+                ASSERT_EQ(SQLITE_OK, OpenTransactionDb(shim ? vfs : 0, &db));
+                IoUringVfsStats before = IoUringVfsCounters();
+                std::vector<double> samples;
+                Stopwatch watch;
+                for (int i = 0; i < commits; ++i) {
+                    double micros = 0;
+                    ASSERT_EQ(SQLITE_OK, RunTransaction(db, 2000 + i, &micros));
+                    samples.push_back(micros);
+                }
+                double seconds = watch.Seconds();
+                sqlite3_close(db);
+
+                IoUringVfsStats after = IoUringVfsCounters();
+                long long submissions = after.submissions - before.submissions;
+                long long operations = after.writes - before.writes + after.syncs - before.syncs;
+                double p50 = Percentile(samples, 50);
+                double p99 = Percentile(samples, 99);
+                if (submissions > 0) {
+                    printf("%-10s %-8s %10.0f %10.1f %10.1f %14.2f\n", vfs, journalMode, commits / seconds,
+                        p50, p99, static_cast<double>(operations) / submissions);
+                }
+                else {
+                    printf("%-10s %-8s %10.0f %10.1f %10.1f %14s\n", vfs, journalMode, commits / seconds,
+                        p50, p99, "-");
+                }
+            }
+        }
+        EXPECT_EQ(SQLITE_OK, UnregisterIoUringVfs());
+        RemoveDb(kVfsDb);
+        RemoveDb(kVfsExtnDb);
+    }
+}
@@ -0,0 +1,159 @@
+#include "gtest/gtest.h"
+#include "pch.h"
+#include "sqlite3.h"
+
+#include "memdb_fixture.h"
+#include "test_support.h"
+
+#include <atomic>
+#include <cstdio>
+#include <string>
+
+using namespace sqlite3tests;
+
+namespace {
+
+    const char* kExportDb = "FixtureExportTest.db";
+
+    std::string FileBytes(const char* path) {
+        std::string bytes;
+        std::FILE* file = std::fopen(path, "rb");
+        if (file != nullptr) {
+            char buffer[4096];
+            size_t n = 0;
+            while ((n = std::fread(buffer, 1, sizeof(buffer), file)) > 0) {
+                bytes.append(buffer, n);
+            }
+            std::fclose(file);
+        }
+        return bytes;
+    }
+
+    /// <summary>
+    /// TRANSACTION from serialized_test.cpp on private copies of MyDB and
+    /// MyDBExtn; the checked-in files must not change.
+    /// </summary>
+    TEST(MEMDB_FIXTURE, TRANSACTION) {
+        std::string myDbBefore = FileBytes("MyDB");
+        std::string extnBefore = FileBytes("MyDBExtn");
+        sqlite3* db = 0;
+        ASSERT_EQ(SQLITE_OK, OpenFixture("MyDB", &db));
+        ASSERT_EQ(SQLITE_OK, AttachFixture(db, "MyDBExtn", "DB1"));
+        EXPECT_TRUE(MatchesFixture(db, "main", "MyDB"));
+        long long students = QueryInt64(db, "select COUNT(*) from Students");
+
+        ASSERT_EQ(SQLITE_OK, sqlite3_exec(db,
+            "begin;"
+            "delete from Students where SID = 2000;"
+            "delete from Courses where SID = 2000;"
+            "insert into Students values (2000);"
+            "insert into Students values (2001);"
+            "insert into Courses values ('SQLite Database', 2000);"
+            "commit;", 0, 0, 0));
+        EXPECT_EQ(students + 1, QueryInt64(db, "select COUNT(*) from Students"));
+        EXPECT_EQ(1, QueryInt64(db, "select COUNT(*) from Students S, Courses C where S.SID = C.SID and S.SID = 2000"));
+        EXPECT_FALSE(MatchesFixture(db, "main", "MyDB"));
+        sqlite3_close(db);
+
+        // A fresh copy starts from the fixture again.
+        ASSERT_EQ(SQLITE_OK, OpenFixture("MyDB", &db));
+        EXPECT_EQ(students, QueryInt64(db, "select COUNT(*) from Students"));
+        sqlite3_close(db);
+        EXPECT_EQ(myDbBefore, FileBytes("MyDB"));
+        EXPECT_EQ(extnBefore, FileBytes("MyDBExtn"));
+    }
+
+    /// <summary>
+    /// SUBTRANSACTION from serialized_test.cpp: the failing statements are
+    /// rolled back on their own and the rest of the transaction commits.
+    /// </summary>
+    TEST(MEMDB_FIXTURE, SUBTRANSACTION) {
+        sqlite3* db = 0;
+        ASSERT_EQ(SQLITE_OK, OpenFixture("Tables", &db));
+        EXPECT_EQ(SQLITE_OK, sqlite3_exec(db,
+            "begin; delete from t1; delete from t2; delete from t3;"
+            "insert into t1 values(10, 11); insert into t1 values(9, 11); insert into t1 values(8, 11);", 0, 0, 0));
+        EXPECT_EQ(SQLITE_ERROR, sqlite3_exec(db, "insert into t2 values(20, 100);", 0, 0, 0));
+        EXPECT_EQ(SQLITE_CONSTRAINT, sqlite3_exec(db, "update t1 set x=x+1 where y > 10;", 0, 0, 0));
+        EXPECT_EQ(SQLITE_OK, sqlite3_exec(db, "insert into t3 values(1, 2, 3); commit;", 0, 0, 0));
+
+        EXPECT_EQ(27, QueryInt64(db, "select SUM(x) from t1"));
+        EXPECT_EQ(0, QueryInt64(db, "select COUNT(*) from t2"));
+        EXPECT_EQ(1, QueryInt64(db, "select COUNT(*) from t3"));
+        sqlite3_close(db);
+    }
+
+    /// <summary>
+    /// ISOLATED_DB_HANDLE without SQLITE_BUSY: every thread writes its own
+    /// copy, so nothing contends.
+    /// </summary>
+    TEST(MEMDB_FIXTURE, PARALLEL_COPIES) {
+        sqlite3* db = 0;
+        ASSERT_EQ(SQLITE_OK, OpenFixture("MyDB", &db));
+        long long students = QueryInt64(db, "select COUNT(*) from Students");
+        sqlite3_close(db);
+
+        std::atomic<int> failures(0);
+        RunThreads(8, [&](int thread) {
+            sqlite3* copy = 0;
+            if (OpenFixture("MyDB", &copy) != SQLITE_OK) {
+                ++failures;
+                return;
+            }
+            for (int i = 0; i <= thread; ++i) {
+                if (sqlite3_exec(copy, "insert into Students values (100);", 0, 0, 0) != SQLITE_OK) {
+                    ++failures;
+                }
+            }
+            if (QueryInt64(copy, "select COUNT(*) from Students") != students + thread + 1) {
+                ++failures;
+            }
+            sqlite3_close(copy);
+        });
+        EXPECT_EQ(0, failures.load());
+    }
+
+    TEST(MEMDB_FIXTURE, EXPORT) {
+        sqlite3* db = 0;
+        ASSERT_EQ(SQLITE_OK, OpenFixture("MyDB", &db));
+        ASSERT_EQ(SQLITE_OK, sqlite3_exec(db, "insert into Students values (4242);", 0, 0, 0));
+        RemoveDb(kExportDb);
+        ASSERT_EQ(SQLITE_OK, ExportDb(db, "main", kExportDb));
+        sqlite3_close(db);
+
+        ASSERT_EQ(SQLITE_OK, sqlite3_open(kExportDb, &db));
+        EXPECT_EQ(1, QueryInt64(db, "select COUNT(*) from Students where SID = 4242"));
+        sqlite3_close(db);
+        RemoveDb(kExportDb);
+    }
+
+    /// <summary>
+    /// What a test pays before its first row: opening a database file and
+    /// loading its schema, against copying the cached fixture image.
+    /// </summary>
+    TEST(MEMDB_FIXTURE_BENCH, STARTUP) {
+        const long long iterations = Scaled(2000);
+        sqlite3* db = 0;
+        ASSERT_EQ(SQLITE_OK, OpenFixture("MyDB", &db));
+        ASSERT_EQ(SQLITE_OK, ExportDb(db, "main", kExportDb));
+        sqlite3_close(db);
+
+        printf("%-14s %12s %12s\n", "startup", "per test us", "tests/s");
+        for (int mode = 0; mode < 2; ++mode) {
+            long long errors = 0;
+            Stopwatch watch;
+            for (long long i = 0; i < iterations; ++i) {
+                int retcode = mode == 0 ? sqlite3_open(kExportDb, &db) : OpenFixture("MyDB", &db);
+                if (retcode != SQLITE_OK || QueryInt64(db, "select COUNT(SID) from Students") < 0) {
+                    ++errors;
+                }
+                sqlite3_close(db);
+            }
+            double seconds = watch.Seconds();
+            EXPECT_EQ(0, errors);
+            printf("%-14s %12.1f %12.0f\n", mode == 0 ? "file" : "deserialize",
+                seconds * 1e6 / iterations, iterations / seconds);
+        }
+        RemoveDb(kExportDb);
+    }
+}
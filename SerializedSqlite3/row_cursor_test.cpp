@@ -0,0 +1,172 @@
+#include "gtest/gtest.h"
+#include "pch.h"
+#include "sqlite3.h"
+
+#include "memdb_fixture.h"
+#include "row_cursor.h"
+#include "test_support.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+using namespace sqlite3tests;
+
+namespace {
+
+    const char* kJoinSql = "select * from Students S, Courses C where S.sid = C.sid";
+
+    /// <summary>
+    /// The join of LIB_CONN_DB_CONN reads the same through the cursor as
+    /// through the sqlite3_exec callback.
+    /// </summary>
+    TEST(ROW_CURSOR, JOIN_MATCHES_EXEC) {
+        sqlite3* db = 0;
+        ASSERT_EQ(SQLITE_OK, OpenFixture("MyDB", &db));
+        ASSERT_EQ(SQLITE_OK, AttachFixture(db, "MyDBExtn", "DB1"));
+
+        std::vector<std::string> expected;
+        ASSERT_EQ(SQLITE_OK, sqlite3_exec(db, kJoinSql, CollectCallback, &expected, 0));
+
+        std::vector<std::string> actual;
+        RowCursor cursor;
+        ASSERT_EQ(SQLITE_OK, cursor.Open(db, kJoinSql));
+        for (const Row& row : cursor) {
+            ASSERT_EQ(3, row.Columns());
+            EXPECT_STREQ("name", row.Name(1));
+            EXPECT_EQ(SQLITE_INTEGER, row.Type(0));
+            EXPECT_EQ(row.Int64(0), row.Int64(2));
+            actual.push_back(std::to_string(row.Int64(0)) + '|' + std::string(row.Text(1)) + '|' +
+                std::to_string(row.Get<int64_t>(2)) + '|');
+        }
+        EXPECT_EQ(SQLITE_OK, cursor.Status());
+        EXPECT_FALSE(expected.empty());
+        EXPECT_EQ(expected, actual);
+
+        cursor.Close();
+        EXPECT_EQ(SQLITE_OK, sqlite3_close(db));
+    }
+
+    TEST(ROW_CURSOR, TYPED_ACCESSORS) {
+        sqlite3* db = 0;
+        ASSERT_EQ(SQLITE_OK, sqlite3_open(":memory:", &db));
+        ASSERT_EQ(SQLITE_OK, sqlite3_exec(db,
+            "create table t3(x, y, z);"
+            "insert into t3 values (9007199254740993, 2.5, 'text');"
+            "insert into t3 values (x'00ff10', null, '');", 0, 0, 0));
+
+        sqlite3_stmt* stmt = 0;
+        ASSERT_EQ(SQLITE_OK, sqlite3_prepare_v2(db, "select x, y, z from t3 order by rowid", -1, &stmt, 0));
+        {
+            // A borrowed statement is only reset when the cursor ends.
+            RowCursor cursor(stmt);
+            ASSERT_TRUE(cursor.Next());
+            Row row = cursor.Current();
+            EXPECT_EQ(9007199254740993LL, row.Int64(0));
+            EXPECT_DOUBLE_EQ(2.5, row.Get<double>(1));
+            EXPECT_EQ("text", row.Text(2));
+
+            ASSERT_TRUE(cursor.Next());
+            std::span<const std::byte> blob = row.Blob(0);
+            ASSERT_EQ(3u, blob.size());
+            EXPECT_EQ(std::byte{ 0xff }, blob[1]);
+            EXPECT_TRUE(row.IsNull(1));
+            EXPECT_TRUE(row.Text(1).empty());
+            EXPECT_EQ(SQLITE_TEXT, row.Type(2));
+            EXPECT_TRUE(row.Text(2).empty());
+
+            EXPECT_FALSE(cursor.Next());
+            EXPECT_EQ(SQLITE_OK, cursor.Status());
+        }
+        ASSERT_EQ(SQLITE_ROW, sqlite3_step(stmt));
+        sqlite3_finalize(stmt);
+
+        RowCursor broken;
+        EXPECT_EQ(SQLITE_ERROR, broken.Open(db, "select * from Missing"));
+        EXPECT_FALSE(broken.Next());
+        EXPECT_EQ(SQLITE_ERROR, broken.Status());
+        EXPECT_EQ(SQLITE_OK, sqlite3_close(db));
+    }
+
+    struct JoinTotals {
+        long long rows = 0;
+        long long sids = 0;
+        long long nameBytes = 0;
+    };
+
+    static int JoinCallback(void* arg, int, char** argv, char**) {
+        JoinTotals* totals = static_cast<JoinTotals*>(arg);
+        ++totals->rows;
+        totals->sids += std::atoll(argv[0]) + std::atoll(argv[2]);
+        totals->nameBytes += static_cast<long long>(std::strlen(argv[1]));
+        return 0;
+    }
+
+    int CreateJoinDb(sqlite3* db, long long students) {
+        int retcode = sqlite3_exec(db,
+            "create table Students(SID INTEGER);"
+            "create table Courses(name, SID);"
+            "create index CoursesSID on Courses(SID);"
+            "begin;", 0, 0, 0);
+        sqlite3_stmt* student = 0;
+        sqlite3_stmt* course = 0;
+        if (retcode == SQLITE_OK) {
+            retcode = sqlite3_prepare_v2(db, "insert into Students values (?)", -1, &student, 0);
+        }
+        if (retcode == SQLITE_OK) {
+            retcode = sqlite3_prepare_v2(db, "insert into Courses values (?, ?)", -1, &course, 0);
+        }
+        const char* names[] = { "SQLite Database", "Operating Systems", "Compilers" };
+        for (long long i = 1; retcode == SQLITE_OK && i <= students; ++i) {
+            sqlite3_bind_int64(student, 1, i);
+            sqlite3_step(student);
+            sqlite3_reset(student);
+            for (int c = 0; c < 2; ++c) {
+                sqlite3_bind_text(course, 1, names[(i + c) % 3], -1, SQLITE_STATIC);
+                sqlite3_bind_int64(course, 2, i);
+                retcode = sqlite3_step(course) == SQLITE_DONE ? SQLITE_OK : sqlite3_errcode(db);
+                sqlite3_reset(course);
+            }
+        }
+        sqlite3_finalize(student);
+        sqlite3_finalize(course);
+        return retcode == SQLITE_OK ? sqlite3_exec(db, "commit", 0, 0, 0) : retcode;
+    }
+
+    TEST(ROW_CURSOR_BENCH, STUDENTS_COURSES_JOIN) {
+        const long long students = Scaled(100000);
+        sqlite3* db = 0;
+        ASSERT_EQ(SQLITE_OK, sqlite3_open(":memory:", &db));
+        ASSERT_EQ(SQLITE_OK, CreateJoinDb(db, students));
+
+        printf("%-10s %10s %12s %10s\n", "path", "rows", "rows/s", "ns/row");
+        JoinTotals totals[2];
+        for (int path = 0; path < 2; ++path) {
+            Stopwatch watch;
+            if (path == 0) {
+                ASSERT_EQ(SQLITE_OK, sqlite3_exec(db, kJoinSql, JoinCallback, &totals[0], 0));
+            }
+            else {
+                RowCursor cursor;
+                ASSERT_EQ(SQLITE_OK, cursor.Open(db, kJoinSql));
+                for (const Row& row : cursor) {
+                    ++totals[1].rows;
+                    totals[1].sids += row.Int64(0) + row.Int64(2);
+                    totals[1].nameBytes += static_cast<long long>(row.Text(1).size());
+                }
+                ASSERT_EQ(SQLITE_OK, cursor.Status());
+            }
+            double seconds = watch.Seconds();
+            printf("%-10s %10lld %12.0f %10.1f\n", path == 0 ? "exec" : "cursor", totals[path].rows,
+                totals[path].rows / seconds, seconds * 1e9 / totals[path].rows);
+        }
+        EXPECT_EQ(2 * students, totals[1].rows);
+        EXPECT_EQ(totals[0].rows, totals[1].rows);
+        EXPECT_EQ(totals[0].sids, totals[1].sids);
+        EXPECT_EQ(totals[0].nameBytes, totals[1].nameBytes);
+        EXPECT_EQ(SQLITE_OK, sqlite3_close(db));
+    }
+}
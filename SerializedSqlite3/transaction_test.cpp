@@ -0,0 +1,213 @@
+#include "gtest/gtest.h"
+#include "pch.h"
+#include "sqlite3.h"
+
+#include "memdb_fixture.h"
+#include "test_support.h"
+#include "transaction.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+using namespace sqlite3tests;
+
+namespace {
+
+    const char* kTransactionDb = "TransactionTest.db";
+
+    int Exec(sqlite3* db, const char* sql) {
+        return sqlite3_exec(db, sql, 0, 0, 0);
+    }
+
+    /// <summary>
+    /// SUBTRANSACTION with the t1 work as one unit: the CHECK failure on
+    /// t1.x undoes the statement before it too, and the rest commits.
+    /// </summary>
+    TEST(TRANSACTION_SCOPE, SUBTRANSACTION) {
+        sqlite3* db = 0;
+        ASSERT_EQ(SQLITE_OK, OpenFixture("Tables", &db));
+        {
+            Transaction transaction;
+            ASSERT_EQ(SQLITE_OK, transaction.Begin(db));
+            EXPECT_EQ(SQLITE_OK, Exec(db, "delete from t1; delete from t2; delete from t3;"
+                "insert into t1 values(10, 11); insert into t1 values(9, 11); insert into t1 values(8, 11);"));
+            EXPECT_EQ(SQLITE_CONSTRAINT, WithSavepoint(db, [](sqlite3* db) {
+                int retcode = Exec(db, "update t1 set x=x-1 where x=8;");
+                return retcode == SQLITE_OK ? Exec(db, "update t1 set x=x+1 where y > 10;") : retcode;
+            }));
+            EXPECT_EQ(SQLITE_OK, WithSavepoint(db, [](sqlite3* db) { return Exec(db, "insert into t3 values(1, 2, 3);"); }));
+            EXPECT_EQ(SQLITE_OK, transaction.Commit());
+            EXPECT_FALSE(transaction.Active());
+        }
+        EXPECT_EQ(27, QueryInt64(db, "select SUM(x) from t1"));
+        EXPECT_EQ(8, QueryInt64(db, "select MIN(x) from t1"));
+        EXPECT_EQ(1, QueryInt64(db, "select COUNT(*) from t3"));
+        EXPECT_EQ(SQLITE_OK, sqlite3_close(db));
+    }
+
+    TEST(TRANSACTION_SCOPE, NESTED_SAVEPOINTS) {
+        sqlite3* db = 0;
+        ASSERT_EQ(SQLITE_OK, sqlite3_open(":memory:", &db));
+        ASSERT_EQ(SQLITE_OK, Exec(db, "create table t2(x int)"));
+        {
+            Transaction transaction;
+            ASSERT_EQ(SQLITE_OK, transaction.Begin(db, TransactionMode::Immediate, ScopeExit::Commit));
+            Exec(db, "insert into t2 values (1)");
+            {
+                Savepoint outer;
+                ASSERT_EQ(SQLITE_OK, outer.Begin(db));
+                Exec(db, "insert into t2 values (2)");
+                {
+                    Savepoint inner;
+                    ASSERT_EQ(SQLITE_OK, inner.Begin(db));
+                    Exec(db, "insert into t2 values (3)");
+                    EXPECT_EQ(SQLITE_OK, inner.Release());
+                    EXPECT_EQ(SQLITE_MISUSE, inner.Release());
+                }
+                {
+                    // Left without Release: rolled back on its own.
+                    Savepoint inner;
+                    ASSERT_EQ(SQLITE_OK, inner.Begin(db));
+                    Exec(db, "insert into t2 values (4)");
+                }
+                EXPECT_EQ(6, QueryInt64(db, "select SUM(x) from t2"));
+                // Undoes the released inner scope as well.
+                EXPECT_EQ(SQLITE_OK, outer.Rollback());
+            }
+            {
+                Savepoint kept;
+                ASSERT_EQ(SQLITE_OK, kept.Begin(db, ScopeExit::Commit));
+                Exec(db, "insert into t2 values (5)");
+            }
+        }
+        // Committed on scope exit.
+        EXPECT_TRUE(sqlite3_get_autocommit(db));
+        EXPECT_EQ(6, QueryInt64(db, "select SUM(x) from t2"));
+
+        // A savepoint in autocommit mode is a transaction of its own.
+        Savepoint alone;
+        ASSERT_EQ(SQLITE_OK, alone.Begin(db));
+        EXPECT_FALSE(sqlite3_get_autocommit(db));
+        Exec(db, "insert into t2 values (7)");
+        EXPECT_EQ(SQLITE_OK, alone.Release());
+        EXPECT_TRUE(sqlite3_get_autocommit(db));
+        EXPECT_EQ(13, QueryInt64(db, "select SUM(x) from t2"));
+        EXPECT_EQ(SQLITE_OK, sqlite3_close(db));
+    }
+
+    Transaction BeginInsert(sqlite3* db, int x) {
+        Transaction transaction;
+        if (transaction.Begin(db, TransactionMode::Deferred, ScopeExit::Commit) == SQLITE_OK) {
+            Exec(db, ("insert into t2 values (" + std::to_string(x) + ")").c_str());
+        }
+        return transaction;
+    }
+
+    void InsertThenThrow(sqlite3* db) {
+        Transaction transaction = BeginInsert(db, 100);
+        throw std::runtime_error("Intend error thrown to see the journal log.");
+    }
+
+    TEST(TRANSACTION_SCOPE, MOVES_AND_EXCEPTIONS) {
+        sqlite3* db = 0;
+        ASSERT_EQ(SQLITE_OK, sqlite3_open(":memory:", &db));
+        ASSERT_EQ(SQLITE_OK, Exec(db, "create table t2(x int)"));
+        {
+            Transaction moved = BeginInsert(db, 1);
+            ASSERT_TRUE(moved.Active());
+            Transaction owner = std::move(moved);
+            EXPECT_FALSE(moved.Active());
+            EXPECT_EQ(db, owner.Db());
+
+            Transaction nested;
+            EXPECT_EQ(SQLITE_ERROR, nested.Begin(db));
+            EXPECT_FALSE(nested.Active());
+        }
+        EXPECT_EQ(1, QueryInt64(db, "select COUNT(*) from t2"));
+
+        // TRANSACTION_JOURNAL: the exception rolls back despite ScopeExit::Commit.
+        EXPECT_THROW(InsertThenThrow(db), std::runtime_error);
+        EXPECT_TRUE(sqlite3_get_autocommit(db));
+        EXPECT_EQ(1, QueryInt64(db, "select COUNT(*) from t2"));
+
+        // Assigning over an open transaction ends it first, here by rolling back.
+        Transaction first;
+        ASSERT_EQ(SQLITE_OK, first.Begin(db));
+        Exec(db, "insert into t2 values (2)");
+        first = Transaction();
+        EXPECT_TRUE(sqlite3_get_autocommit(db));
+        EXPECT_EQ(1, QueryInt64(db, "select COUNT(*) from t2"));
+        EXPECT_EQ(SQLITE_OK, sqlite3_close(db));
+    }
+
+    /// <summary>
+    /// What wrapping every statement of a batch in its own savepoint costs,
+    /// against the plain statements in one transaction.
+    /// </summary>
+    TEST(TRANSACTION_SCOPE_BENCH, SAVEPOINT_OVERHEAD) {
+        const long long statements = Scaled(100000);
+        ASSERT_EQ(SQLITE_OK, CreateStudentsDb(kTransactionDb, 0));
+        sqlite3* db = 0;
+        ASSERT_EQ(SQLITE_OK, sqlite3_open(kTransactionDb, &db));
+        sqlite3_stmt* insert = 0;
+        ASSERT_EQ(SQLITE_OK, sqlite3_prepare_v2(db, "insert into Students values (?)", -1, &insert, 0));
+        auto step = [insert](long long sid) {
+            sqlite3_bind_int64(insert, 1, sid);
+            int retcode = sqlite3_step(insert);
+            sqlite3_reset(insert);
+            return retcode == SQLITE_DONE ? SQLITE_OK : retcode;
+        };
+
+        const struct {
+            const char* name;
+            int every;
+            int depth;
+        } modes[] = {
+            { "plain", 0, 0 },
+            { "per 100", 100, 1 },
+            { "per 10", 10, 1 },
+            { "per stmt", 1, 1 },
+            { "per stmt x2", 1, 2 },
+        };
+        // One untimed pass, so that every mode reuses the same free pages.
+        ASSERT_EQ(SQLITE_OK, Exec(db, "begin"));
+        for (long long i = 0; i < statements; ++i) {
+            ASSERT_EQ(SQLITE_OK, step(i));
+        }
+        ASSERT_EQ(SQLITE_OK, Exec(db, "commit"));
+
+        printf("%-12s %10s %10s %10s %12s\n", "savepoint", "stmts", "ms", "ns/stmt", "overhead ns");
+        double baseline = 0;
+        for (const auto& mode : modes) {
+            ASSERT_EQ(SQLITE_OK, Exec(db, "delete from Students"));
+            Transaction transaction;
+            Stopwatch watch;
+            ASSERT_EQ(SQLITE_OK, transaction.Begin(db));
+            for (long long i = 0; i < statements;) {
+                long long group = mode.every > 0 ? mode.every : statements;
+                Savepoint scopes[2];
+                for (int d = 0; d < mode.depth; ++d) {
+                    ASSERT_EQ(SQLITE_OK, scopes[d].Begin(db));
+                }
+                for (long long end = std::min(statements, i + group); i < end; ++i) {
+                    ASSERT_EQ(SQLITE_OK, step(i));
+                }
+                for (int d = mode.depth - 1; d >= 0; --d) {
+                    ASSERT_EQ(SQLITE_OK, scopes[d].Release());
+                }
+            }
+            ASSERT_EQ(SQLITE_OK, transaction.Commit());
+            double nsPerStatement = watch.Seconds() * 1e9 / statements;
+            baseline = mode.every == 0 ? nsPerStatement : baseline;
+            EXPECT_EQ(statements, QueryInt64(db, "select COUNT(*) from Students"));
+            printf("%-12s %10lld %10.1f %10.0f %12.0f\n", mode.name, statements, nsPerStatement * statements / 1e6,
+                nsPerStatement, nsPerStatement - baseline);
+        }
+        sqlite3_finalize(insert);
+        EXPECT_EQ(SQLITE_OK, sqlite3_close(db));
+        RemoveDb(kTransactionDb);
+    }
+}
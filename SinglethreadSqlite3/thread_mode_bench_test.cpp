@@ -0,0 +1,11 @@
+#include "gtest/gtest.h"
+#include "pch.h"
+#include "sqlite3.h"
+
+#include "thread_mode_bench.h"
+
+namespace {
+	TEST(SINGLETHREAD_BENCH, THREAD_MODE) {
+		EXPECT_EQ(0, sqlite3tests::RunThreadModeBench("ThreadModeTest.db"));
+	}
+}